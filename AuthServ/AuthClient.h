@@ -21,6 +21,7 @@
 #include "NetIO/SockIO.h"
 #include "NetIO/CryptIO.h"
 #include "NetIO/MsgChannel.h"
+#include "NetIO/BroadcastQueue.h"
 #include "Types/Uuid.h"
 #include "Types/ShaHash.h"
 
@@ -29,7 +30,7 @@ struct AuthClient_Private
     DS::SocketHandle m_sock;
     DS::CryptState m_crypt;
     DS::MsgChannel m_channel;
-    DS::MsgChannel m_broadcast;
+    DS::BroadcastQueue m_broadcast;
 };
 
 struct AuthServer_PlayerInfo
@@ -24,13 +24,16 @@
 #include <string_theory/format>
 #include <string_theory/stdio>
 #include <unordered_map>
+#include <algorithm>
 #include <chrono>
 #include <mutex>
+#include <atomic>
+#include <memory>
 
 std::thread s_authDaemonThread;
 DS::MsgChannel s_authChannel;
-PGconn* s_postgres = nullptr;
-bool s_restrictLogins = false;
+thread_local PGconn* s_postgres = nullptr;
+std::atomic<bool> s_restrictLogins(false);
 extern uint32_t s_allPlayers;
 std::unordered_map<ST::string, SDL::State, ST::hash_i, ST::equal_i> s_globalStates;
 
@@ -40,8 +43,8 @@ std::unordered_map<ST::string, SDL::State, ST::hash_i, ST::equal_i> s_globalStat
 void dm_auth_addacct(Auth_AddAcct* msg)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx, \"AcctUuid\" FROM auth.\"Accounts\""
-            "    WHERE LOWER(\"Login\")=LOWER($1)",
+            DS_STATEMENT("SELECT idx, \"AcctUuid\" FROM auth.\"Accounts\""
+                         "    WHERE LOWER(\"Login\")=LOWER($1)"),
             msg->m_acctInfo.m_acctName);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -59,9 +62,9 @@ void dm_auth_addacct(Auth_AddAcct* msg)
             pwHash = DS::ShaHash::Sha1(pwBuf.data(), pwBuf.size());
         }
         result = DS::PQexecVA(s_postgres,
-                "INSERT INTO auth.\"Accounts\""
-                "    (\"AcctUuid\", \"PassHash\", \"Login\", \"AcctFlags\", \"BillingType\")"
-                "    VALUES ($1, $2, $3, 0, 1)",
+                DS_STATEMENT("INSERT INTO auth.\"Accounts\""
+                             "    (\"AcctUuid\", \"PassHash\", \"Login\", \"AcctFlags\", \"BillingType\")"
+                             "    VALUES ($1, $2, $3, 0, 1)"),
                 gen_uuid().toString(), pwHash.toString(),
                 msg->m_acctInfo.m_acctName);
         if (PQresultStatus(result) != PGRES_COMMAND_OK) {
@@ -82,7 +85,7 @@ void dm_auth_shutdown()
     {
         std::lock_guard<std::mutex> authClientGuard(s_authClientMutex);
         for (auto client_iter = s_authClients.begin(); client_iter != s_authClients.end(); ++client_iter)
-            DS::CloseSock((*client_iter)->m_sock);
+            DS::ShutdownSock((*client_iter)->m_sock);
     }
 
     bool complete = false;
@@ -97,7 +100,7 @@ void dm_auth_shutdown()
     if (!complete)
         fputs("[Auth] Clients didn't die after 5 seconds!\n", stderr);
 
-    PQfinish(s_postgres);
+    DS::PQclose(s_postgres);
     s_globalStates.clear();
 }
 
@@ -112,9 +115,9 @@ void dm_auth_login(Auth_LoginInfo* info)
     client->m_acctUuid.clear();
 
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT \"PassHash\", \"AcctUuid\", \"AcctFlags\", \"BillingType\""
-            "    FROM auth.\"Accounts\""
-            "    WHERE LOWER(\"Login\")=LOWER($1)",
+            DS_STATEMENT("SELECT \"PassHash\", \"AcctUuid\", \"AcctFlags\", \"BillingType\""
+                         "    FROM auth.\"Accounts\""
+                         "    WHERE LOWER(\"Login\")=LOWER($1)"),
             info->m_acctName);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -179,9 +182,9 @@ void dm_auth_login(Auth_LoginInfo* info)
 
     // Get list of players
     result = DS::PQexecVA(s_postgres,
-            "SELECT \"PlayerIdx\", \"PlayerName\", \"AvatarShape\", \"Explorer\""
-            "    FROM auth.\"Players\""
-            "    WHERE \"AcctUuid\"=$1",
+            DS_STATEMENT("SELECT \"PlayerIdx\", \"PlayerName\", \"AvatarShape\", \"Explorer\""
+                         "    FROM auth.\"Players\""
+                         "    WHERE \"AcctUuid\"=$1"),
             client->m_acctUuid.toString());
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -199,24 +202,125 @@ void dm_auth_login(Auth_LoginInfo* info)
     SEND_REPLY(info, DS::e_NetSuccess);
 }
 
-void dm_auth_bcast_node(uint32_t nodeIdx, const DS::Uuid& revision)
+void dm_auth_bcast_send(AuthServer_Private* client, int type, DS::BufferStream* msg)
 {
-    DS::BufferStream* msg = new DS::BufferStream(nullptr, 20); // Node ID, Revision Uuid
-    msg->write<uint32_t>(nodeIdx);
-    msg->writeBytes(revision.m_bytes, 16);
+    try {
+        // Vault notifications are never dropped, so a client that can't
+        // keep up with them has to go
+        if (client->m_broadcast.push(type, msg, true) == DS::BroadcastQueue::e_Evict) {
+            ST::printf(stderr, "[Auth] Disconnecting {}: Outbound queue is full\n",
+                       DS::SockIpAddress(client->m_sock));
+            DS::ShutdownSock(client->m_sock);
+        }
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Auth] WARNING: {}\n", ex.what());
+    }
+}
+
+static std::unordered_map<uint32_t, std::vector<AuthServer_Private*>> s_vaultSubscribers;
+
+static void dm_auth_move_subscription(AuthServer_Private* client, uint32_t& subscription,
+                                      uint32_t root)
+{
+    if (subscription == root)
+        return;
+
+    if (subscription) {
+        std::vector<AuthServer_Private*>& subscribers = s_vaultSubscribers[subscription];
+        subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), client),
+                          subscribers.end());
+        if (subscribers.empty())
+            s_vaultSubscribers.erase(subscription);
+        s_vaultIndex.unsubscribe(subscription);
+        subscription = 0;
+    }
+
+    if (root && !client->m_vaultClosed && s_vaultIndex.subscribe(root)) {
+        s_vaultSubscribers[root].push_back(client);
+        subscription = root;
+    }
+}
+
+/* Moves one of a client's vault subscriptions (its player or age node) to
+ * a new root.  A root of 0 just drops the old subscription. */
+void dm_auth_subscribe(AuthServer_Private* client, uint32_t& subscription, uint32_t root)
+{
+    std::lock_guard<std::mutex> indexGuard(s_vaultIndexMutex);
+    dm_auth_move_subscription(client, subscription, root);
+}
+
+/* Drops all of a disconnecting client's subscriptions, and keeps requests
+ * still running on other workers from adding new ones. */
+static void dm_auth_unsubscribe_all(AuthServer_Private* client)
+{
+    std::lock_guard<std::mutex> indexGuard(s_vaultIndexMutex);
+    client->m_vaultClosed = true;
+    dm_auth_move_subscription(client, client->m_vaultPlayer, 0);
+    dm_auth_move_subscription(client, client->m_vaultAge, 0);
+}
+
+static bool dm_auth_wants_node(AuthServer_Private* client, uint32_t nodeIdx)
+{
+    // The subscriptions follow the client's IDs, but those can briefly be
+    // ahead of what the daemon has seen
+    return (client->m_player.m_playerId == client->m_vaultPlayer
+                && s_vaultIndex.reaches(client->m_vaultPlayer, nodeIdx))
+        || (client->m_ageNodeId == client->m_vaultAge
+                && s_vaultIndex.reaches(client->m_vaultAge, nodeIdx));
+}
 
+static void dm_auth_check_index(uint32_t nodeIdx)
+{
     std::lock_guard<std::mutex> guard(s_authClientMutex);
-    for (auto it = s_authClients.begin(); it != s_authClients.end(); ++it) {
-        AuthServer_Private* client = *it;
-        if (!(v_has_node(client->m_ageNodeId, nodeIdx) || v_has_node(client->m_player.m_playerId, nodeIdx)))
+    std::lock_guard<std::mutex> indexGuard(s_vaultIndexMutex);
+    for (AuthServer_Private* client : s_authClients) {
+        bool expected = v_has_node(client->m_ageNodeId, nodeIdx)
+                     || v_has_node(client->m_player.m_playerId, nodeIdx);
+        if (expected != dm_auth_wants_node(client, nodeIdx)) {
+            ST::printf(stderr, "[Auth] Vault index mismatch for node {}: player {}, age {} "
+                               "should {}be notified\n", nodeIdx,
+                       client->m_player.m_playerId, client->m_ageNodeId,
+                       expected ? "" : "not ");
+        }
+    }
+}
+
+/* Sends msg to every client which can reach nodeIdx from its player or age
+ * node, according to the vault index. */
+void dm_auth_bcast_vault(uint32_t nodeIdx, int type, DS::BufferStream* msg)
+{
+    if (DS::Settings::VaultCheckIndex())
+        dm_auth_check_index(nodeIdx);
+
+    // Subscribed clients can't go away while we hold the index lock
+    std::lock_guard<std::mutex> indexGuard(s_vaultIndexMutex);
+    const DS::VaultIndex::RootSet* roots = s_vaultIndex.roots(nodeIdx);
+    if (!roots)
+        return;
+
+    std::vector<AuthServer_Private*> targets;
+    for (uint32_t root : *roots) {
+        auto subscribers = s_vaultSubscribers.find(root);
+        if (subscribers == s_vaultSubscribers.end())
             continue;
-        msg->ref();
-        try {
-            client->m_broadcast.putMessage(e_AuthToCli_VaultNodeChanged, msg);
-        } catch (const std::exception& ex) {
-            ST::printf(stderr, "[Auth] WARNING: {}\n", ex.what());
+        for (AuthServer_Private* client : subscribers->second) {
+            // A client reaching the node from both its player and its age
+            // only gets one notification
+            if (std::find(targets.begin(), targets.end(), client) == targets.end()
+                    && dm_auth_wants_node(client, nodeIdx))
+                targets.push_back(client);
         }
     }
+    for (AuthServer_Private* client : targets)
+        dm_auth_bcast_send(client, type, msg);
+}
+
+void dm_auth_bcast_node(uint32_t nodeIdx, const DS::Uuid& revision)
+{
+    DS::BufferStream* msg = new DS::BufferStream(nullptr, 20); // Node ID, Revision Uuid
+    msg->write<uint32_t>(nodeIdx);
+    msg->writeBytes(revision.m_bytes, 16);
+    dm_auth_bcast_vault(nodeIdx, e_AuthToCli_VaultNodeChanged, msg);
     msg->unref();
 }
 
@@ -226,19 +330,7 @@ void dm_auth_bcast_ref(const DS::Vault::NodeRef& ref)
     msg->write<uint32_t>(ref.m_parent);
     msg->write<uint32_t>(ref.m_child);
     msg->write<uint32_t>(ref.m_owner);
-
-    std::lock_guard<std::mutex> guard(s_authClientMutex);
-    for (auto it = s_authClients.begin(); it != s_authClients.end(); ++it) {
-        AuthServer_Private* client = *it;
-        if (!(v_has_node(client->m_ageNodeId, ref.m_parent) || v_has_node(client->m_player.m_playerId, ref.m_parent)))
-            continue;
-        msg->ref();
-        try {
-            client->m_broadcast.putMessage(e_AuthToCli_VaultNodeAdded, msg);
-        } catch (const std::exception& ex) {
-            ST::printf(stderr, "[Auth] WARNING: {}\n", ex.what());
-        }
-    }
+    dm_auth_bcast_vault(ref.m_parent, e_AuthToCli_VaultNodeAdded, msg);
     msg->unref();
 }
 
@@ -247,33 +339,22 @@ void dm_auth_bcast_unref(const DS::Vault::NodeRef& ref)
     DS::BufferStream* msg = new DS::BufferStream(nullptr, 8); // Parent, Child
     msg->write<uint32_t>(ref.m_parent);
     msg->write<uint32_t>(ref.m_child);
-
-    std::lock_guard<std::mutex> guard(s_authClientMutex);
-    for (auto it = s_authClients.begin(); it != s_authClients.end(); ++it) {
-        AuthServer_Private* client = *it;
-        if (!(v_has_node(client->m_ageNodeId, ref.m_parent) || v_has_node(client->m_player.m_playerId, ref.m_parent)))
-            continue;
-        msg->ref();
-        try {
-            client->m_broadcast.putMessage(e_AuthToCli_VaultNodeRemoved, msg);
-        } catch (const std::exception& ex) {
-            ST::printf(stderr, "[Auth] WARNING: {}\n", ex.what());
-        }
-    }
+    dm_auth_bcast_vault(ref.m_parent, e_AuthToCli_VaultNodeRemoved, msg);
     msg->unref();
 }
 
 void dm_auth_disconnect(Auth_ClientMessage* msg)
 {
     AuthServer_Private* client = reinterpret_cast<AuthServer_Private*>(msg->m_client);
+    dm_auth_unsubscribe_all(client);
     if (client->m_player.m_playerId) {
         // Mark player as offline
         DS::PGresultRef result = DS::PQexecVA(s_postgres,
-                "UPDATE vault.\"Nodes\" SET"
-                "    \"Int32_1\"=0, \"String64_1\"='',"
-                "    \"Uuid_1\"='00000000-0000-0000-0000-000000000000'"
-                "    WHERE \"NodeType\"=$1 AND \"Uint32_1\"=$2"
-                "    RETURNING idx",
+                DS_STATEMENT("UPDATE vault.\"Nodes\" SET"
+                             "    \"Int32_1\"=0, \"String64_1\"='',"
+                             "    \"Uuid_1\"='00000000-0000-0000-0000-000000000000'"
+                             "    WHERE \"NodeType\"=$1 AND \"Uint32_1\"=$2"
+                             "    RETURNING idx"),
                 DS::Vault::e_NodePlayerInfo, client->m_player.m_playerId);
         if (PQresultStatus(result) != PGRES_TUPLES_OK) {
             PQ_PRINT_ERROR(s_postgres, UPDATE);
@@ -291,10 +372,11 @@ void dm_auth_disconnect(Auth_ClientMessage* msg)
 void dm_auth_setPlayer(Auth_ClientMessage* msg)
 {
     AuthServer_Private* client = reinterpret_cast<AuthServer_Private*>(msg->m_client);
+    dm_auth_subscribe(client, client->m_vaultPlayer, 0);
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT \"PlayerName\", \"AvatarShape\", \"Explorer\""
-            "    FROM auth.\"Players\""
-            "    WHERE \"AcctUuid\"=$1 AND \"PlayerIdx\"=$2",
+            DS_STATEMENT("SELECT \"PlayerName\", \"AvatarShape\", \"Explorer\""
+                         "    FROM auth.\"Players\""
+                         "    WHERE \"AcctUuid\"=$1 AND \"PlayerIdx\"=$2"),
             client->m_acctUuid.toString(), client->m_player.m_playerId);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -332,14 +414,15 @@ void dm_auth_setPlayer(Auth_ClientMessage* msg)
     client->m_player.m_playerName = PQgetvalue(result, 0, 0);
     client->m_player.m_avatarModel = PQgetvalue(result, 0, 1);
     client->m_player.m_explorer = strtoul(PQgetvalue(result, 0, 2), nullptr, 10);
+    dm_auth_subscribe(client, client->m_vaultPlayer, client->m_player.m_playerId);
 
     // Mark player as online
     result = DS::PQexecVA(s_postgres,
-            "UPDATE vault.\"Nodes\" SET"
-            "    \"Int32_1\"=1, \"String64_1\"='Lobby',"
-            "    \"Uuid_1\"='00000000-0000-0000-0000-000000000000'"
-            "    WHERE \"NodeType\"=$1 AND \"Uint32_1\"=$2"
-            "    RETURNING idx",
+            DS_STATEMENT("UPDATE vault.\"Nodes\" SET"
+                         "    \"Int32_1\"=1, \"String64_1\"='Lobby',"
+                         "    \"Uuid_1\"='00000000-0000-0000-0000-000000000000'"
+                         "    WHERE \"NodeType\"=$1 AND \"Uint32_1\"=$2"
+                         "    RETURNING idx"),
             DS::Vault::e_NodePlayerInfo, client->m_player.m_playerId);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, UPDATE);
@@ -371,8 +454,8 @@ void dm_auth_createPlayer(Auth_PlayerCreate* msg)
 
     // Check for existing player
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx FROM auth.\"Players\""
-            "    WHERE \"PlayerName\"=$1",
+            DS_STATEMENT("SELECT idx FROM auth.\"Players\""
+                         "    WHERE \"PlayerName\"=$1"),
             msg->m_player.m_playerName);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -403,9 +486,9 @@ void dm_auth_createPlayer(Auth_PlayerCreate* msg)
         dm_auth_bcast_ref({s_allPlayers, std::get<1>(player), 0});
 
     result = DS::PQexecVA(s_postgres,
-            "INSERT INTO auth.\"Players\""
-            "    (\"AcctUuid\", \"PlayerIdx\", \"PlayerName\", \"AvatarShape\", \"Explorer\")"
-            "    VALUES ($1, $2, $3, $4, $5)",
+            DS_STATEMENT("INSERT INTO auth.\"Players\""
+                         "    (\"AcctUuid\", \"PlayerIdx\", \"PlayerName\", \"AvatarShape\", \"Explorer\")"
+                         "    VALUES ($1, $2, $3, $4, $5)"),
             client->m_acctUuid.toString(), msg->m_player.m_playerId,
             msg->m_player.m_playerName, msg->m_player.m_avatarModel,
             msg->m_player.m_explorer);
@@ -426,8 +509,8 @@ void dm_auth_deletePlayer(Auth_PlayerDelete* msg)
 
     // Check for existing player
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx FROM auth.\"Players\""
-            "    WHERE \"AcctUuid\"=$1 AND \"PlayerIdx\"=$2",
+            DS_STATEMENT("SELECT idx FROM auth.\"Players\""
+                         "    WHERE \"AcctUuid\"=$1 AND \"PlayerIdx\"=$2"),
             client->m_acctUuid.toString(), msg->m_playerId);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -442,8 +525,8 @@ void dm_auth_deletePlayer(Auth_PlayerDelete* msg)
     }
 
     result = DS::PQexecVA(s_postgres,
-            "DELETE FROM auth.\"Players\""
-            "    WHERE \"PlayerIdx\"=$1",
+            DS_STATEMENT("DELETE FROM auth.\"Players\""
+                         "    WHERE \"PlayerIdx\"=$1"),
             msg->m_playerId);
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
         PQ_PRINT_ERROR(s_postgres, DELETE);
@@ -453,9 +536,9 @@ void dm_auth_deletePlayer(Auth_PlayerDelete* msg)
 
     // Find PlayerInfo and remove all refs to it
     result = DS::PQexecVA(s_postgres,
-                          "SELECT idx FROM vault.\"Nodes\""
-                          "    WHERE \"Uint32_1\" = $1"
-                          "    AND \"NodeType\" = $2",
+                          DS_STATEMENT("SELECT idx FROM vault.\"Nodes\""
+                                       "    WHERE \"Uint32_1\" = $1"
+                                       "    AND \"NodeType\" = $2"),
                           msg->m_playerId, DS::Vault::e_NodePlayerInfo);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -470,15 +553,17 @@ void dm_auth_deletePlayer(Auth_PlayerDelete* msg)
     }
     uint32_t playerInfo = strtoul(PQgetvalue(result, 0, 0), nullptr, 10);
 
+    std::lock_guard<std::mutex> indexGuard(s_vaultIndexMutex);
     result = DS::PQexecVA(s_postgres,
-                          "DELETE FROM vault.\"NodeRefs\""
-                          "    WHERE \"ChildIdx\" = $1",
+                          DS_STATEMENT("DELETE FROM vault.\"NodeRefs\""
+                                       "    WHERE \"ChildIdx\" = $1"),
                           playerInfo);
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
         PQ_PRINT_ERROR(s_postgres, DELETE);
         SEND_REPLY(msg, DS::e_NetInternalError);
         return;
     }
+    s_vaultIndex.removeParents(playerInfo);
     SEND_REPLY(msg, DS::e_NetSuccess);
 }
 
@@ -487,8 +572,8 @@ void dm_auth_createAge(Auth_AgeCreate* msg)
     std::tuple<uint32_t, uint32_t> ageNodes;
     const ST::string ageIdString = msg->m_age.m_ageId.toString();
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx FROM vault.\"Nodes\""
-            "   WHERE \"Uuid_1\"=$1 AND \"NodeType\"=$2",
+            DS_STATEMENT("SELECT idx FROM vault.\"Nodes\""
+                         "   WHERE \"Uuid_1\"=$1 AND \"NodeType\"=$2"),
             ageIdString, DS::Vault::e_NodeAge);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -498,8 +583,8 @@ void dm_auth_createAge(Auth_AgeCreate* msg)
     if (PQntuples(result) != 0) {
         std::get<0>(ageNodes) = strtoul(PQgetvalue(result, 0, 0), nullptr, 10);
         result = DS::PQexecVA(s_postgres,
-                "SELECT idx FROM vault.\"Nodes\""
-                "   WHERE \"Uuid_1\"=$1 AND \"NodeType\"=$2",
+                DS_STATEMENT("SELECT idx FROM vault.\"Nodes\""
+                             "   WHERE \"Uuid_1\"=$1 AND \"NodeType\"=$2"),
                 ageIdString, DS::Vault::e_NodeAgeInfo);
         if (PQresultStatus(result) != PGRES_TUPLES_OK) {
             PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -534,8 +619,8 @@ void dm_auth_findAge(Auth_GameAge* msg)
 
     const ST::string instanceIdString = msg->m_instanceId.toString();
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx, \"AgeIdx\", \"DisplayName\" FROM game.\"Servers\""
-            "    WHERE \"AgeUuid\"=$1",
+            DS_STATEMENT("SELECT idx, \"AgeIdx\", \"DisplayName\" FROM game.\"Servers\""
+                         "    WHERE \"AgeUuid\"=$1"),
             instanceIdString);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -545,10 +630,10 @@ void dm_auth_findAge(Auth_GameAge* msg)
     ST::string ageDesc;
     if (PQntuples(result) == 0) {
         result = DS::PQexecVA(s_postgres,
-                "INSERT INTO game.\"Servers\""
-                "    (\"AgeUuid\", \"AgeFilename\", \"DisplayName\", \"AgeIdx\", \"SdlIdx\", \"Temporary\")"
-                "    VALUES ($1, $2, $2, 0, 0, 't')"
-                "    RETURNING idx, \"AgeIdx\", \"DisplayName\"",
+                DS_STATEMENT("INSERT INTO game.\"Servers\""
+                             "    (\"AgeUuid\", \"AgeFilename\", \"DisplayName\", \"AgeIdx\", \"SdlIdx\", \"Temporary\")"
+                             "    VALUES ($1, $2, $2, 0, 0, 't')"
+                             "    RETURNING idx, \"AgeIdx\", \"DisplayName\""),
                 instanceIdString, msg->m_name);
         if (PQresultStatus(result) != PGRES_TUPLES_OK) {
             PQ_PRINT_ERROR(s_postgres, INSERT);
@@ -566,10 +651,10 @@ void dm_auth_findAge(Auth_GameAge* msg)
     // Update the player info to show up in the age
     const uint32_t playerId = reinterpret_cast<AuthServer_Private*>(msg->m_client)->m_player.m_playerId;
     result = DS::PQexecVA(s_postgres,
-            "UPDATE vault.\"Nodes\" SET"
-            "    \"String64_1\"=$1, \"Uuid_1\"=$2"
-            "    WHERE \"NodeType\"=$3 AND \"Uint32_1\"=$4"
-            "    RETURNING idx",
+            DS_STATEMENT("UPDATE vault.\"Nodes\" SET"
+                         "    \"String64_1\"=$1, \"Uuid_1\"=$2"
+                         "    WHERE \"NodeType\"=$3 AND \"Uint32_1\"=$4"
+                         "    RETURNING idx"),
             ageDesc, instanceIdString, DS::Vault::e_NodePlayerInfo, playerId);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, UPDATE);
@@ -594,9 +679,9 @@ void dm_auth_get_public(Auth_PubAgeRequest* msg)
 uint32_t dm_auth_set_public(uint32_t nodeid)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "UPDATE vault.\"Nodes\" SET"
-            "    \"ModifyTime\"=$1, \"Int32_2\"=1 WHERE idx=$2"
-            "     AND \"NodeType\"=$3",
+            DS_STATEMENT("UPDATE vault.\"Nodes\" SET"
+                         "    \"ModifyTime\"=$1, \"Int32_2\"=1 WHERE idx=$2"
+                         "     AND \"NodeType\"=$3"),
             (uint32_t)time(nullptr), nodeid, DS::Vault::e_NodeAgeInfo);
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
         PQ_PRINT_ERROR(s_postgres, UPDATE);
@@ -610,9 +695,9 @@ uint32_t dm_auth_set_public(uint32_t nodeid)
 uint32_t dm_auth_set_private(uint32_t nodeid)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "UPDATE vault.\"Nodes\" SET"
-            "    \"Int32_2\"=0, \"ModifyTime\"=$1"
-            "    WHERE \"NodeType\"=$2 AND idx=$3",
+            DS_STATEMENT("UPDATE vault.\"Nodes\" SET"
+                         "    \"Int32_2\"=0, \"ModifyTime\"=$1"
+                         "    WHERE \"NodeType\"=$2 AND idx=$3"),
             (uint32_t)time(nullptr), DS::Vault::e_NodeAgeInfo, nodeid);
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
         PQ_PRINT_ERROR(s_postgres, UPDATE);
@@ -636,7 +721,7 @@ void dm_auth_set_pub_priv(Auth_SetPublic* msg)
 void dm_auth_createScore(Auth_CreateScore* msg)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT auth.create_score($1, $2, $3, $4);",
+            DS_STATEMENT("SELECT auth.create_score($1, $2, $3, $4);"),
             msg->m_owner, msg->m_type, msg->m_name, msg->m_points);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -653,9 +738,9 @@ void dm_auth_createScore(Auth_CreateScore* msg)
 void dm_auth_getScores(Auth_GetScores* msg)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx, \"CreateTime\", \"Type\", \"Points\""
-            "    FROM auth.\"Scores\" WHERE \"OwnerIdx\"=$1 AND"
-            "    \"Name\"=$2",
+            DS_STATEMENT("SELECT idx, \"CreateTime\", \"Type\", \"Points\""
+                         "    FROM auth.\"Scores\" WHERE \"OwnerIdx\"=$1 AND"
+                         "    \"Name\"=$2"),
             msg->m_owner, msg->m_name);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -678,7 +763,7 @@ void dm_auth_getScores(Auth_GetScores* msg)
 void dm_auth_addScorePoints(Auth_UpdateScore* msg)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT \"Type\" FROM auth.\"Scores\" WHERE idx=$1",
+            DS_STATEMENT("SELECT \"Type\" FROM auth.\"Scores\" WHERE idx=$1"),
             msg->m_scoreId);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -698,7 +783,7 @@ void dm_auth_addScorePoints(Auth_UpdateScore* msg)
     // Passed all sanity checks, update score.
     const uint32_t allowNegative = static_cast<uint32_t>(scoreType == Auth_UpdateScore::e_Golf);
     result = DS::PQexecVA(s_postgres,
-                          "SELECT auth.add_score_points($1, $2, $3);",
+                          DS_STATEMENT("SELECT auth.add_score_points($1, $2, $3);"),
                           msg->m_scoreId, msg->m_points, allowNegative);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -713,8 +798,8 @@ void dm_auth_addScorePoints(Auth_UpdateScore* msg)
 void dm_auth_transferScorePoints(Auth_TransferScore* msg)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT \"Type\" FROM auth.\"Scores\""
-            "    WHERE idx=$1 OR idx=$2",
+            DS_STATEMENT("SELECT \"Type\" FROM auth.\"Scores\""
+                         "    WHERE idx=$1 OR idx=$2"),
             msg->m_srcScoreId, msg->m_dstScoreId);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -735,7 +820,7 @@ void dm_auth_transferScorePoints(Auth_TransferScore* msg)
         allowNegative = 1;
     }
     result = DS::PQexecVA(s_postgres,
-            "SELECT auth.transfer_score_points($1, $2, $3, $4)",
+            DS_STATEMENT("SELECT auth.transfer_score_points($1, $2, $3, $4)"),
             msg->m_srcScoreId, msg->m_dstScoreId, msg->m_points,
             allowNegative);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
@@ -750,7 +835,7 @@ void dm_auth_transferScorePoints(Auth_TransferScore* msg)
 void dm_auth_setScorePoints(Auth_UpdateScore* msg)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT \"Type\" FROM auth.\"Scores\" WHERE idx=$1",
+            DS_STATEMENT("SELECT \"Type\" FROM auth.\"Scores\" WHERE idx=$1"),
             msg->m_scoreId);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -767,7 +852,7 @@ void dm_auth_setScorePoints(Auth_UpdateScore* msg)
         return;
     }
     result = DS::PQexecVA(s_postgres,
-                          "UPDATE auth.\"Scores\" SET \"Points\"=$2 WHERE idx=$1",
+                          DS_STATEMENT("UPDATE auth.\"Scores\" SET \"Points\"=$2 WHERE idx=$1"),
                           msg->m_scoreId, msg->m_points);
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
         PQ_PRINT_ERROR(s_postgres, UPDATE);
@@ -782,13 +867,13 @@ void dm_auth_getHighScores(Auth_GetHighScores* msg)
     DS::PGresultRef result;
     if (msg->m_owner == 0) {
         result = DS::PQexecVA(s_postgres,
-                              "SELECT idx, \"CreateTime\", \"Type\", \"Points\""
-                              "    FROM auth.\"Scores\" WHERE \"Name\"=$1"
-                              "    LIMIT $2",
+                              DS_STATEMENT("SELECT idx, \"CreateTime\", \"Type\", \"Points\""
+                                           "    FROM auth.\"Scores\" WHERE \"Name\"=$1"
+                                           "    LIMIT $2"),
                               msg->m_name, msg->m_maxScores);
     } else {
         result = DS::PQexecVA(s_postgres,
-                              "SELECT idx FROM vault.find_folder($1, $2)",
+                              DS_STATEMENT("SELECT idx FROM vault.find_folder($1, $2)"),
                               msg->m_owner, DS::Vault::e_AgeOwnersFolder);
         if (PQresultStatus(result) != PGRES_TUPLES_OK) {
             PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -804,11 +889,11 @@ void dm_auth_getHighScores(Auth_GetHighScores* msg)
         uint32_t ageOwnersFolder = strtoul(PQgetvalue(result, 0, 0), nullptr, 10);
 
         result = DS::PQexecVA(s_postgres,
-                              "SELECT idx, \"OwnerIdx\", \"CreateTime\", \"Type\", \"Points\""
-                              "    FROM auth.\"Scores\" WHERE \"Name\"=$1"
-                              "    AND \"OwnerIdx\" IN (SELECT \"ChildIdx\""
-                              "    FROM vault.\"NodeRefs\" WHERE \"ParentIdx\"=$2)"
-                              "    LIMIT $3",
+                              DS_STATEMENT("SELECT idx, \"OwnerIdx\", \"CreateTime\", \"Type\", \"Points\""
+                                           "    FROM auth.\"Scores\" WHERE \"Name\"=$1"
+                                           "    AND \"OwnerIdx\" IN (SELECT \"ChildIdx\""
+                                           "    FROM vault.\"NodeRefs\" WHERE \"ParentIdx\"=$2)"
+                                           "    LIMIT $3"),
                               msg->m_name, ageOwnersFolder, msg->m_maxScores);
     }
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
@@ -831,18 +916,20 @@ void dm_auth_getHighScores(Auth_GetHighScores* msg)
 
 void dm_auth_updateAgeSrv(Auth_UpdateAgeSrv* msg)
 {
+    // The client may be disconnecting on another worker, so it has to stay
+    // locked into the client list while we update it
+    std::lock_guard<std::mutex> authClientGuard(s_authClientMutex);
     AuthServer_Private* client = nullptr;
-    s_authClientMutex.lock();
     for (auto it = s_authClients.begin(); it != s_authClients.end(); ++it) {
         if ((*it)->m_player.m_playerId == msg->m_playerId) {
             client = *it;
             break;
         }
     }
-    s_authClientMutex.unlock();
 
     if (client) {
         client->m_ageNodeId = msg->m_ageNodeId;
+        dm_auth_subscribe(client, client->m_vaultAge, msg->m_ageNodeId);
         msg->m_isAdmin = (client->m_acctFlags & DS::e_AcctAdmin);
     }
     SEND_REPLY(msg, client ? DS::e_NetSuccess : DS::e_NetPlayerNotFound);
@@ -851,8 +938,8 @@ void dm_auth_updateAgeSrv(Auth_UpdateAgeSrv* msg)
 void dm_auth_acctFlags(Auth_AccountFlags* msg)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT \"AcctFlags\" FROM auth.\"Accounts\""
-            "    WHERE LOWER(\"Login\")=LOWER($1)",
+            DS_STATEMENT("SELECT \"AcctFlags\" FROM auth.\"Accounts\""
+                         "    WHERE LOWER(\"Login\")=LOWER($1)"),
             msg->m_acctName);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -883,8 +970,8 @@ void dm_auth_acctFlags(Auth_AccountFlags* msg)
 
     if (msg->m_flags != 0) {
         result = DS::PQexecVA(s_postgres,
-                              "UPDATE auth.\"Accounts\" SET \"AcctFlags\"=$2"
-                              "    WHERE LOWER(\"Login\")=LOWER($1)",
+                              DS_STATEMENT("UPDATE auth.\"Accounts\" SET \"AcctFlags\"=$2"
+                                           "    WHERE LOWER(\"Login\")=LOWER($1)"),
                               msg->m_acctName, acctFlags);
         if (PQresultStatus(result) != PGRES_COMMAND_OK) {
             PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -977,9 +1064,9 @@ void dm_auth_update_globalSDL(Auth_UpdateGlobalSDL* msg)
             // I guess this is a good time to save it back to the DB?
             DS::Blob blob = state.toBlob();
             DS::PGresultRef result = DS::PQexecVA(s_postgres,
-                    "UPDATE vault.\"GlobalStates\""
-                    "    SET \"SdlBlob\" = $2"
-                    "    WHERE \"Descriptor\" = $1",
+                    DS_STATEMENT("UPDATE vault.\"GlobalStates\""
+                                 "    SET \"SdlBlob\" = $2"
+                                 "    WHERE \"Descriptor\" = $1"),
                     msg->m_ageFilename,
                     ST::base64_encode(blob.buffer(), blob.size()));
             if (PQresultStatus(result) != PGRES_COMMAND_OK) {
@@ -1018,9 +1105,9 @@ void dm_authInit()
 
     // Mark all player info nodes offline
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "UPDATE vault.\"Nodes\" SET"
-            "    \"Int32_1\" = 0"
-            "    WHERE \"NodeType\" = $1",
+            DS_STATEMENT("UPDATE vault.\"Nodes\" SET"
+                         "    \"Int32_1\" = 0"
+                         "    WHERE \"NodeType\" = $1"),
             DS::Vault::e_NodePlayerInfo);
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
         PQ_PRINT_ERROR(s_postgres, UPDATE);
@@ -1039,231 +1126,358 @@ void dm_authCheck(bool reconnect)
     std::call_once(s_authInit, dm_authInit);
 }
 
-void dm_authDaemon()
+static PGconn* dm_auth_connect()
 {
-    s_postgres = PQconnectdb(ST::format(
+    PGconn* postgres = PQconnectdb(ST::format(
                     "host='{}' port='{}' user='{}' password='{}' dbname='{}'",
                     DS::Settings::DbHostname(), DS::Settings::DbPort(),
                     DS::Settings::DbUsername(), DS::Settings::DbPassword(),
                     DS::Settings::DbDbaseName()).c_str());
-    if (PQstatus(s_postgres) != CONNECTION_OK)
-        ST::printf(stderr, "Error connecting to postgres: {}", PQerrorMessage(s_postgres));
-
-    // If the connection to postgres was successful, initialize the vault here.
-    dm_authCheck(false);
-
-    for ( ;; ) {
-        DS::FifoMessage msg { -1, nullptr };
-        try {
-            msg = s_authChannel.getMessage();
+    if (PQstatus(postgres) != CONNECTION_OK)
+        ST::printf(stderr, "Error connecting to postgres: {}", PQerrorMessage(postgres));
+    return postgres;
+}
 
-            // We have a message from a client. Make sure the vault is ready.
-            dm_authCheck(true);
+static void dm_auth_process(const DS::FifoMessage& msg)
+{
+    try {
+        // We have a message from a client. Make sure the vault is ready.
+        dm_authCheck(true);
 
-            switch (msg.m_messageType) {
-            case e_AuthShutdown:
-                dm_auth_shutdown();
-                return;
-            case e_AuthClientLogin:
-                dm_auth_login(reinterpret_cast<Auth_LoginInfo*>(msg.m_payload));
-                break;
-            case e_AuthSetPlayer:
-                dm_auth_setPlayer(reinterpret_cast<Auth_ClientMessage*>(msg.m_payload));
-                break;
-            case e_AuthCreatePlayer:
-                dm_auth_createPlayer(reinterpret_cast<Auth_PlayerCreate*>(msg.m_payload));
-                break;
-            case e_AuthDeletePlayer:
-                dm_auth_deletePlayer(reinterpret_cast<Auth_PlayerDelete*>(msg.m_payload));
-                break;
-            case e_VaultCreateNode:
-                {
-                    Auth_NodeInfo* info = reinterpret_cast<Auth_NodeInfo*>(msg.m_payload);
-                    uint32_t nodeIdx = v_create_node(info->m_node);
-                    if (nodeIdx != 0) {
-                        info->m_node.set_NodeIdx(nodeIdx);
-                        SEND_REPLY(info, DS::e_NetSuccess);
-                    } else {
+        switch (msg.m_messageType) {
+        case e_AuthClientLogin:
+            dm_auth_login(reinterpret_cast<Auth_LoginInfo*>(msg.m_payload));
+            break;
+        case e_AuthSetPlayer:
+            dm_auth_setPlayer(reinterpret_cast<Auth_ClientMessage*>(msg.m_payload));
+            break;
+        case e_AuthCreatePlayer:
+            dm_auth_createPlayer(reinterpret_cast<Auth_PlayerCreate*>(msg.m_payload));
+            break;
+        case e_AuthDeletePlayer:
+            dm_auth_deletePlayer(reinterpret_cast<Auth_PlayerDelete*>(msg.m_payload));
+            break;
+        case e_VaultCreateNode:
+            {
+                Auth_NodeInfo* info = reinterpret_cast<Auth_NodeInfo*>(msg.m_payload);
+                uint32_t nodeIdx = v_create_node(info->m_node);
+                if (nodeIdx != 0) {
+                    info->m_node.set_NodeIdx(nodeIdx);
+                    SEND_REPLY(info, DS::e_NetSuccess);
+                } else {
+                    SEND_REPLY(info, DS::e_NetInternalError);
+                }
+            }
+            break;
+        case e_VaultFetchNode:
+            {
+                Auth_NodeInfo* info = reinterpret_cast<Auth_NodeInfo*>(msg.m_payload);
+                info->m_node = v_fetch_node(info->m_node.m_NodeIdx);
+                if (info->m_node.isNull())
+                    SEND_REPLY(info, DS::e_NetVaultNodeNotFound);
+                else
+                    SEND_REPLY(info, DS::e_NetSuccess);
+            }
+            break;
+        case e_VaultUpdateNode:
+            {
+                Auth_NodeInfo* info = reinterpret_cast<Auth_NodeInfo*>(msg.m_payload);
+                if (!info->m_internal && info->m_node.m_NodeType == DS::Vault::e_NodeSDL) {
+                    // This is an SDL update. It needs to be passed off to the gameserver, which
+                    // will consume the update and return an authoritative version for us to save.
+                    // This prevents race conditions between the AgeSDLHook and vault updates.
+                    DS::PGresultRef result = DS::PQexecVA(s_postgres,
+                            DS_STATEMENT("SELECT \"idx\" FROM game.\"Servers\" WHERE \"SdlIdx\"=$1"),
+                            info->m_node.m_NodeIdx);
+                    if (PQresultStatus(result) != PGRES_TUPLES_OK) {
+                        PQ_PRINT_ERROR(s_postgres, SELECT);
                         SEND_REPLY(info, DS::e_NetInternalError);
+                        break;
                     }
-                }
-                break;
-            case e_VaultFetchNode:
-                {
-                    Auth_NodeInfo* info = reinterpret_cast<Auth_NodeInfo*>(msg.m_payload);
-                    info->m_node = v_fetch_node(info->m_node.m_NodeIdx);
-                    if (info->m_node.isNull())
-                        SEND_REPLY(info, DS::e_NetVaultNodeNotFound);
-                    else
-                        SEND_REPLY(info, DS::e_NetSuccess);
-                }
-                break;
-            case e_VaultUpdateNode:
-                {
-                    Auth_NodeInfo* info = reinterpret_cast<Auth_NodeInfo*>(msg.m_payload);
-                    if (!info->m_internal && info->m_node.m_NodeType == DS::Vault::e_NodeSDL) {
-                        // This is an SDL update. It needs to be passed off to the gameserver, which
-                        // will consume the update and return an authoritative version for us to save.
-                        // This prevents race conditions between the AgeSDLHook and vault updates.
-                        DS::PGresultRef result = DS::PQexecVA(s_postgres,
-                                "SELECT \"idx\" FROM game.\"Servers\" WHERE \"SdlIdx\"=$1",
-                                info->m_node.m_NodeIdx);
-                        if (PQresultStatus(result) != PGRES_TUPLES_OK) {
-                            PQ_PRINT_ERROR(s_postgres, SELECT);
-                            SEND_REPLY(info, DS::e_NetInternalError);
+                    if (PQntuples(result) != 0) {
+                        uint32_t ageMcpId = strtoul(PQgetvalue(result, 0, 0), nullptr, 10);
+                        // The update will respond with "AgeNotFound" if no matching game server
+                        // is found, making this effectively an authoritative update.
+                        uint32_t result = DS::GameServer_UpdateVaultSDL(info->m_node, ageMcpId);
+                        if (result != DS::e_NetAgeNotFound) {
+                            SEND_REPLY(info, result);
                             break;
                         }
-                        if (PQntuples(result) != 0) {
-                            uint32_t ageMcpId = strtoul(PQgetvalue(result, 0, 0), nullptr, 10);
-                            // The update will respond with "AgeNotFound" if no matching game server
-                            // is found, making this effectively an authoritative update.
-                            uint32_t result = DS::GameServer_UpdateVaultSDL(info->m_node, ageMcpId);
-                            if (result != DS::e_NetAgeNotFound) {
-                                SEND_REPLY(info, result);
-                                break;
-                            }
-                        }
-                    }
-                    if (info->m_revision.isNull()) {
-                        info->m_revision = gen_uuid();
-                    }
-                    if (v_update_node(info->m_node)) {
-                        // Broadcast the change
-                        dm_auth_bcast_node(info->m_node.m_NodeIdx, info->m_revision);
-                        SEND_REPLY(info, DS::e_NetSuccess);
-                    } else {
-                        SEND_REPLY(info, DS::e_NetInternalError);
                     }
                 }
-                break;
-            case e_VaultRefNode:
-                {
-                    Auth_NodeRef* info = reinterpret_cast<Auth_NodeRef*>(msg.m_payload);
-                    if (v_ref_node(info->m_ref.m_parent, info->m_ref.m_child, info->m_ref.m_owner)) {
-                        // Broadcast the change
-                        dm_auth_bcast_ref(info->m_ref);
-                        SEND_REPLY(info, DS::e_NetSuccess);
-                    } else {
-                        SEND_REPLY(info, DS::e_NetInternalError);
-                    }
-                }
-                break;
-            case e_VaultSendNode:
-                {
-                    Auth_NodeSend* info = reinterpret_cast<Auth_NodeSend*>(msg.m_payload);
-                    DS::Vault::NodeRef ref = v_send_node(info->m_nodeIdx, info->m_playerIdx, info->m_senderIdx);
-                    if (ref.m_child || ref.m_owner || ref.m_parent)
-                        dm_auth_bcast_ref(ref);
-                    // There's no way to indicate success or failure to the client. Whether or not it gets a NodeRef
-                    // message is the only way the client knows if all went well here.
-                    // This reply is purely for synchronization purposes.
-                    SEND_REPLY(info, 0);
-                }
-                break;
-            case e_VaultUnrefNode:
-                {
-                    Auth_NodeRef* info = reinterpret_cast<Auth_NodeRef*>(msg.m_payload);
-                    if (v_unref_node(info->m_ref.m_parent, info->m_ref.m_child)) {
-                        // Broadcast the change
-                        dm_auth_bcast_unref(info->m_ref);
-                        SEND_REPLY(info, DS::e_NetSuccess);
-                    } else {
-                        SEND_REPLY(info, DS::e_NetInternalError);
-                    }
+                if (info->m_revision.isNull()) {
+                    info->m_revision = gen_uuid();
                 }
-                break;
-            case e_VaultFetchNodeTree:
-                {
-                    Auth_NodeRefList* info = reinterpret_cast<Auth_NodeRefList*>(msg.m_payload);
-                    if (v_fetch_tree(info->m_nodeId, info->m_refs))
-                        SEND_REPLY(info, DS::e_NetSuccess);
-                    else
-                        SEND_REPLY(info, DS::e_NetInternalError);
+                if (v_update_node(info->m_node)) {
+                    // Broadcast the change
+                    dm_auth_bcast_node(info->m_node.m_NodeIdx, info->m_revision);
+                    SEND_REPLY(info, DS::e_NetSuccess);
+                } else {
+                    SEND_REPLY(info, DS::e_NetInternalError);
                 }
-                break;
-            case e_VaultFindNode:
-                {
-                    Auth_NodeFindList* info = reinterpret_cast<Auth_NodeFindList*>(msg.m_payload);
-                    if (v_find_nodes(info->m_template, info->m_nodes))
-                        SEND_REPLY(info, DS::e_NetSuccess);
-                    else
-                        SEND_REPLY(info, DS::e_NetInternalError);
+            }
+            break;
+        case e_VaultRefNode:
+            {
+                Auth_NodeRef* info = reinterpret_cast<Auth_NodeRef*>(msg.m_payload);
+                if (v_ref_node(info->m_ref.m_parent, info->m_ref.m_child, info->m_ref.m_owner)) {
+                    // Broadcast the change
+                    dm_auth_bcast_ref(info->m_ref);
+                    SEND_REPLY(info, DS::e_NetSuccess);
+                } else {
+                    SEND_REPLY(info, DS::e_NetInternalError);
                 }
-                break;
-            case e_VaultInitAge:
-                dm_auth_createAge(reinterpret_cast<Auth_AgeCreate*>(msg.m_payload));
-                break;
-            case e_AuthFindGameServer:
-                dm_auth_findAge(reinterpret_cast<Auth_GameAge*>(msg.m_payload));
-                break;
-            case e_AuthDisconnect:
-                dm_auth_disconnect(reinterpret_cast<Auth_ClientMessage*>(msg.m_payload));
-                break;
-            case e_AuthAddAcct:
-                dm_auth_addacct(reinterpret_cast<Auth_AddAcct*>(msg.m_payload));
-                break;
-            case e_AuthGetPublic:
-                dm_auth_get_public(reinterpret_cast<Auth_PubAgeRequest*>(msg.m_payload));
-                break;
-            case e_AuthSetPublic:
-                dm_auth_set_pub_priv(reinterpret_cast<Auth_SetPublic*>(msg.m_payload));
-                break;
-            case e_AuthCreateScore:
-                dm_auth_createScore(reinterpret_cast<Auth_CreateScore*>(msg.m_payload));
-                break;
-            case e_AuthGetScores:
-                dm_auth_getScores(reinterpret_cast<Auth_GetScores*>(msg.m_payload));
-                break;
-            case e_AuthAddScorePoints:
-                dm_auth_addScorePoints(reinterpret_cast<Auth_UpdateScore*>(msg.m_payload));
-                break;
-            case e_AuthTransferScorePoints:
-                dm_auth_transferScorePoints(reinterpret_cast<Auth_TransferScore*>(msg.m_payload));
-                break;
-            case e_AuthSetScorePoints:
-                dm_auth_setScorePoints(reinterpret_cast<Auth_UpdateScore*>(msg.m_payload));
-                break;
-            case e_AuthGetHighScores:
-                dm_auth_getHighScores(reinterpret_cast<Auth_GetHighScores*>(msg.m_payload));
-                break;
-            case e_AuthUpdateAgeSrv:
-                dm_auth_updateAgeSrv(reinterpret_cast<Auth_UpdateAgeSrv*>(msg.m_payload));
-                break;
-            case e_AuthAcctFlags:
-                dm_auth_acctFlags(reinterpret_cast<Auth_AccountFlags*>(msg.m_payload));
-                break;
-            case e_AuthRestrictLogins:
-                s_restrictLogins = !s_restrictLogins;
-                if (msg.m_payload) {
-                    Auth_RestrictLogins* info = reinterpret_cast<Auth_RestrictLogins*>(msg.m_payload);
-                    info->m_status = s_restrictLogins;
+            }
+            break;
+        case e_VaultSendNode:
+            {
+                Auth_NodeSend* info = reinterpret_cast<Auth_NodeSend*>(msg.m_payload);
+                DS::Vault::NodeRef ref = v_send_node(info->m_nodeIdx, info->m_playerIdx, info->m_senderIdx);
+                if (ref.m_child || ref.m_owner || ref.m_parent)
+                    dm_auth_bcast_ref(ref);
+                // There's no way to indicate success or failure to the client. Whether or not it gets a NodeRef
+                // message is the only way the client knows if all went well here.
+                // This reply is purely for synchronization purposes.
+                SEND_REPLY(info, 0);
+            }
+            break;
+        case e_VaultUnrefNode:
+            {
+                Auth_NodeRef* info = reinterpret_cast<Auth_NodeRef*>(msg.m_payload);
+                if (v_unref_node(info->m_ref.m_parent, info->m_ref.m_child)) {
+                    // Broadcast the change
+                    dm_auth_bcast_unref(info->m_ref);
                     SEND_REPLY(info, DS::e_NetSuccess);
+                } else {
+                    SEND_REPLY(info, DS::e_NetInternalError);
                 }
-                break;
-            case e_AuthAddAllPlayers:
-                dm_auth_addAllPlayers(reinterpret_cast<Auth_AddAllPlayers*>(msg.m_payload));
-                break;
-            case e_AuthFetchSDL:
-                dm_auth_fetchSDL(reinterpret_cast<Auth_FetchSDL*>(msg.m_payload));
-                break;
-            case e_AuthUpdateGlobalSDL:
-                dm_auth_update_globalSDL(reinterpret_cast<Auth_UpdateGlobalSDL*>(msg.m_payload));
-                break;
-            default:
-                /* Invalid message...  This shouldn't happen */
-                ST::printf(stderr, "[Auth] Invalid auth message ({}) in message queue\n",
-                           msg.m_messageType);
-                exit(1);
-                break;
             }
-        } catch (const std::exception& ex) {
-            ST::printf(stderr, "[Auth] Exception raised processing message: {}\n",
-                       ex.what());
+            break;
+        case e_VaultFetchNodeTree:
+            {
+                Auth_NodeRefList* info = reinterpret_cast<Auth_NodeRefList*>(msg.m_payload);
+                if (v_fetch_tree(info->m_nodeId, info->m_refs))
+                    SEND_REPLY(info, DS::e_NetSuccess);
+                else
+                    SEND_REPLY(info, DS::e_NetInternalError);
+            }
+            break;
+        case e_VaultFindNode:
+            {
+                Auth_NodeFindList* info = reinterpret_cast<Auth_NodeFindList*>(msg.m_payload);
+                if (v_find_nodes(info->m_template, info->m_nodes))
+                    SEND_REPLY(info, DS::e_NetSuccess);
+                else
+                    SEND_REPLY(info, DS::e_NetInternalError);
+            }
+            break;
+        case e_VaultInitAge:
+            dm_auth_createAge(reinterpret_cast<Auth_AgeCreate*>(msg.m_payload));
+            break;
+        case e_AuthFindGameServer:
+            dm_auth_findAge(reinterpret_cast<Auth_GameAge*>(msg.m_payload));
+            break;
+        case e_AuthDisconnect:
+            dm_auth_disconnect(reinterpret_cast<Auth_ClientMessage*>(msg.m_payload));
+            break;
+        case e_AuthAddAcct:
+            dm_auth_addacct(reinterpret_cast<Auth_AddAcct*>(msg.m_payload));
+            break;
+        case e_AuthGetPublic:
+            dm_auth_get_public(reinterpret_cast<Auth_PubAgeRequest*>(msg.m_payload));
+            break;
+        case e_AuthSetPublic:
+            dm_auth_set_pub_priv(reinterpret_cast<Auth_SetPublic*>(msg.m_payload));
+            break;
+        case e_AuthCreateScore:
+            dm_auth_createScore(reinterpret_cast<Auth_CreateScore*>(msg.m_payload));
+            break;
+        case e_AuthGetScores:
+            dm_auth_getScores(reinterpret_cast<Auth_GetScores*>(msg.m_payload));
+            break;
+        case e_AuthAddScorePoints:
+            dm_auth_addScorePoints(reinterpret_cast<Auth_UpdateScore*>(msg.m_payload));
+            break;
+        case e_AuthTransferScorePoints:
+            dm_auth_transferScorePoints(reinterpret_cast<Auth_TransferScore*>(msg.m_payload));
+            break;
+        case e_AuthSetScorePoints:
+            dm_auth_setScorePoints(reinterpret_cast<Auth_UpdateScore*>(msg.m_payload));
+            break;
+        case e_AuthGetHighScores:
+            dm_auth_getHighScores(reinterpret_cast<Auth_GetHighScores*>(msg.m_payload));
+            break;
+        case e_AuthUpdateAgeSrv:
+            dm_auth_updateAgeSrv(reinterpret_cast<Auth_UpdateAgeSrv*>(msg.m_payload));
+            break;
+        case e_AuthAcctFlags:
+            dm_auth_acctFlags(reinterpret_cast<Auth_AccountFlags*>(msg.m_payload));
+            break;
+        case e_AuthRestrictLogins:
+            // Only ever toggled on the first worker
+            s_restrictLogins = !s_restrictLogins.load();
             if (msg.m_payload) {
-                // Keep clients from blocking on a reply
-                SEND_REPLY(reinterpret_cast<Auth_ClientMessage*>(msg.m_payload),
-                           DS::e_NetInternalError);
+                Auth_RestrictLogins* info = reinterpret_cast<Auth_RestrictLogins*>(msg.m_payload);
+                info->m_status = s_restrictLogins;
+                SEND_REPLY(info, DS::e_NetSuccess);
             }
+            break;
+        case e_AuthAddAllPlayers:
+            dm_auth_addAllPlayers(reinterpret_cast<Auth_AddAllPlayers*>(msg.m_payload));
+            break;
+        case e_AuthFetchSDL:
+            dm_auth_fetchSDL(reinterpret_cast<Auth_FetchSDL*>(msg.m_payload));
+            break;
+        case e_AuthUpdateGlobalSDL:
+            dm_auth_update_globalSDL(reinterpret_cast<Auth_UpdateGlobalSDL*>(msg.m_payload));
+            break;
+        default:
+            /* Invalid message...  This shouldn't happen */
+            ST::printf(stderr, "[Auth] Invalid auth message ({}) in message queue\n",
+                       msg.m_messageType);
+            exit(1);
+            break;
+        }
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Auth] Exception raised processing message: {}\n",
+                   ex.what());
+        if (msg.m_payload) {
+            // Keep clients from blocking on a reply
+            SEND_REPLY(reinterpret_cast<Auth_ClientMessage*>(msg.m_payload),
+                       DS::e_NetInternalError);
+        }
+    }
+}
+
+/* Picks the key that decides which worker handles a message.  Requests for
+ * the same account, player, vault node or score always share a worker, so
+ * they run in the order they arrived.  Anything touching state which isn't
+ * keyed (global SDL, age instances, the login restriction) goes to the first
+ * worker. */
+static uint32_t dm_auth_route(const DS::FifoMessage& msg)
+{
+    switch (msg.m_messageType) {
+    case e_AuthClientLogin:
+        return ST::hash_i()(reinterpret_cast<Auth_LoginInfo*>(msg.m_payload)->m_acctName);
+    case e_AuthAddAcct:
+        return ST::hash_i()(reinterpret_cast<Auth_AddAcct*>(msg.m_payload)->m_acctInfo.m_acctName);
+    case e_AuthAcctFlags:
+        return ST::hash_i()(reinterpret_cast<Auth_AccountFlags*>(msg.m_payload)->m_acctName);
+    case e_AuthSetPlayer:
+        {
+            Auth_ClientMessage* info = reinterpret_cast<Auth_ClientMessage*>(msg.m_payload);
+            return reinterpret_cast<AuthServer_Private*>(info->m_client)->m_player.m_playerId;
+        }
+    case e_AuthDeletePlayer:
+        return reinterpret_cast<Auth_PlayerDelete*>(msg.m_payload)->m_playerId;
+    case e_AuthUpdateAgeSrv:
+        return reinterpret_cast<Auth_UpdateAgeSrv*>(msg.m_payload)->m_playerId;
+    case e_VaultFetchNode:
+    case e_VaultUpdateNode:
+        return reinterpret_cast<Auth_NodeInfo*>(msg.m_payload)->m_node.m_NodeIdx;
+    case e_VaultRefNode:
+    case e_VaultUnrefNode:
+        return reinterpret_cast<Auth_NodeRef*>(msg.m_payload)->m_ref.m_parent;
+    case e_VaultSendNode:
+        return reinterpret_cast<Auth_NodeSend*>(msg.m_payload)->m_playerIdx;
+    case e_VaultFetchNodeTree:
+        return reinterpret_cast<Auth_NodeRefList*>(msg.m_payload)->m_nodeId;
+    case e_AuthSetPublic:
+        return reinterpret_cast<Auth_SetPublic*>(msg.m_payload)->m_node;
+    case e_AuthGetPublic:
+        return ST::hash_i()(reinterpret_cast<Auth_PubAgeRequest*>(msg.m_payload)->m_agename);
+    case e_AuthCreateScore:
+        return reinterpret_cast<Auth_CreateScore*>(msg.m_payload)->m_owner;
+    case e_AuthGetScores:
+    case e_AuthGetHighScores:
+        return reinterpret_cast<Auth_GetScores*>(msg.m_payload)->m_owner;
+    case e_AuthAddScorePoints:
+    case e_AuthSetScorePoints:
+        return reinterpret_cast<Auth_UpdateScore*>(msg.m_payload)->m_scoreId;
+    case e_AuthTransferScorePoints:
+        return reinterpret_cast<Auth_TransferScore*>(msg.m_payload)->m_srcScoreId;
+    case e_VaultCreateNode:
+    case e_VaultFindNode:
+    case e_AuthDisconnect:
+        // Nothing shared; just spread these out by client
+        return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+                reinterpret_cast<Auth_ClientMessage*>(msg.m_payload)->m_client) >> 4);
+    default:
+        return 0;
+    }
+}
+
+struct AuthWorker
+{
+    std::thread m_thread;
+    DS::MsgChannel m_channel;
+};
+
+static std::vector<std::unique_ptr<AuthWorker>> s_authWorkers;
+
+static void dm_auth_worker(AuthWorker* worker)
+{
+    s_postgres = dm_auth_connect();
+
+    DS::FifoMessage batch[32];
+    size_t batchSize = 0, batchPos = 0;
+    for ( ;; ) {
+        if (batchPos == batchSize) {
+            batchSize = worker->m_channel.getMessages(batch);
+            batchPos = 0;
+        }
+        const DS::FifoMessage& msg = batch[batchPos++];
+        if (msg.m_messageType == e_AuthShutdown)
+            break;
+        dm_auth_process(msg);
+    }
+
+    DS::PQclose(s_postgres);
+}
+
+void dm_authDaemon()
+{
+    s_postgres = dm_auth_connect();
+
+    // If the connection to postgres was successful, initialize the vault here.
+    dm_authCheck(false);
+
+    // With more than one worker, this thread only hands messages out
+    uint32_t workers = DS::Settings::AuthWorkers();
+    if (workers > 1) {
+        for (uint32_t i = 0; i < workers; ++i) {
+            s_authWorkers.emplace_back(new AuthWorker);
+            AuthWorker* worker = s_authWorkers.back().get();
+            worker->m_thread = std::thread(&dm_auth_worker, worker);
+        }
+    }
+
+    // Pull messages off the channel in batches, so a burst of requests
+    // only costs one wakeup
+    DS::FifoMessage batch[32];
+    size_t batchSize = 0, batchPos = 0;
+    for ( ;; ) {
+        if (batchPos == batchSize) {
+            batchSize = s_authChannel.getMessages(batch);
+            batchPos = 0;
+        }
+        const DS::FifoMessage& msg = batch[batchPos++];
+
+        if (msg.m_messageType == e_AuthShutdown) {
+            for (auto& worker : s_authWorkers)
+                worker->m_channel.putMessage(e_AuthShutdown);
+            for (auto& worker : s_authWorkers)
+                worker->m_thread.join();
+            s_authWorkers.clear();
+            dm_auth_shutdown();
+            return;
+        }
+
+        if (s_authWorkers.empty()) {
+            dm_auth_process(msg);
+        } else {
+            AuthWorker* worker = s_authWorkers[dm_auth_route(msg) % s_authWorkers.size()].get();
+            worker->m_channel.putMessage(msg.m_messageType, msg.m_payload);
         }
     }
 
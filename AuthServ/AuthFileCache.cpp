@@ -0,0 +1,95 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "AuthFileCache.h"
+#include "settings.h"
+#include <unordered_map>
+#include <mutex>
+
+static std::unordered_map<ST::string, DS::AuthFileRef, ST::hash> s_fileCache;
+static std::mutex s_fileCacheMutex;
+
+static bool file_current(const DS::AuthCachedFile* cached, const struct stat& st,
+                         const uint32_t* droidKey)
+{
+    return cached->m_inode == st.st_ino && cached->m_fileSize == st.st_size
+        && cached->m_mtime.tv_sec == st.st_mtim.tv_sec
+        && cached->m_mtime.tv_nsec == st.st_mtim.tv_nsec
+        && memcmp(cached->m_droidKey, droidKey, sizeof(cached->m_droidKey)) == 0;
+}
+
+DS::AuthFileRef DS::AuthFileCache_Get(const ST::string& filename)
+{
+    const uint32_t* droidKey = DS::Settings::DroidKey();
+
+    struct stat st;
+    if (stat(filename.c_str(), &st) < 0) {
+        int error = errno;
+        {
+            std::lock_guard<std::mutex> guard(s_fileCacheMutex);
+            s_fileCache.erase(filename);
+        }
+        throw DS::FileIOException(strerror(error));
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(s_fileCacheMutex);
+        auto iter = s_fileCache.find(filename);
+        if (iter != s_fileCache.end() && file_current(iter->second.get(), st, droidKey))
+            return iter->second;
+    }
+
+    // Load and encrypt outside the lock so other downloads aren't held up.
+    // If two clients race here, both build identical images and the last
+    // one wins.
+    DS::BufferStream source;
+    {
+        DS::FileStream file;
+        file.open(filename.c_str(), "rb");
+        uint8_t buf[CHUNK_SIZE];
+        ssize_t nread;
+        while ((nread = file.readBytes(buf, sizeof(buf))) > 0)
+            source.writeBytes(buf, nread);
+    }
+
+    auto entry = std::make_shared<AuthCachedFile>();
+    entry->m_mtime = st.st_mtim;
+    entry->m_fileSize = st.st_size;
+    entry->m_inode = st.st_ino;
+    memcpy(entry->m_droidKey, droidKey, sizeof(entry->m_droidKey));
+
+    // All auth downloads must be encrypted.
+    source.seek(0, SEEK_SET);
+    if (DS::EncryptedStream::CheckEncryption(&source).has_value()) {
+        entry->m_data.writeBytes(source.buffer(), source.size());
+    } else {
+        DS::EncryptedStream encStream(&entry->m_data, DS::EncryptedStream::Mode::e_write,
+                                      DS::EncryptedStream::Type::e_xxtea, droidKey);
+        encStream.writeBytes(source.buffer(), source.size());
+    }
+
+    DS::AuthFileRef result = entry;
+    std::lock_guard<std::mutex> guard(s_fileCacheMutex);
+    s_fileCache[filename] = result;
+    return result;
+}
+
+void DS::AuthFileCache_Clear()
+{
+    std::lock_guard<std::mutex> guard(s_fileCacheMutex);
+    s_fileCache.clear();
+}
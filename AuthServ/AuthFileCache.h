@@ -0,0 +1,50 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _DS_AUTHFILECACHE_H
+#define _DS_AUTHFILECACHE_H
+
+#include "streams.h"
+#include <memory>
+#include <sys/stat.h>
+
+namespace DS
+{
+    /* An auth download as it is sent to clients, i.e. already encrypted with
+     * the droid key.  Entries are shared read-only between every download
+     * of the same file; a changed file produces a new entry instead. */
+    struct AuthCachedFile
+    {
+        BufferStream m_data;
+
+        // Identity of the source file and key this image was built from
+        struct timespec m_mtime;
+        off_t m_fileSize;
+        ino_t m_inode;
+        uint32_t m_droidKey[4];
+    };
+
+    typedef std::shared_ptr<const AuthCachedFile> AuthFileRef;
+
+    /* Returns the encrypted image of filename, (re)loading it if the file
+     * has changed since it was cached.  Throws FileIOException if the file
+     * can't be read. */
+    AuthFileRef AuthFileCache_Get(const ST::string& filename);
+    void AuthFileCache_Clear();
+}
+
+#endif
@@ -17,6 +17,7 @@
 
 #include "AuthServer_Private.h"
 #include "AuthManifest.h"
+#include "NetIO/HandshakePool.h"
 #include "SDL/DescriptorDb.h"
 #include "Types/BitVector.h"
 #include "Types/Uuid.h"
@@ -44,39 +45,25 @@ std::mutex s_authClientMutex;
 
 void auth_init(AuthServer_Private& client)
 {
-    /* Auth server header:  size, null uuid */
-    uint32_t size = DS::RecvValue<uint32_t>(client.m_sock);
-    if (size != 20)
-        throw DS::InvalidConnectionHeader();
-    DS::Uuid uuid;
-    DS::RecvBuffer(client.m_sock, uuid.m_bytes, sizeof(uuid.m_bytes));
+    // The connection request was already read in full (see m_connect)
 
     /* Reply header */
     client.m_buffer.truncate();
     client.m_buffer.write<uint8_t>(DS::e_ServToCliEncrypt);
 
     /* Establish encryption, and write reply body */
-    uint8_t msgId = DS::RecvValue<uint8_t>(client.m_sock);
-    if (msgId != DS::e_CliToServConnect)
-        throw DS::InvalidConnectionHeader();
-    uint8_t msgSize = DS::RecvValue<uint8_t>(client.m_sock);
-    if (msgSize == 2) {
+    uint8_t Y[64];
+    if (!client.m_connect.clientKey(Y)) {
         // no seed... client wishes unencrypted connection (that's okay, nobody
         // else can "fake" us as nobody has the private key, so if the client
         // actually wants encryption it will only work with the correct peer)
         client.m_buffer.write<uint8_t>(2); // reply with an empty seed as well
+        client.m_crypt = DS::CryptStateInit(nullptr, 0);
     } else {
-        uint8_t Y[64];
-        memset(Y, 0, sizeof(Y));
-        if (msgSize > 66)
-            throw DS::InvalidConnectionHeader();
-        DS::RecvBuffer(client.m_sock, Y, 64 - (66 - msgSize));
-        BYTE_SWAP_BUFFER(Y, 64);
-
         uint8_t serverSeed[7];
         uint8_t sharedKey[7];
-        DS::CryptEstablish(serverSeed, sharedKey, DS::Settings::CryptKey(DS::e_KeyAuth_N),
-                           DS::Settings::CryptKey(DS::e_KeyAuth_K), Y);
+        DS::CryptEstablish(serverSeed, sharedKey,
+                           DS::CryptKeyFromSettings(DS::e_KeyAuth_N, DS::e_KeyAuth_K), Y);
         client.m_crypt = DS::CryptStateInit(sharedKey, 7);
 
         client.m_buffer.write<uint8_t>(9);
@@ -154,7 +141,7 @@ void cb_register(AuthServer_Private& client)
     if (buildId && buildId != DS::Settings::BuildId()) {
         ST::printf(stderr, "[Auth] Wrong Build ID from {}: {}\n",
                    DS::SockIpAddress(client.m_sock), buildId);
-        DS::CloseSock(client.m_sock);
+        DS::ShutdownSock(client.m_sock);
         return;
     }
 
@@ -166,20 +153,9 @@ void cb_register(AuthServer_Private& client)
     SEND_REPLY();
 }
 
-void cb_login(AuthServer_Private& client)
+static void auth_login_reply(AuthServer_Private& client, const Auth_LoginInfo& msg,
+                             uint32_t transId, const DS::FifoMessage& reply)
 {
-    Auth_LoginInfo msg;
-    msg.m_client = &client;
-    uint32_t transId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_clientChallenge = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_acctName = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    DS::CryptRecvBuffer(client.m_sock, client.m_crypt,
-                        msg.m_passHash.m_data, sizeof(DS::ShaHash));
-    msg.m_token = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    msg.m_os = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_AuthClientLogin, reinterpret_cast<void*>(&msg));
-
-    DS::FifoMessage reply = client.m_channel.getMessage();
     if (reply.m_messageType != DS::e_NetSuccess) {
         static uint32_t zerokey[4] = { 0, 0, 0, 0 };
 
@@ -215,6 +191,24 @@ void cb_login(AuthServer_Private& client)
     SEND_REPLY();
 }
 
+void cb_login(AuthServer_Private& client)
+{
+    auto msg = std::make_shared<Auth_LoginInfo>();
+    msg->m_client = &client;
+    uint32_t transId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_clientChallenge = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_acctName = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    DS::CryptRecvBuffer(client.m_sock, client.m_crypt,
+                        msg->m_passHash.m_data, sizeof(DS::ShaHash));
+    msg->m_token = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    msg->m_os = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_AuthClientLogin, reinterpret_cast<void*>(msg.get()));
+
+    client.awaitReply(client.m_channel, [&client, msg, transId](const DS::FifoMessage& reply) {
+        auth_login_reply(client, *msg, transId, reply);
+    });
+}
+
 void cb_setPlayer(AuthServer_Private& client)
 {
     START_REPLY(e_AuthToCli_AcctSetPlayerReply);
@@ -227,15 +221,17 @@ void cb_setPlayer(AuthServer_Private& client)
     if (client.m_player.m_playerId == 0) {
         // No player -- always successful
         client.m_buffer.write<uint32_t>(DS::e_NetSuccess);
-    } else {
-        Auth_ClientMessage msg;
-        msg.m_client = &client;
-        s_authChannel.putMessage(e_AuthSetPlayer, reinterpret_cast<void*>(&msg));
-        DS::FifoMessage reply = client.m_channel.getMessage();
-        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        SEND_REPLY();
+        return;
     }
 
-    SEND_REPLY();
+    auto msg = std::make_shared<Auth_ClientMessage>();
+    msg->m_client = &client;
+    s_authChannel.putMessage(e_AuthSetPlayer, reinterpret_cast<void*>(msg.get()));
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        SEND_REPLY();
+    });
 }
 
 void cb_playerCreate(AuthServer_Private& client)
@@ -245,28 +241,29 @@ void cb_playerCreate(AuthServer_Private& client)
     // Trans ID
     client.m_buffer.write<uint32_t>(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
 
-    Auth_PlayerCreate msg;
-    msg.m_client = &client;
-    msg.m_player.m_playerName = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    msg.m_player.m_avatarModel = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    auto msg = std::make_shared<Auth_PlayerCreate>();
+    msg->m_client = &client;
+    msg->m_player.m_playerName = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    msg->m_player.m_avatarModel = DS::CryptRecvString(client.m_sock, client.m_crypt);
     DS::CryptRecvString(client.m_sock, client.m_crypt);   // Friend invite
-    s_authChannel.putMessage(e_AuthCreatePlayer, reinterpret_cast<void*>(&msg));
+    s_authChannel.putMessage(e_AuthCreatePlayer, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    if (reply.m_messageType != DS::e_NetSuccess) {
-        client.m_buffer.write<uint32_t>(0);   // Player ID
-        client.m_buffer.write<uint32_t>(0);   // Explorer
-        client.m_buffer.write<uint16_t>(0);   // Player Name
-        client.m_buffer.write<uint16_t>(0);   // Avatar Model
-    } else {
-        client.m_buffer.write<uint32_t>(msg.m_player.m_playerId);
-        client.m_buffer.write<uint32_t>(1);   // Explorer
-        client.m_buffer.writePString<uint16_t>(msg.m_player.m_playerName, DS::e_StringUTF16);
-        client.m_buffer.writePString<uint16_t>(msg.m_player.m_avatarModel, DS::e_StringUTF16);
-    }
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        if (reply.m_messageType != DS::e_NetSuccess) {
+            client.m_buffer.write<uint32_t>(0);   // Player ID
+            client.m_buffer.write<uint32_t>(0);   // Explorer
+            client.m_buffer.write<uint16_t>(0);   // Player Name
+            client.m_buffer.write<uint16_t>(0);   // Avatar Model
+        } else {
+            client.m_buffer.write<uint32_t>(msg->m_player.m_playerId);
+            client.m_buffer.write<uint32_t>(1);   // Explorer
+            client.m_buffer.writePString<uint16_t>(msg->m_player.m_playerName, DS::e_StringUTF16);
+            client.m_buffer.writePString<uint16_t>(msg->m_player.m_avatarModel, DS::e_StringUTF16);
+        }
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_playerDelete(AuthServer_Private& client)
@@ -276,15 +273,16 @@ void cb_playerDelete(AuthServer_Private& client)
     // Trans ID
     client.m_buffer.write<uint32_t>(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
 
-    Auth_PlayerDelete msg;
-    msg.m_client = &client;
-    msg.m_playerId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_AuthDeletePlayer, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_PlayerDelete>();
+    msg->m_client = &client;
+    msg->m_playerId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_AuthDeletePlayer, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_ageCreate(AuthServer_Private& client)
@@ -294,31 +292,32 @@ void cb_ageCreate(AuthServer_Private& client)
     // Trans ID
     client.m_buffer.write<uint32_t>(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
 
-    Auth_AgeCreate msg;
-    msg.m_client = &client;
-    DS::CryptRecvBuffer(client.m_sock, client.m_crypt, msg.m_age.m_ageId.m_bytes,
-                        sizeof(msg.m_age.m_ageId.m_bytes));
-    DS::CryptRecvBuffer(client.m_sock, client.m_crypt, msg.m_age.m_parentId.m_bytes,
-                        sizeof(msg.m_age.m_parentId.m_bytes));
-    msg.m_age.m_filename = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    msg.m_age.m_instName = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    msg.m_age.m_userName = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    msg.m_age.m_description = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    msg.m_age.m_seqNumber = DS::CryptRecvValue<int32_t>(client.m_sock, client.m_crypt);
-    msg.m_age.m_language = DS::CryptRecvValue<int32_t>(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_VaultInitAge, reinterpret_cast<void*>(&msg));
-
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    if (reply.m_messageType != DS::e_NetSuccess) {
-        client.m_buffer.write<uint32_t>(0);   // Age Node Idx
-        client.m_buffer.write<uint32_t>(0);   // Age Info Node Idx
-    } else {
-        client.m_buffer.write<uint32_t>(msg.m_ageIdx);
-        client.m_buffer.write<uint32_t>(msg.m_infoIdx);
-    }
+    auto msg = std::make_shared<Auth_AgeCreate>();
+    msg->m_client = &client;
+    DS::CryptRecvBuffer(client.m_sock, client.m_crypt, msg->m_age.m_ageId.m_bytes,
+                        sizeof(msg->m_age.m_ageId.m_bytes));
+    DS::CryptRecvBuffer(client.m_sock, client.m_crypt, msg->m_age.m_parentId.m_bytes,
+                        sizeof(msg->m_age.m_parentId.m_bytes));
+    msg->m_age.m_filename = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    msg->m_age.m_instName = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    msg->m_age.m_userName = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    msg->m_age.m_description = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    msg->m_age.m_seqNumber = DS::CryptRecvValue<int32_t>(client.m_sock, client.m_crypt);
+    msg->m_age.m_language = DS::CryptRecvValue<int32_t>(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_VaultInitAge, reinterpret_cast<void*>(msg.get()));
+
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        if (reply.m_messageType != DS::e_NetSuccess) {
+            client.m_buffer.write<uint32_t>(0);   // Age Node Idx
+            client.m_buffer.write<uint32_t>(0);   // Age Info Node Idx
+        } else {
+            client.m_buffer.write<uint32_t>(msg->m_ageIdx);
+            client.m_buffer.write<uint32_t>(msg->m_infoIdx);
+        }
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_nodeCreate(AuthServer_Private& client)
@@ -334,23 +333,24 @@ void cb_nodeCreate(AuthServer_Private& client)
     DS::Blob nodeData = DS::Blob::Steal(nodeBuffer.release(), nodeSize);
     DS::BlobStream nodeStream(nodeData);
 
-    Auth_NodeInfo msg;
-    msg.m_client = &client;
-    msg.m_node.read(&nodeStream);
+    auto msg = std::make_shared<Auth_NodeInfo>();
+    msg->m_client = &client;
+    msg->m_node.read(&nodeStream);
     if (!nodeStream.atEof()) {
         ST::printf(stderr, "WARNING: Ignoring {} bytes of unread data at end of node stream\n",
                    nodeStream.size() - nodeStream.tell());
     }
-    s_authChannel.putMessage(e_VaultCreateNode, reinterpret_cast<void*>(&msg));
+    s_authChannel.putMessage(e_VaultCreateNode, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    if (reply.m_messageType != DS::e_NetSuccess)
-        client.m_buffer.write<uint32_t>(0);
-    else
-        client.m_buffer.write<uint32_t>(msg.m_node.m_NodeIdx);
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        if (reply.m_messageType != DS::e_NetSuccess)
+            client.m_buffer.write<uint32_t>(0);
+        else
+            client.m_buffer.write<uint32_t>(msg->m_node.m_NodeIdx);
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_nodeFetch(AuthServer_Private& client)
@@ -360,25 +360,26 @@ void cb_nodeFetch(AuthServer_Private& client)
     // Trans ID
     client.m_buffer.write<uint32_t>(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
 
-    Auth_NodeInfo msg;
-    msg.m_client = &client;
-    msg.m_node.set_NodeIdx(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
-    s_authChannel.putMessage(e_VaultFetchNode, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_NodeInfo>();
+    msg->m_client = &client;
+    msg->m_node.set_NodeIdx(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
+    s_authChannel.putMessage(e_VaultFetchNode, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    if (reply.m_messageType != DS::e_NetSuccess) {
-        client.m_buffer.write<uint32_t>(0);
-    } else {
-        uint32_t sizePos = client.m_buffer.tell();
-        client.m_buffer.write<uint32_t>(0);
-        msg.m_node.write(&client.m_buffer);
-        uint32_t endPos = client.m_buffer.tell();
-        client.m_buffer.seek(sizePos, SEEK_SET);
-        client.m_buffer.write<uint32_t>(endPos - sizePos - sizeof(uint32_t));
-    }
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        if (reply.m_messageType != DS::e_NetSuccess) {
+            client.m_buffer.write<uint32_t>(0);
+        } else {
+            uint32_t sizePos = client.m_buffer.tell();
+            client.m_buffer.write<uint32_t>(0);
+            msg->m_node.write(&client.m_buffer);
+            uint32_t endPos = client.m_buffer.tell();
+            client.m_buffer.seek(sizePos, SEEK_SET);
+            client.m_buffer.write<uint32_t>(endPos - sizePos - sizeof(uint32_t));
+        }
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_nodeUpdate(AuthServer_Private& client)
@@ -388,11 +389,11 @@ void cb_nodeUpdate(AuthServer_Private& client)
     // Trans ID
     client.m_buffer.write<uint32_t>(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
 
-    Auth_NodeInfo msg;
-    msg.m_client = &client;
+    auto msg = std::make_shared<Auth_NodeInfo>();
+    msg->m_client = &client;
     uint32_t m_nodeId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    DS::CryptRecvBuffer(client.m_sock, client.m_crypt, &msg.m_revision.m_bytes,
-                        sizeof(msg.m_revision.m_bytes));
+    DS::CryptRecvBuffer(client.m_sock, client.m_crypt, &msg->m_revision.m_bytes,
+                        sizeof(msg->m_revision.m_bytes));
 
     uint32_t nodeSize = DS::CryptRecvSize(client.m_sock, client.m_crypt, NODE_SIZE_MAX);
     std::unique_ptr<uint8_t[]> nodeBuffer(new uint8_t[nodeSize]);
@@ -400,19 +401,20 @@ void cb_nodeUpdate(AuthServer_Private& client)
     DS::Blob nodeData = DS::Blob::Steal(nodeBuffer.release(), nodeSize);
     DS::BlobStream nodeStream(nodeData);
 
-    msg.m_node.read(&nodeStream);
+    msg->m_node.read(&nodeStream);
     if (!nodeStream.atEof()) {
         ST::printf(stderr, "WARNING: Ignoring {} bytes of unread data at end of node stream\n",
                    nodeStream.size() - nodeStream.tell());
     }
-    msg.m_node.m_NodeIdx = m_nodeId;
-    msg.m_internal = false;
-    s_authChannel.putMessage(e_VaultUpdateNode, reinterpret_cast<void*>(&msg));
+    msg->m_node.m_NodeIdx = m_nodeId;
+    msg->m_internal = false;
+    s_authChannel.putMessage(e_VaultUpdateNode, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_nodeRef(AuthServer_Private& client)
@@ -422,17 +424,18 @@ void cb_nodeRef(AuthServer_Private& client)
     // Trans ID
     client.m_buffer.write<uint32_t>(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
 
-    Auth_NodeRef msg;
-    msg.m_client = &client;
-    msg.m_ref.m_parent = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_ref.m_child = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_ref.m_owner = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_VaultRefNode, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_NodeRef>();
+    msg->m_client = &client;
+    msg->m_ref.m_parent = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_ref.m_child = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_ref.m_owner = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_VaultRefNode, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_nodeUnref(AuthServer_Private& client)
@@ -442,16 +445,17 @@ void cb_nodeUnref(AuthServer_Private& client)
     // Trans ID
     client.m_buffer.write<uint32_t>(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
 
-    Auth_NodeRef msg;
-    msg.m_client = &client;
-    msg.m_ref.m_parent = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_ref.m_child = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_VaultUnrefNode, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_NodeRef>();
+    msg->m_client = &client;
+    msg->m_ref.m_parent = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_ref.m_child = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_VaultUnrefNode, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_nodeTree(AuthServer_Private& client)
@@ -461,26 +465,27 @@ void cb_nodeTree(AuthServer_Private& client)
     // Trans ID
     client.m_buffer.write<uint32_t>(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
 
-    Auth_NodeRefList msg;
-    msg.m_client = &client;
-    msg.m_nodeId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_VaultFetchNodeTree, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_NodeRefList>();
+    msg->m_client = &client;
+    msg->m_nodeId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_VaultFetchNodeTree, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    if (reply.m_messageType != DS::e_NetSuccess) {
-        client.m_buffer.write<uint32_t>(0);
-    } else {
-        client.m_buffer.write<uint32_t>(msg.m_refs.size());
-        for (auto it = msg.m_refs.begin(); it != msg.m_refs.end(); ++it) {
-            client.m_buffer.write<uint32_t>(it->m_parent);
-            client.m_buffer.write<uint32_t>(it->m_child);
-            client.m_buffer.write<uint32_t>(it->m_owner);
-            client.m_buffer.write<uint8_t>(0);
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        if (reply.m_messageType != DS::e_NetSuccess) {
+            client.m_buffer.write<uint32_t>(0);
+        } else {
+            client.m_buffer.write<uint32_t>(msg->m_refs.size());
+            for (auto it = msg->m_refs.begin(); it != msg->m_refs.end(); ++it) {
+                client.m_buffer.write<uint32_t>(it->m_parent);
+                client.m_buffer.write<uint32_t>(it->m_child);
+                client.m_buffer.write<uint32_t>(it->m_owner);
+                client.m_buffer.write<uint8_t>(0);
+            }
         }
-    }
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_nodeFind(AuthServer_Private& client)
@@ -490,8 +495,8 @@ void cb_nodeFind(AuthServer_Private& client)
     // Trans ID
     client.m_buffer.write<uint32_t>(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
 
-    Auth_NodeFindList msg;
-    msg.m_client = &client;
+    auto msg = std::make_shared<Auth_NodeFindList>();
+    msg->m_client = &client;
 
     uint32_t nodeSize = DS::CryptRecvSize(client.m_sock, client.m_crypt, NODE_SIZE_MAX);
     std::unique_ptr<uint8_t[]> nodeBuffer(new uint8_t[nodeSize]);
@@ -499,35 +504,38 @@ void cb_nodeFind(AuthServer_Private& client)
     DS::Blob nodeData = DS::Blob::Steal(nodeBuffer.release(), nodeSize);
     DS::BlobStream nodeStream(nodeData);
 
-    msg.m_template.read(&nodeStream);
+    msg->m_template.read(&nodeStream);
     if (!nodeStream.atEof()) {
         ST::printf(stderr, "WARNING: Ignoring {} bytes of unread data at end of node stream\n",
                    nodeStream.size() - nodeStream.tell());
     }
-    s_authChannel.putMessage(e_VaultFindNode, reinterpret_cast<void*>(&msg));
+    s_authChannel.putMessage(e_VaultFindNode, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    if (reply.m_messageType != DS::e_NetSuccess) {
-        client.m_buffer.write<uint32_t>(0);
-    } else {
-        client.m_buffer.write<uint32_t>(msg.m_nodes.size());
-        for (size_t i=0; i<msg.m_nodes.size(); ++i)
-            client.m_buffer.write<uint32_t>(msg.m_nodes[i]);
-    }
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        if (reply.m_messageType != DS::e_NetSuccess) {
+            client.m_buffer.write<uint32_t>(0);
+        } else {
+            client.m_buffer.write<uint32_t>(msg->m_nodes.size());
+            for (size_t i=0; i<msg->m_nodes.size(); ++i)
+                client.m_buffer.write<uint32_t>(msg->m_nodes[i]);
+        }
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_nodeSend(AuthServer_Private& client)
 {
-    Auth_NodeSend msg;
-    msg.m_client = &client;
-    msg.m_senderIdx = client.m_player.m_playerId;
-    msg.m_nodeIdx = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_playerIdx = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_VaultSendNode, reinterpret_cast<void*>(&msg));
-    client.m_channel.getMessage(); // wait for the vault operation to complete before returning
+    auto msg = std::make_shared<Auth_NodeSend>();
+    msg->m_client = &client;
+    msg->m_senderIdx = client.m_player.m_playerId;
+    msg->m_nodeIdx = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_playerIdx = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_VaultSendNode, reinterpret_cast<void*>(msg.get()));
+
+    // Wait for the vault operation to complete before reading anything else
+    client.awaitReply(client.m_channel, [msg](const DS::FifoMessage&) { });
 }
 
 void cb_ageRequest(AuthServer_Private& client, bool ext)
@@ -537,35 +545,36 @@ void cb_ageRequest(AuthServer_Private& client, bool ext)
     // Trans ID
     client.m_buffer.write<uint32_t>(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
 
-    Auth_GameAge msg;
-    msg.m_client = &client;
-    msg.m_name = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    DS::CryptRecvBuffer(client.m_sock, client.m_crypt, &msg.m_instanceId.m_bytes,
-                        sizeof(msg.m_instanceId.m_bytes));
-    s_authChannel.putMessage(e_AuthFindGameServer, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_GameAge>();
+    msg->m_client = &client;
+    msg->m_name = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    DS::CryptRecvBuffer(client.m_sock, client.m_crypt, &msg->m_instanceId.m_bytes,
+                        sizeof(msg->m_instanceId.m_bytes));
+    s_authChannel.putMessage(e_AuthFindGameServer, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    if (reply.m_messageType != DS::e_NetSuccess) {
-        client.m_buffer.write<uint32_t>(0);   // MCP ID
-        client.m_buffer.write<DS::Uuid>(DS::Uuid());
-        client.m_buffer.write<uint32_t>(0);   // Age Node Idx
-        // Game server address
-        if (ext)
-            client.m_buffer.write<uint16_t>(0);
-        else
-            client.m_buffer.write<uint32_t>(0);
-    } else {
-        client.m_buffer.write<uint32_t>(msg.m_mcpId);
-        client.m_buffer.write<DS::Uuid>(msg.m_instanceId);
-        client.m_buffer.write<uint32_t>(msg.m_ageNodeIdx);
-        if (ext)
-            client.m_buffer.writePString<uint16_t>(DS::Settings::GameServerAddress(), DS::e_StringUTF16);
-        else
-            client.m_buffer.write<uint32_t>(msg.m_serverAddress);
-    }
+    client.awaitReply(client.m_channel, [&client, msg, ext](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        if (reply.m_messageType != DS::e_NetSuccess) {
+            client.m_buffer.write<uint32_t>(0);   // MCP ID
+            client.m_buffer.write<DS::Uuid>(DS::Uuid());
+            client.m_buffer.write<uint32_t>(0);   // Age Node Idx
+            // Game server address
+            if (ext)
+                client.m_buffer.write<uint16_t>(0);
+            else
+                client.m_buffer.write<uint32_t>(0);
+        } else {
+            client.m_buffer.write<uint32_t>(msg->m_mcpId);
+            client.m_buffer.write<DS::Uuid>(msg->m_instanceId);
+            client.m_buffer.write<uint32_t>(msg->m_ageNodeIdx);
+            if (ext)
+                client.m_buffer.writePString<uint16_t>(DS::Settings::GameServerAddress(), DS::e_StringUTF16);
+            else
+                client.m_buffer.write<uint32_t>(msg->m_serverAddress);
+        }
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_fileList(AuthServer_Private& client)
@@ -637,6 +646,26 @@ void cb_fileList(AuthServer_Private& client)
     SEND_REPLY();
 }
 
+/* Sends the next chunk of a download behind the reply header already in
+ * client.m_buffer.  The chunk is sent straight out of the shared file image.
+ * Returns true once the last chunk has been sent. */
+static bool auth_send_chunk(AuthServer_Private& client, AuthServer_Download& download)
+{
+    const DS::BufferStream& data = download.m_file->m_data;
+    uint32_t chunksz = std::min<uint32_t>(data.size() - download.m_position, CHUNK_SIZE);
+
+    client.m_buffer.write<uint32_t>(DS::e_NetSuccess);
+    client.m_buffer.write<uint32_t>(data.size());           // File size
+    client.m_buffer.write<uint32_t>(download.m_position);   // Chunk offset
+    client.m_buffer.write<uint32_t>(chunksz);               // Data packet size
+    DS::CryptSendMessage(client.m_sock, client.m_crypt,
+                         client.m_buffer.buffer(), client.m_buffer.size(),
+                         data.buffer() + download.m_position, chunksz);
+
+    download.m_position += chunksz;
+    return download.m_position >= data.size();
+}
+
 void cb_downloadStart(AuthServer_Private& client)
 {
     START_REPLY(e_AuthToCli_FileDownloadChunk);
@@ -667,9 +696,9 @@ void cb_downloadStart(AuthServer_Private& client)
         filename = DS::Settings::AuthRoot() + filename;
     }
 
-    auto fileStream = std::make_unique<DS::FileStream>();
+    AuthServer_Download download;
     try {
-        fileStream->open(filename.c_str(), "rb");
+        download.m_file = DS::AuthFileCache_Get(filename);
     } catch (const DS::FileIOException& ex) {
         ST::printf(stderr, "[Auth] Could not open file {}: {}\n[Auth] Requested by {}\n",
                    filename, ex.what(), DS::SockIpAddress(client.m_sock));
@@ -680,46 +709,10 @@ void cb_downloadStart(AuthServer_Private& client)
         SEND_REPLY();
         return;
     }
+    download.m_position = 0;
 
-    // All auth downloads must be encrypted.
-    std::unique_ptr<DS::Stream> stream;
-    if (!DS::EncryptedStream::CheckEncryption(fileStream.get()).has_value()) {
-        auto bufStream = std::make_unique<DS::BufferStream>();
-        {
-            DS::EncryptedStream encStream(bufStream.get(), DS::EncryptedStream::Mode::e_write,
-                                          DS::EncryptedStream::Type::e_xxtea,
-                                          DS::Settings::DroidKey());
-            uint8_t buf[CHUNK_SIZE];
-            while (fileStream->tell() < fileStream->size()) {
-                ssize_t nread = fileStream->readBytes(buf, sizeof(buf));
-                DS_ASSERT(nread >= 0);
-                encStream.writeBytes(buf, nread);
-            }
-        }
-        bufStream->seek(0, SEEK_SET);
-        stream = std::move(bufStream);
-    } else {
-        stream = std::move(fileStream);
-    }
-
-    DS_ASSERT(stream);
-    client.m_buffer.write<uint32_t>(DS::e_NetSuccess);
-    client.m_buffer.write<uint32_t>(stream->size());
-    client.m_buffer.write<uint32_t>(stream->tell());
-
-    uint8_t data[CHUNK_SIZE];
-    if (stream->size() > CHUNK_SIZE) {
-        client.m_buffer.write<uint32_t>(CHUNK_SIZE);
-        stream->readBytes(data, CHUNK_SIZE);
-        client.m_buffer.writeBytes(data, CHUNK_SIZE);
-        client.m_downloads[transId] = std::move(stream);
-    } else {
-        client.m_buffer.write<uint32_t>(stream->size());
-        stream->readBytes(data, stream->size());
-        client.m_buffer.writeBytes(data, stream->size());
-    }
-
-    SEND_REPLY();
+    if (!auth_send_chunk(client, download))
+        client.m_downloads[transId] = std::move(download);
 }
 
 void cb_downloadNext(AuthServer_Private& client)
@@ -736,24 +729,8 @@ void cb_downloadNext(AuthServer_Private& client)
         return;
     }
 
-    client.m_buffer.write<uint32_t>(DS::e_NetSuccess);
-    client.m_buffer.write<uint32_t>(fi->second->size());
-    client.m_buffer.write<uint32_t>(fi->second->tell());
-
-    uint8_t data[CHUNK_SIZE];
-    size_t bytesLeft = fi->second->size() - fi->second->tell();
-    if (bytesLeft > CHUNK_SIZE) {
-        client.m_buffer.write<uint32_t>(CHUNK_SIZE);
-        fi->second->readBytes(data, CHUNK_SIZE);
-        client.m_buffer.writeBytes(data, CHUNK_SIZE);
-    } else {
-        client.m_buffer.write<uint32_t>(bytesLeft);
-        fi->second->readBytes(data, bytesLeft);
-        client.m_buffer.writeBytes(data, bytesLeft);
+    if (auth_send_chunk(client, fi->second))
         client.m_downloads.erase(fi);
-    }
-
-    SEND_REPLY();
 }
 
 void cb_scoreCreate(AuthServer_Private& client)
@@ -764,24 +741,25 @@ void cb_scoreCreate(AuthServer_Private& client)
     uint32_t transId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
     client.m_buffer.write<uint32_t>(transId);
 
-    Auth_CreateScore msg;
-    msg.m_client = &client;
-    msg.m_owner = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_name = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    msg.m_type = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_points = DS::CryptRecvValue<int32_t>(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_AuthCreateScore, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_CreateScore>();
+    msg->m_client = &client;
+    msg->m_owner = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_name = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    msg->m_type = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_points = DS::CryptRecvValue<int32_t>(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_AuthCreateScore, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    if (reply.m_messageType != DS::e_NetSuccess) {
-        client.m_buffer.write<uint32_t>(0); // Score ID
-        client.m_buffer.write<uint32_t>(0); // Create Time
-    } else {
-        client.m_buffer.write<uint32_t>(msg.m_scoreId);
-        client.m_buffer.write<uint32_t>((uint32_t)time(nullptr)); // close enough.
-    }
-    SEND_REPLY();
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        if (reply.m_messageType != DS::e_NetSuccess) {
+            client.m_buffer.write<uint32_t>(0); // Score ID
+            client.m_buffer.write<uint32_t>(0); // Create Time
+        } else {
+            client.m_buffer.write<uint32_t>(msg->m_scoreId);
+            client.m_buffer.write<uint32_t>((uint32_t)time(nullptr)); // close enough.
+        }
+        SEND_REPLY();
+    });
 }
 
 void write_scoreBuffer(AuthServer_Private& client, const Auth_GetScores& msg,
@@ -819,15 +797,16 @@ void cb_scoreGetScores(AuthServer_Private& client)
     uint32_t transId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
     client.m_buffer.write<uint32_t>(transId);
 
-    Auth_GetScores msg;
-    msg.m_client = &client;
-    msg.m_owner = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_name = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_AuthGetScores, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_GetScores>();
+    msg->m_client = &client;
+    msg->m_owner = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_name = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_AuthGetScores, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    write_scoreBuffer(client, msg, reply);
-    SEND_REPLY();
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        write_scoreBuffer(client, *msg, reply);
+        SEND_REPLY();
+    });
 }
 
 void cb_scoreAddPoints(AuthServer_Private& client)
@@ -836,15 +815,16 @@ void cb_scoreAddPoints(AuthServer_Private& client)
     uint32_t transId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
     client.m_buffer.write<uint32_t>(transId);
 
-    Auth_UpdateScore msg;
-    msg.m_client = &client;
-    msg.m_scoreId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_points = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_AuthAddScorePoints, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_UpdateScore>();
+    msg->m_client = &client;
+    msg->m_scoreId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_points = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_AuthAddScorePoints, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    SEND_REPLY();
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        SEND_REPLY();
+    });
 }
 
 void cb_scoreTransferPoints(AuthServer_Private& client)
@@ -853,16 +833,17 @@ void cb_scoreTransferPoints(AuthServer_Private& client)
     uint32_t transId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
     client.m_buffer.write<uint32_t>(transId);
 
-    Auth_TransferScore msg;
-    msg.m_client = &client;
-    msg.m_srcScoreId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_dstScoreId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_points = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_AuthTransferScorePoints, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_TransferScore>();
+    msg->m_client = &client;
+    msg->m_srcScoreId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_dstScoreId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_points = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_AuthTransferScorePoints, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    SEND_REPLY();
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        SEND_REPLY();
+    });
 }
 
 void cb_scoreSetPoints(AuthServer_Private& client)
@@ -871,15 +852,16 @@ void cb_scoreSetPoints(AuthServer_Private& client)
     uint32_t transId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
     client.m_buffer.write<uint32_t>(transId);
 
-    Auth_UpdateScore msg;
-    msg.m_client = &client;
-    msg.m_scoreId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_points = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_AuthSetScorePoints, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_UpdateScore>();
+    msg->m_client = &client;
+    msg->m_scoreId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_points = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_AuthSetScorePoints, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    SEND_REPLY();
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        SEND_REPLY();
+    });
 }
 
 void cb_scoreGetHighScores(AuthServer_Private& client)
@@ -888,16 +870,17 @@ void cb_scoreGetHighScores(AuthServer_Private& client)
     uint32_t transId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
     client.m_buffer.write<uint32_t>(transId);
 
-    Auth_GetHighScores msg;
-    msg.m_client = &client;
-    msg.m_owner = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_maxScores = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_name = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_AuthGetHighScores, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_GetHighScores>();
+    msg->m_client = &client;
+    msg->m_owner = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_maxScores = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_name = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_AuthGetHighScores, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    write_scoreBuffer(client, msg, reply);
-    SEND_REPLY();
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        write_scoreBuffer(client, *msg, reply);
+        SEND_REPLY();
+    });
 }
 
 void cb_getPublicAges(AuthServer_Private& client)
@@ -908,68 +891,70 @@ void cb_getPublicAges(AuthServer_Private& client)
     uint32_t transId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
     client.m_buffer.write<uint32_t>(transId);
 
-    Auth_PubAgeRequest msg;
-    msg.m_client = &client;
-    msg.m_agename = DS::CryptRecvString(client.m_sock, client.m_crypt);
-    s_authChannel.putMessage(e_AuthGetPublic, reinterpret_cast<void*>(&msg));
+    auto msg = std::make_shared<Auth_PubAgeRequest>();
+    msg->m_client = &client;
+    msg->m_agename = DS::CryptRecvString(client.m_sock, client.m_crypt);
+    s_authChannel.putMessage(e_AuthGetPublic, reinterpret_cast<void*>(msg.get()));
 
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
-    if (reply.m_messageType != DS::e_NetSuccess) {
-        client.m_buffer.write<uint32_t>(0);
-    } else {
-        client.m_buffer.write<uint32_t>(msg.m_ages.size());
-        for (size_t i = 0; i < msg.m_ages.size(); i++) {
-            client.m_buffer.writeBytes(msg.m_ages[i].m_instance.m_bytes, sizeof(client.m_acctUuid.m_bytes));
-
-            char16_t strbuffer[2048];
-            ST::utf16_buffer buf;
-            uint32_t copylen;
-
-            buf = msg.m_agename.to_utf16();
-            copylen = buf.size() < 64 ? buf.size() : 63;
-            memcpy(strbuffer, buf.data(), copylen * sizeof(char16_t));
-            strbuffer[copylen] = 0;
-            client.m_buffer.writeBytes(strbuffer, 64 * sizeof(char16_t));
-
-            buf = msg.m_ages[i].m_instancename.to_utf16();
-            copylen = buf.size() < 64 ? buf.size() : 63;
-            memcpy(strbuffer, buf.data(), copylen * sizeof(char16_t));
-            strbuffer[copylen] = 0;
-            client.m_buffer.writeBytes(strbuffer, 64 * sizeof(char16_t));
-
-            buf = msg.m_ages[i].m_username.to_utf16();
-            copylen = buf.size() < 64 ? buf.size() : 63;
-            memcpy(strbuffer, buf.data(), copylen * sizeof(char16_t));
-            strbuffer[copylen] = 0;
-            client.m_buffer.writeBytes(strbuffer, 64 * sizeof(char16_t));
-
-            buf = msg.m_ages[i].m_description.to_utf16();
-            copylen = buf.size() < 1024 ? buf.size() : 1023;
-            memcpy(strbuffer, buf.data(), copylen * sizeof(char16_t));
-            strbuffer[copylen] = 0;
-            client.m_buffer.writeBytes(strbuffer, 1024 * sizeof(char16_t));
-
-            client.m_buffer.write<uint32_t>(msg.m_ages[i].m_sequence);
-            client.m_buffer.write<uint32_t>(msg.m_ages[i].m_language);
-            client.m_buffer.write<uint32_t>(msg.m_ages[i].m_population);
-            client.m_buffer.write<uint32_t>(msg.m_ages[i].m_curPopulation);
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage& reply) {
+        client.m_buffer.write<uint32_t>(reply.m_messageType);
+        if (reply.m_messageType != DS::e_NetSuccess) {
+            client.m_buffer.write<uint32_t>(0);
+        } else {
+            client.m_buffer.write<uint32_t>(msg->m_ages.size());
+            for (size_t i = 0; i < msg->m_ages.size(); i++) {
+                client.m_buffer.writeBytes(msg->m_ages[i].m_instance.m_bytes, sizeof(client.m_acctUuid.m_bytes));
+
+                char16_t strbuffer[2048];
+                ST::utf16_buffer buf;
+                uint32_t copylen;
+
+                buf = msg->m_agename.to_utf16();
+                copylen = buf.size() < 64 ? buf.size() : 63;
+                memcpy(strbuffer, buf.data(), copylen * sizeof(char16_t));
+                strbuffer[copylen] = 0;
+                client.m_buffer.writeBytes(strbuffer, 64 * sizeof(char16_t));
+
+                buf = msg->m_ages[i].m_instancename.to_utf16();
+                copylen = buf.size() < 64 ? buf.size() : 63;
+                memcpy(strbuffer, buf.data(), copylen * sizeof(char16_t));
+                strbuffer[copylen] = 0;
+                client.m_buffer.writeBytes(strbuffer, 64 * sizeof(char16_t));
+
+                buf = msg->m_ages[i].m_username.to_utf16();
+                copylen = buf.size() < 64 ? buf.size() : 63;
+                memcpy(strbuffer, buf.data(), copylen * sizeof(char16_t));
+                strbuffer[copylen] = 0;
+                client.m_buffer.writeBytes(strbuffer, 64 * sizeof(char16_t));
+
+                buf = msg->m_ages[i].m_description.to_utf16();
+                copylen = buf.size() < 1024 ? buf.size() : 1023;
+                memcpy(strbuffer, buf.data(), copylen * sizeof(char16_t));
+                strbuffer[copylen] = 0;
+                client.m_buffer.writeBytes(strbuffer, 1024 * sizeof(char16_t));
+
+                client.m_buffer.write<uint32_t>(msg->m_ages[i].m_sequence);
+                client.m_buffer.write<uint32_t>(msg->m_ages[i].m_language);
+                client.m_buffer.write<uint32_t>(msg->m_ages[i].m_population);
+                client.m_buffer.write<uint32_t>(msg->m_ages[i].m_curPopulation);
+            }
         }
-    }
 
-    SEND_REPLY();
+        SEND_REPLY();
+    });
 }
 
 void cb_setAgePublic(AuthServer_Private& client)
 {
-    Auth_SetPublic msg;
-    msg.m_client = &client;
-    msg.m_node = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
-    msg.m_public = DS::CryptRecvValue<uint8_t>(client.m_sock, client.m_crypt);
+    auto msg = std::make_shared<Auth_SetPublic>();
+    msg->m_client = &client;
+    msg->m_node = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    msg->m_public = DS::CryptRecvValue<uint8_t>(client.m_sock, client.m_crypt);
 
-    s_authChannel.putMessage(e_AuthSetPublic, reinterpret_cast<void*>(&msg));
+    s_authChannel.putMessage(e_AuthSetPublic, reinterpret_cast<void*>(msg.get()));
 
-    client.m_channel.getMessage(); // wait for daemon to finish
+    // Wait for the daemon to finish
+    client.awaitReply(client.m_channel, [msg](const DS::FifoMessage&) { });
 }
 
 void cb_sockRead(AuthServer_Private& client)
@@ -1082,25 +1067,98 @@ void cb_sockRead(AuthServer_Private& client)
     case e_CliToAuth_KickPlayer:
         ST::printf(stderr, "[Auth] Got unsupported client message {} from {}\n",
                    msgId, DS::SockIpAddress(client.m_sock));
-        DS::CloseSock(client.m_sock);
+        DS::ShutdownSock(client.m_sock);
         throw DS::SockHup();
     default:
         /* Invalid message */
         ST::printf(stderr, "[Auth] Got invalid message ID {} from {}\n",
                    msgId, DS::SockIpAddress(client.m_sock));
-        DS::CloseSock(client.m_sock);
+        DS::ShutdownSock(client.m_sock);
         throw DS::SockHup();
     }
 }
 
 void cb_broadcast(AuthServer_Private& client)
 {
-    DS::FifoMessage bcast = client.m_broadcast.getMessage();
-    DS::BufferStream* msg = reinterpret_cast<DS::BufferStream*>(bcast.m_payload);
-    START_REPLY(bcast.m_messageType);
-    client.m_buffer.writeBytes(msg->buffer(), msg->size());
-    msg->unref();
-    SEND_REPLY();
+    DS::FifoMessage batch[16];
+    size_t count = client.m_broadcast.getMessages(batch);
+    for (size_t i = 0; i < count; ++i) {
+        DS::BufferStream* msg = reinterpret_cast<DS::BufferStream*>(batch[i].m_payload);
+        uint16_t msgId = batch[i].m_messageType;
+        try {
+            // The payload is shared by every recipient, so send it in place
+            DS::CryptSendMessage(client.m_sock, client.m_crypt, &msgId, sizeof(msgId),
+                                 msg->buffer(), msg->size());
+        } catch (...) {
+            // Don't leak the rest of the batch
+            for (size_t j = i; j < count; ++j)
+                reinterpret_cast<DS::BufferStream*>(batch[j].m_payload)->unref();
+            throw;
+        }
+        msg->unref();
+    }
+}
+
+void auth_connect(AuthServer_Private& client)
+{
+    auth_init(client);
+    client.m_player.m_playerId = 0;
+
+    // Now that we're encrypted, we can add the client to our list
+    s_authClientMutex.lock();
+    s_authClients.push_back(&client);
+    s_authClientMutex.unlock();
+}
+
+static void auth_release(AuthServer_Private& client)
+{
+    s_authClientMutex.lock();
+    s_authClients.remove(&client);
+    s_authClientMutex.unlock();
+
+    // Drain the broadcast queue
+    client.m_broadcast.clear();
+
+    DS::CryptStateFree(client.m_crypt);
+    DS::FreeSock(client.m_sock);
+}
+
+void auth_disconnect(AuthServer_Private& client)
+{
+    auto disconMsg = std::make_shared<Auth_ClientMessage>();
+    disconMsg->m_client = &client;
+    try {
+        s_authChannel.putMessage(e_AuthDisconnect, reinterpret_cast<void*>(disconMsg.get()));
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Auth] WARNING: {}\n", ex.what());
+        auth_release(client);
+        return;
+    }
+
+    // The daemon may still refer to the client until it replies
+    client.awaitReply(client.m_channel, [&client, disconMsg](const DS::FifoMessage&) {
+        auth_release(client);
+    });
+}
+
+void AuthServer_Private::onConnect()
+{
+    auth_connect(*this);
+}
+
+void AuthServer_Private::onSockRead()
+{
+    cb_sockRead(*this);
+}
+
+void AuthServer_Private::onEvent()
+{
+    cb_broadcast(*this);
+}
+
+void AuthServer_Private::onDisconnect()
+{
+    auth_disconnect(*this);
 }
 
 void wk_authWorker(DS::SocketHandle sockp)
@@ -1110,13 +1168,8 @@ void wk_authWorker(DS::SocketHandle sockp)
     client.m_sock = sockp;
 
     try {
-        auth_init(client);
-        client.m_player.m_playerId = 0;
-
-        // Now that we're encrypted, we can add the client to our list
-        s_authClientMutex.lock();
-        s_authClients.push_back(&client);
-        s_authClientMutex.unlock();
+        client.m_connect.read(sockp);
+        DS::HandshakeRun(sockp, [&client] { auth_connect(client); });
 
         // Poll the client socket and the daemon broadcast channel for messages
         pollfd fds[2];
@@ -1126,15 +1179,17 @@ void wk_authWorker(DS::SocketHandle sockp)
         fds[1].events = POLLIN;
 
         for ( ;; ) {
-            int result = poll(fds, 2, NET_TIMEOUT * 1000);
+            // Data already buffered by the crypt layer won't wake up poll()
+            bool pending = DS::CryptRecvPending(client.m_crypt);
+            int result = poll(fds, 2, pending ? 0 : NET_TIMEOUT * 1000);
             if (result < 0) {
                 ST::printf(stderr, "[Auth] Failure in poll: {}\n", strerror(errno));
                 throw DS::SockHup();
             }
-            if (result == 0 || fds[0].revents & (POLLERR | POLLHUP | POLLNVAL) || fds[1].revents & (POLLERR | POLLNVAL))
+            if ((result == 0 && !pending) || fds[0].revents & (POLLERR | POLLHUP | POLLNVAL) || fds[1].revents & (POLLERR | POLLNVAL))
                 throw DS::SockHup();
 
-            if (fds[0].revents & POLLIN)
+            if (pending || fds[0].revents & POLLIN)
                 cb_sockRead(client);
             if (fds[1].revents & POLLIN)
                 cb_broadcast(client);
@@ -1146,31 +1201,7 @@ void wk_authWorker(DS::SocketHandle sockp)
                    DS::SockIpAddress(sockp), ex.what());
     }
 
-    Auth_ClientMessage disconMsg;
-    disconMsg.m_client = &client;
-    try {
-        s_authChannel.putMessage(e_AuthDisconnect, reinterpret_cast<void*>(&disconMsg));
-        client.m_channel.getMessage();
-    } catch (const std::exception& ex) {
-        ST::printf(stderr, "[Auth] WARNING: {}\n", ex.what());
-    }
-
-    s_authClientMutex.lock();
-    s_authClients.remove(&client);
-    s_authClientMutex.unlock();
-
-    // Drain the broadcast channel
-    try {
-        while (client.m_broadcast.hasMessage()) {
-            DS::FifoMessage msg = client.m_broadcast.getMessage();
-            reinterpret_cast<DS::BufferStream*>(msg.m_payload)->unref();
-        }
-    } catch (const std::exception& ex) {
-        ST::printf(stderr, "[Auth] WARNING: {}\n", ex.what());
-    }
-
-    DS::CryptStateFree(client.m_crypt);
-    DS::FreeSock(client.m_sock);
+    auth_disconnect(client);
 }
 
 void DS::AuthServer_Init(bool restrictLogins)
@@ -1192,8 +1223,16 @@ void DS::AuthServer_Add(DS::SocketHandle client)
         ST::printf("Connecting AUTH on {}\n", DS::SockIpAddress(client));
 #endif
 
-    std::thread threadh(&wk_authWorker, client);
-    threadh.detach();
+    if (DS::Settings::ThreadPerClient()) {
+        std::thread threadh(&wk_authWorker, client);
+        threadh.detach();
+        return;
+    }
+
+    AuthServer_Private* auth = new AuthServer_Private;
+    auth->m_crypt = nullptr;
+    auth->m_sock = client;
+    DS::ReactorAdd(auth);
 }
 
 bool DS::AuthServer_RestrictLogins()
@@ -1220,19 +1259,34 @@ void DS::AuthServer_Shutdown()
         ST::printf(stderr, "[Auth] WARNING: {}\n", ex.what());
     }
     s_authDaemonThread.join();
+
+    DS::AuthFileCache_Clear();
 }
 
 void DS::AuthServer_DisplayClients()
 {
     std::lock_guard<std::mutex> authClientGuard(s_authClientMutex);
-    if (s_authClients.size())
-        fputs("Auth Server:\n", stdout);
+    if (s_authClients.size()) {
+        ST::printf("Auth Server (daemon queue: {}, peak {}):\n",
+                   s_authChannel.depth(), s_authChannel.peakDepth());
+    }
     for (const auto& client : s_authClients) {
-        ST::printf("  * {} {}\n", DS::SockIpAddress(client->m_sock),
-                   client->m_acctUuid.toString(true));
+        ST::printf("  * {} {} queue: {}, {} bytes, peak {} bytes, dropped {}\n",
+                   DS::SockIpAddress(client->m_sock), client->m_acctUuid.toString(true),
+                   client->m_broadcast.depth(), client->m_broadcast.bytes(),
+                   client->m_broadcast.peakBytes(), client->m_broadcast.dropped());
     }
 }
 
+DS::BroadcastQueueStats DS::AuthServer_QueueStats()
+{
+    BroadcastQueueStats stats;
+    std::lock_guard<std::mutex> authClientGuard(s_authClientMutex);
+    for (const auto& client : s_authClients)
+        stats.add(client->m_broadcast);
+    return stats;
+}
+
 bool DS::AuthServer_AddAcct(const ST::string& acctName, const ST::string& password)
 {
     AuthClient_Private client;
@@ -19,6 +19,7 @@
 #define _DS_AUTHSERVER_H
 
 #include "NetIO/SockIO.h"
+#include "NetIO/BroadcastQueue.h"
 #include <exception>
 
 namespace DS
@@ -29,6 +30,7 @@ namespace DS
     void AuthServer_Shutdown();
 
     void AuthServer_DisplayClients();
+    BroadcastQueueStats AuthServer_QueueStats();
 
     bool AuthServer_AddAcct(const ST::string&, const ST::string&);
     uint32_t AuthServer_AcctFlags(const ST::string& acctName, uint32_t flags);
@@ -17,6 +17,10 @@
 
 #include "AuthServer.h"
 #include "AuthClient.h"
+#include "AuthFileCache.h"
+#include "VaultIndex.h"
+#include "NetIO/Reactor.h"
+#include "NetIO/HandshakePool.h"
 #include "db/pqaccess.h"
 #include "SDL/StateInfo.h"
 #include "streams.h"
@@ -98,25 +102,56 @@ enum ServerCaps
     e_CapsGameMgrVarSync,
 };
 
-struct AuthServer_Private : public AuthClient_Private
+struct AuthServer_Download
 {
+    DS::AuthFileRef m_file;
+    uint32_t m_position;
+};
+
+struct AuthServer_Private : public AuthClient_Private, public DS::ReactorClient
+{
+    // Auth server header:  size, null uuid
+    DS::ConnectRequest m_connect { 20 };
+
     DS::BufferStream m_buffer;
     uint32_t m_serverChallenge;
     DS::Uuid m_acctUuid;
     uint32_t m_acctFlags;
     AuthServer_PlayerInfo m_player;
     uint32_t m_ageNodeId;
-    std::map<uint32_t, std::unique_ptr<DS::Stream>> m_downloads;
-
-    AuthServer_Private() : m_serverChallenge(0), m_acctFlags(0), m_ageNodeId(0) { }
+    std::map<uint32_t, AuthServer_Download> m_downloads;
+
+    // Vault roots this client is subscribed to in s_vaultIndex.  Only
+    // touched by the auth daemon, under s_vaultIndexMutex.  Once the client
+    // is closed, it can't subscribe again.
+    uint32_t m_vaultPlayer, m_vaultAge;
+    bool m_vaultClosed;
+
+    AuthServer_Private()
+        : m_serverChallenge(0), m_acctFlags(0), m_ageNodeId(0),
+          m_vaultPlayer(0), m_vaultAge(0), m_vaultClosed(false) { }
+
+    DS::SocketHandle sock() const override { return m_sock; }
+    DS::CryptState cryptState() const override { return m_crypt; }
+    int eventFd() override { return m_broadcast.fd(); }
+    bool recvPending() override { return DS::CryptRecvPending(m_crypt); }
+    bool onConnectRead() override { return m_connect.readSome(m_sock); }
+    void onConnect() override;
+    void onSockRead() override;
+    void onEvent() override;
+    void onDisconnect() override;
+    const char* serviceName() const override { return "Auth"; }
 };
 
 extern std::list<AuthServer_Private*> s_authClients;
 extern std::mutex s_authClientMutex;
 extern std::thread s_authDaemonThread;
 
-extern PGconn* s_postgres;
+// Each auth worker thread has its own connection
+extern thread_local PGconn* s_postgres;
 extern uint32_t s_allPlayers;
+extern DS::VaultIndex s_vaultIndex;
+extern std::mutex s_vaultIndexMutex;
 extern std::unordered_map<ST::string, SDL::State, ST::hash_i, ST::equal_i> s_globalStates;
 
 void dm_authDaemon();
@@ -26,6 +26,8 @@
 
 static uint32_t s_systemNode = 0;
 uint32_t s_allPlayers = 0;
+DS::VaultIndex s_vaultIndex(&v_fetch_tree);
+std::mutex s_vaultIndexMutex;
 
 #define SEND_REPLY(msg, result) \
     msg->m_client->m_channel.putMessage(result)
@@ -33,7 +35,7 @@ uint32_t s_allPlayers = 0;
 DS::Uuid gen_uuid()
 {
     check_postgres(s_postgres);
-    DS::PGresultRef result = PQexec(s_postgres, "SELECT uuid_generate_v4()");
+    DS::PGresultRef result = DS::PQexecVA(s_postgres, DS_STATEMENT("SELECT uuid_generate_v4()"));
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
         return DS::Uuid();
@@ -60,9 +62,9 @@ static std::tuple<uint32_t, uint32_t>
 find_a_friendly_neighborhood_for_our_new_visitor()
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx FROM vault.\"Nodes\" WHERE \"String64_2\"="
-            "    'Neighborhood' AND \"String64_4\" = $1"
-            "    ORDER BY \"Int32_1\"",
+            DS_STATEMENT("SELECT idx FROM vault.\"Nodes\" WHERE \"String64_2\"="
+                         "    'Neighborhood' AND \"String64_4\" = $1"
+                         "    ORDER BY \"Int32_1\""),
             DS::Settings::HoodUserName());
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -92,7 +94,7 @@ find_a_friendly_neighborhood_for_our_new_visitor()
     }
 
     // It's important to BCast new hood members, so we'll return the ageOwners folder
-    result = DS::PQexecVA(s_postgres, "SELECT idx FROM vault.find_folder($1, $2);",
+    result = DS::PQexecVA(s_postgres, DS_STATEMENT("SELECT idx FROM vault.find_folder($1, $2);"),
                           theHoodInfo, DS::Vault::e_AgeOwnersFolder);
     if (PQresultStatus(result) == PGRES_TUPLES_OK) {
         uint32_t ownersFolder = strtoul(PQgetvalue(result, 0, 0), nullptr, 10);
@@ -107,14 +109,14 @@ static uint32_t find_public_age_1(const ST::string& filename, const DS::Uuid& uu
 {
     DS::PGresultRef result;
     if (uuid.isNull()) {
-        result = DS::PQexecVA(s_postgres, "SELECT idx FROM vault.\"Nodes\""
-                              "    WHERE \"NodeType\"=$1 AND \"Int32_2\"=1 AND"
-                              "          \"String64_2\"=$2",
+        result = DS::PQexecVA(s_postgres, DS_STATEMENT("SELECT idx FROM vault.\"Nodes\""
+                                                       "    WHERE \"NodeType\"=$1 AND \"Int32_2\"=1 AND"
+                                                       "          \"String64_2\"=$2"),
                               DS::Vault::e_NodeAgeInfo, filename);
     } else {
-        result = DS::PQexecVA(s_postgres, "SELECT idx FROM vault.\"Nodes\""
-                              "    WHERE \"NodeType\"=$1 AND \"Int32_2\"=1 AND"
-                              "          \"String64_2\"=$2 AND \"Uuid_1\"=$3",
+        result = DS::PQexecVA(s_postgres, DS_STATEMENT("SELECT idx FROM vault.\"Nodes\""
+                                                       "    WHERE \"NodeType\"=$1 AND \"Int32_2\"=1 AND"
+                                                       "          \"String64_2\"=$2 AND \"Uuid_1\"=$3"),
                               DS::Vault::e_NodeAgeInfo, filename, uuid.toString());
     }
     uint32_t ageInfoId = 0;
@@ -198,8 +200,8 @@ std::list<AuthServer_AgeInfo> configure_static_ages()
 bool dm_vault_init()
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT \"idx\" FROM vault.\"Nodes\""
-            "    WHERE \"NodeType\"=$1",
+            DS_STATEMENT("SELECT \"idx\" FROM vault.\"Nodes\""
+                         "    WHERE \"NodeType\"=$1"),
             DS::Vault::e_NodeSystem);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -245,8 +247,8 @@ bool dm_global_sdl_init()
 bool dm_all_players_init()
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx FROM vault.\"Nodes\""
-            "    WHERE \"NodeType\"=$1 AND \"Int32_1\"=$2",
+            DS_STATEMENT("SELECT idx FROM vault.\"Nodes\""
+                         "    WHERE \"NodeType\"=$1 AND \"Int32_1\"=$2"),
             DS::Vault::e_NodePlayerInfoList, DS::Vault::e_AllPlayersFolder);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -262,8 +264,8 @@ bool dm_all_players_init()
 
     // create that mutha
     result = DS::PQexecVA(s_postgres,
-                          "INSERT INTO vault.\"Nodes\" (\"NodeType\", \"Int32_1\")"
-                          "    VALUES ($1, $2) RETURNING idx",
+                          DS_STATEMENT("INSERT INTO vault.\"Nodes\" (\"NodeType\", \"Int32_1\")"
+                                       "    VALUES ($1, $2) RETURNING idx"),
                           DS::Vault::e_NodePlayerInfoList,
                           DS::Vault::e_AllPlayersFolder);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
@@ -274,7 +276,7 @@ bool dm_all_players_init()
 
     // add the already existing players
     result = DS::PQexecVA(s_postgres,
-                          "SELECT idx FROM vault.\"Nodes\" WHERE \"NodeType\"=$1",
+                          DS_STATEMENT("SELECT idx FROM vault.\"Nodes\" WHERE \"NodeType\"=$1"),
                           DS::Vault::e_NodePlayerInfo);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -312,8 +314,8 @@ bool v_check_global_sdl(const ST::string& name, SDL::StateDescriptor* desc)
     }
 
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx,\"SdlBlob\" FROM vault.\"GlobalStates\""
-            "    WHERE \"Descriptor\"=$1 LIMIT 1",
+            DS_STATEMENT("SELECT idx,\"SdlBlob\" FROM vault.\"GlobalStates\""
+                         "    WHERE \"Descriptor\"=$1 LIMIT 1"),
             name);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -325,8 +327,8 @@ bool v_check_global_sdl(const ST::string& name, SDL::StateDescriptor* desc)
         DS::Blob blob = s_globalStates[name].toBlob();
 
         result = DS::PQexecVA(s_postgres,
-                "INSERT INTO vault.\"GlobalStates\""
-                "    (\"Descriptor\", \"SdlBlob\") VALUES ($1, $2)",
+                DS_STATEMENT("INSERT INTO vault.\"GlobalStates\""
+                             "    (\"Descriptor\", \"SdlBlob\") VALUES ($1, $2)"),
                 name, ST::base64_encode(blob.buffer(), blob.size()));
         if (PQresultStatus(result) != PGRES_COMMAND_OK) {
             PQ_PRINT_ERROR(s_postgres, INSERT);
@@ -343,8 +345,8 @@ bool v_check_global_sdl(const ST::string& name, SDL::StateDescriptor* desc)
             blob = state.toBlob();
 
             result = DS::PQexecVA(s_postgres,
-                    "UPDATE vault.\"GlobalStates\""
-                    "    SET \"SdlBlob\"=$1 WHERE idx=$2",
+                    DS_STATEMENT("UPDATE vault.\"GlobalStates\""
+                                 "    SET \"SdlBlob\"=$1 WHERE idx=$2"),
                     ST::base64_encode(blob.buffer(), blob.size()), idx);
             if (PQresultStatus(result) != PGRES_COMMAND_OK) {
                 PQ_PRINT_ERROR(s_postgres, UPDATE);
@@ -364,8 +366,8 @@ SDL::State v_find_global_sdl(const ST::string& ageName)
     check_postgres(s_postgres);
 
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT \"SdlBlob\" FROM vault.\"GlobalStates\""
-            "    WHERE \"Descriptor\"=$1 LIMIT 1",
+            DS_STATEMENT("SELECT \"SdlBlob\" FROM vault.\"GlobalStates\""
+                         "    WHERE \"Descriptor\"=$1 LIMIT 1"),
             ageName);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -537,9 +539,9 @@ v_create_age(AuthServer_AgeInfo age, uint32_t flags)
                            : age.m_filename;
 
         DS::PGresultRef result = DS::PQexecVA(s_postgres,
-                "INSERT INTO game.\"Servers\""
-                "    (\"AgeUuid\", \"AgeFilename\", \"DisplayName\", \"AgeIdx\", \"SdlIdx\")"
-                "    VALUES ($1, $2, $3, $4, $5)",
+                DS_STATEMENT("INSERT INTO game.\"Servers\""
+                             "    (\"AgeUuid\", \"AgeFilename\", \"DisplayName\", \"AgeIdx\", \"SdlIdx\")"
+                             "    VALUES ($1, $2, $3, $4, $5)"),
                 age.m_ageId.toString(), age.m_filename, agedesc, ageNode, ageSdlNode);
         if (PQresultStatus(result) != PGRES_COMMAND_OK) {
             PQ_PRINT_ERROR(s_postgres, INSERT);
@@ -722,7 +724,7 @@ v_create_player(DS::Uuid acctId, const AuthServer_PlayerInfo& player)
 
     {
         DS::PGresultRef result = DS::PQexecVA(s_postgres,
-                "SELECT idx FROM vault.find_folder($1, $2);",
+                DS_STATEMENT("SELECT idx FROM vault.find_folder($1, $2);"),
                 std::get<1>(reltoAge), DS::Vault::e_AgeOwnersFolder);
         if (PQresultStatus(result) != PGRES_TUPLES_OK) {
             PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -875,9 +877,9 @@ uint32_t v_create_node(const DS::Vault::Node& node)
     if (node.has_Text_2())
         SET_FIELD(Text_2, node.m_Text_2);
     if (node.has_Blob_1())
-        SET_FIELD(Blob_1, ST::base64_encode(node.m_Blob_1.buffer(), node.m_Blob_1.size()));
+        SET_FIELD(Blob_1, node.m_Blob_1);
     if (node.has_Blob_2())
-        SET_FIELD(Blob_2, ST::base64_encode(node.m_Blob_2.buffer(), node.m_Blob_2.size()));
+        SET_FIELD(Blob_2, node.m_Blob_2);
     #undef SET_FIELD
 
     DS_ASSERT(fieldp > fieldbuf && fieldp < fieldbuf + sizeof(fieldbuf));
@@ -898,7 +900,7 @@ uint32_t v_create_node(const DS::Vault::Node& node)
     check_postgres(s_postgres);
     DS::PGresultRef result = PQexecParams(s_postgres, queryStr.to_string().c_str(),
                                           parmcount, nullptr, parms.m_values,
-                                          nullptr, nullptr, 0);
+                                          parms.m_lengths, parms.m_formats, 0);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, INSERT);
         return 0;
@@ -917,7 +919,8 @@ bool v_has_node(uint32_t parentId, uint32_t childId)
 
     check_postgres(s_postgres);
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT vault.has_node($1, $2)",
+            DS_STATEMENT("SELECT vault.has_node($1, $2)",
+                         DS::PGStatement::e_BinaryResults),
             parentId, childId);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -926,8 +929,7 @@ bool v_has_node(uint32_t parentId, uint32_t childId)
     // If this assertion fails, it is a problem in the implementation of
     // vault.has_node(), not in the vault data itself
     DS_ASSERT(PQntuples(result) == 1);
-    bool retval = (*PQgetvalue(result, 0, 0) == 't');
-    return retval != 0;
+    return DS::PQgetBool(result, 0, 0);
 }
 
 bool v_update_node(const DS::Vault::Node& node)
@@ -1003,9 +1005,9 @@ bool v_update_node(const DS::Vault::Node& node)
     if (node.has_Text_2())
         SET_FIELD(Text_2, node.m_Text_2);
     if (node.has_Blob_1())
-        SET_FIELD(Blob_1, ST::base64_encode(node.m_Blob_1.buffer(), node.m_Blob_1.size()));
+        SET_FIELD(Blob_1, node.m_Blob_1);
     if (node.has_Blob_2())
-        SET_FIELD(Blob_2, ST::base64_encode(node.m_Blob_2.buffer(), node.m_Blob_2.size()));
+        SET_FIELD(Blob_2, node.m_Blob_2);
     #undef SET_FIELD
 
     DS_ASSERT(fieldp > fieldbuf && fieldp < fieldbuf + sizeof(fieldbuf));
@@ -1019,7 +1021,7 @@ bool v_update_node(const DS::Vault::Node& node)
     check_postgres(s_postgres);
     DS::PGresultRef result = PQexecParams(s_postgres, queryStr.to_string().c_str(),
                                           parmcount, nullptr, parms.m_values,
-                                          nullptr, nullptr, 0);
+                                          parms.m_lengths, parms.m_formats, 0);
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
         PQ_PRINT_ERROR(s_postgres, UPDATE);
         return false;
@@ -1030,15 +1032,16 @@ bool v_update_node(const DS::Vault::Node& node)
 DS::Vault::Node v_fetch_node(uint32_t nodeIdx)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-        "SELECT idx, \"CreateTime\", \"ModifyTime\", \"CreateAgeName\","
-        "    \"CreateAgeUuid\", \"CreatorUuid\", \"CreatorIdx\", \"NodeType\","
-        "    \"Int32_1\", \"Int32_2\", \"Int32_3\", \"Int32_4\","
-        "    \"Uint32_1\", \"Uint32_2\", \"Uint32_3\", \"Uint32_4\","
-        "    \"Uuid_1\", \"Uuid_2\", \"Uuid_3\", \"Uuid_4\","
-        "    \"String64_1\", \"String64_2\", \"String64_3\", \"String64_4\","
-        "    \"String64_5\", \"String64_6\", \"IString64_1\", \"IString64_2\","
-        "    \"Text_1\", \"Text_2\", \"Blob_1\", \"Blob_2\""
-        "    FROM vault.\"Nodes\" WHERE idx=$1",
+        DS_STATEMENT("SELECT idx, \"CreateTime\", \"ModifyTime\", \"CreateAgeName\","
+                     "    \"CreateAgeUuid\", \"CreatorUuid\", \"CreatorIdx\", \"NodeType\","
+                     "    \"Int32_1\", \"Int32_2\", \"Int32_3\", \"Int32_4\","
+                     "    \"Uint32_1\", \"Uint32_2\", \"Uint32_3\", \"Uint32_4\","
+                     "    \"Uuid_1\", \"Uuid_2\", \"Uuid_3\", \"Uuid_4\","
+                     "    \"String64_1\", \"String64_2\", \"String64_3\", \"String64_4\","
+                     "    \"String64_5\", \"String64_6\", \"IString64_1\", \"IString64_2\","
+                     "    \"Text_1\", \"Text_2\", \"Blob_1\", \"Blob_2\""
+                     "    FROM vault.\"Nodes\" WHERE idx=$1",
+                     DS::PGStatement::e_BinaryResults),
         nodeIdx);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -1049,42 +1052,42 @@ DS::Vault::Node v_fetch_node(uint32_t nodeIdx)
     }
 
     DS::Vault::Node node;
-    node.set_NodeIdx(strtoul(PQgetvalue(result, 0, 0), nullptr, 10));
-    node.set_CreateTime(strtoul(PQgetvalue(result, 0, 1), nullptr, 10));
-    node.set_ModifyTime(strtoul(PQgetvalue(result, 0, 2), nullptr, 10));
+    node.set_NodeIdx(DS::PQgetInt(result, 0, 0));
+    node.set_CreateTime(DS::PQgetInt(result, 0, 1));
+    node.set_ModifyTime(DS::PQgetInt(result, 0, 2));
     if (!PQgetisnull(result, 0, 3))
         node.set_CreateAgeName(PQgetvalue(result, 0, 3));
     if (!PQgetisnull(result, 0, 4))
-        node.set_CreateAgeUuid(PQgetvalue(result, 0, 4));
+        node.set_CreateAgeUuid(DS::PQgetUuid(result, 0, 4));
     if (!PQgetisnull(result, 0, 5))
-        node.set_CreatorUuid(PQgetvalue(result, 0, 5));
+        node.set_CreatorUuid(DS::PQgetUuid(result, 0, 5));
     if (!PQgetisnull(result, 0, 6))
-        node.set_CreatorIdx(strtoul(PQgetvalue(result, 0, 6), nullptr, 10));
-    node.set_NodeType(strtoul(PQgetvalue(result, 0, 7), nullptr, 10));
+        node.set_CreatorIdx(DS::PQgetInt(result, 0, 6));
+    node.set_NodeType(DS::PQgetInt(result, 0, 7));
     if (!PQgetisnull(result, 0, 8))
-        node.set_Int32_1(strtol(PQgetvalue(result, 0, 8), nullptr, 10));
+        node.set_Int32_1(DS::PQgetInt(result, 0, 8));
     if (!PQgetisnull(result, 0, 9))
-        node.set_Int32_2(strtol(PQgetvalue(result, 0, 9), nullptr, 10));
+        node.set_Int32_2(DS::PQgetInt(result, 0, 9));
     if (!PQgetisnull(result, 0, 10))
-        node.set_Int32_3(strtol(PQgetvalue(result, 0, 10), nullptr, 10));
+        node.set_Int32_3(DS::PQgetInt(result, 0, 10));
     if (!PQgetisnull(result, 0, 11))
-        node.set_Int32_4(strtol(PQgetvalue(result, 0, 11), nullptr, 10));
+        node.set_Int32_4(DS::PQgetInt(result, 0, 11));
     if (!PQgetisnull(result, 0, 12))
-        node.set_Uint32_1(strtoul(PQgetvalue(result, 0, 12), nullptr, 10));
+        node.set_Uint32_1(DS::PQgetInt(result, 0, 12));
     if (!PQgetisnull(result, 0, 13))
-        node.set_Uint32_2(strtoul(PQgetvalue(result, 0, 13), nullptr, 10));
+        node.set_Uint32_2(DS::PQgetInt(result, 0, 13));
     if (!PQgetisnull(result, 0, 14))
-        node.set_Uint32_3(strtoul(PQgetvalue(result, 0, 14), nullptr, 10));
+        node.set_Uint32_3(DS::PQgetInt(result, 0, 14));
     if (!PQgetisnull(result, 0, 15))
-        node.set_Uint32_4(strtoul(PQgetvalue(result, 0, 15), nullptr, 10));
+        node.set_Uint32_4(DS::PQgetInt(result, 0, 15));
     if (!PQgetisnull(result, 0, 16))
-        node.set_Uuid_1(PQgetvalue(result, 0, 16));
+        node.set_Uuid_1(DS::PQgetUuid(result, 0, 16));
     if (!PQgetisnull(result, 0, 17))
-        node.set_Uuid_2(PQgetvalue(result, 0, 17));
+        node.set_Uuid_2(DS::PQgetUuid(result, 0, 17));
     if (!PQgetisnull(result, 0, 18))
-        node.set_Uuid_3(PQgetvalue(result, 0, 18));
+        node.set_Uuid_3(DS::PQgetUuid(result, 0, 18));
     if (!PQgetisnull(result, 0, 19))
-        node.set_Uuid_4(PQgetvalue(result, 0, 19));
+        node.set_Uuid_4(DS::PQgetUuid(result, 0, 19));
     if (!PQgetisnull(result, 0, 20))
         node.set_String64_1(PQgetvalue(result, 0, 20));
     if (!PQgetisnull(result, 0, 21))
@@ -1106,45 +1109,67 @@ DS::Vault::Node v_fetch_node(uint32_t nodeIdx)
     if (!PQgetisnull(result, 0, 29))
         node.set_Text_2(PQgetvalue(result, 0, 29));
     if (!PQgetisnull(result, 0, 30))
-        node.set_Blob_1(DS::Base64Decode(PQgetvalue(result, 0, 30)));
+        node.set_Blob_1(DS::PQgetBlob(result, 0, 30));
     if (!PQgetisnull(result, 0, 31))
-        node.set_Blob_2(DS::Base64Decode(PQgetvalue(result, 0, 31)));
+        node.set_Blob_2(DS::PQgetBlob(result, 0, 31));
 
     return node;
 }
 
 bool v_ref_node(uint32_t parentIdx, uint32_t childIdx, uint32_t ownerIdx)
 {
+    // A subtree that is about to become watched is loaded without the lock,
+    // and thrown away if any refs changed in the meantime, since it may be
+    // missing them
+    std::unique_lock<std::mutex> indexLock(s_vaultIndexMutex);
+    DS::VaultIndex::Tree tree;
+    bool fetched = false;
+    for (int attempt = 0; attempt < 3 && !fetched
+                          && s_vaultIndex.needsTree(parentIdx, childIdx); ++attempt) {
+        uint64_t generation = s_vaultIndex.generation();
+        indexLock.unlock();
+        tree.clear();
+        fetched = v_fetch_tree(childIdx, tree);
+        indexLock.lock();
+        fetched = fetched && s_vaultIndex.generation() == generation;
+    }
+
+    // The write itself stays under the lock, so the index sees ref changes
+    // in the same order as the database does
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "INSERT INTO vault.\"NodeRefs\""
-            "    (\"ParentIdx\", \"ChildIdx\", \"OwnerIdx\")"
-            "    VALUES ($1, $2, $3)",
+            DS_STATEMENT("INSERT INTO vault.\"NodeRefs\""
+                         "    (\"ParentIdx\", \"ChildIdx\", \"OwnerIdx\")"
+                         "    VALUES ($1, $2, $3)"),
             parentIdx, childIdx, ownerIdx);
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
         PQ_PRINT_ERROR(s_postgres, INSERT);
         return false;
     }
+    s_vaultIndex.addRef(parentIdx, childIdx, fetched ? &tree : nullptr);
     return true;
 }
 
 bool v_unref_node(uint32_t parentIdx, uint32_t childIdx)
 {
+    std::lock_guard<std::mutex> indexGuard(s_vaultIndexMutex);
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "DELETE FROM vault.\"NodeRefs\""
-            "    WHERE \"ParentIdx\"=$1 AND \"ChildIdx\"=$2",
+            DS_STATEMENT("DELETE FROM vault.\"NodeRefs\""
+                         "    WHERE \"ParentIdx\"=$1 AND \"ChildIdx\"=$2"),
             parentIdx, childIdx);
     if (PQresultStatus(result) != PGRES_COMMAND_OK) {
         PQ_PRINT_ERROR(s_postgres, DELETE);
         return false;
     }
+    s_vaultIndex.removeRef(parentIdx, childIdx);
     return true;
 }
 
 bool v_fetch_tree(uint32_t nodeId, std::vector<DS::Vault::NodeRef>& refs)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT \"ParentIdx\", \"ChildIdx\", \"OwnerIdx\""
-            "    FROM vault.fetch_tree($1);",
+            DS_STATEMENT("SELECT \"ParentIdx\", \"ChildIdx\", \"OwnerIdx\""
+                         "    FROM vault.fetch_tree($1);",
+                         DS::PGStatement::e_BinaryResults),
             nodeId);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -1153,9 +1178,9 @@ bool v_fetch_tree(uint32_t nodeId, std::vector<DS::Vault::NodeRef>& refs)
 
     refs.resize(PQntuples(result));
     for (size_t i=0; i<refs.size(); ++i) {
-        refs[i].m_parent = strtoul(PQgetvalue(result, i, 0), nullptr, 10);
-        refs[i].m_child = strtoul(PQgetvalue(result, i, 1), nullptr, 10);
-        refs[i].m_owner = strtoul(PQgetvalue(result, i, 2), nullptr, 10);
+        refs[i].m_parent = DS::PQgetInt(result, i, 0);
+        refs[i].m_child = DS::PQgetInt(result, i, 1);
+        refs[i].m_owner = DS::PQgetInt(result, i, 2);
     }
     return true;
 }
@@ -1243,9 +1268,9 @@ bool v_find_nodes(const DS::Vault::Node& nodeTemplate, std::vector<uint32_t>& no
     if (nodeTemplate.has_Text_2())
         SET_FIELD(Text_2, nodeTemplate.m_Text_2);
     if (nodeTemplate.has_Blob_1())
-        SET_FIELD(Blob_1, ST::base64_encode(nodeTemplate.m_Blob_1.buffer(), nodeTemplate.m_Blob_1.size()));
+        SET_FIELD(Blob_1, nodeTemplate.m_Blob_1);
     if (nodeTemplate.has_Blob_2())
-        SET_FIELD(Blob_2, ST::base64_encode(nodeTemplate.m_Blob_2.buffer(), nodeTemplate.m_Blob_2.size()));
+        SET_FIELD(Blob_2, nodeTemplate.m_Blob_2);
     #undef SET_FIELD
     #undef SET_FIELD_I
 
@@ -1260,7 +1285,7 @@ bool v_find_nodes(const DS::Vault::Node& nodeTemplate, std::vector<uint32_t>& no
     check_postgres(s_postgres);
     DS::PGresultRef result = PQexecParams(s_postgres, queryStr.to_string().c_str(),
                                           parmcount, nullptr, parms.m_values,
-                                          nullptr, nullptr, 0);
+                                          parms.m_lengths, parms.m_formats, 0);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
         return false;
@@ -1277,7 +1302,7 @@ DS::Vault::NodeRef v_send_node(uint32_t nodeId, uint32_t playerId, uint32_t send
     DS::Vault::NodeRef ref;
     ref.m_child = ref.m_owner = ref.m_parent = 0;
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx FROM vault.find_folder($1, $2);",
+            DS_STATEMENT("SELECT idx FROM vault.find_folder($1, $2);"),
             playerId, DS::Vault::e_InboxFolder);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
         PQ_PRINT_ERROR(s_postgres, SELECT);
@@ -1300,7 +1325,7 @@ DS::Vault::NodeRef v_send_node(uint32_t nodeId, uint32_t playerId, uint32_t send
 uint32_t v_count_age_owners(uint32_t ageInfoId)
 {
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
-            "SELECT idx FROM vault.find_folder($1, $2);",
+            DS_STATEMENT("SELECT idx FROM vault.find_folder($1, $2);"),
             ageInfoId, DS::Vault::e_AgeOwnersFolder);
     uint32_t owners = 0;
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
@@ -1309,7 +1334,7 @@ uint32_t v_count_age_owners(uint32_t ageInfoId)
     }
     const ST::string parentIdx = PQgetvalue(result, 0, 0);
     result = DS::PQexecVA(s_postgres,
-            "SELECT COUNT(*) FROM vault.\"NodeRefs\" WHERE \"ParentIdx\"=$1",
+            DS_STATEMENT("SELECT COUNT(*) FROM vault.\"NodeRefs\" WHERE \"ParentIdx\"=$1"),
             parentIdx);
     if (PQresultStatus(result) == PGRES_TUPLES_OK) {
         owners = strtoul(PQgetvalue(result, 0, 0), nullptr, 10);
@@ -1322,7 +1347,7 @@ uint32_t v_count_age_owners(uint32_t ageInfoId)
 bool v_find_public_ages(const ST::string& ageFilename, std::vector<Auth_PubAgeRequest::NetAgeInfo>& ages)
 {
     // InstUuid, InstName, UserName, Description, SeqNumber, Language, AgePopulation, NumOwners
-    const char* queryStr = R"""(
+    static const DS::PGStatement s_query(R"""(
         SELECT
             pubage."Uuid_1",
             pubage."String64_3",
@@ -1344,9 +1369,9 @@ bool v_find_public_ages(const ST::string& ageFilename, std::vector<Auth_PubAgeRe
         WHERE pubage."NodeType" = $3 AND pubage."Int32_2" = 1 AND pubage."String64_2" = $4
         ORDER BY "ModifyTime" DESC
         LIMIT 50;
-    )""";
+    )""");
 
-    DS::PGresultRef result = DS::PQexecVA(s_postgres, queryStr,
+    DS::PGresultRef result = DS::PQexecVA(s_postgres, s_query,
         DS::Vault::e_NodePlayerInfo, DS::Vault::e_AgeOwnersFolder,
         DS::Vault::e_NodeAgeInfo, ageFilename);
 
@@ -0,0 +1,188 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "VaultIndex.h"
+#include <string_theory/stdio>
+
+bool DS::VaultIndex::track(uint32_t node, const Tree* tree)
+{
+    // Nodes which are already tracked have an up to date child list, so
+    // only the parts of the tree we haven't seen yet need to be loaded
+    if (m_reach.find(node) != m_reach.end())
+        return true;
+
+    Tree fetched;
+    if (!tree) {
+        if (!m_fetchTree(node, fetched)) {
+            ST::printf(stderr, "[Vault] Could not load vault tree for node {}\n", node);
+            return false;
+        }
+        tree = &fetched;
+    }
+    m_children[node];
+    for (const Vault::NodeRef& ref : *tree) {
+        if (m_reach.find(ref.m_parent) == m_reach.end())
+            m_children[ref.m_parent].insert(ref.m_child);
+    }
+    return true;
+}
+
+void DS::VaultIndex::propagate(uint32_t root, uint32_t start)
+{
+    std::vector<uint32_t> stack { start };
+    while (!stack.empty()) {
+        uint32_t node = stack.back();
+        stack.pop_back();
+        if (!m_reach[node].insert(root).second)
+            continue;
+
+        auto children = m_children.find(node);
+        if (children != m_children.end()) {
+            for (uint32_t child : children->second)
+                stack.push_back(child);
+        }
+    }
+}
+
+void DS::VaultIndex::recompute(const RootSet& roots)
+{
+    // Strip the affected roots from everything and walk the trees again.
+    // This is only needed when refs are removed, which is much rarer than
+    // notifications being sent.
+    for (auto& reach : m_reach) {
+        for (uint32_t root : roots)
+            reach.second.erase(root);
+    }
+    for (uint32_t root : roots) {
+        if (m_subscribers.find(root) != m_subscribers.end())
+            propagate(root, root);
+    }
+
+    // Anything no longer reachable from any root is forgotten, since its
+    // child list would go stale without anyone watching it
+    auto iter = m_reach.begin();
+    while (iter != m_reach.end()) {
+        if (iter->second.empty()) {
+            m_children.erase(iter->first);
+            iter = m_reach.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
+
+bool DS::VaultIndex::subscribe(uint32_t root)
+{
+    if (root == 0)
+        return false;
+
+    auto sub = m_subscribers.find(root);
+    if (sub != m_subscribers.end()) {
+        ++sub->second;
+        return true;
+    }
+
+    if (!track(root))
+        return false;
+    m_subscribers[root] = 1;
+    propagate(root, root);
+    return true;
+}
+
+void DS::VaultIndex::unsubscribe(uint32_t root)
+{
+    auto sub = m_subscribers.find(root);
+    if (sub == m_subscribers.end())
+        return;
+    if (--sub->second != 0)
+        return;
+
+    m_subscribers.erase(sub);
+    recompute(RootSet { root });
+}
+
+void DS::VaultIndex::addRef(uint32_t parent, uint32_t child, const Tree* childTree)
+{
+    ++m_generation;
+    auto reach = m_reach.find(parent);
+    if (reach == m_reach.end()) {
+        // Nobody is watching the parent, so nothing changes for anyone
+        return;
+    }
+
+    if (!track(child, childTree))
+        return;
+    m_children[parent].insert(child);
+
+    RootSet roots = reach->second;
+    for (uint32_t root : roots)
+        propagate(root, child);
+}
+
+void DS::VaultIndex::removeRef(uint32_t parent, uint32_t child)
+{
+    ++m_generation;
+    auto children = m_children.find(parent);
+    if (children == m_children.end() || m_reach.find(parent) == m_reach.end())
+        return;
+    if (children->second.erase(child) == 0)
+        return;
+
+    auto reach = m_reach.find(child);
+    if (reach != m_reach.end()) {
+        RootSet roots = reach->second;
+        recompute(roots);
+    }
+}
+
+void DS::VaultIndex::removeParents(uint32_t child)
+{
+    ++m_generation;
+    bool removed = false;
+    for (auto& children : m_children)
+        removed |= (children.second.erase(child) != 0);
+
+    auto reach = m_reach.find(child);
+    if (removed && reach != m_reach.end()) {
+        RootSet roots = reach->second;
+        recompute(roots);
+    }
+}
+
+bool DS::VaultIndex::needsTree(uint32_t parent, uint32_t child) const
+{
+    return m_reach.find(parent) != m_reach.end() && m_reach.find(child) == m_reach.end();
+}
+
+const DS::VaultIndex::RootSet* DS::VaultIndex::roots(uint32_t node) const
+{
+    auto reach = m_reach.find(node);
+    return (reach != m_reach.end()) ? &reach->second : nullptr;
+}
+
+bool DS::VaultIndex::reaches(uint32_t root, uint32_t node) const
+{
+    const RootSet* nodeRoots = roots(node);
+    return nodeRoots && nodeRoots->find(root) != nodeRoots->end();
+}
+
+void DS::VaultIndex::clear()
+{
+    m_subscribers.clear();
+    m_reach.clear();
+    m_children.clear();
+}
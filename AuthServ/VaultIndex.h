@@ -0,0 +1,93 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _DS_VAULTINDEX_H
+#define _DS_VAULTINDEX_H
+
+#include "VaultTypes.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <vector>
+
+namespace DS
+{
+    /* In-memory reachability index for vault notifications.
+     *
+     * Clients are notified of changes to any node reachable from their
+     * player or age node (their "roots").  Rather than asking the database
+     * with vault.has_node() for every online client, the index keeps a copy
+     * of the refs below every subscribed root, and for each of those nodes
+     * the set of roots it can be reached from.  It is kept up to date by
+     * feeding it every ref added or removed through the auth daemon.
+     *
+     * The index is not thread safe; it belongs to the auth daemon.
+     */
+    class VaultIndex
+    {
+    public:
+        typedef std::unordered_set<uint32_t> RootSet;
+        typedef std::vector<Vault::NodeRef> Tree;
+        typedef std::function<bool (uint32_t, Tree&)> FetchTree;
+
+        explicit VaultIndex(FetchTree fetchTree)
+            : m_fetchTree(std::move(fetchTree)), m_generation(0) { }
+
+        // Roots are reference counted, so a root with several subscribers
+        // is only removed when the last one unsubscribes
+        bool subscribe(uint32_t root);
+        void unsubscribe(uint32_t root);
+
+        // If the child's subtree has to be loaded, a tree fetched ahead of
+        // time is used instead of calling FetchTree, provided no refs have
+        // changed since (see generation())
+        void addRef(uint32_t parent, uint32_t child, const Tree* childTree = nullptr);
+        void removeRef(uint32_t parent, uint32_t child);
+        void removeParents(uint32_t child);
+
+        // True if adding this ref would have to load the child's subtree
+        bool needsTree(uint32_t parent, uint32_t child) const;
+
+        // Changes whenever a ref is added or removed, watched or not
+        uint64_t generation() const { return m_generation; }
+
+        // The subscribed roots node can be reached from (including itself,
+        // if it is a root), or nullptr if there are none
+        const RootSet* roots(uint32_t node) const;
+        bool reaches(uint32_t root, uint32_t node) const;
+
+        size_t rootCount() const { return m_subscribers.size(); }
+        size_t nodeCount() const { return m_reach.size(); }
+        void clear();
+
+    private:
+        FetchTree m_fetchTree;
+        uint64_t m_generation;
+        std::unordered_map<uint32_t, uint32_t> m_subscribers;
+
+        // Only nodes reachable from a subscribed root are tracked.  The
+        // child list of every tracked node mirrors vault."NodeRefs" exactly.
+        std::unordered_map<uint32_t, RootSet> m_reach;
+        std::unordered_map<uint32_t, std::unordered_set<uint32_t>> m_children;
+
+        bool track(uint32_t node, const Tree* tree = nullptr);
+        void propagate(uint32_t root, uint32_t start);
+        void recompute(const RootSet& roots);
+    };
+}
+
+#endif
@@ -17,6 +17,8 @@
 
 #include "FileManifest.h"
 #include <string_theory/stdio>
+#include <unordered_map>
+#include <mutex>
 #include <cstdio>
 
 DS::NetResultCode DS::FileManifest::loadManifest(const char* filename)
@@ -97,3 +99,58 @@ uint32_t DS::FileManifest::encodeToStream(DS::Stream* stream) const
     }
     return (stream->tell() - start) / sizeof(char16_t);
 }
+
+static std::unordered_map<ST::string, DS::ManifestRef, ST::hash> s_manifestCache;
+static std::mutex s_manifestMutex;
+
+static bool manifest_current(const DS::CachedManifest* cached, const struct stat& st)
+{
+    return cached->m_inode == st.st_ino && cached->m_fileSize == st.st_size
+        && cached->m_mtime.tv_sec == st.st_mtim.tv_sec
+        && cached->m_mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+DS::NetResultCode DS::FileManifest_Get(const ST::string& filename, DS::ManifestRef& manifest)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) < 0) {
+        std::lock_guard<std::mutex> guard(s_manifestMutex);
+        s_manifestCache.erase(filename);
+        return e_NetFileNotFound;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(s_manifestMutex);
+        auto iter = s_manifestCache.find(filename);
+        if (iter != s_manifestCache.end() && manifest_current(iter->second.get(), st)) {
+            manifest = iter->second;
+            return e_NetSuccess;
+        }
+    }
+
+    // Parse outside the lock so a slow reload doesn't stall requests for
+    // other manifests.  If two clients race here, both produce identical
+    // entries and the last one wins.
+    FileManifest parsed;
+    NetResultCode result = parsed.loadManifest(filename.c_str());
+    if (result != e_NetSuccess)
+        return result;
+
+    auto entry = std::make_shared<CachedManifest>();
+    entry->m_fileCount = parsed.fileCount();
+    entry->m_dataSize = parsed.encodeToStream(&entry->m_encoded);
+    entry->m_mtime = st.st_mtim;
+    entry->m_fileSize = st.st_size;
+    entry->m_inode = st.st_ino;
+
+    manifest = entry;
+    std::lock_guard<std::mutex> guard(s_manifestMutex);
+    s_manifestCache[filename] = manifest;
+    return e_NetSuccess;
+}
+
+void DS::FileManifest_ClearCache()
+{
+    std::lock_guard<std::mutex> guard(s_manifestMutex);
+    s_manifestCache.clear();
+}
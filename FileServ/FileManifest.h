@@ -21,6 +21,8 @@
 #include "config.h"
 #include "streams.h"
 #include <list>
+#include <memory>
+#include <sys/stat.h>
 
 namespace DS
 {
@@ -53,6 +55,29 @@ namespace DS
     private:
         std::vector<FileInfo> m_files;
     };
+
+    /* A parsed manifest with its ManifestReply body already encoded.
+     * Entries are never modified after they are published; a changed .mfs
+     * file produces a new entry, so clients still holding the old one can
+     * finish sending it safely. */
+    struct CachedManifest
+    {
+        uint32_t m_fileCount;
+        uint32_t m_dataSize;        // In UTF-16 characters
+        BufferStream m_encoded;
+
+        // Identity of the .mfs file this entry was built from
+        struct timespec m_mtime;
+        off_t m_fileSize;
+        ino_t m_inode;
+    };
+
+    typedef std::shared_ptr<const CachedManifest> ManifestRef;
+
+    /* Returns the cached manifest for filename, (re)loading it if the file
+     * has changed on disk since it was last parsed. */
+    NetResultCode FileManifest_Get(const ST::string& filename, ManifestRef& manifest);
+    void FileManifest_ClearCache();
 }
 
 #endif
@@ -17,22 +17,82 @@
 
 #include "FileServer.h"
 #include "FileManifest.h"
+#include "NetIO/Reactor.h"
+#include "NetIO/HandshakePool.h"
 #include "settings.h"
 #include "errors.h"
 #include <list>
 #include <map>
+#include <vector>
+#include <algorithm>
 #include <thread>
 #include <mutex>
 #include <chrono>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
-struct FileServer_Private
+// The largest client message is a download request, at 536 bytes
+#define FILE_MAX_MESSAGE_SIZE (1024)
+
+// Limits on how much a single connection can have outstanding at once
+#define FILE_MAX_DOWNLOADS (16)
+#define FILE_MAX_QUEUED_REPLIES (256)
+
+// Bytes sent per writable notification, so one fast client can't hog the
+// event loop it shares with everyone else
+#define FILE_SEND_BUDGET (8 * CHUNK_SIZE)
+
+struct FileReply
+{
+    std::vector<uint8_t> m_header;
+    DS::ManifestRef m_body;
+
+    size_t bodySize() const { return m_body ? m_body->m_encoded.size() : 0; }
+    size_t size() const { return m_header.size() + bodySize(); }
+};
+
+struct FileDownload
+{
+    uint32_t m_transId, m_readerId;
+    int m_fd;
+    off_t m_position, m_size;
+};
+
+struct FileServer_Private : public DS::ReactorClient
 {
     DS::SocketHandle m_sock;
     DS::BufferStream m_buffer;
+    DS::BufferStream m_message;
     uint32_t m_readerId;
+
+    // File server header:  size, buildId, serverType
+    DS::ConnectRequest m_connect { 12, false };
+
+    // Bytes received which don't form a complete message yet
+    std::vector<uint8_t> m_recvBuffer;
+
+    // Replies and file chunks are sent one at a time, with queued replies
+    // going out between each chunk and active downloads taking turns
+    std::list<FileReply> m_replies;
+    std::list<FileDownload> m_downloads;
+
+    FileReply m_sending;
+    size_t m_sendOffset;
+    std::list<FileDownload> m_sendFile;     // Holds at most one download
+    uint32_t m_sendFileSize;
+
+    FileServer_Private() : m_sock(), m_readerId(), m_sendOffset(), m_sendFileSize() { }
+
+    DS::SocketHandle sock() const override { return m_sock; }
+    bool sendPending() override;
+    bool onConnectRead() override { return m_connect.readSome(m_sock); }
+    void onConnect() override;
+    void onSockRead() override;
+    void onSockWrite() override;
+    void onDisconnect() override;
+    const char* serviceName() const override { return "File"; }
 };
 
 static std::list<FileServer_Private*> s_clients;
@@ -54,24 +114,37 @@ enum FileServer_MsgIds
     client.m_buffer.write<uint32_t>(0); \
     client.m_buffer.write<uint32_t>(msgId)
 
-#define SEND_REPLY() \
-    client.m_buffer.seek(0, SEEK_SET); \
-    client.m_buffer.write<uint32_t>(client.m_buffer.size()); \
-    DS::SendBuffer(client.m_sock, client.m_buffer.buffer(), client.m_buffer.size())
+#define QUEUE_REPLY() \
+    file_queue_reply(client, DS::ManifestRef())
 
-#define SEND_FD_REPLY(fd, off, sz) \
-    client.m_buffer.seek(0, SEEK_SET); \
-    client.m_buffer.write<uint32_t>(client.m_buffer.size() + sz); \
-    DS::SendFile(client.m_sock, client.m_buffer.buffer(), client.m_buffer.size(), (fd), &(off), (sz))
+static void file_queue_reply(FileServer_Private& client, DS::ManifestRef body)
+{
+    if (client.m_replies.size() >= FILE_MAX_QUEUED_REPLIES) {
+        ST::printf(stderr, "[File] Too many unsent replies for {}; disconnecting\n",
+                   DS::SockIpAddress(client.m_sock));
+        throw DS::SockHup();
+    }
+
+    client.m_buffer.seek(0, SEEK_SET);
+    FileReply& reply = client.m_replies.emplace_back();
+    reply.m_body = std::move(body);
+    client.m_buffer.write<uint32_t>(client.m_buffer.size() + reply.bodySize());
+    reply.m_header.assign(client.m_buffer.buffer(),
+                          client.m_buffer.buffer() + client.m_buffer.size());
+}
+
+static void file_read_buffer(FileServer_Private& client, void* buffer, size_t size)
+{
+    if (client.m_message.readBytes(buffer, size) != static_cast<ssize_t>(size))
+        throw DS::EofException();
+}
 
 void file_init(FileServer_Private& client)
 {
-    /* File server header:  size, buildId, serverType */
-    uint32_t size = DS::RecvValue<uint32_t>(client.m_sock);
-    if (size != 12)
-        throw DS::InvalidConnectionHeader();
-    DS::RecvValue<uint32_t>(client.m_sock);
-    DS::RecvValue<uint32_t>(client.m_sock);
+    // The header was already read in full (see m_connect), and there's
+    // nothing in it we need.  Everything after it is handled without
+    // blocking, so that downloads can be interleaved with other requests
+    DS::SockSetBlocking(client.m_sock, false);
 }
 
 void cb_ping(FileServer_Private& client)
@@ -79,9 +152,9 @@ void cb_ping(FileServer_Private& client)
     START_REPLY(e_FileToCli_PingReply);
 
     // Ping time
-    client.m_buffer.write<uint32_t>(DS::RecvValue<uint32_t>(client.m_sock));
+    client.m_buffer.write<uint32_t>(client.m_message.read<uint32_t>());
 
-    SEND_REPLY();
+    QUEUE_REPLY();
 }
 
 void cb_buildId(FileServer_Private& client)
@@ -89,7 +162,7 @@ void cb_buildId(FileServer_Private& client)
     START_REPLY(e_FileToCli_BuildIdReply);
 
     // Trans ID
-    client.m_buffer.write<uint32_t>(DS::RecvValue<uint32_t>(client.m_sock));
+    client.m_buffer.write<uint32_t>(client.m_message.read<uint32_t>());
 
     // Result
     client.m_buffer.write<uint32_t>(DS::e_NetSuccess);
@@ -97,7 +170,7 @@ void cb_buildId(FileServer_Private& client)
     // Build ID
     client.m_buffer.write<uint32_t>(DS::Settings::BuildId());
 
-    SEND_REPLY();
+    QUEUE_REPLY();
 }
 
 void cb_manifest(FileServer_Private& client)
@@ -105,21 +178,21 @@ void cb_manifest(FileServer_Private& client)
     START_REPLY(e_FileToCli_ManifestReply);
 
     // Trans ID
-    client.m_buffer.write<uint32_t>(DS::RecvValue<uint32_t>(client.m_sock));
+    client.m_buffer.write<uint32_t>(client.m_message.read<uint32_t>());
 
     // Manifest name
     char16_t mfsbuf[260];
-    DS::RecvBuffer(client.m_sock, mfsbuf, sizeof(mfsbuf));
+    file_read_buffer(client, mfsbuf, sizeof(mfsbuf));
     mfsbuf[259] = 0;
     ST::string mfsname = ST::string::from_utf16(mfsbuf, ST_AUTO_SIZE, ST::substitute_invalid);
 
     // Build ID
-    uint32_t buildId = DS::RecvValue<uint32_t>(client.m_sock);
+    uint32_t buildId = client.m_message.read<uint32_t>();
     if (buildId && buildId != DS::Settings::BuildId()) {
         ST::printf(stderr, "[File] Wrong Build ID from {}: {}\n",
                    DS::SockIpAddress(client.m_sock), buildId);
-        DS::CloseSock(client.m_sock);
-        return;
+        DS::ShutdownSock(client.m_sock);
+        throw DS::SockHup();
     }
 
     // Manifest may not have any path characters
@@ -131,13 +204,13 @@ void cb_manifest(FileServer_Private& client)
         client.m_buffer.write<uint32_t>(0);     // Reader ID
         client.m_buffer.write<uint32_t>(0);     // File count
         client.m_buffer.write<uint32_t>(0);     // Data packet size
-        SEND_REPLY();
+        QUEUE_REPLY();
         return;
     }
 
-    DS::FileManifest manifest;
+    DS::ManifestRef manifest;
     mfsname = DS::Settings::FileRoot() + mfsname + ".mfs";
-    DS::NetResultCode result = manifest.loadManifest(mfsname.c_str());
+    DS::NetResultCode result = DS::FileManifest_Get(mfsname, manifest);
     client.m_buffer.write<uint32_t>(result);
 
     if (result != DS::e_NetSuccess) {
@@ -146,44 +219,44 @@ void cb_manifest(FileServer_Private& client)
         client.m_buffer.write<uint32_t>(0);     // Reader ID
         client.m_buffer.write<uint32_t>(0);     // File count
         client.m_buffer.write<uint32_t>(0);     // Data packet size
-    } else {
-        client.m_buffer.write<uint32_t>(++client.m_readerId);
-        client.m_buffer.write<uint32_t>(manifest.fileCount());
-        uint32_t sizeLocation = client.m_buffer.tell();
-        client.m_buffer.write<uint32_t>(0);
-        uint32_t dataSize = manifest.encodeToStream(&client.m_buffer);
-        client.m_buffer.seek(sizeLocation, SEEK_SET);
-        client.m_buffer.write<uint32_t>(dataSize);
+        QUEUE_REPLY();
+        return;
     }
 
-    SEND_REPLY();
+    client.m_buffer.write<uint32_t>(++client.m_readerId);
+    client.m_buffer.write<uint32_t>(manifest->m_fileCount);
+    client.m_buffer.write<uint32_t>(manifest->m_dataSize);
+
+    // The encoded manifest body is shared between all clients, so it is
+    // sent straight from the cache behind our reply header.
+    file_queue_reply(client, std::move(manifest));
 }
 
 void cb_manifestAck(FileServer_Private& client)
 {
     /* This is TCP, nobody cares about this ack... */
-    DS::RecvValue<uint32_t>(client.m_sock);     // Trans ID
-    DS::RecvValue<uint32_t>(client.m_sock);     // Reader ID
+    client.m_message.read<uint32_t>();      // Trans ID
+    client.m_message.read<uint32_t>();      // Reader ID
 }
 
 void cb_downloadStart(FileServer_Private& client)
 {
     // Trans ID
-    uint32_t transId = DS::RecvValue<uint32_t>(client.m_sock);
+    uint32_t transId = client.m_message.read<uint32_t>();
 
     // Download filename
     char16_t buffer[260];
-    DS::RecvBuffer(client.m_sock, buffer, sizeof(buffer));
+    file_read_buffer(client, buffer, sizeof(buffer));
     buffer[259] = 0;
     ST::string filename = ST::string::from_utf16(buffer, ST_AUTO_SIZE, ST::substitute_invalid);
 
     // Build ID
-    uint32_t buildId = DS::RecvValue<uint32_t>(client.m_sock);
+    uint32_t buildId = client.m_message.read<uint32_t>();
     if (buildId && buildId != DS::Settings::BuildId()) {
         ST::printf(stderr, "[File] Wrong Build ID from {}: {}\n",
                    DS::SockIpAddress(client.m_sock), buildId);
-        DS::CloseSock(client.m_sock);
-        return;
+        DS::ShutdownSock(client.m_sock);
+        throw DS::SockHup();
     }
 
     // Ensure filename is jailed to our data path
@@ -194,11 +267,24 @@ void cb_downloadStart(FileServer_Private& client)
         client.m_buffer.write<uint32_t>(0);     // Reader ID
         client.m_buffer.write<uint32_t>(0);     // File size
         client.m_buffer.write<uint32_t>(0);     // Data packet size
-        SEND_REPLY();
+        QUEUE_REPLY();
         return;
     }
     filename = filename.replace("\\", "/");
 
+    if (client.m_downloads.size() + client.m_sendFile.size() >= FILE_MAX_DOWNLOADS) {
+        ST::printf(stderr, "[File] Too many concurrent downloads from {}\n",
+                   DS::SockIpAddress(client.m_sock));
+        START_REPLY(e_FileToCli_FileDownloadReply);
+        client.m_buffer.write<uint32_t>(transId);
+        client.m_buffer.write<uint32_t>(DS::e_NetServerBusy);
+        client.m_buffer.write<uint32_t>(0);     // Reader ID
+        client.m_buffer.write<uint32_t>(0);     // File size
+        client.m_buffer.write<uint32_t>(0);     // Data packet size
+        QUEUE_REPLY();
+        return;
+    }
+
     filename = DS::Settings::FileRoot() + filename;
     int fd = open(filename.c_str(), O_RDONLY);
 
@@ -211,12 +297,11 @@ void cb_downloadStart(FileServer_Private& client)
         client.m_buffer.write<uint32_t>(0);     // Reader ID
         client.m_buffer.write<uint32_t>(0);     // File size
         client.m_buffer.write<uint32_t>(0);     // Data packet size
-        SEND_REPLY();
+        QUEUE_REPLY();
         return;
     }
 
     struct stat stat_buf;
-    off_t filepos = 0;
     if (fstat(fd, &stat_buf) < 0) {
         ST::printf(stderr, "[File] Could not stat file {}\n[File] Requested by {}\n",
                    filename, DS::SockIpAddress(client.m_sock));
@@ -226,40 +311,238 @@ void cb_downloadStart(FileServer_Private& client)
         client.m_buffer.write<uint32_t>(0);     // Reader ID
         client.m_buffer.write<uint32_t>(0);     // File size
         client.m_buffer.write<uint32_t>(0);     // Data packet size
-        SEND_REPLY();
+        QUEUE_REPLY();
 
         close(fd);
         return;
     }
 
     // Attempting to use the MOUL protocol's "acking" of file chunks has a severe performance
-    // penalty. For me, I see an improvement from 950 KiB/s to 14 MiB/s by simply sending the
-    // whole file synchronously. We still have to chunk it, though, so the client's progress
-    // bar updates correctly. Besides, this is TCP, who needs acks at this level? The drawback
-    // to this is that the connection becomes unresponsive to all other traffic when a download
-    // is in progress.
-    while (filepos < stat_buf.st_size) {
-        off_t remsz = stat_buf.st_size - filepos;
-        uint32_t chunksz = remsz > CHUNK_SIZE ? CHUNK_SIZE : (uint32_t)remsz;
+    // penalty, so chunks are sent as fast as the socket will take them.  We still have to
+    // chunk the file, though, so the client's progress bar updates correctly.  The chunks
+    // themselves are sent by file_flush, taking turns with any other active downloads.
+    FileDownload& download = client.m_downloads.emplace_back();
+    download.m_transId = transId;
+    download.m_readerId = client.m_readerId++;
+    download.m_fd = fd;
+    download.m_position = 0;
+    download.m_size = stat_buf.st_size;
+}
 
-        START_REPLY(e_FileToCli_FileDownloadReply);
-        client.m_buffer.write<uint32_t>(transId);
-        client.m_buffer.write<uint32_t>(DS::e_NetSuccess);
-        client.m_buffer.write<uint32_t>(client.m_readerId);     // Reader ID
-        client.m_buffer.write<uint32_t>(stat_buf.st_size);      // File size
-        client.m_buffer.write<uint32_t>(chunksz);               // Data packet size
-        SEND_FD_REPLY(fd, filepos, chunksz);
+void cb_downloadNext(FileServer_Private& client)
+{
+    /* This is TCP, nobody cares about this ack... */
+    client.m_message.read<uint32_t>();      // TransID
+    client.m_message.read<uint32_t>();      // Reader ID
+}
+
+void cb_message(FileServer_Private& client)
+{
+    client.m_message.read<uint32_t>();  // Message size
+    uint32_t msgId = client.m_message.read<uint32_t>();
+    switch (msgId) {
+    case e_CliToFile_PingRequest:
+        cb_ping(client);
+        break;
+    case e_CliToFile_BuildIdRequest:
+        cb_buildId(client);
+        break;
+    case e_CliToFile_ManifestRequest:
+        cb_manifest(client);
+        break;
+    case e_CliToFile_ManifestEntryAck:
+        cb_manifestAck(client);
+        break;
+    case e_CliToFile_DownloadRequest:
+        cb_downloadStart(client);
+        break;
+    case e_CliToFile_DownloadChunkAck:
+        cb_downloadNext(client);
+        break;
+    default:
+        /* Invalid message */
+        ST::printf(stderr, "[File] Got invalid message ID {} from {}\n",
+                   msgId, DS::SockIpAddress(client.m_sock));
+        DS::ShutdownSock(client.m_sock);
+        throw DS::SockHup();
     }
+}
+
+static void file_next_chunk(FileServer_Private& client)
+{
+    // Take the download at the front of the line; it goes to the back again
+    // once this chunk is sent
+    client.m_sendFile.splice(client.m_sendFile.end(), client.m_downloads,
+                             client.m_downloads.begin());
+    FileDownload& download = client.m_sendFile.front();
+
+    off_t remsz = download.m_size - download.m_position;
+    uint32_t chunksz = remsz > CHUNK_SIZE ? CHUNK_SIZE : (uint32_t)remsz;
 
-    ++client.m_readerId;
-    close(fd);
+    START_REPLY(e_FileToCli_FileDownloadReply);
+    client.m_buffer.write<uint32_t>(download.m_transId);
+    client.m_buffer.write<uint32_t>(DS::e_NetSuccess);
+    client.m_buffer.write<uint32_t>(download.m_readerId);   // Reader ID
+    client.m_buffer.write<uint32_t>(download.m_size);       // File size
+    client.m_buffer.write<uint32_t>(chunksz);               // Data packet size
+    client.m_buffer.seek(0, SEEK_SET);
+    client.m_buffer.write<uint32_t>(client.m_buffer.size() + chunksz);
+
+    client.m_sending.m_header.assign(client.m_buffer.buffer(),
+                                     client.m_buffer.buffer() + client.m_buffer.size());
+    client.m_sending.m_body.reset();
+    client.m_sendOffset = 0;
+    client.m_sendFileSize = chunksz;
 }
 
-void cb_downloadNext(FileServer_Private& client)
+static void file_flush(FileServer_Private& client)
 {
-    /* This is TCP, nobody cares about this ack... */
-    DS::RecvValue<uint32_t>(client.m_sock);     // TransID
-    DS::RecvValue<uint32_t>(client.m_sock);     // Reader ID
+    size_t budget = FILE_SEND_BUDGET;
+    while (budget > 0) {
+        const FileReply& reply = client.m_sending;
+        if (client.m_sendOffset < reply.size()) {
+            size_t headerSize = reply.m_header.size();
+            iovec parts[2];
+            size_t count = 0;
+            if (client.m_sendOffset < headerSize) {
+                parts[count].iov_base = const_cast<uint8_t*>(reply.m_header.data())
+                                      + client.m_sendOffset;
+                parts[count].iov_len = headerSize - client.m_sendOffset;
+                ++count;
+            }
+            if (reply.m_body) {
+                size_t bodyOffset = client.m_sendOffset > headerSize
+                                  ? client.m_sendOffset - headerSize : 0;
+                parts[count].iov_base = const_cast<uint8_t*>(reply.m_body->m_encoded.buffer())
+                                      + bodyOffset;
+                parts[count].iov_len = reply.bodySize() - bodyOffset;
+                ++count;
+            }
+
+            size_t bytes = DS::SendNonBlocking(client.m_sock, parts, count,
+                                               !client.m_sendFile.empty());
+            if (bytes == 0)
+                return;
+            client.m_sendOffset += bytes;
+            budget -= std::min(budget, bytes);
+            continue;
+        }
+
+        if (!client.m_sendFile.empty()) {
+            FileDownload& download = client.m_sendFile.front();
+            if (client.m_sendFileSize > 0) {
+                size_t bytes = DS::SendFileNonBlocking(client.m_sock, download.m_fd,
+                                                       &download.m_position,
+                                                       client.m_sendFileSize);
+                if (bytes == 0)
+                    return;
+                client.m_sendFileSize -= bytes;
+                budget -= std::min(budget, bytes);
+                continue;
+            }
+
+            if (download.m_position >= download.m_size) {
+                close(download.m_fd);
+                client.m_sendFile.clear();
+            } else {
+                client.m_downloads.splice(client.m_downloads.end(), client.m_sendFile);
+            }
+        }
+
+        // Start the next frame.  Queued replies always go ahead of file
+        // data, so pings and manifest requests aren't stuck behind downloads.
+        if (!client.m_replies.empty()) {
+            client.m_sending = std::move(client.m_replies.front());
+            client.m_replies.pop_front();
+            client.m_sendOffset = 0;
+        } else if (!client.m_downloads.empty()) {
+            file_next_chunk(client);
+        } else {
+            client.m_sending.m_header.clear();
+            client.m_sending.m_body.reset();
+            client.m_sendOffset = 0;
+            return;
+        }
+    }
+}
+
+void cb_sockRead(FileServer_Private& client)
+{
+    uint8_t buffer[4096];
+    size_t bytes = DS::RecvNonBlocking(client.m_sock, buffer, sizeof(buffer));
+    if (bytes == 0)
+        return;
+    client.m_recvBuffer.insert(client.m_recvBuffer.end(), buffer, buffer + bytes);
+
+    size_t offset = 0;
+    while (client.m_recvBuffer.size() - offset >= sizeof(uint32_t)) {
+        uint32_t size;
+        memcpy(&size, client.m_recvBuffer.data() + offset, sizeof(size));
+        if (size < 2 * sizeof(uint32_t) || size > FILE_MAX_MESSAGE_SIZE) {
+            ST::printf(stderr, "[File] Got invalid message size {} from {}\n",
+                       size, DS::SockIpAddress(client.m_sock));
+            DS::ShutdownSock(client.m_sock);
+            throw DS::SockHup();
+        }
+        if (client.m_recvBuffer.size() - offset < size)
+            break;
+
+        client.m_message.set(client.m_recvBuffer.data() + offset, size);
+        cb_message(client);
+        offset += size;
+    }
+    client.m_recvBuffer.erase(client.m_recvBuffer.begin(),
+                              client.m_recvBuffer.begin() + offset);
+
+    file_flush(client);
+}
+
+void file_disconnect(FileServer_Private& client)
+{
+    s_clientMutex.lock();
+    auto client_iter = s_clients.begin();
+    while (client_iter != s_clients.end()) {
+        if (*client_iter == &client)
+            client_iter = s_clients.erase(client_iter);
+        else
+            ++client_iter;
+    }
+    s_clientMutex.unlock();
+
+    for (const FileDownload& download : client.m_downloads)
+        close(download.m_fd);
+    for (const FileDownload& download : client.m_sendFile)
+        close(download.m_fd);
+    client.m_downloads.clear();
+    client.m_sendFile.clear();
+
+    DS::FreeSock(client.m_sock);
+}
+
+bool FileServer_Private::sendPending()
+{
+    return m_sendOffset < m_sending.size() || !m_sendFile.empty()
+        || !m_replies.empty() || !m_downloads.empty();
+}
+
+void FileServer_Private::onConnect()
+{
+    file_init(*this);
+}
+
+void FileServer_Private::onSockRead()
+{
+    cb_sockRead(*this);
+}
+
+void FileServer_Private::onSockWrite()
+{
+    file_flush(*this);
+}
+
+void FileServer_Private::onDisconnect()
+{
+    file_disconnect(*this);
 }
 
 void wk_fileServ(DS::SocketHandle sockp)
@@ -273,37 +556,24 @@ void wk_fileServ(DS::SocketHandle sockp)
     s_clientMutex.unlock();
 
     try {
+        client.m_connect.read(sockp);
         file_init(client);
 
         for ( ;; ) {
-            DS::RecvValue<uint32_t>(client.m_sock);  // Message size
-            uint32_t msgId = DS::RecvValue<uint32_t>(client.m_sock);
-            switch (msgId) {
-            case e_CliToFile_PingRequest:
-                cb_ping(client);
-                break;
-            case e_CliToFile_BuildIdRequest:
-                cb_buildId(client);
-                break;
-            case e_CliToFile_ManifestRequest:
-                cb_manifest(client);
-                break;
-            case e_CliToFile_ManifestEntryAck:
-                cb_manifestAck(client);
-                break;
-            case e_CliToFile_DownloadRequest:
-                cb_downloadStart(client);
-                break;
-            case e_CliToFile_DownloadChunkAck:
-                cb_downloadNext(client);
-                break;
-            default:
-                /* Invalid message */
-                ST::printf(stderr, "[File] Got invalid message ID {} from {}\n",
-                           msgId, DS::SockIpAddress(client.m_sock));
-                DS::CloseSock(client.m_sock);
+            pollfd pfd;
+            pfd.fd = DS::SockFd(client.m_sock);
+            pfd.events = POLLIN | (client.sendPending() ? POLLOUT : 0);
+            pfd.revents = 0;
+            int result = poll(&pfd, 1, NET_TIMEOUT * 1000);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
                 throw DS::SockHup();
-            }
+
+            if (pfd.revents & POLLOUT)
+                file_flush(client);
+            if (pfd.revents & ~POLLOUT)
+                cb_sockRead(client);
         }
     } catch (const DS::SockHup&) {
         // Socket closed...
@@ -312,17 +582,7 @@ void wk_fileServ(DS::SocketHandle sockp)
                    DS::SockIpAddress(sockp), ex.what());
     }
 
-    s_clientMutex.lock();
-    auto client_iter = s_clients.begin();
-    while (client_iter != s_clients.end()) {
-        if (*client_iter == &client)
-            client_iter = s_clients.erase(client_iter);
-        else
-            ++client_iter;
-    }
-    s_clientMutex.unlock();
-
-    DS::FreeSock(client.m_sock);
+    file_disconnect(client);
 }
 
 void DS::FileServer_Init()
@@ -330,8 +590,21 @@ void DS::FileServer_Init()
 
 void DS::FileServer_Add(DS::SocketHandle client)
 {
-    std::thread threadh(&wk_fileServ, client);
-    threadh.detach();
+    if (DS::Settings::ThreadPerClient()) {
+        std::thread threadh(&wk_fileServ, client);
+        threadh.detach();
+        return;
+    }
+
+    FileServer_Private* file = new FileServer_Private;
+
+    s_clientMutex.lock();
+    file->m_sock = client;
+    file->m_readerId = 0;
+    s_clients.push_back(file);
+    s_clientMutex.unlock();
+
+    DS::ReactorAdd(file);
 }
 
 void DS::FileServer_Shutdown()
@@ -339,7 +612,7 @@ void DS::FileServer_Shutdown()
     {
         std::lock_guard<std::mutex> clientGuard(s_clientMutex);
         for (auto client_iter = s_clients.begin(); client_iter != s_clients.end(); ++client_iter)
-            DS::CloseSock((*client_iter)->m_sock);
+            DS::ShutdownSock((*client_iter)->m_sock);
     }
 
     bool complete = false;
@@ -353,6 +626,8 @@ void DS::FileServer_Shutdown()
     }
     if (!complete)
         fputs("[File] Clients didn't die after 5 seconds!\n", stderr);
+
+    DS::FileManifest_ClearCache();
 }
 
 void DS::FileServer_DisplayClients()
@@ -0,0 +1,137 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "GameDb.h"
+#include "NetIO/MsgChannel.h"
+#include "db/pqaccess.h"
+#include "settings.h"
+#include "errors.h"
+#include <string_theory/format>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+enum GameDbMessages
+{
+    e_GameDbJob, e_GameDbShutdown
+};
+
+struct GameDbConnection
+{
+    std::thread m_thread;
+    DS::MsgChannel m_channel;
+};
+
+static std::vector<std::unique_ptr<GameDbConnection>> s_dbConnections;
+
+static PGconn* dm_game_db_connect()
+{
+    PGconn* postgres = PQconnectdb(ST::format(
+                    "host='{}' port='{}' user='{}' password='{}' dbname='{}'",
+                    DS::Settings::DbHostname(), DS::Settings::DbPort(),
+                    DS::Settings::DbUsername(), DS::Settings::DbPassword(),
+                    DS::Settings::DbDbaseName()).c_str());
+    if (PQstatus(postgres) != CONNECTION_OK)
+        ST::printf(stderr, "Error connecting to postgres: {}", PQerrorMessage(postgres));
+    return postgres;
+}
+
+static void dm_game_db(GameDbConnection* connection)
+{
+    PGconn* postgres = dm_game_db_connect();
+
+    DS::FifoMessage batch[32];
+    size_t batchSize = 0, batchPos = 0;
+    bool stopping = false;
+    for ( ;; ) {
+        if (batchPos == batchSize) {
+            // Once asked to stop, only finish off whatever is still queued,
+            // since somebody may be waiting on any of it
+            batchSize = connection->m_channel.getMessages(batch, !stopping);
+            batchPos = 0;
+            if (batchSize == 0)
+                break;
+        }
+        const DS::FifoMessage& msg = batch[batchPos++];
+        if (msg.m_messageType == e_GameDbShutdown) {
+            stopping = true;
+            continue;
+        }
+
+        GameDbJob* job = reinterpret_cast<GameDbJob*>(msg.m_payload);
+        try {
+            check_postgres(postgres);
+            (*job)(postgres);
+        } catch (const std::exception& ex) {
+            ST::printf(stderr, "[Game] Exception raised by database job: {}\n", ex.what());
+        }
+        delete job;
+    }
+
+    DS::PQclose(postgres);
+}
+
+void game_db_start()
+{
+    uint32_t connections = std::max<uint32_t>(1, DS::Settings::GameDbConnections());
+    for (uint32_t i = 0; i < connections; ++i) {
+        s_dbConnections.emplace_back(new GameDbConnection);
+        GameDbConnection* connection = s_dbConnections.back().get();
+        connection->m_thread = std::thread(&dm_game_db, connection);
+    }
+}
+
+void game_db_stop()
+{
+    // Anything already queued still gets written
+    for (auto& connection : s_dbConnections)
+        connection->m_channel.putMessage(e_GameDbShutdown);
+    for (auto& connection : s_dbConnections)
+        connection->m_thread.join();
+    s_dbConnections.clear();
+}
+
+void game_db_submit(uint32_t route, GameDbJob job)
+{
+    DS_ASSERT(!s_dbConnections.empty());
+    GameDbConnection* connection = s_dbConnections[route % s_dbConnections.size()].get();
+    connection->m_channel.putMessage(e_GameDbJob, new GameDbJob(std::move(job)));
+}
+
+void game_db_call(uint32_t route, GameDbJob job)
+{
+    std::promise<void> done;
+    std::future<void> result = done.get_future();
+    game_db_submit(route, [&job, &done](PGconn* postgres) {
+        try {
+            job(postgres);
+        } catch (const std::exception& ex) {
+            ST::printf(stderr, "[Game] Exception raised by database job: {}\n", ex.what());
+        }
+        done.set_value();
+    });
+    result.wait();
+}
+
+size_t game_db_queued()
+{
+    size_t queued = 0;
+    for (const auto& connection : s_dbConnections)
+        queued += connection->m_channel.depth();
+    return queued;
+}
@@ -0,0 +1,45 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _DS_GAMEDB_H
+#define _DS_GAMEDB_H
+
+#include <libpq-fe.h>
+#include <functional>
+#include <cstdint>
+
+/* Database connections shared by every game host.  Each connection has its
+ * own thread and queue; submitting work never blocks, and jobs with the same
+ * route (e.g. the same age instance) always run in order on one connection.
+ * The Game.DbConnections setting caps how many connections game hosts use
+ * no matter how many ages are running. */
+typedef std::function<void (PGconn*)> GameDbJob;
+
+void game_db_start();
+void game_db_stop();
+
+void game_db_submit(uint32_t route, GameDbJob job);
+
+/* Runs a job and waits for it to finish.  Must not be used from a host
+ * thread; those should submit and carry on.  Anything else running on the
+ * executor has to wait in an ExecutorBlockingScope. */
+void game_db_call(uint32_t route, GameDbJob job);
+
+/* Jobs waiting for a connection */
+size_t game_db_queued();
+
+#endif
@@ -23,9 +23,12 @@
 #include "PlasMOUL/NetMessages/NetMsgSDLState.h"
 #include "PlasMOUL/NetMessages/NetMsgGroupOwner.h"
 #include "PlasMOUL/NetMessages/NetMsgVoice.h"
+#include "PlasMOUL/NetMessages/NetMsgRelevanceRegions.h"
+#include "PlasMOUL/NetMessages/NetMessageView.h"
 #include "PlasMOUL/Messages/ServerReplyMsg.h"
 #include "PlasMOUL/Messages/LoadAvatarMsg.h"
 #include "SDL/DescriptorDb.h"
+#include "GameDb.h"
 #include "settings.h"
 #include "errors.h"
 #include <string_theory/codecs>
@@ -33,14 +36,17 @@
 
 hostmap_t s_gameHosts;
 std::mutex s_gameHostMutex;
+GameClientIndex s_gameClients;
 agemap_t s_ages;
 
+std::atomic<uint64_t> s_coldStarts, s_warmStarts;
+std::atomic<uint32_t> s_closingHosts;
+
 #define SEND_REPLY(msg, result) \
     msg->m_client->m_channel.putMessage(result)
 
-#define DM_SENDBUF(client) \
-    _msgbuf->ref(); \
-    client->m_broadcast.putMessage(e_GameToCli_PropagateBuffer, _msgbuf)
+#define DM_SENDBUF(client, msg) \
+    dm_send(client, _msgbuf, (msg->m_contentFlags & MOUL::NetMessage::e_NeedsReliableSend) != 0)
 
 #define DM_UNREFBUF() \
     _msgbuf->unref()
@@ -55,102 +61,290 @@ agemap_t s_ages;
 
 #define DM_SENDMSG(msg, client) \
     DM_WRITEBUF(msg); \
-    client->m_broadcast.putMessage(e_GameToCli_PropagateBuffer, _msgbuf)
+    dm_send(client, _msgbuf, true); \
+    DM_UNREFBUF()
+
+void dm_push(GameClient_Private* client, int type, DS::BufferStream* buffer, bool reliable,
+             const std::string& coalesceKey = std::string())
+{
+    DS::BroadcastQueue::PushResult result =
+            client->m_broadcast.push(type, buffer, reliable, coalesceKey);
+    if (result == DS::BroadcastQueue::e_Evict) {
+        ST::printf(stderr, "[Game] Disconnecting {}: Outbound queue is full\n",
+                   DS::SockIpAddress(client->m_sock));
+        DS::ShutdownSock(client->m_sock);
+    }
+}
+
+void dm_send(GameClient_Private* client, DS::BufferStream* buffer, bool reliable,
+             const std::string& coalesceKey = std::string())
+{
+    dm_push(client, e_GameToCli_PropagateBuffer, buffer, reliable, coalesceKey);
+}
+
+/* Appends msg to a prepared batch as a complete PropagateBuffer message */
+void dm_write_prepared(DS::BufferStream* batch, const MOUL::NetMessage* msg)
+{
+    uint32_t start = batch->tell();
+    batch->write<uint16_t>(e_GameToCli_PropagateBuffer);
+    batch->write<uint32_t>(msg->type());
+    batch->write<uint32_t>(0);
+    MOUL::Factory::WriteCreatable(batch, msg);
+    uint32_t end = batch->tell();
+    batch->seek(start + sizeof(uint16_t) + sizeof(uint32_t), SEEK_SET);
+    batch->write<uint32_t>(end - start - sizeof(uint16_t) - 2 * sizeof(uint32_t));
+    batch->seek(end, SEEK_SET);
+}
 
+std::string dm_prepare_message(const MOUL::NetMessage* msg)
+{
+    DS::BufferStream buffer;
+    dm_write_prepared(&buffer, msg);
+    return std::string(reinterpret_cast<const char*>(buffer.buffer()), buffer.size());
+}
+
+void dm_invalidate_snapshot(GameHost_Private* host)
+{
+    for (DS::BufferStream* batch : host->m_snapshot)
+        batch->unref();
+    host->m_snapshot.clear();
+}
+
+void dm_flush_sdl_states(GameHost_Private* host);
+void dm_states_flushed(GameHost_Private* host);
+
+/* Starts shutting the host down.  Clients are disconnected right away;
+ * dm_shutdown_step() takes care of the rest over as many runs as needed. */
 void dm_game_shutdown(GameHost_Private* host)
 {
+    if (host->m_shutdown != GameHost_Private::e_HostRunning)
+        return;
+    host->m_shutdown = GameHost_Private::e_HostDraining;
+    host->m_shutdownDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    host->m_lingering = false;
+    ++s_closingHosts;
+
     {
         std::lock_guard<std::mutex> clientGuard(host->m_clientMutex);
         for (auto client_iter = host->m_clients.begin(); client_iter != host->m_clients.end(); ++client_iter)
-            DS::CloseSock(client_iter->second->m_sock);
+            DS::ShutdownSock(client_iter->second->m_sock);
     }
 
     for (auto clone_iter = host->m_clones.begin(); clone_iter != host->m_clones.end(); ++clone_iter)
         clone_iter->second->unref();
     host->m_clones.clear();
+}
 
-    bool complete = false;
-    for (int i=0; i<50 && !complete; ++i) {
-        host->m_clientMutex.lock();
-        size_t alive = host->m_clients.size();
-        host->m_clientMutex.unlock();
-        if (alive == 0)
-            complete = true;
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
-    if (!complete)
-        fputs("[Game] Clients didn't die after 5 seconds!\n", stderr);
-
-    s_gameHostMutex.lock();
-    hostmap_t::iterator host_iter = s_gameHosts.begin();
-    while (host_iter != s_gameHosts.end()) {
-        if (host_iter->second == host)
-            host_iter = s_gameHosts.erase(host_iter);
-        else
-            ++host_iter;
+/* Called after every run of a host that is shutting down.  Returns true
+ * once the host is done, and has been deleted. */
+bool dm_shutdown_step(GameHost_Private* host)
+{
+    switch (host->m_shutdown) {
+    case GameHost_Private::e_HostDraining:
+        {
+            // Disconnects wake us up as they arrive, and the timer catches
+            // the deadline
+            host->m_clientMutex.lock();
+            size_t alive = host->m_clients.size();
+            host->m_clientMutex.unlock();
+            if (alive != 0 && std::chrono::steady_clock::now() < host->m_shutdownDeadline)
+                return false;
+            if (alive != 0)
+                fputs("[Game] Clients didn't die after 5 seconds!\n", stderr);
+            host->m_shutdown = GameHost_Private::e_HostSaving;
+        }
+        /* fall through */
+
+    case GameHost_Private::e_HostSaving:
+        // Wait for a write that's still in flight (its e_GameStatesFlushed
+        // wakes us up), then write whatever is left
+        if (host->m_flushResult.valid())
+            return false;
+        dm_flush_sdl_states(host);
+        host->m_shutdown = GameHost_Private::e_HostSaved;
+        /* fall through */
+
+    case GameHost_Private::e_HostSaved:
+        if (host->m_flushResult.valid())
+            return false;
+        break;
+
+    default:
+        DS_ASSERT(false);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
+        hostmap_t::iterator host_iter = s_gameHosts.begin();
+        while (host_iter != s_gameHosts.end()) {
+            if (host_iter->second == host)
+                host_iter = s_gameHosts.erase(host_iter);
+            else
+                ++host_iter;
+        }
+
+        // Joins that found the host before now still have to be turned
+        // away, and whoever sent the last messages may still be signaling
+        if (host->m_pendingJoins != 0 || !host->m_channel.idle())
+            return false;
     }
-    s_gameHostMutex.unlock();
 
     if (host->m_temp) {
-        DS::PQexecVA(host->m_postgres,
-                     "DELETE FROM game.\"Servers\" "
-                     "    WHERE \"idx\"=$1",
-                     host->m_serverIdx);
+        uint32_t serverIdx = host->m_serverIdx;
+        game_db_submit(serverIdx, [serverIdx](PGconn* postgres) {
+            DS::PGresultRef result = DS::PQexecVA(postgres,
+                    DS_STATEMENT("DELETE FROM game.\"Servers\" "
+                                 "    WHERE \"idx\"=$1"),
+                    serverIdx);
+            if (PQresultStatus(result) != PGRES_COMMAND_OK)
+                PQ_PRINT_ERROR(postgres, DELETE);
+        });
     }
-    PQfinish(host->m_postgres);
+    dm_invalidate_snapshot(host);
+    DS::ExecutorCancelTimer(host);
     delete host;
+    --s_closingHosts;
+    return true;
 }
 
-void dm_broadcast(GameHost_Private* host, MOUL::NetMessage* msg, uint32_t sender)
+void dm_start_linger(GameHost_Private* host)
 {
-    DM_WRITEBUF(msg);
+    uint32_t lingerTime = Game_AgeInfo().m_lingerTime;
+    agemap_t::const_iterator age_iter = s_ages.find(host->m_ageFilename);
+    if (age_iter != s_ages.end())
+        lingerTime = age_iter->second.m_lingerTime;
+    host->m_lingerTime = std::chrono::steady_clock::now() + std::chrono::seconds(lingerTime);
+    host->m_lingering = true;
+}
 
-    std::lock_guard<std::mutex> hostGuard(s_gameHostMutex);
-    for (auto host_it = s_gameHosts.begin(); host_it != s_gameHosts.end(); ++host_it) {
-        std::lock_guard<std::mutex> clientGuard(host_it->second->m_clientMutex);
-        for (auto client_it = host_it->second->m_clients.begin(); client_it != host_it->second->m_clients.end(); ++client_it) {
-            if (client_it->second->m_clientInfo.m_PlayerId == sender
-                && !(msg->m_contentFlags & MOUL::NetMessage::e_EchoBackToSender))
-                continue;
-            DM_SENDBUF(client_it->second);
+/* Called once an empty age has lingered long enough.  If nobody is in or
+ * on the way in, the host is taken out of s_gameHosts so that no new join
+ * can find it, and may be shut down. */
+bool dm_linger_expired(GameHost_Private* host)
+{
+    std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
+
+    // A join adds its client before it stops pending, so check in this order
+    if (host->m_pendingJoins != 0) {
+        dm_start_linger(host);
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> clientGuard(host->m_clientMutex);
+        if (!host->m_clients.empty()) {
+            host->m_lingering = false;
+            return false;
         }
     }
 
-    DM_UNREFBUF();
+    hostmap_t::iterator host_iter = s_gameHosts.find(host->m_serverIdx);
+    if (host_iter != s_gameHosts.end() && host_iter->second == host)
+        s_gameHosts.erase(host_iter);
+    return true;
 }
 
-void dm_propagate(GameHost_Private* host, MOUL::NetMessage* msg, uint32_t sender)
+/* Earliest time the host has to wake up for, if any */
+bool dm_wake_time(GameHost_Private* host, std::chrono::steady_clock::time_point& wakeTime)
+{
+    // Pending joins finish without telling us, so keep checking
+    if (host->m_shutdown != GameHost_Private::e_HostRunning) {
+        wakeTime = std::min(host->m_shutdownDeadline,
+                            std::chrono::steady_clock::now() + std::chrono::milliseconds(100));
+        return true;
+    }
+
+    bool wake = false;
+    if (!host->m_dirtyStates.empty() && !host->m_flushResult.valid()) {
+        wakeTime = host->m_stateFlushTime;
+        wake = true;
+    }
+    if (host->m_lingering && (!wake || host->m_lingerTime < wakeTime)) {
+        wakeTime = host->m_lingerTime;
+        wake = true;
+    }
+    return wake;
+}
+
+/* The *_buffer variants send an already serialized message, given the
+ * NetMessage content flags it was written with */
+void dm_broadcast_buffer(DS::BufferStream* buffer, uint32_t contentFlags, uint32_t sender)
+{
+    bool reliable = (contentFlags & MOUL::NetMessage::e_NeedsReliableSend) != 0;
+    s_gameClients.visitAll([&](GameClient_Private* client) {
+        if (client->m_clientInfo.m_PlayerId == sender
+            && !(contentFlags & MOUL::NetMessage::e_EchoBackToSender))
+            return;
+        dm_send(client, buffer, reliable);
+    });
+}
+
+void dm_broadcast(GameHost_Private* host, MOUL::NetMessage* msg, uint32_t sender)
 {
     DM_WRITEBUF(msg);
+    dm_broadcast_buffer(_msgbuf, msg->m_contentFlags, sender);
+    DM_UNREFBUF();
+}
 
+void dm_propagate_buffer(GameHost_Private* host, DS::BufferStream* buffer,
+                         uint32_t contentFlags, uint32_t sender,
+                         const std::string& coalesceKey = std::string())
+{
+    bool reliable = (contentFlags & MOUL::NetMessage::e_NeedsReliableSend) != 0;
     std::lock_guard<std::mutex> clientGuard(host->m_clientMutex);
+
+    // Only clients that care about a region the sender is in get messages
+    // flagged for relevance filtering.  Either side not having reported
+    // any regions yet means everyone is relevant.
+    const DS::BitVector* senderRegions = nullptr;
+    if (contentFlags & MOUL::NetMessage::e_UseRelevanceRegions) {
+        auto sender_iter = host->m_clients.find(sender);
+        if (sender_iter != host->m_clients.end() && !sender_iter->second->m_regionsIAmIn.empty())
+            senderRegions = &sender_iter->second->m_regionsIAmIn;
+    }
+
+    uint64_t skipped = 0;
     for (auto client_iter = host->m_clients.begin(); client_iter != host->m_clients.end(); ++client_iter) {
         if (client_iter->second->m_clientInfo.m_PlayerId == sender
-            && !(msg->m_contentFlags & MOUL::NetMessage::e_EchoBackToSender))
+            && !(contentFlags & MOUL::NetMessage::e_EchoBackToSender))
             continue;
-        DM_SENDBUF(client_iter->second);
+        if (senderRegions && !client_iter->second->m_regionsICareAbout.empty()
+            && !client_iter->second->m_regionsICareAbout.overlaps(*senderRegions)) {
+            ++skipped;
+            continue;
+        }
+        dm_send(client_iter->second, buffer, reliable, coalesceKey);
+    }
+    if (skipped) {
+        host->m_irrelevantMessages.fetch_add(skipped, std::memory_order_relaxed);
+        host->m_irrelevantBytes.fetch_add(skipped * buffer->size(), std::memory_order_relaxed);
     }
+}
 
+void dm_propagate(GameHost_Private* host, MOUL::NetMessage* msg, uint32_t sender,
+                  const std::string& coalesceKey = std::string())
+{
+    DM_WRITEBUF(msg);
+    dm_propagate_buffer(host, _msgbuf, msg->m_contentFlags, sender, coalesceKey);
     DM_UNREFBUF();
 }
 
+void dm_propagate_to_buffer(DS::BufferStream* buffer, uint32_t contentFlags,
+                            const std::vector<uint32_t>& receivers)
+{
+    bool reliable = (contentFlags & MOUL::NetMessage::e_NeedsReliableSend) != 0;
+    for (uint32_t receiver : receivers) {
+        s_gameClients.visit(receiver, [&](GameClient_Private* client) {
+            dm_send(client, buffer, reliable);
+        });
+    }
+}
+
 void dm_propagate_to(GameHost_Private* host, MOUL::NetMessage* msg,
                      const std::vector<uint32_t>& receivers)
 {
     DM_WRITEBUF(msg);
-
-    for (auto rcvr_iter = receivers.begin(); rcvr_iter != receivers.end(); ++rcvr_iter) {
-        std::lock_guard<std::mutex> hostGuard(s_gameHostMutex);
-        for (hostmap_t::iterator recv_host = s_gameHosts.begin(); recv_host != s_gameHosts.end(); ++recv_host) {
-            std::lock_guard<std::mutex> clientGuard(recv_host->second->m_clientMutex);
-            auto client = recv_host->second->m_clients.find(*rcvr_iter);
-            if (client != recv_host->second->m_clients.end()) {
-                DM_SENDBUF(client->second);
-                break; // Don't bother checking the rest of the hosts, we found the one we're looking for
-            }
-        }
-    }
-
+    dm_propagate_to_buffer(_msgbuf, msg->m_contentFlags, receivers);
     DM_UNREFBUF();
 }
 
@@ -163,6 +357,7 @@ void dm_local_sdl_update(GameHost_Private* host, DS::Blob blob)
     sdlNode.m_node.set_NodeIdx(host->m_sdlIdx);
     sdlNode.m_node.set_Blob_1(std::move(blob));
     s_authChannel.putMessage(e_VaultUpdateNode, reinterpret_cast<void*>(&sdlNode));
+    DS::ExecutorBlockingScope blocking;
     if (fakeClient.m_channel.getMessage().m_messageType != DS::e_NetSuccess)
         fputs("[Game] Error writing SDL node back to vault\n", stderr);
 }
@@ -195,7 +390,8 @@ void dm_game_disconnect(GameHost_Private* host, Game_ClientMessage* msg)
         dm_propagate(host, netMsg, msg->m_client->m_clientInfo.m_PlayerId);
         netMsg->unref();
 
-        host->m_states.erase(msg->m_client->m_clientKey);
+        if (host->m_states.erase(msg->m_client->m_clientKey))
+            dm_invalidate_snapshot(host);
     }
 
     MOUL::NetMsgMemberUpdate* memberMsg = MOUL::NetMsgMemberUpdate::Create();
@@ -239,7 +435,7 @@ void dm_game_disconnect(GameHost_Private* host, Game_ClientMessage* msg)
             if (host->m_clients.size()) {
                 GameClient_Private* newOwner = host->m_clients.begin()->second;
                 host->m_gameMaster = newOwner->m_clientInfo.m_PlayerId;
-                DM_SENDBUF(newOwner);
+                DM_SENDBUF(newOwner, groupMsg);
             } else {
                 host->m_gameMaster = 0;
             }
@@ -251,11 +447,9 @@ void dm_game_disconnect(GameHost_Private* host, Game_ClientMessage* msg)
     // Good time to write this back to the vault
     dm_local_sdl_update(host, host->m_localState.toBlob());
 
-    // TODO: This should probably respect the age's LingerTime
-    //       As it is, there might be a race condition if another player is
-    //       joining just as the last player is leaving.
+    // Keep the age loaded for a while, in case someone comes back
     if (host->m_clients.size() == 0)
-        host->m_channel.putMessage(e_GameShutdown, nullptr);
+        dm_start_linger(host);
 
     SEND_REPLY(msg, DS::e_NetSuccess);
 }
@@ -273,7 +467,12 @@ void dm_game_join(GameHost_Private* host, Game_ClientMessage* msg)
     authReq.m_playerId = msg->m_client->m_clientInfo.m_PlayerId;
     s_authChannel.putMessage(e_AuthUpdateAgeSrv, reinterpret_cast<void*>(&authReq));
 
-    DS::FifoMessage authReply = fakeClient.m_channel.getMessage();
+    // The auth daemon may in turn be waiting on another host
+    DS::FifoMessage authReply;
+    {
+        DS::ExecutorBlockingScope blocking;
+        authReply = fakeClient.m_channel.getMessage();
+    }
     msg->m_client->m_isAdmin = authReq.m_isAdmin;
     if (authReply.m_messageType != DS::e_NetSuccess) {
         SEND_REPLY(msg, authReply.m_messageType);
@@ -313,12 +512,31 @@ void dm_game_join(GameHost_Private* host, Game_ClientMessage* msg)
     dm_propagate(host, memberMsg, msg->m_client->m_clientInfo.m_PlayerId);
     memberMsg->unref();
 
+    // The client is added as soon as it gets the reply, so the age is no
+    // longer empty (dm_set_wake_timer() drops the linger deadline)
+    if (host->m_lingering) {
+        host->m_lingering = false;
+        if (host->m_joined)
+            ++s_warmStarts;
+    }
+    host->m_joined = true;
+
     SEND_REPLY(msg, DS::e_NetSuccess);
 }
 
-void dm_send_state(GameHost_Private* host, GameClient_Private* client)
+// Size at which the initial state snapshot starts a new batch
+#define SNAPSHOT_BATCH_SIZE (64 * 1024)
+
+/* Assembles the initial age state from the cached message of each state,
+ * only serializing the states that changed since they were last sent. */
+void dm_build_snapshot(GameHost_Private* host)
 {
-    check_postgres(host->m_postgres);
+    auto append = [host](const std::string& message) {
+        if (host->m_snapshot.empty()
+                || host->m_snapshot.back()->size() + message.size() > SNAPSHOT_BATCH_SIZE)
+            host->m_snapshot.push_back(new DS::BufferStream());
+        host->m_snapshot.back()->writeBytes(message.data(), message.size());
+    };
 
     MOUL::NetMsgSDLState* state = MOUL::NetMsgSDLState::Create();
     state->m_contentFlags = MOUL::NetMessage::e_HasTimeSent
@@ -329,15 +547,20 @@ void dm_send_state(GameHost_Private* host, GameClient_Private* client)
     state->m_isAvatar = false;
 
     uint32_t states = 0;
-    DS::Blob ageSdlBlob = host->m_ageSdlHook.toBlob();
-    if (ageSdlBlob.size()) {
-        Game_AgeInfo info = s_ages[host->m_ageFilename];
-        state->m_object.m_location = MOUL::Location(info.m_seqPrefix, -2, MOUL::Location::e_BuiltIn);
-        state->m_object.m_name = "AgeSDLHook";
-        state->m_object.m_type = 1;  // SceneObject
-        state->m_object.m_id = 1;
-        state->m_sdlBlob = std::move(ageSdlBlob);
-        DM_SENDMSG(state, client);
+    if (host->m_ageSdlHookSnapshot.empty()) {
+        DS::Blob ageSdlBlob = host->m_ageSdlHook.toBlob();
+        if (ageSdlBlob.size()) {
+            Game_AgeInfo info = s_ages[host->m_ageFilename];
+            state->m_object.m_location = MOUL::Location(info.m_seqPrefix, -2, MOUL::Location::e_BuiltIn);
+            state->m_object.m_name = "AgeSDLHook";
+            state->m_object.m_type = 1;  // SceneObject
+            state->m_object.m_id = 1;
+            state->m_sdlBlob = std::move(ageSdlBlob);
+            host->m_ageSdlHookSnapshot = dm_prepare_message(state);
+        }
+    }
+    if (!host->m_ageSdlHookSnapshot.empty()) {
+        append(host->m_ageSdlHookSnapshot);
         ++states;
     }
 
@@ -345,11 +568,14 @@ void dm_send_state(GameHost_Private* host, GameClient_Private* client)
          state_iter != host->m_states.end(); ++state_iter) {
         for (sdlnamemap_t::iterator it = state_iter->second.begin();
              it != state_iter->second.end(); ++it) {
-            state->m_object = state_iter->first;
-            state->m_isAvatar = it->second.m_isAvatar;
-            state->m_persistOnServer = it->second.m_persist;
-            state->m_sdlBlob = it->second.m_state.toBlob();
-            DM_SENDMSG(state, client);
+            if (it->second.m_snapshot.empty()) {
+                state->m_object = state_iter->first;
+                state->m_isAvatar = it->second.m_isAvatar;
+                state->m_persistOnServer = it->second.m_persist;
+                state->m_sdlBlob = it->second.m_state.toBlob();
+                it->second.m_snapshot = dm_prepare_message(state);
+            }
+            append(it->second.m_snapshot);
             ++states;
         }
     }
@@ -362,55 +588,187 @@ void dm_send_state(GameHost_Private* host, GameClient_Private* client)
                           | MOUL::NetMessage::e_NeedsReliableSend;
     reply->m_timestamp.setNow();
     reply->m_numStates = states;
-    DM_SENDMSG(reply, client);
+    append(dm_prepare_message(reply));
     reply->unref();
 }
 
-void dm_save_sdl_state(GameHost_Private* host, const ST::string& descriptor,
-                       const MOUL::Uoid& object, const SDL::State& state)
+void dm_send_state(GameHost_Private* host, GameClient_Private* client)
 {
-    check_postgres(host->m_postgres);
+    if (host->m_snapshot.empty())
+        dm_build_snapshot(host);
+    for (DS::BufferStream* batch : host->m_snapshot)
+        dm_push(client, e_GameToCli_PreparedBatch, batch, true);
+}
 
-    DS::Blob sdlBlob = state.toBlob();
-    DS::BufferStream buffer;
-    object.write(&buffer);
-    const ST::string object_b64 = ST::base64_encode(buffer.buffer(), buffer.size());
-    const ST::string blob_b64 = ST::base64_encode(sdlBlob.buffer(), sdlBlob.size());
-    DS::PGresultRef result = DS::PQexecVA(host->m_postgres,
-            "SELECT idx FROM game.\"AgeStates\""
-            "    WHERE \"ServerIdx\"=$1 AND \"Descriptor\"=$2 AND \"ObjectKey\"=$3",
-            host->m_serverIdx, descriptor, object_b64);
-    if (PQresultStatus(result) != PGRES_TUPLES_OK) {
-        PQ_PRINT_ERROR(host->m_postgres, SELECT);
+/* Queues a persistent state to be written back by dm_flush_sdl_states().
+ * Repeated changes before the flush only cost one write. */
+void dm_save_sdl_state(GameHost_Private* host, const ST::string& descriptor,
+                       const MOUL::Uoid& object, GameState& state)
+{
+    if (state.m_dirty)
         return;
+    state.m_dirty = true;
+    if (host->m_dirtyStates.empty()) {
+        host->m_stateFlushTime = std::chrono::steady_clock::now()
+                + std::chrono::milliseconds(DS::Settings::StateFlushInterval());
     }
-    if (PQntuples(result) == 0) {
-        result = DS::PQexecVA(host->m_postgres,
-                              "INSERT INTO game.\"AgeStates\""
-                              "    (\"ServerIdx\", \"Descriptor\", \"ObjectKey\", \"SdlBlob\")"
-                              "    VALUES ($1, $2, $3, $4)",
-                              host->m_serverIdx, descriptor, object_b64, blob_b64);
+    host->m_dirtyStates.emplace_back(object, descriptor);
+}
+
+// Rows per INSERT statement; each row takes 3 parameters
+#define STATE_FLUSH_BATCH 256
+
+/* A snapshot of dirty states, written back on a shared connection */
+struct Game_StateWrite
+{
+    uint32_t m_serverIdx;
+    std::vector<ST::string> m_descriptors;
+    std::vector<DS::Blob> m_objects, m_blobs;
+    std::promise<bool> m_result;
+};
+
+static bool dm_write_sdl_states(PGconn* postgres, const Game_StateWrite& write,
+                                size_t first, size_t count)
+{
+    ST::string_stream query;
+    query << "INSERT INTO game.\"AgeStates\""
+             "    (\"ServerIdx\", \"Descriptor\", \"ObjectKey\", \"SdlBlob\") VALUES ";
+
+    const ST::string serverIdx = ST::string::from_uint(write.m_serverIdx);
+    std::vector<const char*> values { serverIdx.c_str() };
+    std::vector<int> lengths { 0 };
+    std::vector<int> formats { 0 };
+    for (size_t i = first; i < first + count; ++i) {
+        size_t param = values.size() + 1;
+        query << (i == first ? "" : ", ")
+              << "($1, $" << param << ", $" << (param + 1) << ", $" << (param + 2) << ")";
+        values.push_back(write.m_descriptors[i].c_str());
+        lengths.push_back(0);
+        formats.push_back(0);
+        values.push_back(reinterpret_cast<const char*>(write.m_objects[i].buffer()));
+        lengths.push_back(static_cast<int>(write.m_objects[i].size()));
+        formats.push_back(1);
+        values.push_back(reinterpret_cast<const char*>(write.m_blobs[i].buffer()));
+        lengths.push_back(static_cast<int>(write.m_blobs[i].size()));
+        formats.push_back(1);
+    }
+    query << " ON CONFLICT (\"ServerIdx\", \"Descriptor\", \"ObjectKey\")"
+             "    DO UPDATE SET \"SdlBlob\"=EXCLUDED.\"SdlBlob\"";
+
+    DS::PGresultRef result = PQexecParams(postgres, query.to_string().c_str(),
+                                          values.size(), nullptr, values.data(),
+                                          lengths.data(), formats.data(), 0);
+    if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+        PQ_PRINT_ERROR(postgres, INSERT);
+        return false;
+    }
+    return true;
+}
+
+/* Runs on a database connection; writes all of the states in a single
+ * transaction */
+static bool dm_write_sdl_states(PGconn* postgres, const Game_StateWrite& write)
+{
+    size_t states = write.m_descriptors.size();
+    bool success = true;
+    bool transaction = states > STATE_FLUSH_BATCH;
+    if (transaction) {
+        DS::PGresultRef result = PQexec(postgres, "BEGIN");
+        success = (PQresultStatus(result) == PGRES_COMMAND_OK);
+        if (!success)
+            PQ_PRINT_ERROR(postgres, BEGIN);
+    }
+    for (size_t first = 0; success && first < states; first += STATE_FLUSH_BATCH) {
+        size_t count = std::min<size_t>(STATE_FLUSH_BATCH, states - first);
+        success = dm_write_sdl_states(postgres, write, first, count);
+    }
+    if (transaction) {
+        DS::PGresultRef result = PQexec(postgres, success ? "COMMIT" : "ROLLBACK");
         if (PQresultStatus(result) != PGRES_COMMAND_OK) {
-            PQ_PRINT_ERROR(host->m_postgres, INSERT);
-            return;
+            PQ_PRINT_ERROR(postgres, COMMIT);
+            success = false;
         }
-    } else {
-        if (PQntuples(result) != 1)
-            fputs("Warning: Multiple rows returned for age state\n", stderr);
-        const ST::string stateIdx(PQgetvalue(result, 0, 0));
-        result = DS::PQexecVA(host->m_postgres,
-                              "UPDATE game.\"AgeStates\""
-                              "    SET \"SdlBlob\"=$2 WHERE idx=$1",
-                              stateIdx, blob_b64);
-        if (PQresultStatus(result) != PGRES_COMMAND_OK) {
-            PQ_PRINT_ERROR(host->m_postgres, UPDATE);
-            return;
+    }
+    return success;
+}
+
+/* Hands every dirty persistent state to the database pool to be written
+ * back to game."AgeStates", without waiting for it.  dm_states_flushed()
+ * picks up the result. */
+void dm_flush_sdl_states(GameHost_Private* host)
+{
+    if (host->m_dirtyStates.empty() || host->m_flushResult.valid())
+        return;
+
+    auto write = std::make_shared<Game_StateWrite>();
+    write->m_serverIdx = host->m_serverIdx;
+    for (auto& dirty : host->m_dirtyStates) {
+        auto object = host->m_states.find(dirty.first);
+        if (object == host->m_states.end())
+            continue;
+        auto state = object->second.find(dirty.second);
+        if (state == object->second.end())
+            continue;
+
+        DS::BufferStream key;
+        dirty.first.write(&key);
+        write->m_descriptors.push_back(dirty.second);
+        write->m_objects.emplace_back(key.buffer(), key.size());
+        write->m_blobs.push_back(state->second.m_state.toBlob());
+
+        // Changes from here on need another write
+        state->second.m_dirty = false;
+        host->m_flushingStates.push_back(std::move(dirty));
+    }
+    host->m_dirtyStates.clear();
+    if (host->m_flushingStates.empty())
+        return;
+
+    host->m_flushResult = write->m_result.get_future();
+    game_db_submit(host->m_serverIdx, [host, write](PGconn* postgres) {
+        bool success = false;
+        try {
+            success = dm_write_sdl_states(postgres, *write);
+        } catch (const std::exception& ex) {
+            ST::printf(stderr, "[Game] Exception saving states: {}\n", ex.what());
+        }
+
+        // The host may be waiting on the result to shut down, so it has to
+        // be woken up before the result is set
+        host->m_channel.putMessage(e_GameStatesFlushed);
+        write->m_result.set_value(success);
+    });
+}
+
+/* Finishes the write started by dm_flush_sdl_states(), waiting for it if
+ * needed.  States that failed to save are queued up again. */
+void dm_states_flushed(GameHost_Private* host)
+{
+    if (!host->m_flushResult.valid())
+        return;
+
+    if (!host->m_flushResult.get()) {
+        ST::printf(stderr, "[Game] Failed to save {} states for {}; will retry\n",
+                   host->m_flushingStates.size(), host->m_ageFilename);
+        for (const auto& flushing : host->m_flushingStates) {
+            auto object = host->m_states.find(flushing.first);
+            if (object == host->m_states.end())
+                continue;
+            auto state = object->second.find(flushing.second);
+            if (state != object->second.end())
+                dm_save_sdl_state(host, flushing.second, flushing.first, state->second);
         }
     }
+    host->m_flushingStates.clear();
 }
 
+/* Sends the variables changed by an update to everyone else in the age,
+ * using the indexed (dirty-only) encoding of the state blob.  Clients whose
+ * queue is coalescing get the complete state with a coalesce key instead,
+ * since a held-back update can only be replaced by one covering everything. */
 void dm_bcast_sdl_state(GameHost_Private* host, GameClient_Private* client,
-                        const MOUL::NetMsgSDLState* update, const SDL::State& state)
+                        const MOUL::NetMsgSDLState* update, const SDL::State& state,
+                        const SDL::State& changes)
 {
     MOUL::NetMsgSDLStateBCast* bcast = MOUL::NetMsgSDLStateBCast::Create();
     bcast->m_contentFlags = MOUL::NetMessage::e_HasPlayerID
@@ -423,10 +781,53 @@ void dm_bcast_sdl_state(GameHost_Private* host, GameClient_Private* client,
     bcast->m_object = update->m_object;
     bcast->m_persistOnServer = update->m_persistOnServer;
     bcast->m_playerId = client->m_clientInfo.m_PlayerId;
-    bcast->m_sdlBlob = state.toBlob();
-    bcast->m_timestamp.setNow();
-    dm_propagate(host, bcast, bcast->m_playerId);
+
+    DS::BufferStream* fullBuf;
+    {
+        bcast->m_sdlBlob = state.toBlob();
+        DM_WRITEBUF(bcast);
+        fullBuf = _msgbuf;
+    }
+    DS::BufferStream* deltaBuf = nullptr;
+    if (&changes != &state) {
+        bcast->m_sdlBlob = changes.toBlob();
+        DM_WRITEBUF(bcast);
+        if (_msgbuf->size() < fullBuf->size())
+            deltaBuf = _msgbuf;
+        else
+            DM_UNREFBUF();
+    }
     bcast->unref();
+
+    DS::BufferStream coalesceKey;
+    update->m_object.write(&coalesceKey);
+    coalesceKey.writeBytes(state.descriptor()->m_name.c_str(),
+                           state.descriptor()->m_name.size());
+    std::string key(reinterpret_cast<const char*>(coalesceKey.buffer()), coalesceKey.size());
+
+    uint64_t sent = 0, saved = 0;
+    {
+        std::lock_guard<std::mutex> clientGuard(host->m_clientMutex);
+        for (const auto& it : host->m_clients) {
+            if (it.second->m_clientInfo.m_PlayerId == client->m_clientInfo.m_PlayerId)
+                continue;
+            if (deltaBuf && !it.second->m_broadcast.coalescing()) {
+                dm_send(it.second, deltaBuf, true);
+                sent += deltaBuf->size();
+                saved += fullBuf->size() - deltaBuf->size();
+            } else {
+                dm_send(it.second, fullBuf, true, key);
+                sent += fullBuf->size();
+            }
+        }
+    }
+    host->m_sdlBroadcasts.fetch_add(1, std::memory_order_relaxed);
+    host->m_sdlBytes.fetch_add(sent, std::memory_order_relaxed);
+    host->m_sdlBytesSaved.fetch_add(saved, std::memory_order_relaxed);
+
+    if (deltaBuf)
+        deltaBuf->unref();
+    fullBuf->unref();
 }
 
 void dm_read_sdl(GameHost_Private* host, GameClient_Private* client,
@@ -459,32 +860,36 @@ void dm_read_sdl(GameHost_Private* host, GameClient_Private* client,
     if (state->m_object.m_name == "AgeSDLHook") {
         host->m_localState.add(update);
         host->m_ageSdlHook.add(update);
+        host->m_ageSdlHookSnapshot.clear();
+        dm_invalidate_snapshot(host);
         dm_local_sdl_update(host, host->m_localState.toBlob());
         if (bcast)
-            dm_bcast_sdl_state(host, client, state, host->m_ageSdlHook);
+            dm_bcast_sdl_state(host, client, state, host->m_ageSdlHook, update);
     } else {
         auto fobj = host->m_states.find(state->m_object);
         if (fobj == host->m_states.end() || fobj->second.find(update.descriptor()->m_name) == fobj->second.end()) {
-            GameState gs;
+            GameState& gs = host->m_states[state->m_object][update.descriptor()->m_name];
             gs.m_isAvatar = state->m_isAvatar;
             gs.m_persist = state->m_persistOnServer;
             gs.m_state = update;
-            host->m_states[state->m_object][update.descriptor()->m_name] = gs;
+            dm_invalidate_snapshot(host);
 
             if (state->m_persistOnServer)
-                dm_save_sdl_state(host, update.descriptor()->m_name, state->m_object, update);
+                dm_save_sdl_state(host, update.descriptor()->m_name, state->m_object, gs);
             if (bcast)
-                dm_bcast_sdl_state(host, client, state, update);
+                dm_bcast_sdl_state(host, client, state, update, update);
         } else {
             GameState& gs = host->m_states[state->m_object][update.descriptor()->m_name];
             gs.m_isAvatar = state->m_isAvatar;
             gs.m_persist = state->m_persistOnServer;
             gs.m_state.add(update);
+            gs.m_snapshot.clear();
+            dm_invalidate_snapshot(host);
 
             if (state->m_persistOnServer)
-                dm_save_sdl_state(host, update.descriptor()->m_name, state->m_object, gs.m_state);
+                dm_save_sdl_state(host, update.descriptor()->m_name, state->m_object, gs);
             if (bcast)
-                dm_bcast_sdl_state(host, client, state, gs.m_state);
+                dm_bcast_sdl_state(host, client, state, gs.m_state, update);
         }
     }
 }
@@ -546,13 +951,14 @@ void dm_send_members(GameHost_Private* host, GameClient_Private* client)
     }
     host->m_clientMutex.unlock();
 
-    DM_SENDMSG(members, client);
+    // Everything goes out together as one prepared batch
+    DS::BufferStream* batch = new DS::BufferStream();
+    dm_write_prepared(batch, members);
     members->unref();
 
     // Load non-avatar clones (ie NPC quabs)
-    for (auto clone_iter = host->m_clones.begin(); clone_iter != host->m_clones.end(); ++clone_iter) {
-        DM_SENDMSG(clone_iter->second, client);
-    }
+    for (auto clone_iter = host->m_clones.begin(); clone_iter != host->m_clones.end(); ++clone_iter)
+        dm_write_prepared(batch, clone_iter->second);
 
     // Load clones for players already in the age
     MOUL::NetMsgLoadClone* cloneMsg = MOUL::NetMsgLoadClone::Create();
@@ -581,11 +987,14 @@ void dm_send_members(GameHost_Private* host, GameClient_Private* client)
                 && !client->m_clientKey.isNull()) {
                 avatarMsg->m_cloneKey = client_iter->second->m_clientKey;
                 avatarMsg->m_originPlayerId = client_iter->second->m_clientInfo.m_PlayerId;
-                DM_SENDMSG(cloneMsg, client);
+                dm_write_prepared(batch, cloneMsg);
             }
         }
     }
     cloneMsg->unref();
+
+    dm_push(client, e_GameToCli_PreparedBatch, batch, true);
+    batch->unref();
 }
 
 void dm_load_clone(GameHost_Private* host, GameClient_Private* client,
@@ -620,8 +1029,77 @@ void dm_load_clone(GameHost_Private* host, GameClient_Private* client,
     }
 }
 
+/* Releases a propagated message, reporting a failure back to its client and
+ * waking the client up if it is waiting for the host to catch up. */
+void dm_propagate_done(Game_PropagateMessage* msg, DS::NetResultCode result)
+{
+    GameClient_Private* client = msg->m_client;
+    delete msg;
+
+    if (result != DS::e_NetSuccess) {
+        DS::BufferStream* error = new DS::BufferStream();
+        error->write<uint32_t>(result);
+        dm_push(client, e_GameToCli_PropagateError, error, true);
+        error->unref();
+    }
+    if (client->m_inFlight.fetch_sub(1) > DS::Settings::GameMaxInFlight())
+        client->m_channel.putMessage(DS::e_NetSuccess);
+}
+
+/* Routes a message that doesn't need to be decoded or rewritten, sending
+ * its original bytes.  Returns false if it needs the full decode. */
+bool dm_forward_message(GameHost_Private* host, Game_PropagateMessage* msg,
+                        const MOUL::NetMessageView& view)
+{
+    GameClient_Private* client = msg->m_client;
+    bool gameMsg = (view.m_type == MOUL::ID_NetMsgGameMessage
+                    || view.m_type == MOUL::ID_NetMsgGameMessageDirected);
+    if (gameMsg && !client->m_isAdmin && !view.gameMsgSafeForNet())
+        return false;
+
+    DS::BufferStream* buffer = new DS::BufferStream();
+    buffer->write<uint32_t>(view.m_type);
+    buffer->write<uint32_t>(msg->m_message.size());
+    uint32_t start = buffer->tell();
+    buffer->writeBytes(msg->m_message.buffer(), msg->m_message.size());
+    if (gameMsg && !(view.m_bcastFlags & MOUL::Message::e_NetNonLocal)) {
+        buffer->seek(start + view.m_bcastFlagsOffset, SEEK_SET);
+        buffer->write<uint32_t>(view.m_bcastFlags | MOUL::Message::e_NetNonLocal);
+    }
+
+    uint32_t sender = client->m_clientInfo.m_PlayerId;
+    if (view.m_type == MOUL::ID_NetMsgGameMessage) {
+        if (client->m_isAdmin && (view.m_contentFlags & MOUL::NetMessage::e_RouteToAllPlayers))
+            dm_broadcast_buffer(buffer, view.m_contentFlags, sender);
+        else
+            dm_propagate_buffer(host, buffer, view.m_contentFlags, sender);
+    } else {
+        dm_propagate_to_buffer(buffer, view.m_contentFlags, view.m_receivers);
+    }
+    buffer->unref();
+    return true;
+}
+
 void dm_game_message(GameHost_Private* host, Game_PropagateMessage* msg)
 {
+    // Most traffic only needs its header inspected; anything unusual goes
+    // through the full decode below, which also reports any errors
+    MOUL::NetMessageView view;
+    bool forwardable;
+    try {
+        forwardable = view.read(msg->m_message);
+    } catch (const std::exception&) {
+        forwardable = false;
+    }
+    if (forwardable && dm_forward_message(host, msg, view)) {
+        dm_propagate_done(msg, DS::e_NetSuccess);
+        return;
+    }
+
+    // Everything decoded or built for this message comes from one arena,
+    // which is released in one go once the message has been handled
+    MOUL::ArenaScope arena;
+
     DS::BlobStream stream(msg->m_message);
     MOUL::NetMessage* netmsg = nullptr;
     try {
@@ -629,7 +1107,7 @@ void dm_game_message(GameHost_Private* host, Game_PropagateMessage* msg)
     } catch (const MOUL::FactoryException&) {
         ST::printf(stderr, "[Game] Warning: Ignoring message: {04X}\n",
                    msg->m_messageType);
-        SEND_REPLY(msg, DS::e_NetInternalError);
+        dm_propagate_done(msg, DS::e_NetInternalError);
         return;
     } catch (const std::exception& ex) {
         // magickal code to print out the name of the offending plMessage
@@ -647,13 +1125,13 @@ void dm_game_message(GameHost_Private* host, Game_PropagateMessage* msg)
             ST::printf(stderr, "[Game] Exception reading net message: {}\n",
                        ex.what());
         }
-        SEND_REPLY(msg, DS::e_NetInternalError);
+        dm_propagate_done(msg, DS::e_NetInternalError);
         return;
     }
     if (!stream.atEof()) {
         ST::printf(stderr, "[Game] Incomplete parse of {04X}\n", netmsg->type());
         netmsg->unref();
-        SEND_REPLY(msg, DS::e_NetInternalError);
+        dm_propagate_done(msg, DS::e_NetInternalError);
         return;
     }
 
@@ -702,7 +1180,11 @@ void dm_game_message(GameHost_Private* host, Game_PropagateMessage* msg)
             dm_read_sdl(host, msg->m_client, netmsg->Cast<MOUL::NetMsgSDLState>(), true);
             break;
         case MOUL::ID_NetMsgRelevanceRegions:
-            //TODO: Filter messages by client's requested relevance regions
+            {
+                MOUL::NetMsgRelevanceRegions* regions = netmsg->Cast<MOUL::NetMsgRelevanceRegions>();
+                msg->m_client->m_regionsICareAbout = std::move(regions->m_regionsICareAbout);
+                msg->m_client->m_regionsIAmIn = std::move(regions->m_regionsIAmIn);
+            }
             break;
         case MOUL::ID_NetMsgLoadClone:
             dm_load_clone(host, msg->m_client, netmsg->Cast<MOUL::NetMsgLoadClone>());
@@ -719,7 +1201,7 @@ void dm_game_message(GameHost_Private* host, Game_PropagateMessage* msg)
         // Client wasn't paying attention
     }
     netmsg->unref();
-    SEND_REPLY(msg, DS::e_NetSuccess);
+    dm_propagate_done(msg, DS::e_NetSuccess);
 }
 
 void dm_bcast_agesdl_hook(GameHost_Private* host)
@@ -763,6 +1245,8 @@ void dm_local_sdl_update(GameHost_Private* host, Game_SdlMessage* msg)
 
     host->m_ageSdlHook.merge(vaultState);
     host->m_ageSdlHook.merge(host->m_globalState);
+    host->m_ageSdlHookSnapshot.clear();
+    dm_invalidate_snapshot(host);
     host->m_localState.merge(vaultState);
     msg->m_node.m_Blob_1 = host->m_localState.toBlob();
 
@@ -777,8 +1261,11 @@ void dm_local_sdl_update(GameHost_Private* host, Game_SdlMessage* msg)
     SEND_REPLY(msg, DS::e_NetSuccess);
 
     s_authChannel.putMessage(e_VaultUpdateNode, reinterpret_cast<void*>(&sdlNode));
-    if (fakeClient.m_channel.getMessage().m_messageType != DS::e_NetSuccess)
-        fputs("[Game] Error writing SDL node back to vault\n", stderr);
+    {
+        DS::ExecutorBlockingScope blocking;
+        if (fakeClient.m_channel.getMessage().m_messageType != DS::e_NetSuccess)
+            fputs("[Game] Error writing SDL node back to vault\n", stderr);
+    }
 
     dm_bcast_agesdl_hook(host);
 }
@@ -786,24 +1273,70 @@ void dm_local_sdl_update(GameHost_Private* host, Game_SdlMessage* msg)
 void dm_global_sdl_update(GameHost_Private* host)
 {
     host->m_ageSdlHook.merge(host->m_globalState);
+    host->m_ageSdlHookSnapshot.clear();
+    dm_invalidate_snapshot(host);
     dm_bcast_agesdl_hook(host);
 }
 
-void dm_gameHost(GameHost_Private* host)
+/* Asks the executor to run the host again in time to write back dirty
+ * states or to stop lingering */
+void dm_set_wake_timer(GameHost_Private* host)
+{
+    std::chrono::steady_clock::time_point wakeTime;
+    if (dm_wake_time(host, wakeTime)) {
+        if (!host->m_timerSet || host->m_timerTime != wakeTime) {
+            DS::ExecutorSetTimer(host, wakeTime);
+            host->m_timerSet = true;
+            host->m_timerTime = wakeTime;
+        }
+    } else if (host->m_timerSet) {
+        DS::ExecutorCancelTimer(host);
+        host->m_timerSet = false;
+    }
+}
+
+/* Handles one batch of messages for the host.  Returns false once the host
+ * has finished shutting down (and been deleted). */
+bool dm_gameHost(GameHost_Private* host)
 {
-    for ( ;; ) {
-        DS::FifoMessage msg { -1, nullptr };
+    if (!host->m_started)
+        return true;
+
+    DS::FifoMessage batch[32];
+    size_t batchSize = 0;
+    try {
+        auto now = std::chrono::steady_clock::now();
+        if (host->m_shutdown != GameHost_Private::e_HostRunning) {
+            // dm_shutdown_step() takes care of the last write
+        } else if (!host->m_dirtyStates.empty() && now >= host->m_stateFlushTime) {
+            dm_flush_sdl_states(host);
+        }
+        if (host->m_lingering && now >= host->m_lingerTime && dm_linger_expired(host))
+            dm_game_shutdown(host);
+        batchSize = host->m_channel.getMessages(batch, false);
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Game] Exception raised processing message: {}\n",
+                   ex.what());
+    }
+
+    for (size_t i = 0; i < batchSize; ++i) {
+        const DS::FifoMessage& msg = batch[i];
         try {
-            msg = host->m_channel.getMessage();
             switch (msg.m_messageType) {
             case e_GameShutdown:
                 dm_game_shutdown(host);
-                return;
+                break;
             case e_GameDisconnect:
                 dm_game_disconnect(host, reinterpret_cast<Game_ClientMessage*>(msg.m_payload));
                 break;
             case e_GameJoinAge:
-                dm_game_join(host, reinterpret_cast<Game_ClientMessage*>(msg.m_payload));
+                if (host->m_shutdown != GameHost_Private::e_HostRunning) {
+                    // Found the host just before it started shutting down
+                    SEND_REPLY(reinterpret_cast<Game_ClientMessage*>(msg.m_payload),
+                               DS::e_NetServerBusy);
+                } else {
+                    dm_game_join(host, reinterpret_cast<Game_ClientMessage*>(msg.m_payload));
+                }
                 break;
             case e_GamePropagate:
                 dm_game_message(host, reinterpret_cast<Game_PropagateMessage*>(msg.m_payload));
@@ -814,6 +1347,9 @@ void dm_gameHost(GameHost_Private* host)
             case e_GameGlobalSdlUpdate:
                 dm_global_sdl_update(host);
                 break;
+            case e_GameStatesFlushed:
+                dm_states_flushed(host);
+                break;
             default:
                 /* Invalid message...  This shouldn't happen */
                 ST::printf(stderr, "[Game] Invalid message ({}) in message queue\n",
@@ -824,7 +1360,10 @@ void dm_gameHost(GameHost_Private* host)
         } catch (const std::exception& ex) {
             ST::printf(stderr, "[Game] Exception raised processing message: {}\n",
                        ex.what());
-            if (msg.m_payload) {
+            if (msg.m_messageType == e_GamePropagate) {
+                dm_propagate_done(reinterpret_cast<Game_PropagateMessage*>(msg.m_payload),
+                                  DS::e_NetInternalError);
+            } else if (msg.m_payload) {
                 // Keep clients from blocking on a reply
                 SEND_REPLY(reinterpret_cast<Game_ClientMessage*>(msg.m_payload),
                            DS::e_NetInternalError);
@@ -832,37 +1371,39 @@ void dm_gameHost(GameHost_Private* host)
         }
     }
 
-    // This line should be unreachable
-    DS_ASSERT(false);
+    if (host->m_shutdown != GameHost_Private::e_HostRunning) {
+        try {
+            if (dm_shutdown_step(host))
+                return false;
+        } catch (const std::exception& ex) {
+            ST::printf(stderr, "[Game] Exception raised shutting down: {}\n", ex.what());
+        }
+    }
+
+    dm_set_wake_timer(host);
+    return true;
 }
 
-GameHost_Private* start_game_host(uint32_t ageMcpId)
+bool GameHost_Private::onRun()
 {
-    PGconn* postgres = PQconnectdb(ST::format(
-                    "host='{}' port='{}' user='{}' password='{}' dbname='{}'",
-                    DS::Settings::DbHostname(), DS::Settings::DbPort(),
-                    DS::Settings::DbUsername(), DS::Settings::DbPassword(),
-                    DS::Settings::DbDbaseName()).c_str());
-    if (PQstatus(postgres) != CONNECTION_OK) {
-        ST::printf(stderr, "Error connecting to postgres: {}", PQerrorMessage(postgres));
-        PQfinish(postgres);
-        return nullptr;
-    }
+    return dm_gameHost(this);
+}
 
-    DS::PGresultRef result = DS::PQexecVA(postgres,
-            "SELECT \"AgeUuid\", \"AgeFilename\", \"AgeIdx\", \"SdlIdx\", \"Temporary\""
-            "    FROM game.\"Servers\" WHERE idx=$1",
-            ageMcpId);
-    if (PQresultStatus(result) != PGRES_TUPLES_OK) {
-        PQ_PRINT_ERROR(postgres, SELECT);
-        result.reset();
-        PQfinish(postgres);
+GameHost_Private* start_game_host(uint32_t ageMcpId)
+{
+    DS::PGresultRef result;
+    game_db_call(ageMcpId, [&result, ageMcpId](PGconn* postgres) {
+        result = DS::PQexecVA(postgres,
+                DS_STATEMENT("SELECT \"AgeUuid\", \"AgeFilename\", \"AgeIdx\", \"SdlIdx\", \"Temporary\""
+                             "    FROM game.\"Servers\" WHERE idx=$1"),
+                ageMcpId);
+        if (PQresultStatus(result) != PGRES_TUPLES_OK)
+            PQ_PRINT_ERROR(postgres, SELECT);
+    });
+    if (PQresultStatus(result) != PGRES_TUPLES_OK)
         return nullptr;
-    }
     if (PQntuples(result) == 0) {
         ST::printf(stderr, "[Game] Age MCP {} not found\n", ageMcpId);
-        result.reset();
-        PQfinish(postgres);
         return nullptr;
     } else {
         if (PQntuples(result) != 1) {
@@ -871,12 +1412,12 @@ GameHost_Private* start_game_host(uint32_t ageMcpId)
         }
 
         GameHost_Private* host = new GameHost_Private();
+        host->m_channel.setWakeup([host] { DS::ExecutorSchedule(host); });
         host->m_instanceId = PQgetvalue(result, 0, 0);
         host->m_ageFilename = PQgetvalue(result, 0, 1);
         host->m_ageIdx = strtoul(PQgetvalue(result, 0, 2), nullptr, 10);
         host->m_gameMaster = 0;
         host->m_serverIdx = ageMcpId;
-        host->m_postgres = postgres;
         host->m_temp = strcmp("t", PQgetvalue(result, 0, 4)) == 0;
 
         // Fetch the age states
@@ -891,7 +1432,6 @@ GameHost_Private* start_game_host(uint32_t ageMcpId)
         DS::FifoMessage reply = fakeClient.m_channel.getMessage();
         if (reply.m_messageType != DS::e_NetSuccess) {
             fputs("[Game] Error fetching Age SDL\n", stderr);
-            PQfinish(postgres);
             delete host;
             return nullptr;
         }
@@ -904,7 +1444,6 @@ GameHost_Private* start_game_host(uint32_t ageMcpId)
         } catch (const std::exception& ex) {
             ST::printf(stderr, "[SDL] Error parsing Age SDL state for {}: {}\n",
                        host->m_ageFilename, ex.what());
-            PQfinish(postgres);
             delete host;
             return nullptr;
         }
@@ -928,24 +1467,35 @@ GameHost_Private* start_game_host(uint32_t ageMcpId)
         }
         host->m_ageSdlHook.merge(host->m_globalState);
 
+        // Nobody can reach this host until it's in s_gameHosts, so start
+        // out lingering with the caller's join pending
+        host->m_pendingJoins = 1;
+        dm_start_linger(host);
+
         s_gameHostMutex.lock();
         s_gameHosts[ageMcpId] = host;
         s_gameHostMutex.unlock();
 
         // Fetch initial server state
-        result = DS::PQexecVA(host->m_postgres,
-                "SELECT \"Descriptor\", \"ObjectKey\", \"SdlBlob\""
-                "    FROM game.\"AgeStates\" WHERE \"ServerIdx\"=$1",
-                host->m_serverIdx);
+        result.reset();
+        game_db_call(ageMcpId, [&result, ageMcpId](PGconn* postgres) {
+            result = DS::PQexecVA(postgres,
+                    DS_STATEMENT("SELECT \"Descriptor\", \"ObjectKey\", \"SdlBlob\""
+                                 "    FROM game.\"AgeStates\" WHERE \"ServerIdx\"=$1",
+                                 DS::PGStatement::e_BinaryResults),
+                    ageMcpId);
+            if (PQresultStatus(result) != PGRES_TUPLES_OK)
+                PQ_PRINT_ERROR(postgres, SELECT);
+        });
         if (PQresultStatus(result) != PGRES_TUPLES_OK) {
-            PQ_PRINT_ERROR(host->m_postgres, SELECT);
+            // Already reported
         } else {
             int count = PQntuples(result);
 
             for (int i=0; i<count; ++i) {
-                DS::Blob objblob = DS::Base64Decode(PQgetvalue(result, i, 1));
+                DS::Blob objblob = DS::PQgetBlob(result, i, 1);
                 DS::BlobStream bsObject(objblob);
-                DS::Blob sdlblob = DS::Base64Decode(PQgetvalue(result, i, 2));
+                DS::Blob sdlblob = DS::PQgetBlob(result, i, 2);
                 MOUL::Uoid key;
                 key.read(&bsObject);
                 try {
@@ -965,8 +1515,9 @@ GameHost_Private* start_game_host(uint32_t ageMcpId)
             }
         }
 
-        std::thread threadh(&dm_gameHost, host);
-        threadh.detach();
+        ++s_coldStarts;
+        host->m_started = true;
+        DS::ExecutorSchedule(host);
         return host;
     }
 }
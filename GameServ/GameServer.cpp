@@ -16,6 +16,8 @@
  ******************************************************************************/
 
 #include "GameServer_Private.h"
+#include "GameDb.h"
+#include "NetIO/HandshakePool.h"
 #include "settings.h"
 #include "errors.h"
 #include <string_theory/format>
@@ -35,40 +37,25 @@
 
 void game_client_init(GameClient_Private& client)
 {
-    /* Game client header:  size, account uuid, age instance uuid */
-    uint32_t size = DS::RecvValue<uint32_t>(client.m_sock);
-    if (size != 36)
-        throw DS::InvalidConnectionHeader();
-    DS::Uuid clientUuid, connUuid;
-    DS::RecvBuffer(client.m_sock, clientUuid.m_bytes, sizeof(clientUuid.m_bytes));
-    DS::RecvBuffer(client.m_sock, connUuid.m_bytes, sizeof(connUuid.m_bytes));
+    // The connection request was already read in full (see m_connect)
 
     /* Reply header */
     client.m_buffer.truncate();
     client.m_buffer.write<uint8_t>(DS::e_ServToCliEncrypt);
 
     /* Establish encryption, and write reply body */
-    uint8_t msgId = DS::RecvValue<uint8_t>(client.m_sock);
-    if (msgId != DS::e_CliToServConnect)
-        throw DS::InvalidConnectionHeader();
-    uint8_t msgSize = DS::RecvValue<uint8_t>(client.m_sock);
-    if (msgSize == 2) {
+    uint8_t Y[64];
+    if (!client.m_connect.clientKey(Y)) {
         // no seed... client wishes unencrypted connection (that's okay, nobody
         // else can "fake" us as nobody has the private key, so if the client
         // actually wants encryption it will only work with the correct peer)
         client.m_buffer.write<uint8_t>(2); // reply with an empty seed as well
+        client.m_crypt = DS::CryptStateInit(nullptr, 0);
     } else {
-        uint8_t Y[64];
-        memset(Y, 0, sizeof(Y));
-        if (msgSize > 66)
-            throw DS::InvalidConnectionHeader();
-        DS::RecvBuffer(client.m_sock, Y, 64 - (66 - msgSize));
-        BYTE_SWAP_BUFFER(Y, 64);
-
         uint8_t serverSeed[7];
         uint8_t sharedKey[7];
-        DS::CryptEstablish(serverSeed, sharedKey, DS::Settings::CryptKey(DS::e_KeyGame_N),
-                           DS::Settings::CryptKey(DS::e_KeyGame_K), Y);
+        DS::CryptEstablish(serverSeed, sharedKey,
+                           DS::CryptKeyFromSettings(DS::e_KeyGame_N, DS::e_KeyGame_K), Y);
         client.m_crypt = DS::CryptStateInit(sharedKey, 7);
 
         client.m_buffer.write<uint8_t>(9);
@@ -79,21 +66,68 @@ void game_client_init(GameClient_Private& client)
     DS::SendBuffer(client.m_sock, client.m_buffer.buffer(), client.m_buffer.size());
 }
 
+// Finds a running host, and holds it for a join (see GameJoin)
 GameHost_Private* find_game_host(uint32_t ageMcpId)
 {
+    std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
+    hostmap_t::iterator host_iter = s_gameHosts.find(ageMcpId);
+    if (host_iter == s_gameHosts.end())
+        return nullptr;
+
+    GameHost_Private* host = host_iter->second;
+    ++host->m_pendingJoins;
+    return host;
+}
+
+/* Starting a host means waiting on the database and the auth daemon, so
+ * it's done on the executor rather than on the client's event loop.  The
+ * host (held for the join), or nullptr if it couldn't be started, is then
+ * handed back on the client's channel. */
+class GameHostStarter : public DS::ExecutorTask
+{
+public:
+    GameHostStarter(uint32_t ageMcpId, DS::MsgChannel* channel)
+        : m_ageMcpId(ageMcpId), m_channel(channel) { }
+
+    bool onRun() override
     {
-        std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
-        hostmap_t::iterator host_iter = s_gameHosts.find(ageMcpId);
-        if (host_iter != s_gameHosts.end())
-            return host_iter->second;
-    }
-    try {
-        return start_game_host(ageMcpId);
-    } catch (const std::exception& ex) {
-        ST::printf(stderr, "[Game] ERROR: {}\n", ex.what());
+        GameHost_Private* host = nullptr;
+        {
+            DS::ExecutorBlockingScope blocking;
+
+            // Another client may have started it in the meantime
+            host = find_game_host(m_ageMcpId);
+            if (!host) {
+                try {
+                    host = start_game_host(m_ageMcpId);
+                } catch (const std::exception& ex) {
+                    ST::printf(stderr, "[Game] ERROR: {}\n", ex.what());
+                }
+            }
+        }
+        m_channel->putMessage(DS::e_NetSuccess, reinterpret_cast<void*>(host));
+        delete this;
+        return false;
     }
-    return nullptr;
-}
+
+    bool runPending() override { return false; }
+
+private:
+    uint32_t m_ageMcpId;
+    DS::MsgChannel* m_channel;
+};
+
+/* A join in progress.  The host may shut down again once the join is over,
+ * however it ends. */
+struct GameJoin
+{
+    GameHost_Private* m_host;
+    Auth_NodeInfo m_nodeInfo;
+    Game_ClientMessage m_msg;
+
+    explicit GameJoin(GameHost_Private* host) : m_host(host) { }
+    ~GameJoin() { --m_host->m_pendingJoins; }
+};
 
 void cb_ping(GameClient_Private& client)
 {
@@ -105,6 +139,44 @@ void cb_ping(GameClient_Private& client)
     SEND_REPLY();
 }
 
+static void game_join(GameClient_Private& client, GameHost_Private* host)
+{
+    auto join = std::make_shared<GameJoin>(host);
+
+    // Get player info from the vault
+    join->m_nodeInfo.m_client = &client;
+    join->m_nodeInfo.m_node.set_NodeIdx(client.m_clientInfo.m_PlayerId);
+    s_authChannel.putMessage(e_VaultFetchNode, reinterpret_cast<void*>(&join->m_nodeInfo));
+
+    client.awaitReply(client.m_channel, [&client, join](const DS::FifoMessage& reply) {
+        if (reply.m_messageType != DS::e_NetSuccess) {
+            client.m_buffer.write<uint32_t>(reply.m_messageType);
+            SEND_REPLY();
+            return;
+        }
+        client.m_clientInfo.set_PlayerName(join->m_nodeInfo.m_node.m_IString64_1);
+        client.m_clientInfo.set_CCRLevel(0);
+        join->m_msg.m_client = &client;
+        join->m_host->m_channel.putMessage(e_GameJoinAge, reinterpret_cast<void*>(&join->m_msg));
+
+        client.awaitReply(client.m_channel, [&client, join](const DS::FifoMessage& reply) {
+            client.m_buffer.write<uint32_t>(reply.m_messageType);
+            if (reply.m_messageType == DS::e_NetSuccess) {
+                // Registered before the reply goes out, so the host still
+                // hears about the disconnect if sending it fails
+                GameHost_Private* host = join->m_host;
+                host->m_clientMutex.lock();
+                host->m_clients[client.m_clientInfo.m_PlayerId] = &client;
+                host->m_clientMutex.unlock();
+                client.m_host = host;
+                s_gameClients.add(client.m_clientInfo.m_PlayerId, &client);
+            }
+
+            SEND_REPLY();
+        });
+    });
+}
+
 void cb_join(GameClient_Private& client)
 {
     START_REPLY(e_GameToCli_JoinAgeReply);
@@ -116,8 +188,6 @@ void cb_join(GameClient_Private& client)
     // correctly send a reply if the server isn't found.
     uint32_t mcpId = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
 
-    Game_ClientMessage msg;
-    msg.m_client = &client;
     DS::CryptRecvBuffer(client.m_sock, client.m_crypt, client.m_clientId.m_bytes,
                         sizeof(client.m_clientId.m_bytes));
     client.m_clientInfo.set_PlayerId(DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt));
@@ -127,53 +197,47 @@ void cb_join(GameClient_Private& client)
         return;
     }
 
-    client.m_host = find_game_host(mcpId);
-    if (!client.m_host) {
-        ST::printf(stderr, "Could not find a game host for {}\n", mcpId);
-        client.m_buffer.write<uint32_t>(DS::e_NetInternalError);
-        SEND_REPLY();
-        return;
-    }
-
-    // Get player info from the vault
-    Auth_NodeInfo nodeInfo;
-    nodeInfo.m_client = &client;
-    nodeInfo.m_node.set_NodeIdx(client.m_clientInfo.m_PlayerId);
-    s_authChannel.putMessage(e_VaultFetchNode, reinterpret_cast<void*>(&nodeInfo));
-
-    DS::FifoMessage reply = client.m_channel.getMessage();
-    if (reply.m_messageType != DS::e_NetSuccess) {
-        client.m_buffer.write<uint32_t>(reply.m_messageType);
-        SEND_REPLY();
+    // Only hand the host to the client once it has actually joined; a
+    // host with no clients can linger out and be deleted at any time
+    GameHost_Private* host = find_game_host(mcpId);
+    if (host) {
+        game_join(client, host);
         return;
     }
-    msg.m_client->m_clientInfo.set_PlayerName(nodeInfo.m_node.m_IString64_1);
-    msg.m_client->m_clientInfo.set_CCRLevel(0);
-    client.m_host->m_channel.putMessage(e_GameJoinAge, reinterpret_cast<void*>(&msg));
-
-    reply = client.m_channel.getMessage();
-    client.m_buffer.write<uint32_t>(reply.m_messageType);
 
-    SEND_REPLY();
-
-    client.m_host->m_clientMutex.lock();
-    client.m_host->m_clients[client.m_clientInfo.m_PlayerId] = &client;
-    client.m_host->m_clientMutex.unlock();
+    DS::ExecutorSchedule(new GameHostStarter(mcpId, &client.m_channel));
+    client.awaitReply(client.m_channel, [&client, mcpId](const DS::FifoMessage& reply) {
+        GameHost_Private* host = reinterpret_cast<GameHost_Private*>(reply.m_payload);
+        if (!host) {
+            ST::printf(stderr, "Could not find a game host for {}\n", mcpId);
+            client.m_buffer.write<uint32_t>(DS::e_NetInternalError);
+            SEND_REPLY();
+            return;
+        }
+        game_join(client, host);
+    });
 }
 
 void cb_netmsg(GameClient_Private& client)
 {
-    Game_PropagateMessage msg;
-    msg.m_client = &client;
-    msg.m_messageType = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    uint32_t messageType = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
 
     uint32_t size = DS::CryptRecvSize(client.m_sock, client.m_crypt);
     std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
     DS::CryptRecvBuffer(client.m_sock, client.m_crypt, buffer.get(), size);
-    msg.m_message = DS::Blob::Steal(buffer.release(), size);
     if (client.m_host) {
-        client.m_host->m_channel.putMessage(e_GamePropagate, reinterpret_cast<void*>(&msg));
-        client.m_channel.getMessage();
+        // The host owns the message from here and reports failures through
+        // the broadcast queue, so only stop reading from the client if too
+        // much is outstanding.  dm_propagate_done() lets us know once the
+        // host has caught up.
+        Game_PropagateMessage* msg = new Game_PropagateMessage;
+        msg->m_client = &client;
+        msg->m_messageType = messageType;
+        msg->m_message = DS::Blob::Steal(buffer.release(), size);
+        uint32_t inFlight = ++client.m_inFlight;
+        client.m_host->m_channel.putMessage(e_GamePropagate, reinterpret_cast<void*>(msg));
+        if (inFlight > DS::Settings::GameMaxInFlight())
+            client.awaitReply(client.m_channel, [](const DS::FifoMessage&) { });
     } else {
         ST::printf(stderr, "Client {} sent a game message with no game host connection\n",
                    DS::SockIpAddress(client.m_sock));
@@ -226,14 +290,95 @@ void cb_sockRead(GameClient_Private& client)
 
 void cb_broadcast(GameClient_Private& client)
 {
-    DS::FifoMessage bcast = client.m_broadcast.getMessage();
-    DS::BufferStream* msg = reinterpret_cast<DS::BufferStream*>(bcast.m_payload);
-    START_REPLY(bcast.m_messageType);
-    client.m_buffer.writeBytes(msg->buffer(), msg->size());
-    msg->unref();
-    SEND_REPLY();
+    DS::FifoMessage batch[16];
+    size_t count = client.m_broadcast.getMessages(batch);
+    for (size_t i = 0; i < count; ++i) {
+        DS::BufferStream* msg = reinterpret_cast<DS::BufferStream*>(batch[i].m_payload);
+        uint16_t msgId = batch[i].m_messageType;
+        if (msgId == e_GameToCli_PropagateError) {
+            uint32_t result = *reinterpret_cast<const uint32_t*>(msg->buffer());
+            if (client.m_propagateErrors++ == 0) {
+                ST::printf(stderr, "[Game] {}: Failed to propagate a message (error {})\n",
+                           DS::SockIpAddress(client.m_sock), result);
+            }
+            msg->unref();
+            continue;
+        }
+        try {
+            // The payload is shared by every recipient, so send it in place
+            if (msgId == e_GameToCli_PreparedBatch) {
+                DS::CryptSendBuffer(client.m_sock, client.m_crypt, msg->buffer(),
+                                    msg->size());
+            } else {
+                DS::CryptSendMessage(client.m_sock, client.m_crypt, &msgId, sizeof(msgId),
+                                     msg->buffer(), msg->size());
+            }
+        } catch (...) {
+            // Don't leak the rest of the batch
+            for (size_t j = i; j < count; ++j)
+                reinterpret_cast<DS::BufferStream*>(batch[j].m_payload)->unref();
+            throw;
+        }
+        msg->unref();
+    }
+}
+
+
+static void game_release(GameClient_Private& client)
+{
+    // Drain the broadcast queue
+    client.m_broadcast.clear();
+
+    DS::CryptStateFree(client.m_crypt);
+    DS::FreeSock(client.m_sock);
+}
+
+void game_disconnect(GameClient_Private& client)
+{
+    if (!client.m_host) {
+        game_release(client);
+        return;
+    }
+
+    client.m_host->m_clientMutex.lock();
+    client.m_host->m_clients.erase(client.m_clientInfo.m_PlayerId);
+    client.m_host->m_clientMutex.unlock();
+    s_gameClients.remove(client.m_clientInfo.m_PlayerId, &client);
+    auto msg = std::make_shared<Game_ClientMessage>();
+    msg->m_client = &client;
+    try {
+        client.m_host->m_channel.putMessage(e_GameDisconnect, reinterpret_cast<void*>(msg.get()));
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Game] WARNING: {}\n", ex.what());
+        game_release(client);
+        return;
+    }
+
+    // The host may still refer to the client until it replies
+    client.awaitReply(client.m_channel, [&client, msg](const DS::FifoMessage&) {
+        game_release(client);
+    });
+}
+
+void GameClient_Private::onConnect()
+{
+    game_client_init(*this);
 }
 
+void GameClient_Private::onSockRead()
+{
+    cb_sockRead(*this);
+}
+
+void GameClient_Private::onEvent()
+{
+    cb_broadcast(*this);
+}
+
+void GameClient_Private::onDisconnect()
+{
+    game_disconnect(*this);
+}
 
 void wk_gameWorker(DS::SocketHandle sockp)
 {
@@ -242,15 +387,20 @@ void wk_gameWorker(DS::SocketHandle sockp)
     client.m_host = nullptr;
     client.m_crypt = nullptr;
     client.m_isLoaded = false;
+    client.m_inFlight = 0;
+    client.m_propagateErrors = 0;
 
     try {
-        game_client_init(client);
+        client.m_connect.read(sockp);
+        DS::HandshakeRun(sockp, [&client] { game_client_init(client); });
     } catch (const DS::InvalidConnectionHeader& ex) {
         ST::printf(stderr, "[Game] Invalid connection header from {}\n",
                    DS::SockIpAddress(sockp));
+        game_disconnect(client);
         return;
     } catch (const DS::SockHup&) {
         // Socket closed...
+        game_disconnect(client);
         return;
     }
 
@@ -263,16 +413,18 @@ void wk_gameWorker(DS::SocketHandle sockp)
         fds[1].events = POLLIN;
 
         for ( ;; ) {
-            int result = poll(fds, 2, NET_TIMEOUT * 1000);
+            // Data already buffered by the crypt layer won't wake up poll()
+            bool pending = DS::CryptRecvPending(client.m_crypt);
+            int result = poll(fds, 2, pending ? 0 : NET_TIMEOUT * 1000);
             if (result < 0) {
                 ST::printf(stderr, "[Game] Failed to poll for events: {}\n",
                            strerror(errno));
                 throw DS::SockHup();
             }
-            if (result == 0 || fds[0].revents & (POLLERR | POLLHUP | POLLNVAL) || fds[1].revents & (POLLERR | POLLNVAL))
+            if ((result == 0 && !pending) || fds[0].revents & (POLLERR | POLLHUP | POLLNVAL) || fds[1].revents & (POLLERR | POLLNVAL))
                 throw DS::SockHup();
 
-            if (fds[0].revents & POLLIN)
+            if (pending || fds[0].revents & POLLIN)
                 cb_sockRead(client);
             if (fds[1].revents & POLLIN)
                 cb_broadcast(client);
@@ -284,32 +436,7 @@ void wk_gameWorker(DS::SocketHandle sockp)
                    DS::SockIpAddress(sockp), ex.what());
     }
 
-    if (client.m_host) {
-        client.m_host->m_clientMutex.lock();
-        client.m_host->m_clients.erase(client.m_clientInfo.m_PlayerId);
-        client.m_host->m_clientMutex.unlock();
-        Game_ClientMessage msg;
-        msg.m_client = &client;
-        try {
-            client.m_host->m_channel.putMessage(e_GameDisconnect, reinterpret_cast<void*>(&msg));
-            client.m_channel.getMessage();
-        } catch (const std::exception& ex) {
-            ST::printf(stderr, "[Game] WARNING: {}\n", ex.what());
-        }
-    }
-
-    // Drain the broadcast channel
-    try {
-        while (client.m_broadcast.hasMessage()) {
-            DS::FifoMessage msg = client.m_broadcast.getMessage();
-            reinterpret_cast<DS::BufferStream*>(msg.m_payload)->unref();
-        }
-    } catch (const std::exception& ex) {
-        ST::printf(stderr, "[Game] WARNING: {}\n", ex.what());
-    }
-
-    DS::CryptStateFree(client.m_crypt);
-    DS::FreeSock(client.m_sock);
+    game_disconnect(client);
 }
 
 static int sel_age(const dirent* de)
@@ -386,6 +513,9 @@ void DS::GameServer_Init()
         }
         free(dirls);
     }
+
+    game_db_start();
+    DS::StartExecutor(DS::Settings::GameHostThreads());
 }
 
 void DS::GameServer_Add(DS::SocketHandle client)
@@ -395,8 +525,20 @@ void DS::GameServer_Add(DS::SocketHandle client)
         ST::printf("Connecting GAME on {}\n", DS::SockIpAddress(client));
 #endif
 
-    std::thread threadh(&wk_gameWorker, client);
-    threadh.detach();
+    if (DS::Settings::ThreadPerClient()) {
+        std::thread threadh(&wk_gameWorker, client);
+        threadh.detach();
+        return;
+    }
+
+    GameClient_Private* game = new GameClient_Private;
+    game->m_sock = client;
+    game->m_host = nullptr;
+    game->m_crypt = nullptr;
+    game->m_isLoaded = false;
+    game->m_inFlight = 0;
+    game->m_propagateErrors = 0;
+    DS::ReactorAdd(game);
 }
 
 void DS::GameServer_Shutdown()
@@ -413,17 +555,22 @@ void DS::GameServer_Shutdown()
         }
     }
 
+    // Hosts give their clients up to 5 seconds before saving, so allow
+    // some time on top of that for the final writes
     bool complete = false;
-    for (int i=0; i<50 && !complete; ++i) {
+    for (int i=0; i<100 && !complete; ++i) {
         s_gameHostMutex.lock();
         size_t alive = s_gameHosts.size();
         s_gameHostMutex.unlock();
-        if (alive == 0)
+        if (alive == 0 && s_closingHosts == 0)
             complete = true;
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
     if (!complete)
-        fputs("[Game] Servers didn't die after 5 seconds!\n", stderr);
+        fputs("[Game] Servers didn't die after 10 seconds!\n", stderr);
+
+    DS::StopExecutor();
+    game_db_stop();
 }
 
 void DS::GameServer_UpdateGlobalSDL(const ST::string& age)
@@ -443,42 +590,127 @@ void DS::GameServer_UpdateGlobalSDL(const ST::string& age)
 
 uint32_t DS::GameServer_UpdateVaultSDL(const DS::Vault::Node& node, uint32_t ageMcpId)
 {
-    std::lock_guard<std::mutex> lock(s_gameHostMutex);
-    hostmap_t::iterator host_iter = s_gameHosts.find(ageMcpId);
+    // The host has to be held while we wait for it, rather than the host
+    // list, since a lingering host takes s_gameHostMutex to shut down
     GameHost_Private* host = nullptr;
-    if (host_iter != s_gameHosts.end())
+    {
+        std::lock_guard<std::mutex> lock(s_gameHostMutex);
+        hostmap_t::iterator host_iter = s_gameHosts.find(ageMcpId);
+        if (host_iter == s_gameHosts.end())
+            return DS::e_NetAgeNotFound;
         host = host_iter->second;
+        ++host->m_pendingJoins;
+    }
 
-    if (host) {
-        GameClient_Private client;
-        Game_SdlMessage msg;
-        msg.m_client = &client;
-        msg.m_node = node.copy();
-        try {
-            host->m_channel.putMessage(e_GameLocalSdlUpdate, &msg);
-            return client.m_channel.getMessage().m_messageType;
-        } catch (const std::exception& ex) {
-            ST::printf(stderr, "[Game] WARNING: {}\n", ex.what());
-        }
+    uint32_t result = DS::e_NetAgeNotFound;
+    GameClient_Private client;
+    Game_SdlMessage msg;
+    msg.m_client = &client;
+    msg.m_node = node.copy();
+    try {
+        host->m_channel.putMessage(e_GameLocalSdlUpdate, &msg);
+        result = client.m_channel.getMessage().m_messageType;
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Game] WARNING: {}\n", ex.what());
     }
-    return DS::e_NetAgeNotFound;
+    --host->m_pendingJoins;
+    return result;
 }
 
 void DS::GameServer_DisplayClients()
 {
+    GameHostPoolStats pool = GameServer_HostPoolStats();
+    ST::printf("Game hosts: {} cold starts, {} warm, {} lingering; {} threads, "
+               "{} runnable, {} runs, {} steals; {} database jobs queued\n",
+               pool.m_coldStarts, pool.m_warmStarts, pool.m_lingering,
+               pool.m_workers, pool.m_runnable, pool.m_runs, pool.m_steals,
+               pool.m_dbQueued);
+
     std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
     if (s_gameHosts.size())
         fputs("Game Servers:\n", stdout);
     for (hostmap_t::iterator host_iter = s_gameHosts.begin(); host_iter != s_gameHosts.end(); ++host_iter) {
-        ST::printf("    {} {}\n", host_iter->second->m_ageFilename,
-                   host_iter->second->m_instanceId.toString(true));
+        ST::printf("    {} {} (queue: {}, peak {}; SDL: {} updates, {} bytes, {} saved; "
+                   "irrelevant: {} messages, {} bytes)\n",
+                   host_iter->second->m_ageFilename,
+                   host_iter->second->m_instanceId.toString(true),
+                   host_iter->second->m_channel.depth(),
+                   host_iter->second->m_channel.peakDepth(),
+                   host_iter->second->m_sdlBroadcasts.load(),
+                   host_iter->second->m_sdlBytes.load(),
+                   host_iter->second->m_sdlBytesSaved.load(),
+                   host_iter->second->m_irrelevantMessages.load(),
+                   host_iter->second->m_irrelevantBytes.load());
         std::lock_guard<std::mutex> clientGuard(host_iter->second->m_clientMutex);
         for (auto client_iter = host_iter->second->m_clients.begin();
-             client_iter != host_iter->second->m_clients.end(); ++ client_iter)
-            ST::printf("      * {} - {} ({})\n", DS::SockIpAddress(client_iter->second->m_sock),
+             client_iter != host_iter->second->m_clients.end(); ++ client_iter) {
+            const DS::BroadcastQueue& queue = client_iter->second->m_broadcast;
+            ST::printf("      * {} - {} ({}) queue: {}, {} bytes, peak {} bytes, "
+                       "dropped {}, coalesced {}; in flight: {}, errors: {}\n",
+                       DS::SockIpAddress(client_iter->second->m_sock),
                        client_iter->second->m_clientInfo.m_PlayerName,
-                       client_iter->second->m_clientInfo.m_PlayerId);
+                       client_iter->second->m_clientInfo.m_PlayerId,
+                       queue.depth(), queue.bytes(), queue.peakBytes(),
+                       queue.dropped(), queue.coalesced(),
+                       client_iter->second->m_inFlight.load(),
+                       client_iter->second->m_propagateErrors.load());
+        }
+    }
+}
+
+DS::BroadcastQueueStats DS::GameServer_QueueStats()
+{
+    BroadcastQueueStats stats;
+    std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
+    for (const auto& host : s_gameHosts) {
+        std::lock_guard<std::mutex> clientGuard(host.second->m_clientMutex);
+        for (const auto& client : host.second->m_clients)
+            stats.add(client.second->m_broadcast);
+    }
+    return stats;
+}
+
+std::vector<DS::GameAgeStats> DS::GameServer_AgeStats()
+{
+    std::vector<GameAgeStats> stats;
+    std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
+    stats.reserve(s_gameHosts.size());
+    for (const auto& host : s_gameHosts) {
+        GameAgeStats age;
+        age.m_ageFilename = host.second->m_ageFilename;
+        age.m_instanceId = host.second->m_instanceId;
+        {
+            std::lock_guard<std::mutex> clientGuard(host.second->m_clientMutex);
+            age.m_clients = host.second->m_clients.size();
+        }
+        age.m_sdlBroadcasts = host.second->m_sdlBroadcasts.load(std::memory_order_relaxed);
+        age.m_sdlBytes = host.second->m_sdlBytes.load(std::memory_order_relaxed);
+        age.m_sdlBytesSaved = host.second->m_sdlBytesSaved.load(std::memory_order_relaxed);
+        age.m_irrelevantMessages = host.second->m_irrelevantMessages.load(std::memory_order_relaxed);
+        age.m_irrelevantBytes = host.second->m_irrelevantBytes.load(std::memory_order_relaxed);
+        stats.push_back(age);
+    }
+    return stats;
+}
+
+DS::GameHostPoolStats DS::GameServer_HostPoolStats()
+{
+    GameHostPoolStats stats;
+    stats.m_coldStarts = s_coldStarts.load(std::memory_order_relaxed);
+    stats.m_warmStarts = s_warmStarts.load(std::memory_order_relaxed);
+    DS::ExecutorStats executor = DS::ExecutorGetStats();
+    stats.m_workers = executor.m_workers;
+    stats.m_runnable = executor.m_queued;
+    stats.m_runs = executor.m_runs;
+    stats.m_steals = executor.m_steals;
+    stats.m_dbQueued = game_db_queued();
+    stats.m_lingering = 0;
+    std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
+    for (const auto& host : s_gameHosts) {
+        if (host.second->m_lingering)
+            ++stats.m_lingering;
     }
+    return stats;
 }
 
 uint32_t DS::GameServer_GetNumClients(Uuid instance)
@@ -19,8 +19,10 @@
 #define _DS_GAMESERVER_H
 
 #include "NetIO/SockIO.h"
+#include "NetIO/BroadcastQueue.h"
 #include "Types/Uuid.h"
 #include <exception>
+#include <vector>
 
 namespace DS
 {
@@ -35,7 +37,30 @@ namespace DS
     void GameServer_UpdateGlobalSDL(const ST::string& age);
     uint32_t GameServer_UpdateVaultSDL(const DS::Vault::Node& node, uint32_t ageMcpId);
 
+    struct GameAgeStats
+    {
+        ST::string m_ageFilename;
+        Uuid m_instanceId;
+        size_t m_clients;
+        uint64_t m_sdlBroadcasts, m_sdlBytes, m_sdlBytesSaved;
+        uint64_t m_irrelevantMessages, m_irrelevantBytes;
+    };
+
+    struct GameHostPoolStats
+    {
+        uint64_t m_coldStarts, m_warmStarts;
+        size_t m_lingering, m_dbQueued;
+
+        // Threads running the hosts, hosts waiting for one, and how often
+        // a host ran or was taken over by another thread
+        size_t m_workers, m_runnable;
+        uint64_t m_runs, m_steals;
+    };
+
     void GameServer_DisplayClients();
+    BroadcastQueueStats GameServer_QueueStats();
+    std::vector<GameAgeStats> GameServer_AgeStats();
+    GameHostPoolStats GameServer_HostPoolStats();
     uint32_t GameServer_GetNumClients(Uuid instance);
 }
 
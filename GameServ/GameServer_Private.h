@@ -19,7 +19,11 @@
 #include "AuthServ/AuthClient.h"
 #include "NetIO/CryptIO.h"
 #include "NetIO/MsgChannel.h"
+#include "NetIO/Reactor.h"
+#include "NetIO/HandshakePool.h"
+#include "NetIO/Executor.h"
 #include "Types/Uuid.h"
+#include "Types/BitVector.h"
 #include "PlasMOUL/factory.h"
 #include "PlasMOUL/NetMessages/NetMsgMembersList.h"
 #include "PlasMOUL/NetMessages/NetMsgLoadClone.h"
@@ -28,8 +32,12 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <list>
+#include <vector>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
 
 enum GameServer_MsgIds
 {
@@ -38,32 +46,67 @@ enum GameServer_MsgIds
 
     e_GameToCli_PingReply = 0, e_GameToCli_JoinAgeReply,
     e_GameToCli_PropagateBuffer, e_GameToCli_GameMgrMsg,
+
+    // Not sent as such: the payload is a series of complete messages, each
+    // with its own message ID, to be sent back to back
+    e_GameToCli_PreparedBatch = 0x8000,
+
+    // Not sent: the host reporting that a propagated message failed, with
+    // the DS::NetResultCode as the payload
+    e_GameToCli_PropagateError,
 };
 
 struct GameState
 {
     bool m_persist;
     bool m_isAvatar;
+    bool m_dirty;       // Changed since it was last written to the database
     SDL::State m_state;
+
+    // Initial state message for joining clients; empty when out of date
+    std::string m_snapshot;
+
+    GameState() : m_persist(), m_isAvatar(), m_dirty() { }
 };
 
 typedef std::unordered_map<ST::string, GameState, ST::hash> sdlnamemap_t;
 typedef std::unordered_map<MOUL::Uoid, sdlnamemap_t, MOUL::UoidHash> sdlstatemap_t;
 typedef std::unordered_map<MOUL::Uoid, uint32_t, MOUL::UoidHash> lockmap_t;
 
-struct GameClient_Private : public AuthClient_Private
+struct GameClient_Private : public AuthClient_Private, public DS::ReactorClient
 {
     struct GameHost_Private* m_host;
     DS::BufferStream m_buffer;
 
+    // Game client header:  size, account uuid, age instance uuid
+    DS::ConnectRequest m_connect { 36 };
+
     DS::Uuid m_clientId;
     MOUL::ClientGuid m_clientInfo;
     MOUL::Uoid m_clientKey;
     bool m_isLoaded;
     bool m_isAdmin;
+
+    // Propagated messages handed to the host and not yet processed, and
+    // how many of them failed
+    std::atomic<uint32_t> m_inFlight, m_propagateErrors;
+
+    // From the client's NetMsgRelevanceRegions; only used on the host thread
+    DS::BitVector m_regionsICareAbout, m_regionsIAmIn;
+
+    DS::SocketHandle sock() const override { return m_sock; }
+    DS::CryptState cryptState() const override { return m_crypt; }
+    int eventFd() override { return m_broadcast.fd(); }
+    bool recvPending() override { return DS::CryptRecvPending(m_crypt); }
+    bool onConnectRead() override { return m_connect.readSome(m_sock); }
+    void onConnect() override;
+    void onSockRead() override;
+    void onEvent() override;
+    void onDisconnect() override;
+    const char* serviceName() const override { return "Game"; }
 };
 
-struct GameHost_Private
+struct GameHost_Private : public DS::ExecutorTask
 {
     DS::Uuid m_instanceId;
     ST::string m_ageFilename;
@@ -78,21 +121,135 @@ struct GameHost_Private
     std::mutex m_gmMutex;
     DS::MsgChannel m_channel;
 
-    PGconn* m_postgres;
     sdlstatemap_t m_states;
 
+    // Persistent states waiting to be written back, and when that's due
+    std::vector<std::pair<MOUL::Uoid, ST::string>> m_dirtyStates;
+    std::chrono::steady_clock::time_point m_stateFlushTime;
+
+    // States being written back on a shared database connection, and
+    // whether that worked.  Only one write is in flight at a time.
+    std::vector<std::pair<MOUL::Uoid, ST::string>> m_flushingStates;
+    std::future<bool> m_flushResult;
+
     uint32_t m_sdlIdx;
     SDL::State m_globalState;
     SDL::State m_localState;
     SDL::State m_ageSdlHook;
 
+    // Initial age state sent to joining clients, as prepared batches built
+    // from each state's cached message.  Cleared whenever a state changes.
+    std::vector<DS::BufferStream*> m_snapshot;
+    std::string m_ageSdlHookSnapshot;
+
+    // SDL broadcasts, and bytes sent or saved by sending only the changed
+    // variables (summed over all recipients)
+    std::atomic<uint64_t> m_sdlBroadcasts, m_sdlBytes, m_sdlBytesSaved;
+
+    // Sends skipped because the receiver isn't interested in the sender's
+    // relevance regions
+    std::atomic<uint64_t> m_irrelevantMessages, m_irrelevantBytes;
+
+    // Joins that have looked this host up but haven't added their client
+    // yet, and anyone else waiting on the host.  The host can't shut down
+    // while any are pending.
+    std::atomic<uint32_t> m_pendingJoins;
+
+    // Set while the age is empty; it shuts down at m_lingerTime unless
+    // someone joins before then
+    std::atomic<bool> m_lingering;
+    std::chrono::steady_clock::time_point m_lingerTime;
+
+    // Set once anyone has joined, so the first join after a cold start
+    // isn't counted as a warm start
+    bool m_joined = false;
+
+    // Set once the host is loaded and may process messages, and when the
+    // executor was last asked to wake it up
+    std::atomic<bool> m_started;
+    bool m_timerSet = false;
+    std::chrono::steady_clock::time_point m_timerTime;
+
+    // Rather than holding up an executor thread, a host that is shutting
+    // down keeps being run until its clients are gone (or the deadline has
+    // passed) and its states are saved
+    enum ShutdownState { e_HostRunning, e_HostDraining, e_HostSaving, e_HostSaved };
+    ShutdownState m_shutdown = e_HostRunning;
+    std::chrono::steady_clock::time_point m_shutdownDeadline;
+
     bool m_temp;
+
+    bool onRun() override;
+    bool runPending() override { return m_started && m_channel.hasMessage(); }
 };
 
 typedef std::unordered_map<uint32_t, GameHost_Private*> hostmap_t;
 extern hostmap_t s_gameHosts;
 extern std::mutex s_gameHostMutex;
 
+// Age instances loaded from the database, and joins that found an empty
+// age still lingering
+extern std::atomic<uint64_t> s_coldStarts, s_warmStarts;
+
+// Hosts that have started shutting down but haven't been deleted yet
+extern std::atomic<uint32_t> s_closingHosts;
+
+/* Every joined game client in any age, by player ID.  The index is split
+ * into shards, so delivering a message to a player only locks that player's
+ * shard.  A client is removed before it is torn down, and stays valid while
+ * it is being visited. */
+class GameClientIndex
+{
+public:
+    void add(uint32_t playerId, GameClient_Private* client)
+    {
+        Shard& shard = m_shards[playerId % e_NumShards];
+        std::lock_guard<std::mutex> guard(shard.m_mutex);
+        shard.m_clients[playerId] = client;
+    }
+
+    void remove(uint32_t playerId, GameClient_Private* client)
+    {
+        Shard& shard = m_shards[playerId % e_NumShards];
+        std::lock_guard<std::mutex> guard(shard.m_mutex);
+        auto iter = shard.m_clients.find(playerId);
+        if (iter != shard.m_clients.end() && iter->second == client)
+            shard.m_clients.erase(iter);
+    }
+
+    template <typename Visitor>
+    bool visit(uint32_t playerId, Visitor&& visitor)
+    {
+        Shard& shard = m_shards[playerId % e_NumShards];
+        std::lock_guard<std::mutex> guard(shard.m_mutex);
+        auto iter = shard.m_clients.find(playerId);
+        if (iter == shard.m_clients.end())
+            return false;
+        visitor(iter->second);
+        return true;
+    }
+
+    template <typename Visitor>
+    void visitAll(Visitor&& visitor)
+    {
+        for (Shard& shard : m_shards) {
+            std::lock_guard<std::mutex> guard(shard.m_mutex);
+            for (const auto& client : shard.m_clients)
+                visitor(client.second);
+        }
+    }
+
+private:
+    enum { e_NumShards = 32 };
+
+    struct Shard
+    {
+        std::mutex m_mutex;
+        std::unordered_map<uint32_t, GameClient_Private*> m_clients;
+    } m_shards[e_NumShards];
+};
+extern GameClientIndex s_gameClients;
+
 struct Game_AgeInfo
 {
     uint32_t m_startTime, m_lingerTime;
@@ -110,7 +267,7 @@ extern agemap_t s_ages;
 enum GameHostMessages
 {
     e_GameShutdown, e_GameDisconnect, e_GameJoinAge, e_GamePropagate,
-    e_GameLocalSdlUpdate, e_GameGlobalSdlUpdate
+    e_GameLocalSdlUpdate, e_GameGlobalSdlUpdate, e_GameStatesFlushed
 };
 
 struct Game_ClientMessage
@@ -17,6 +17,8 @@
 
 #include "GateServ.h"
 #include "NetIO/CryptIO.h"
+#include "NetIO/Reactor.h"
+#include "NetIO/HandshakePool.h"
 #include "Types/Uuid.h"
 #include "settings.h"
 #include "streams.h"
@@ -26,11 +28,23 @@
 #include <mutex>
 #include <chrono>
 
-struct GateKeeper_Private
+struct GateKeeper_Private : public DS::ReactorClient
 {
     DS::SocketHandle m_sock;
     DS::CryptState m_crypt;
     DS::BufferStream m_buffer;
+
+    // Gate Keeper header:  size, null uuid
+    DS::ConnectRequest m_connect { 20 };
+
+    DS::SocketHandle sock() const override { return m_sock; }
+    DS::CryptState cryptState() const override { return m_crypt; }
+    bool recvPending() override { return DS::CryptRecvPending(m_crypt); }
+    bool onConnectRead() override { return m_connect.readSome(m_sock); }
+    void onConnect() override;
+    void onSockRead() override;
+    void onDisconnect() override;
+    const char* serviceName() const override { return "GateKeeper"; }
 };
 
 static std::list<GateKeeper_Private*> s_clients;
@@ -55,39 +69,25 @@ enum GateKeeper_MsgIds
 
 void gate_init(GateKeeper_Private& client)
 {
-    /* Gate Keeper header:  size, null uuid */
-    uint32_t size = DS::RecvValue<uint32_t>(client.m_sock);
-    if (size != 20)
-        throw DS::InvalidConnectionHeader();
-    DS::Uuid uuid;
-    DS::RecvBuffer(client.m_sock, uuid.m_bytes, sizeof(uuid.m_bytes));
+    // The connection request was already read in full (see m_connect)
 
     /* Reply header */
     client.m_buffer.truncate();
     client.m_buffer.write<uint8_t>(DS::e_ServToCliEncrypt);
 
     /* Establish encryption, and write reply body */
-    uint8_t msgId = DS::RecvValue<uint8_t>(client.m_sock);
-    if (msgId != DS::e_CliToServConnect)
-        throw DS::InvalidConnectionHeader();
-    uint8_t msgSize = DS::RecvValue<uint8_t>(client.m_sock);
-    if (msgSize == 2) {
+    uint8_t Y[64];
+    if (!client.m_connect.clientKey(Y)) {
         // no seed... client wishes unencrypted connection (that's okay, nobody
         // else can "fake" us as nobody has the private key, so if the client
         // actually wants encryption it will only work with the correct peer)
         client.m_buffer.write<uint8_t>(2); // reply with an empty seed as well
+        client.m_crypt = DS::CryptStateInit(nullptr, 0);
     } else {
-        uint8_t Y[64];
-        memset(Y, 0, sizeof(Y));
-        if (msgSize > 66)
-            throw DS::InvalidConnectionHeader();
-        DS::RecvBuffer(client.m_sock, Y, 64 - (66 - msgSize));
-        BYTE_SWAP_BUFFER(Y, 64);
-
         uint8_t serverSeed[7];
         uint8_t sharedKey[7];
-        DS::CryptEstablish(serverSeed, sharedKey, DS::Settings::CryptKey(DS::e_KeyGate_N),
-                           DS::Settings::CryptKey(DS::e_KeyGate_K), Y);
+        DS::CryptEstablish(serverSeed, sharedKey,
+                           DS::CryptKeyFromSettings(DS::e_KeyGate_N, DS::e_KeyGate_K), Y);
         client.m_crypt = DS::CryptStateInit(sharedKey, 7);
 
         client.m_buffer.write<uint8_t>(9);
@@ -153,6 +153,59 @@ void cb_authServIpAddress(GateKeeper_Private& client)
     SEND_REPLY();
 }
 
+void cb_sockRead(GateKeeper_Private& client)
+{
+    uint16_t msgId = DS::CryptRecvValue<uint16_t>(client.m_sock, client.m_crypt);
+    switch (msgId) {
+    case e_CliToGateKeeper_PingRequest:
+        cb_ping(client);
+        break;
+    case e_CliToGateKeeper_FileServIpAddressRequest:
+        cb_fileServIpAddress(client);
+        break;
+    case e_CliToGateKeeper_AuthServIpAddressRequest:
+        cb_authServIpAddress(client);
+        break;
+    default:
+        /* Invalid message */
+        ST::printf(stderr, "[GateKeeper] Got invalid message ID {} from {}\n",
+                   msgId, DS::SockIpAddress(client.m_sock));
+        DS::ShutdownSock(client.m_sock);
+        throw DS::SockHup();
+    }
+}
+
+void gate_disconnect(GateKeeper_Private& client)
+{
+    s_clientMutex.lock();
+    auto client_iter = s_clients.begin();
+    while (client_iter != s_clients.end()) {
+        if (*client_iter == &client)
+            client_iter = s_clients.erase(client_iter);
+        else
+            ++client_iter;
+    }
+    s_clientMutex.unlock();
+
+    DS::CryptStateFree(client.m_crypt);
+    DS::FreeSock(client.m_sock);
+}
+
+void GateKeeper_Private::onConnect()
+{
+    gate_init(*this);
+}
+
+void GateKeeper_Private::onSockRead()
+{
+    cb_sockRead(*this);
+}
+
+void GateKeeper_Private::onDisconnect()
+{
+    gate_disconnect(*this);
+}
+
 void wk_gateKeeper(DS::SocketHandle sockp)
 {
     GateKeeper_Private client;
@@ -164,28 +217,11 @@ void wk_gateKeeper(DS::SocketHandle sockp)
     s_clientMutex.unlock();
 
     try {
-        gate_init(client);
-
-        for ( ;; ) {
-            uint16_t msgId = DS::CryptRecvValue<uint16_t>(client.m_sock, client.m_crypt);
-            switch (msgId) {
-            case e_CliToGateKeeper_PingRequest:
-                cb_ping(client);
-                break;
-            case e_CliToGateKeeper_FileServIpAddressRequest:
-                cb_fileServIpAddress(client);
-                break;
-            case e_CliToGateKeeper_AuthServIpAddressRequest:
-                cb_authServIpAddress(client);
-                break;
-            default:
-                /* Invalid message */
-                ST::printf(stderr, "[GateKeeper] Got invalid message ID {} from {}\n",
-                           msgId, DS::SockIpAddress(client.m_sock));
-                DS::CloseSock(client.m_sock);
-                throw DS::SockHup();
-            }
-        }
+        client.m_connect.read(sockp);
+        DS::HandshakeRun(sockp, [&client] { gate_init(client); });
+
+        for ( ;; )
+            cb_sockRead(client);
     } catch (const DS::SockHup&) {
         // Socket closed...
     } catch (const std::exception& ex) {
@@ -193,18 +229,7 @@ void wk_gateKeeper(DS::SocketHandle sockp)
                    DS::SockIpAddress(sockp), ex.what());
     }
 
-    s_clientMutex.lock();
-    auto client_iter = s_clients.begin();
-    while (client_iter != s_clients.end()) {
-        if (*client_iter == &client)
-            client_iter = s_clients.erase(client_iter);
-        else
-            ++client_iter;
-    }
-    s_clientMutex.unlock();
-
-    DS::CryptStateFree(client.m_crypt);
-    DS::FreeSock(client.m_sock);
+    gate_disconnect(client);
 }
 
 void DS::GateKeeper_Init()
@@ -217,8 +242,21 @@ void DS::GateKeeper_Add(DS::SocketHandle client)
         ST::printf("Connecting GATE on {}\n", DS::SockIpAddress(client));
 #endif
 
-    std::thread threadh(&wk_gateKeeper, client);
-    threadh.detach();
+    if (DS::Settings::ThreadPerClient()) {
+        std::thread threadh(&wk_gateKeeper, client);
+        threadh.detach();
+        return;
+    }
+
+    GateKeeper_Private* gate = new GateKeeper_Private;
+    gate->m_crypt = nullptr;
+
+    s_clientMutex.lock();
+    gate->m_sock = client;
+    s_clients.push_back(gate);
+    s_clientMutex.unlock();
+
+    DS::ReactorAdd(gate);
 }
 
 void DS::GateKeeper_Shutdown()
@@ -226,7 +264,7 @@ void DS::GateKeeper_Shutdown()
     {
         std::lock_guard<std::mutex> clientGuard(s_clientMutex);
         for (auto client_iter = s_clients.begin(); client_iter != s_clients.end(); ++client_iter)
-            DS::CloseSock((*client_iter)->m_sock);
+            DS::ShutdownSock((*client_iter)->m_sock);
     }
 
     bool complete = false;
@@ -0,0 +1,186 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "BroadcastQueue.h"
+#include "SockIO.h"
+#include <algorithm>
+
+/* Payload-less messages wake the consumer up to flush coalesced messages */
+#define QUEUE_FLUSH_MARKER (-1)
+
+static std::atomic<uint64_t> s_evictions(0);
+
+DS::BroadcastQueue::BroadcastQueue()
+    : BroadcastQueue(DS::Settings::QueueOverflowPolicy(), DS::Settings::QueueBytes(),
+                     DS::Settings::QueueMessages())
+{ }
+
+DS::BroadcastQueue::BroadcastQueue(QueuePolicy policy, size_t maxBytes, size_t maxMessages)
+    : m_policy(policy), m_maxBytes(maxBytes), m_maxMessages(maxMessages),
+      m_bytes(0), m_peakBytes(0), m_dropped(0), m_coalesced(0),
+      m_evicted(false), m_pendingCount(0)
+{ }
+
+void DS::BroadcastQueue::addBytes(size_t bytes)
+{
+    size_t total = m_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = m_peakBytes.load(std::memory_order_relaxed);
+    while (total > peak && !m_peakBytes.compare_exchange_weak(peak, total,
+                                                              std::memory_order_relaxed))
+        ;
+}
+
+DS::BroadcastQueue::PushResult DS::BroadcastQueue::push(int type, BufferStream* buffer,
+        bool reliable, const std::string& coalesceKey)
+{
+    if (m_evicted.load(std::memory_order_relaxed))
+        return e_Dropped;
+
+    size_t size = buffer->size();
+    size_t bytes = m_bytes.load(std::memory_order_relaxed);
+    size_t messages = depth();
+    bool overBudget = (bytes + size > m_maxBytes) || (messages + 1 > m_maxMessages);
+
+    if (m_policy == e_QueueCoalesce && !coalesceKey.empty()
+            && (overBudget || m_pendingCount.load(std::memory_order_relaxed) > 0)) {
+        // Once anything is held back, all updates for coalesced keys must
+        // go through here so they can't overtake each other.
+        std::lock_guard<std::mutex> guard(m_coalesceMutex);
+        auto iter = m_pending.find(coalesceKey);
+        buffer->ref();
+        if (iter != m_pending.end()) {
+            m_bytes.fetch_sub(iter->second.m_buffer->size(), std::memory_order_relaxed);
+            iter->second.m_buffer->unref();
+            iter->second.m_type = type;
+            iter->second.m_buffer = buffer;
+            m_coalesced.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            m_pending.emplace(coalesceKey, Pending { type, buffer });
+            if (m_pendingCount.fetch_add(1, std::memory_order_relaxed) == 0)
+                m_channel.putMessage(QUEUE_FLUSH_MARKER);
+        }
+        addBytes(size);
+        return e_Coalesced;
+    }
+
+    if (overBudget) {
+        bool overLimit = (bytes + size > m_maxBytes * 2) || (messages + 1 > m_maxMessages * 2);
+        if (m_policy == e_QueueDisconnect || (reliable && overLimit)) {
+            if (m_evicted.exchange(true))
+                return e_Dropped;
+            s_evictions.fetch_add(1, std::memory_order_relaxed);
+            // Wake up the consumer so it notices the eviction
+            m_channel.putMessage(QUEUE_FLUSH_MARKER);
+            return e_Evict;
+        }
+        if (!reliable) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return e_Dropped;
+        }
+    }
+
+    buffer->ref();
+    addBytes(size);
+    m_channel.putMessage(type, buffer);
+    return e_Queued;
+}
+
+bool DS::BroadcastQueue::coalescing() const
+{
+    if (m_policy != e_QueueCoalesce)
+        return false;
+    return m_pendingCount.load(std::memory_order_relaxed) > 0
+        || bytes() >= m_maxBytes || depth() >= m_maxMessages;
+}
+
+size_t DS::BroadcastQueue::getMessages(FifoMessage* messages, size_t count)
+{
+    if (m_evicted.load(std::memory_order_relaxed))
+        throw DS::SockHup();
+
+    size_t fetched = m_channel.getMessages(messages, count, false);
+    size_t result = 0;
+    for (size_t i = 0; i < fetched; ++i) {
+        if (!messages[i].m_payload)
+            continue;
+        BufferStream* buffer = reinterpret_cast<BufferStream*>(messages[i].m_payload);
+        m_bytes.fetch_sub(buffer->size(), std::memory_order_relaxed);
+        messages[result++] = messages[i];
+    }
+
+    // Coalesced messages go out once everything queued before them has
+    if (fetched < count && m_pendingCount.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> guard(m_coalesceMutex);
+        auto iter = m_pending.begin();
+        while (iter != m_pending.end() && result < count) {
+            m_bytes.fetch_sub(iter->second.m_buffer->size(), std::memory_order_relaxed);
+            messages[result].m_messageType = iter->second.m_type;
+            messages[result].m_payload = iter->second.m_buffer;
+            ++result;
+            iter = m_pending.erase(iter);
+        }
+        m_pendingCount.store(m_pending.size(), std::memory_order_relaxed);
+        if (!m_pending.empty())
+            m_channel.putMessage(QUEUE_FLUSH_MARKER);
+    }
+
+    return result;
+}
+
+void DS::BroadcastQueue::clear()
+{
+    FifoMessage messages[32];
+    for ( ;; ) {
+        size_t count = m_channel.getMessages(messages, false);
+        if (count == 0)
+            break;
+        for (size_t i = 0; i < count; ++i) {
+            if (messages[i].m_payload)
+                reinterpret_cast<BufferStream*>(messages[i].m_payload)->unref();
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(m_coalesceMutex);
+    for (auto& pending : m_pending)
+        pending.second.m_buffer->unref();
+    m_pending.clear();
+    m_pendingCount.store(0, std::memory_order_relaxed);
+    m_bytes.store(0, std::memory_order_relaxed);
+}
+
+size_t DS::BroadcastQueue::depth() const
+{
+    return m_channel.depth() + m_pendingCount.load(std::memory_order_relaxed);
+}
+
+void DS::BroadcastQueueStats::add(const BroadcastQueue& queue)
+{
+    size_t messages = queue.depth();
+    size_t bytes = queue.bytes();
+    ++m_queues;
+    m_messages += messages;
+    m_bytes += bytes;
+    m_maxMessages = std::max(m_maxMessages, messages);
+    m_maxBytes = std::max(m_maxBytes, bytes);
+    m_dropped += queue.dropped();
+    m_coalesced += queue.coalesced();
+}
+
+uint64_t DS::BroadcastQueue_Evictions()
+{
+    return s_evictions.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,130 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _DS_BROADCASTQUEUE_H
+#define _DS_BROADCASTQUEUE_H
+
+#include "MsgChannel.h"
+#include "streams.h"
+#include "settings.h"
+#include <unordered_map>
+#include <string>
+#include <mutex>
+
+namespace DS
+{
+    /* Outbound message queue for a single client, bounded by the byte and
+     * message budgets from the settings.  Once a client falls behind far
+     * enough to exceed its budget, new messages are handled according to
+     * the configured policy:
+     *
+     *  - e_QueueDropUnreliable: Messages not marked reliable are dropped.
+     *  - e_QueueCoalesce: Additionally, messages with a coalesce key only
+     *    keep the newest copy for each key until the client catches up.
+     *  - e_QueueDisconnect: The client is evicted immediately.
+     *
+     * Reliable messages are still queued past the budget, but a client
+     * using twice its budget is always evicted.
+     */
+    class BroadcastQueue
+    {
+    public:
+        enum PushResult
+        {
+            e_Queued, e_Coalesced, e_Dropped,
+
+            // The client just exceeded its hard limit, and should be
+            // disconnected by the caller.  Further messages are dropped.
+            e_Evict
+        };
+
+        // Uses the budget and policy from the settings
+        BroadcastQueue();
+        BroadcastQueue(QueuePolicy policy, size_t maxBytes, size_t maxMessages);
+        ~BroadcastQueue() { clear(); }
+
+        int fd() { return m_channel.fd(); }
+
+        // Queues a reference to buffer.  Safe to call from any thread.
+        PushResult push(int type, BufferStream* buffer, bool reliable,
+                        const std::string& coalesceKey = std::string());
+
+        // Retrieves up to count messages without blocking.  The caller
+        // takes over the reference held on each payload.  Throws SockHup
+        // once the client has been evicted.
+        size_t getMessages(FifoMessage* messages, size_t count);
+
+        template <size_t count>
+        size_t getMessages(FifoMessage (&messages)[count])
+        {
+            return getMessages(messages, count);
+        }
+
+        // Releases all pending messages
+        void clear();
+
+        size_t depth() const;
+        size_t bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+        size_t peakBytes() const { return m_peakBytes.load(std::memory_order_relaxed); }
+        uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+        uint64_t coalesced() const { return m_coalesced.load(std::memory_order_relaxed); }
+        bool evicted() const { return m_evicted.load(std::memory_order_relaxed); }
+
+        // True while pushes with a coalesce key may be held back, so they
+        // could be delivered after messages pushed later without one.
+        bool coalescing() const;
+
+    private:
+        struct Pending
+        {
+            int m_type;
+            BufferStream* m_buffer;
+        };
+
+        MsgChannel m_channel;
+        QueuePolicy m_policy;
+        size_t m_maxBytes, m_maxMessages;
+
+        std::atomic<size_t> m_bytes, m_peakBytes;
+        std::atomic<uint64_t> m_dropped, m_coalesced;
+        std::atomic<bool> m_evicted;
+
+        std::mutex m_coalesceMutex;
+        std::unordered_map<std::string, Pending> m_pending;
+        std::atomic<size_t> m_pendingCount;
+
+        void addBytes(size_t bytes);
+    };
+
+    struct BroadcastQueueStats
+    {
+        size_t m_queues, m_messages, m_bytes;
+        size_t m_maxMessages, m_maxBytes;
+        uint64_t m_dropped, m_coalesced;
+
+        BroadcastQueueStats()
+            : m_queues(), m_messages(), m_bytes(), m_maxMessages(),
+              m_maxBytes(), m_dropped(), m_coalesced() { }
+
+        void add(const BroadcastQueue& queue);
+    };
+
+    // Number of clients evicted for exceeding their queue budget
+    uint64_t BroadcastQueue_Evictions();
+}
+
+#endif
@@ -25,6 +25,7 @@
 #include <cstdio>
 #include <mutex>
 #include <memory>
+#include <vector>
 #include <regex>
 
 #ifdef DEBUG
@@ -34,8 +35,9 @@ std::mutex s_commdebug_mutex;
 
 static void init_rand()
 {
-    static bool _rand_seeded = false;
-    if (!_rand_seeded) {
+    // Handshakes run on several threads at once
+    static std::once_flag s_randSeeded;
+    std::call_once(s_randSeeded, [] {
         struct {
             pid_t   mypid;
             timeval now;
@@ -58,8 +60,7 @@ static void init_rand()
         }
         fclose(urand);
         RAND_seed(&_random, sizeof(_random));
-        _rand_seeded = true;
-    }
+    });
 }
 
 void DS::GenPrimeKeys(uint8_t* N, uint8_t* K)
@@ -106,14 +107,73 @@ void DS::CryptCalcX(uint8_t* X, const uint8_t* N, const uint8_t* K, uint32_t bas
     BN_CTX_free(ctx);
 }
 
-void DS::CryptEstablish(uint8_t* seed, uint8_t* key, const uint8_t* N,
-                        const uint8_t* K, const uint8_t* Y)
+struct CryptKey_Private
+{
+    BIGNUM* m_N;
+    BIGNUM* m_K;
+    BN_MONT_CTX* m_mont;
+};
+
+/* BN_CTX is scratch space for the big number routines, so each thread
+ * keeps its own rather than allocating one per handshake */
+static BN_CTX* thread_bn_ctx()
+{
+    static thread_local std::unique_ptr<BN_CTX, decltype(&BN_CTX_free)>
+            s_ctx(BN_CTX_new(), &BN_CTX_free);
+    return s_ctx.get();
+}
+
+DS::CryptKey DS::CryptKeyInit(const uint8_t* N, const uint8_t* K)
+{
+    CryptKey_Private* keyp = new CryptKey_Private;
+    keyp->m_N = BN_bin2bn(reinterpret_cast<const unsigned char*>(N), 64, nullptr);
+    keyp->m_K = BN_bin2bn(reinterpret_cast<const unsigned char*>(K), 64, nullptr);
+    keyp->m_mont = nullptr;
+
+    // N is prime (and therefore odd) unless the keys were never configured
+    if (!BN_is_zero(keyp->m_N)) {
+        keyp->m_mont = BN_MONT_CTX_new();
+        if (!BN_MONT_CTX_set(keyp->m_mont, keyp->m_N, thread_bn_ctx())) {
+            BN_MONT_CTX_free(keyp->m_mont);
+            keyp->m_mont = nullptr;
+        }
+    }
+    return reinterpret_cast<CryptKey>(keyp);
+}
+
+void DS::CryptKeyFree(DS::CryptKey key)
+{
+    if (!key)
+        return;
+
+    CryptKey_Private* keyp = reinterpret_cast<CryptKey_Private*>(key);
+    BN_MONT_CTX_free(keyp->m_mont);
+    BN_free(keyp->m_N);
+    BN_free(keyp->m_K);
+    delete keyp;
+}
+
+DS::CryptKey DS::CryptKeyFromSettings(DS::KeyType N, DS::KeyType K)
+{
+    static std::once_flag s_keyOnce[e_KeyMaxTypes];
+    static CryptKey s_keys[e_KeyMaxTypes];
+
+    DS_ASSERT(static_cast<int>(N) >= 0 && static_cast<int>(N) < e_KeyMaxTypes);
+    std::call_once(s_keyOnce[N], [N, K] {
+        s_keys[N] = CryptKeyInit(DS::Settings::CryptKey(N), DS::Settings::CryptKey(K));
+    });
+    return s_keys[N];
+}
+
+void DS::CryptEstablish(uint8_t* seed, uint8_t* key, DS::CryptKey serverKey,
+                        const uint8_t* Y)
 {
+    const CryptKey_Private* keyp = reinterpret_cast<const CryptKey_Private*>(serverKey);
+    DS_ASSERT(keyp->m_mont);
+
     BIGNUM* bn_Y = BN_new();
-    BIGNUM* bn_N = BN_new();
-    BIGNUM* bn_K = BN_new();
     BIGNUM* bn_seed = BN_new();
-    BN_CTX* ctx = BN_CTX_new();
+    BN_CTX* ctx = thread_bn_ctx();
 
     /* Random 7-byte server seed */
     init_rand();
@@ -121,39 +181,105 @@ void DS::CryptEstablish(uint8_t* seed, uint8_t* key, const uint8_t* N,
 
     /* client = Y ^ K % N */
     BN_bin2bn(reinterpret_cast<const unsigned char*>(Y), 64, bn_Y);
-    BN_bin2bn(reinterpret_cast<const unsigned char*>(N), 64, bn_N);
-    BN_bin2bn(reinterpret_cast<const unsigned char*>(K), 64, bn_K);
-    DS_ASSERT(!BN_is_zero(bn_N));
-    BN_mod_exp(bn_seed, bn_Y, bn_K, bn_N, ctx);
+    BN_mod_exp_mont(bn_seed, bn_Y, keyp->m_K, keyp->m_N, ctx, keyp->m_mont);
 
     /* Apply server seed for establishing crypt state with client */
     uint8_t keybuf[64];
-    if (BN_num_bytes(bn_seed) > 64)
+    if (BN_num_bytes(bn_seed) > 64) {
+        BN_free(bn_Y);
+        BN_free(bn_seed);
         throw DS::InvalidConnectionHeader();
+    }
     size_t outBytes = BN_bn2bin(bn_seed, reinterpret_cast<unsigned char*>(keybuf));
     BYTE_SWAP_BUFFER(keybuf, outBytes);
     for (size_t i=0; i<7; ++i)
         key[i] = keybuf[i] ^ seed[i];
 
     BN_free(bn_Y);
-    BN_free(bn_N);
-    BN_free(bn_K);
     BN_free(bn_seed);
-    BN_CTX_free(ctx);
 }
 
 
+#ifdef DEBUG
+static void commdebug_dump(const char* direction, const DS::SocketHandle sock,
+                           const iovec* parts, size_t count)
+{
+    std::lock_guard<std::mutex> commdebugGuard(s_commdebug_mutex);
+    ST::printf("{} {}", direction, DS::SockIpAddress(sock));
+    size_t pos = 0;
+    for (size_t p=0; p<count; ++p) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(parts[p].iov_base);
+        for (size_t i=0; i<parts[p].iov_len; ++i, ++pos) {
+            if ((pos % 16) == 0)
+                fputs("\n    ", stdout);
+            else if ((pos % 16) == 8)
+                fputs("   ", stdout);
+            ST::printf("{02X} ", data[i]);
+        }
+    }
+    fputc('\n', stdout);
+}
+#endif
+
+/* Incoming data is read in chunks of up to this size and decrypted in one
+ * pass, so individual field reads can be served from memory.
+ */
+#define CRYPT_RECV_BUFFER_SIZE (16 * 1024)
+
+/* Outgoing data is encrypted directly into a ring of this size, which is
+ * flushed with writev() whenever it fills up and at the end of each send.
+ */
+#define CRYPT_SEND_BUFFER_SIZE (16 * 1024)
+
 struct CryptState_Private
 {
     RC4_KEY m_writeKey;
     RC4_KEY m_readKey;
+    bool m_encrypted;
+
+    // Grows past CRYPT_RECV_BUFFER_SIZE only while a non-blocking
+    // connection is receiving a message too big to fit
+    std::vector<uint8_t> m_recvBuffer;
+    size_t m_recvStart, m_recvEnd;
+
+    uint8_t m_sendBuffer[CRYPT_SEND_BUFFER_SIZE];
+    size_t m_sendStart, m_sendSize;
+
+    // Non-blocking connections:  m_recvMark is the start of the message
+    // being parsed, and m_recvWanted how much of it the parser needed when
+    // it last ran out of data.  Sends that didn't fit are kept in the queue
+    // from m_sendQueueStart on.
+    bool m_nonBlocking;
+    size_t m_recvMark, m_recvWanted;
+    bool m_recvStalled;
+    std::vector<uint8_t> m_sendQueue;
+    size_t m_sendQueueStart;
 };
 
+static void crypt_decrypt(CryptState_Private* statep, uint8_t* data, size_t size)
+{
+    if (statep->m_encrypted)
+        RC4(&statep->m_readKey, size, data, data);
+}
+
 DS::CryptState DS::CryptStateInit(const uint8_t* key, size_t size)
 {
     CryptState_Private* state = new CryptState_Private;
-    RC4_set_key(&state->m_readKey, size, key);
-    RC4_set_key(&state->m_writeKey, size, key);
+    state->m_encrypted = (size > 0);
+    state->m_recvBuffer.resize(CRYPT_RECV_BUFFER_SIZE);
+    state->m_recvStart = 0;
+    state->m_recvEnd = 0;
+    state->m_sendStart = 0;
+    state->m_sendSize = 0;
+    state->m_nonBlocking = false;
+    state->m_recvMark = 0;
+    state->m_recvWanted = 0;
+    state->m_recvStalled = false;
+    state->m_sendQueueStart = 0;
+    if (state->m_encrypted) {
+        RC4_set_key(&state->m_readKey, size, key);
+        RC4_set_key(&state->m_writeKey, size, key);
+    }
     return reinterpret_cast<CryptState>(state);
 }
 
@@ -166,36 +292,103 @@ void DS::CryptStateFree(DS::CryptState state)
     delete statep;
 }
 
-void DS::CryptSendBuffer(const DS::SocketHandle sock, DS::CryptState crypt,
-                         const void* buffer, size_t size)
+static void crypt_flush(const DS::SocketHandle sock, CryptState_Private* statep,
+                        bool all)
 {
-#ifdef DEBUG
-    if (s_commdebug) {
-        std::lock_guard<std::mutex> commdebugGuard(s_commdebug_mutex);
-        ST::printf("SEND TO {}", DS::SockIpAddress(sock));
-        for (size_t i=0; i<size; ++i) {
-            if ((i % 16) == 0)
-                fputs("\n    ", stdout);
-            else if ((i % 16) == 8)
-                fputs("   ", stdout);
-            ST::printf("{02X} ", reinterpret_cast<const uint8_t*>(buffer)[i]);
+    do {
+        iovec parts[2];
+        size_t count = 1;
+        size_t first = std::min(statep->m_sendSize,
+                                CRYPT_SEND_BUFFER_SIZE - statep->m_sendStart);
+        parts[0].iov_base = statep->m_sendBuffer + statep->m_sendStart;
+        parts[0].iov_len = first;
+        if (first < statep->m_sendSize) {
+            // The queued data wraps around the end of the ring
+            parts[1].iov_base = statep->m_sendBuffer;
+            parts[1].iov_len = statep->m_sendSize - first;
+            count = 2;
         }
-        fputc('\n', stdout);
-    }
+
+        size_t bytes = DS::SendSome(sock, parts, count);
+        statep->m_sendStart = (statep->m_sendStart + bytes) % CRYPT_SEND_BUFFER_SIZE;
+        statep->m_sendSize -= bytes;
+    } while (all && statep->m_sendSize > 0);
+
+    if (statep->m_sendSize == 0)
+        statep->m_sendStart = 0;
+}
+
+static void crypt_send(const DS::SocketHandle sock, DS::CryptState crypt,
+                       iovec* parts, size_t count)
+{
+#ifdef DEBUG
+    if (s_commdebug)
+        commdebug_dump("SEND TO", sock, parts, count);
 #endif
 
     CryptState_Private* statep = reinterpret_cast<CryptState_Private*>(crypt);
     if (!statep) {
-        DS::SendBuffer(sock, buffer, size);
-    } else if (size > 4096) {
-        std::unique_ptr<unsigned char[]> cryptbuf(new unsigned char[size]);
-        RC4(&statep->m_writeKey, size, reinterpret_cast<const unsigned char*>(buffer), cryptbuf.get());
-        DS::SendBuffer(sock, cryptbuf.get(), size);
-    } else {
-        unsigned char stack[4096];
-        RC4(&statep->m_writeKey, size, reinterpret_cast<const unsigned char*>(buffer), stack);
-        DS::SendBuffer(sock, stack, size);
+        DS::SendVector(sock, parts, count);
+        return;
+    }
+
+    if (statep->m_nonBlocking) {
+        for (size_t p=0; p<count; ++p) {
+            const uint8_t* inp = reinterpret_cast<const uint8_t*>(parts[p].iov_base);
+            size_t start = statep->m_sendQueue.size();
+            statep->m_sendQueue.insert(statep->m_sendQueue.end(), inp, inp + parts[p].iov_len);
+            if (statep->m_encrypted) {
+                RC4(&statep->m_writeKey, parts[p].iov_len, statep->m_sendQueue.data() + start,
+                    statep->m_sendQueue.data() + start);
+            }
+        }
+        DS::CryptSendFlush(sock, crypt);
+        return;
+    }
+
+    for (size_t p=0; p<count; ++p) {
+        const uint8_t* inp = reinterpret_cast<const uint8_t*>(parts[p].iov_base);
+        size_t remain = parts[p].iov_len;
+        while (remain > 0) {
+            if (statep->m_sendSize == CRYPT_SEND_BUFFER_SIZE)
+                crypt_flush(sock, statep, false);
+
+            size_t tail = (statep->m_sendStart + statep->m_sendSize) % CRYPT_SEND_BUFFER_SIZE;
+            size_t space = (tail < statep->m_sendStart)
+                         ? statep->m_sendStart - tail
+                         : CRYPT_SEND_BUFFER_SIZE - tail;
+            size_t chunk = std::min(remain, space);
+            if (statep->m_encrypted)
+                RC4(&statep->m_writeKey, chunk, inp, statep->m_sendBuffer + tail);
+            else
+                memcpy(statep->m_sendBuffer + tail, inp, chunk);
+            statep->m_sendSize += chunk;
+            inp += chunk;
+            remain -= chunk;
+        }
     }
+    crypt_flush(sock, statep, true);
+}
+
+void DS::CryptSendBuffer(const DS::SocketHandle sock, DS::CryptState crypt,
+                         const void* buffer, size_t size)
+{
+    iovec part;
+    part.iov_base = const_cast<void*>(buffer);
+    part.iov_len = size;
+    crypt_send(sock, crypt, &part, 1);
+}
+
+void DS::CryptSendMessage(const DS::SocketHandle sock, DS::CryptState crypt,
+                          const void* header, size_t headerSize,
+                          const void* payload, size_t payloadSize)
+{
+    iovec parts[2];
+    parts[0].iov_base = const_cast<void*>(header);
+    parts[0].iov_len = headerSize;
+    parts[1].iov_base = const_cast<void*>(payload);
+    parts[1].iov_len = payloadSize;
+    crypt_send(sock, crypt, parts, 2);
 }
 
 void DS::CryptRecvBuffer(const DS::SocketHandle sock, DS::CryptState crypt,
@@ -204,32 +397,154 @@ void DS::CryptRecvBuffer(const DS::SocketHandle sock, DS::CryptState crypt,
     CryptState_Private* statep = reinterpret_cast<CryptState_Private*>(crypt);
     if (!statep) {
         DS::RecvBuffer(sock, buffer, size);
-    } else if (size > 4096) {
-        std::unique_ptr<unsigned char[]> cryptbuf(new unsigned char[size]);
-        DS::RecvBuffer(sock, cryptbuf.get(), size);
-        RC4(&statep->m_readKey, size, cryptbuf.get(), reinterpret_cast<unsigned char*>(buffer));
+    } else if (statep->m_nonBlocking) {
+        if (statep->m_recvEnd - statep->m_recvStart < size) {
+            statep->m_recvWanted = statep->m_recvStart - statep->m_recvMark + size;
+            statep->m_recvStalled = true;
+            throw DS::RecvIncomplete();
+        }
+        memcpy(buffer, statep->m_recvBuffer.data() + statep->m_recvStart, size);
+        statep->m_recvStart += size;
     } else {
-        unsigned char stack[4096];
-        DS::RecvBuffer(sock, stack, size);
-        RC4(&statep->m_readKey, size, stack, reinterpret_cast<unsigned char*>(buffer));
+        uint8_t* outp = reinterpret_cast<uint8_t*>(buffer);
+        size_t remain = size;
+        while (remain > 0) {
+            if (statep->m_recvStart == statep->m_recvEnd) {
+                statep->m_recvStart = 0;
+                statep->m_recvEnd = 0;
+                if (remain >= CRYPT_RECV_BUFFER_SIZE) {
+                    // Large reads bypass the buffer entirely
+                    DS::RecvBuffer(sock, outp, remain);
+                    crypt_decrypt(statep, outp, remain);
+                    break;
+                }
+                size_t bytes = DS::RecvSome(sock, statep->m_recvBuffer.data(),
+                                            CRYPT_RECV_BUFFER_SIZE);
+                crypt_decrypt(statep, statep->m_recvBuffer.data(), bytes);
+                statep->m_recvEnd = bytes;
+            }
+
+            size_t count = std::min(remain, statep->m_recvEnd - statep->m_recvStart);
+            memcpy(outp, statep->m_recvBuffer.data() + statep->m_recvStart, count);
+            statep->m_recvStart += count;
+            outp += count;
+            remain -= count;
+        }
     }
 
 #ifdef DEBUG
     if (s_commdebug) {
-        std::lock_guard<std::mutex> commdebugGuard(s_commdebug_mutex);
-        ST::printf("RECV FROM {}", DS::SockIpAddress(sock));
-        for (size_t i=0; i<size; ++i) {
-            if ((i % 16) == 0)
-                fputs("\n    ", stdout);
-            else if ((i % 16) == 8)
-                fputs("   ", stdout);
-            ST::printf("{02X} ", reinterpret_cast<const uint8_t*>(buffer)[i]);
-        }
-        fputc('\n', stdout);
+        iovec part;
+        part.iov_base = buffer;
+        part.iov_len = size;
+        commdebug_dump("RECV FROM", sock, &part, 1);
     }
 #endif
 }
 
+bool DS::CryptRecvPending(CryptState crypt)
+{
+    // A message we've already tried to parse needs more data first
+    CryptState_Private* statep = reinterpret_cast<CryptState_Private*>(crypt);
+    return statep && statep->m_recvStart != statep->m_recvEnd && !statep->m_recvStalled;
+}
+
+void DS::CryptSetNonBlocking(CryptState crypt)
+{
+    CryptState_Private* statep = reinterpret_cast<CryptState_Private*>(crypt);
+    DS_ASSERT(statep && statep->m_sendSize == 0);
+    statep->m_nonBlocking = true;
+    statep->m_recvMark = statep->m_recvStart;
+}
+
+bool DS::CryptRecvFill(const SocketHandle sock, CryptState crypt)
+{
+    CryptState_Private* statep = reinterpret_cast<CryptState_Private*>(crypt);
+    DS_ASSERT(statep && statep->m_nonBlocking);
+
+    // Move the message in progress to the front, to make room behind it
+    if (statep->m_recvMark > 0) {
+        memmove(statep->m_recvBuffer.data(), statep->m_recvBuffer.data() + statep->m_recvMark,
+                statep->m_recvEnd - statep->m_recvMark);
+        statep->m_recvStart -= statep->m_recvMark;
+        statep->m_recvEnd -= statep->m_recvMark;
+        statep->m_recvMark = 0;
+    }
+
+    if (statep->m_recvEnd == statep->m_recvBuffer.size()) {
+        // A full buffer of complete messages has to be handled first.  The
+        // parser has already checked the size of a message that doesn't fit.
+        if (!statep->m_recvStalled)
+            return false;
+        statep->m_recvBuffer.resize(std::max(statep->m_recvWanted,
+                                             statep->m_recvBuffer.size() * 2));
+    }
+
+    size_t bytes = DS::RecvNonBlocking(sock, statep->m_recvBuffer.data() + statep->m_recvEnd,
+                                       statep->m_recvBuffer.size() - statep->m_recvEnd);
+    if (bytes == 0)
+        return false;
+    crypt_decrypt(statep, statep->m_recvBuffer.data() + statep->m_recvEnd, bytes);
+    statep->m_recvEnd += bytes;
+    statep->m_recvStalled = false;
+    return true;
+}
+
+void DS::CryptRecvCommit(CryptState crypt)
+{
+    CryptState_Private* statep = reinterpret_cast<CryptState_Private*>(crypt);
+    statep->m_recvMark = statep->m_recvStart;
+    if (statep->m_recvStart == statep->m_recvEnd) {
+        statep->m_recvStart = 0;
+        statep->m_recvEnd = 0;
+        statep->m_recvMark = 0;
+        if (statep->m_recvBuffer.size() > CRYPT_RECV_BUFFER_SIZE) {
+            statep->m_recvBuffer.resize(CRYPT_RECV_BUFFER_SIZE);
+            statep->m_recvBuffer.shrink_to_fit();
+        }
+    }
+}
+
+void DS::CryptRecvRewind(CryptState crypt)
+{
+    CryptState_Private* statep = reinterpret_cast<CryptState_Private*>(crypt);
+    statep->m_recvStart = statep->m_recvMark;
+}
+
+void DS::CryptSendFlush(const SocketHandle sock, CryptState crypt)
+{
+    CryptState_Private* statep = reinterpret_cast<CryptState_Private*>(crypt);
+    if (!statep)
+        return;
+
+    while (statep->m_sendQueueStart < statep->m_sendQueue.size()) {
+        iovec part;
+        part.iov_base = statep->m_sendQueue.data() + statep->m_sendQueueStart;
+        part.iov_len = statep->m_sendQueue.size() - statep->m_sendQueueStart;
+        size_t bytes = DS::SendNonBlocking(sock, &part, 1);
+        if (bytes == 0)
+            break;
+        statep->m_sendQueueStart += bytes;
+    }
+
+    if (statep->m_sendQueueStart == statep->m_sendQueue.size()) {
+        statep->m_sendQueue.clear();
+        statep->m_sendQueueStart = 0;
+        if (statep->m_sendQueue.capacity() > CRYPT_SEND_BUFFER_SIZE)
+            statep->m_sendQueue.shrink_to_fit();
+    } else if (statep->m_sendQueueStart >= CRYPT_SEND_BUFFER_SIZE) {
+        statep->m_sendQueue.erase(statep->m_sendQueue.begin(),
+                                  statep->m_sendQueue.begin() + statep->m_sendQueueStart);
+        statep->m_sendQueueStart = 0;
+    }
+}
+
+size_t DS::CryptSendQueued(CryptState crypt)
+{
+    CryptState_Private* statep = reinterpret_cast<CryptState_Private*>(crypt);
+    return statep ? statep->m_sendQueue.size() - statep->m_sendQueueStart : 0;
+}
+
 ST::string DS::CryptRecvString(const SocketHandle sock, CryptState crypt)
 {
     uint16_t length = CryptRecvValue<uint16_t>(sock, crypt);
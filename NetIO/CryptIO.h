@@ -20,6 +20,7 @@
 
 #include "Types/ShaHash.h"
 #include "SockIO.h"
+#include "settings.h"
 #include <algorithm>
 
 #define BYTE_SWAP_BUFFER(buffer, size) \
@@ -44,19 +45,76 @@ namespace DS
     void GenPrimeKeys(uint8_t* N, uint8_t* K);
     void CryptCalcX(uint8_t* X, const uint8_t* N, const uint8_t* K, uint32_t base);
 
-    void CryptEstablish(uint8_t* seed, uint8_t* key, const uint8_t* N,
-                        const uint8_t* K, const uint8_t* Y);
+    /* A server key pair (N and K) parsed once up front, along with the
+     * Montgomery context for N, so each handshake only has to do the
+     * exponentiation itself.  Safe to share between threads.
+     */
+    typedef void* CryptKey;
+
+    CryptKey CryptKeyInit(const uint8_t* N, const uint8_t* K);
+    void CryptKeyFree(CryptKey key);
+
+    // Shared key for one of the configured services, built on first use
+    CryptKey CryptKeyFromSettings(KeyType N, KeyType K);
+
+    void CryptEstablish(uint8_t* seed, uint8_t* key, CryptKey serverKey,
+                        const uint8_t* Y);
 
     typedef void* CryptState;
 
+    // With no key (a size of 0), data is passed through unencrypted
     CryptState CryptStateInit(const uint8_t* key, size_t size);
     void CryptStateFree(CryptState state);
 
     void CryptSendBuffer(const SocketHandle sock, CryptState crypt,
                          const void* buffer, size_t size);
+
+    /* Sends a header and a payload stored elsewhere as one message, without
+     * first copying them into a common buffer.
+     */
+    void CryptSendMessage(const SocketHandle sock, CryptState crypt,
+                          const void* header, size_t headerSize,
+                          const void* payload, size_t payloadSize);
+
     void CryptRecvBuffer(const SocketHandle sock, CryptState crypt,
                          void* buffer, size_t size);
 
+    /* Returns true if data has already been read from the socket and is
+     * waiting in the receive buffer.  poll() will not report this data, so
+     * callers should drain it before waiting on the socket again.
+     */
+    bool CryptRecvPending(CryptState crypt);
+
+    /* Connections run by an event loop (see Reactor.h) must never wait on
+     * their socket.  Once switched over, sends are queued and written out
+     * as far as the socket allows, with the rest going out through
+     * CryptSendFlush().  Receives are served only from the data already
+     * read by CryptRecvFill().
+     *
+     * If that data runs out partway through a message, the read throws
+     * RecvIncomplete.  The caller then goes back to the start of the
+     * message with CryptRecvRewind(), and parses all of it again once more
+     * has arrived, so handlers must read their whole message before they
+     * act on any of it.  CryptRecvCommit() marks a message as done.
+     */
+    void CryptSetNonBlocking(CryptState crypt);
+
+    // Reads whatever the socket has ready.  Returns false if nothing was read.
+    bool CryptRecvFill(const SocketHandle sock, CryptState crypt);
+    void CryptRecvCommit(CryptState crypt);
+    void CryptRecvRewind(CryptState crypt);
+
+    void CryptSendFlush(const SocketHandle sock, CryptState crypt);
+
+    // Bytes queued up behind a socket that wouldn't take them yet
+    size_t CryptSendQueued(CryptState crypt);
+
+    class RecvIncomplete : public std::runtime_error
+    {
+    public:
+        RecvIncomplete() : std::runtime_error("Message is incomplete") { }
+    };
+
     template <typename tp>
     inline tp CryptRecvValue(const SocketHandle sock, CryptState crypt)
     {
@@ -0,0 +1,366 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "Executor.h"
+#include "errors.h"
+#include <string_theory/stdio>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct DS::ExecutorWorker
+{
+    size_t m_index;
+    std::thread m_thread;
+
+    std::mutex m_queueMutex;
+    std::deque<ExecutorTask*> m_queue;
+
+    void push(ExecutorTask* task);
+    ExecutorTask* pop();
+    ExecutorTask* steal();
+
+    void run();
+    void runSpare();
+    void runTask(ExecutorTask* task);
+
+    static void schedule(ExecutorTask* task, bool haveExecLock);
+    static void scheduleExpired(ExecutorTask::TimePoint now);
+};
+
+static std::vector<std::unique_ptr<DS::ExecutorWorker>> s_workers;
+static thread_local DS::ExecutorWorker* s_currentWorker = nullptr;
+static thread_local bool s_onExecutor = false;
+static std::atomic<size_t> s_nextWorker;
+
+// Tasks waiting in any queue, and workers waiting for one to show up.
+// Both are updated before the other is checked, so a task can't be queued
+// without somebody either seeing it or being woken up for it.
+static std::atomic<size_t> s_queued, s_sleeping;
+
+// Protects the timers and the sleeping workers
+static std::mutex s_execMutex;
+static std::condition_variable s_execCond;
+static std::multimap<DS::ExecutorTask::TimePoint, DS::ExecutorTask*> s_timers;
+static bool s_running = false;
+
+// When the earliest timer expires, so workers can check for expired timers
+// without taking s_execMutex.  Only changed under s_execMutex.
+static std::atomic<DS::ExecutorTask::TimePoint::rep> s_nextTimer(
+        DS::ExecutorTask::TimePoint::max().time_since_epoch().count());
+
+static std::atomic<uint64_t> s_runs, s_steals;
+
+// Threads stuck in an ExecutorBlockingScope, and spare threads started
+// because all of the others were.  Only changed under s_execMutex.
+static size_t s_blocked = 0, s_spares = 0;
+
+void DS::ExecutorWorker::push(ExecutorTask* task)
+{
+    {
+        std::lock_guard<std::mutex> queueGuard(m_queueMutex);
+        m_queue.push_back(task);
+    }
+    ++s_queued;
+}
+
+DS::ExecutorTask* DS::ExecutorWorker::pop()
+{
+    std::lock_guard<std::mutex> queueGuard(m_queueMutex);
+    if (m_queue.empty())
+        return nullptr;
+    ExecutorTask* task = m_queue.front();
+    m_queue.pop_front();
+    --s_queued;
+    return task;
+}
+
+DS::ExecutorTask* DS::ExecutorWorker::steal()
+{
+    // Take the most recently queued task, which the owner would have
+    // gotten to last anyway
+    std::lock_guard<std::mutex> queueGuard(m_queueMutex);
+    if (m_queue.empty())
+        return nullptr;
+    ExecutorTask* task = m_queue.back();
+    m_queue.pop_back();
+    --s_queued;
+    ++s_steals;
+    return task;
+}
+
+static void wake_worker(bool haveExecLock)
+{
+    if (s_sleeping == 0)
+        return;
+    if (!haveExecLock) {
+        // Make sure a worker that just decided to sleep is actually waiting
+        std::lock_guard<std::mutex> execGuard(s_execMutex);
+    }
+    s_execCond.notify_one();
+}
+
+void DS::ExecutorWorker::runTask(ExecutorTask* task)
+{
+    task->m_exState = ExecutorTask::e_Running;
+    ++s_runs;
+    if (!task->onRun())
+        return;
+
+    // Anything left over (or arriving while the task was running) goes to
+    // the back of the queue, so other tasks get a turn first
+    int expected = ExecutorTask::e_Running;
+    if (task->runPending()
+            || !task->m_exState.compare_exchange_strong(expected, ExecutorTask::e_Idle)) {
+        task->m_exState = ExecutorTask::e_Scheduled;
+        ExecutorWorker* worker = this;
+        if (m_index >= s_workers.size()) {
+            // Nobody looks at a spare's own queue
+            worker = s_workers[s_nextWorker++ % s_workers.size()].get();
+        }
+        worker->push(task);
+        wake_worker(false);
+    }
+}
+
+// Must be called with s_execMutex held
+static void update_next_timer()
+{
+    DS::ExecutorTask::TimePoint next = s_timers.empty()
+            ? DS::ExecutorTask::TimePoint::max() : s_timers.begin()->first;
+    s_nextTimer.store(next.time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+void DS::ExecutorWorker::run()
+{
+    s_currentWorker = this;
+    s_onExecutor = true;
+    for ( ;; ) {
+        // Timers are checked on every pass, so they still go off while the
+        // queues are busy
+        auto now = std::chrono::steady_clock::now();
+        if (now.time_since_epoch().count() >= s_nextTimer.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> execGuard(s_execMutex);
+            scheduleExpired(now);
+        }
+
+        ExecutorTask* task = pop();
+        for (size_t i = 1; !task && i < s_workers.size(); ++i)
+            task = s_workers[(m_index + i) % s_workers.size()]->steal();
+        if (task) {
+            runTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(s_execMutex);
+        if (!s_running)
+            break;
+
+        ++s_sleeping;
+        if (s_queued == 0) {
+            if (s_timers.empty()) {
+                s_execCond.wait(lock);
+            } else if (s_timers.begin()->first > std::chrono::steady_clock::now()) {
+                // Copied, since the timer may be cancelled while we wait
+                ExecutorTask::TimePoint next = s_timers.begin()->first;
+                s_execCond.wait_until(lock, next);
+            } else {
+                scheduleExpired(std::chrono::steady_clock::now());
+            }
+        }
+        --s_sleeping;
+    }
+}
+
+void DS::ExecutorWorker::runSpare()
+{
+    // Tasks scheduled from here go to the regular workers
+    s_onExecutor = true;
+    for ( ;; ) {
+        ExecutorTask* task = nullptr;
+        for (size_t i = 0; !task && i < s_workers.size(); ++i)
+            task = s_workers[i]->steal();
+        if (task) {
+            runTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(s_execMutex);
+        if (s_queued != 0)
+            continue;
+        if (!s_running || s_blocked + 1 < s_workers.size() + s_spares)
+            break;
+
+        ++s_sleeping;
+        s_execCond.wait_for(lock, std::chrono::milliseconds(100));
+        --s_sleeping;
+    }
+
+    std::lock_guard<std::mutex> execGuard(s_execMutex);
+    --s_spares;
+    s_execCond.notify_all();
+    delete this;
+}
+
+void DS::ExecutorWorker::schedule(ExecutorTask* task, bool haveExecLock)
+{
+    int state = task->m_exState;
+    for ( ;; ) {
+        switch (state) {
+        case ExecutorTask::e_Idle:
+            if (task->m_exState.compare_exchange_weak(state, ExecutorTask::e_Scheduled))
+                break;
+            continue;
+        case ExecutorTask::e_Running:
+            // The worker running it will queue it again when it's done
+            if (task->m_exState.compare_exchange_weak(state, ExecutorTask::e_RunningNotified))
+                return;
+            continue;
+        default:
+            return;
+        }
+        break;
+    }
+
+    DS_ASSERT(!s_workers.empty());
+    ExecutorWorker* worker = s_currentWorker;
+    if (!worker)
+        worker = s_workers[s_nextWorker++ % s_workers.size()].get();
+    worker->push(task);
+    wake_worker(haveExecLock);
+}
+
+// Must be called with s_execMutex held.  Expired tasks are scheduled while
+// still holding the lock, so they can't cancel their timers and go away in
+// the meantime.
+void DS::ExecutorWorker::scheduleExpired(ExecutorTask::TimePoint now)
+{
+    bool expired = false;
+    while (!s_timers.empty() && s_timers.begin()->first <= now) {
+        ExecutorTask* task = s_timers.begin()->second;
+        task->m_exTimerArmed = false;
+        s_timers.erase(s_timers.begin());
+        schedule(task, true);
+        expired = true;
+    }
+    if (expired)
+        update_next_timer();
+}
+
+void DS::ExecutorSchedule(ExecutorTask* task)
+{
+    ExecutorWorker::schedule(task, false);
+}
+
+void DS::ExecutorSetTimer(ExecutorTask* task, ExecutorTask::TimePoint when)
+{
+    std::lock_guard<std::mutex> execGuard(s_execMutex);
+    if (task->m_exTimerArmed)
+        s_timers.erase(task->m_exTimer);
+    task->m_exTimer = s_timers.emplace(when, task);
+    task->m_exTimerArmed = true;
+    update_next_timer();
+
+    // A sleeping worker may be waiting for a later timer
+    if (task->m_exTimer == s_timers.begin())
+        s_execCond.notify_one();
+}
+
+void DS::ExecutorCancelTimer(ExecutorTask* task)
+{
+    std::lock_guard<std::mutex> execGuard(s_execMutex);
+    if (task->m_exTimerArmed) {
+        s_timers.erase(task->m_exTimer);
+        update_next_timer();
+    }
+    task->m_exTimerArmed = false;
+}
+
+void DS::StartExecutor(size_t threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    s_running = true;
+    for (size_t i = 0; i < threads; ++i) {
+        s_workers.emplace_back(new ExecutorWorker);
+        s_workers.back()->m_index = i;
+    }
+
+    // Workers steal from each other, so they all have to exist first
+    for (auto& worker : s_workers)
+        worker->m_thread = std::thread(&ExecutorWorker::run, worker.get());
+    ST::printf("[Executor] Started {} workers\n", s_workers.size());
+}
+
+void DS::StopExecutor()
+{
+    {
+        std::lock_guard<std::mutex> execGuard(s_execMutex);
+        s_running = false;
+    }
+    s_execCond.notify_all();
+    for (auto& worker : s_workers)
+        worker->m_thread.join();
+    {
+        // Spares steal from the workers' queues until the very end
+        std::unique_lock<std::mutex> lock(s_execMutex);
+        while (s_spares != 0)
+            s_execCond.wait(lock);
+    }
+    s_workers.clear();
+}
+
+DS::ExecutorStats DS::ExecutorGetStats()
+{
+    ExecutorStats stats;
+    stats.m_workers = s_workers.size();
+    stats.m_queued = s_queued;
+    stats.m_runs = s_runs;
+    stats.m_steals = s_steals;
+    return stats;
+}
+
+DS::ExecutorBlockingScope::ExecutorBlockingScope()
+    : m_counted(s_onExecutor)
+{
+    if (!m_counted)
+        return;
+
+    std::lock_guard<std::mutex> execGuard(s_execMutex);
+    ++s_blocked;
+    if (s_running && s_blocked >= s_workers.size() + s_spares) {
+        ExecutorWorker* spare = new ExecutorWorker;
+        spare->m_index = SIZE_MAX;
+        ++s_spares;
+        std::thread(&ExecutorWorker::runSpare, spare).detach();
+        ST::printf(stderr, "[Executor] All workers blocked; started a spare ({} now)\n",
+                   s_spares);
+    }
+}
+
+DS::ExecutorBlockingScope::~ExecutorBlockingScope()
+{
+    if (!m_counted)
+        return;
+
+    std::lock_guard<std::mutex> execGuard(s_execMutex);
+    --s_blocked;
+}
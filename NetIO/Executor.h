@@ -0,0 +1,109 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _DS_EXECUTOR_H
+#define _DS_EXECUTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+
+/* The executor runs many long-lived tasks (such as game age hosts) on a
+ * small, fixed number of worker threads (one per core by default), rather
+ * than giving each task a thread of its own that mostly sleeps.
+ *
+ * A task is scheduled when it has something to do, and runs until it has
+ * dealt with a batch of work.  A task is never run by two workers at once,
+ * so everything it does is still serialized.  Each worker has its own run
+ * queue; a worker that runs out of tasks steals from the others, so a few
+ * busy tasks are spread across all of the cores.
+ *
+ * Tasks may still block briefly (e.g. on a reply from the auth daemon),
+ * but that keeps their worker away from other tasks in the meantime.  Such
+ * waits should be wrapped in an ExecutorBlockingScope: if every worker is
+ * blocked at once, a spare thread is started to keep the queues moving,
+ * since the reply may well depend on another task getting a turn.
+ */
+
+namespace DS
+{
+    struct ExecutorWorker;
+
+    class ExecutorTask
+    {
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        ExecutorTask()
+            : m_exState(e_Idle), m_exTimerArmed(false) { }
+        virtual ~ExecutorTask() { }
+
+        // Deal with a batch of pending work.  Once this returns false, the
+        // executor forgets about the task, which may then delete itself;
+        // its timer must have been cancelled by then.
+        virtual bool onRun() = 0;
+
+        // True if the task has more work waiting, and should be run again
+        virtual bool runPending() = 0;
+
+    private:
+        enum State { e_Idle, e_Scheduled, e_Running, e_RunningNotified };
+
+        std::atomic<int> m_exState;
+        bool m_exTimerArmed;
+        std::multimap<TimePoint, ExecutorTask*>::iterator m_exTimer;
+
+        friend struct ExecutorWorker;
+        friend void ExecutorSetTimer(ExecutorTask*, TimePoint);
+        friend void ExecutorCancelTimer(ExecutorTask*);
+    };
+
+    struct ExecutorStats
+    {
+        size_t m_workers, m_queued;
+        uint64_t m_runs, m_steals;
+    };
+
+    void StartExecutor(size_t threads);
+    void StopExecutor();
+
+    // Make sure the task runs soon.  Safe to call from any thread, and
+    // cheap if the task is already scheduled or running.
+    void ExecutorSchedule(ExecutorTask* task);
+
+    // Schedule the task at the given time, replacing any earlier timer
+    void ExecutorSetTimer(ExecutorTask* task, ExecutorTask::TimePoint when);
+    void ExecutorCancelTimer(ExecutorTask* task);
+
+    ExecutorStats ExecutorGetStats();
+
+    class ExecutorBlockingScope
+    {
+    public:
+        ExecutorBlockingScope();
+        ~ExecutorBlockingScope();
+
+        ExecutorBlockingScope(const ExecutorBlockingScope&) = delete;
+        ExecutorBlockingScope& operator=(const ExecutorBlockingScope&) = delete;
+
+    private:
+        bool m_counted;
+    };
+}
+
+#endif
@@ -0,0 +1,235 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "HandshakePool.h"
+#include "CryptIO.h"
+#include "settings.h"
+#include "errors.h"
+#include <cstring>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <chrono>
+
+struct Handshake_Job
+{
+    DS::SocketHandle m_sock;
+    DS::HandshakeJob m_job;
+};
+
+static std::vector<std::thread> s_handshakeThreads;
+static std::deque<Handshake_Job> s_handshakeQueue;
+static std::mutex s_handshakeMutex;
+static std::condition_variable s_handshakeCond, s_handshakeSpace;
+static size_t s_handshakeBacklog;
+static bool s_handshakeRunning = false;
+static size_t s_handshakeActive = 0;
+static thread_local bool s_onHandshakeThread = false;
+
+static void wk_handshake()
+{
+    s_onHandshakeThread = true;
+    for ( ;; ) {
+        Handshake_Job job;
+        {
+            std::unique_lock<std::mutex> lock(s_handshakeMutex);
+            s_handshakeCond.wait(lock, [] {
+                return !s_handshakeRunning || !s_handshakeQueue.empty();
+            });
+            if (s_handshakeQueue.empty())
+                break;
+            job = std::move(s_handshakeQueue.front());
+            s_handshakeQueue.pop_front();
+            ++s_handshakeActive;
+        }
+        s_handshakeSpace.notify_one();
+
+        // Jobs are responsible for reporting their own errors
+        try {
+            job.m_job();
+        } catch (const std::exception& ex) {
+            ST::printf(stderr, "[Handshake] Error connecting {}: {}\n",
+                       DS::SockIpAddress(job.m_sock), ex.what());
+        }
+
+        std::lock_guard<std::mutex> lock(s_handshakeMutex);
+        --s_handshakeActive;
+    }
+}
+
+void DS::StartHandshakePool()
+{
+    size_t numThreads = DS::Settings::HandshakeThreads();
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    {
+        std::lock_guard<std::mutex> lock(s_handshakeMutex);
+        s_handshakeBacklog = std::max(1u, DS::Settings::HandshakeBacklog());
+        s_handshakeRunning = true;
+    }
+    for (size_t i = 0; i < numThreads; ++i)
+        s_handshakeThreads.emplace_back(&wk_handshake);
+    ST::printf("[Handshake] Started {} handshake threads\n", s_handshakeThreads.size());
+}
+
+void DS::StopHandshakePool()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_handshakeMutex);
+        s_handshakeRunning = false;
+    }
+    s_handshakeCond.notify_all();
+    s_handshakeSpace.notify_all();
+
+    bool complete = false;
+    for (int i=0; i<50 && !complete; ++i) {
+        {
+            std::lock_guard<std::mutex> lock(s_handshakeMutex);
+            complete = s_handshakeQueue.empty() && s_handshakeActive == 0;
+        }
+        if (!complete)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    for (std::thread& thread : s_handshakeThreads) {
+        if (complete)
+            thread.join();
+        else
+            thread.detach();
+    }
+    if (!complete)
+        fputs("[Handshake] Handshake threads didn't die after 5 seconds!\n", stderr);
+    s_handshakeThreads.clear();
+}
+
+bool DS::HandshakeSubmit(SocketHandle sock, HandshakeJob job)
+{
+    {
+        std::lock_guard<std::mutex> lock(s_handshakeMutex);
+        if (!s_handshakeRunning || s_handshakeQueue.size() >= s_handshakeBacklog)
+            return false;
+        s_handshakeQueue.push_back(Handshake_Job { sock, std::move(job) });
+    }
+    s_handshakeCond.notify_one();
+    return true;
+}
+
+void DS::HandshakeRun(SocketHandle sock, const HandshakeJob& job)
+{
+    if (s_onHandshakeThread) {
+        job();
+        return;
+    }
+
+    std::exception_ptr error;
+    bool done = false;
+    std::condition_variable doneCond;
+    {
+        std::unique_lock<std::mutex> lock(s_handshakeMutex);
+        s_handshakeSpace.wait(lock, [] {
+            return !s_handshakeRunning || s_handshakeQueue.size() < s_handshakeBacklog;
+        });
+        if (!s_handshakeRunning)
+            throw DS::SockHup();
+        s_handshakeQueue.push_back(Handshake_Job { sock, [&] {
+            try {
+                job();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> doneLock(s_handshakeMutex);
+            done = true;
+            doneCond.notify_one();
+        }});
+    }
+    s_handshakeCond.notify_one();
+
+    {
+        std::unique_lock<std::mutex> lock(s_handshakeMutex);
+        doneCond.wait(lock, [&done] { return done; });
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+DS::ConnectRequest::ConnectRequest(uint32_t headerSize, bool keyExchange)
+    : m_headerSize(headerSize), m_keyExchange(keyExchange), m_size(0),
+      m_needed(headerSize + (keyExchange ? 2 : 0))
+{
+    // Room for the header, the connect message header and a 64-byte key
+    DS_ASSERT(headerSize >= sizeof(uint32_t) && m_needed + 64 <= sizeof(m_buffer));
+}
+
+void DS::ConnectRequest::update()
+{
+    // Malformed requests are rejected as soon as they can be recognized,
+    // rather than after waiting for the rest of them
+    if (m_size >= sizeof(uint32_t)) {
+        uint32_t size;
+        memcpy(&size, m_buffer, sizeof(size));
+        if (size != m_headerSize)
+            throw DS::InvalidConnectionHeader();
+    }
+    if (m_keyExchange && m_size >= m_headerSize + 2) {
+        uint8_t msgId = m_buffer[m_headerSize];
+        uint8_t msgSize = m_buffer[m_headerSize + 1];
+        if (msgId != DS::e_CliToServConnect || msgSize < 2 || msgSize > 66)
+            throw DS::InvalidConnectionHeader();
+        m_needed = m_headerSize + msgSize;
+    }
+}
+
+bool DS::ConnectRequest::readSome(SocketHandle sock)
+{
+    while (m_size < m_needed) {
+        size_t bytes = DS::RecvNonBlocking(sock, m_buffer + m_size, m_needed - m_size);
+        if (bytes == 0)
+            return false;
+        m_size += bytes;
+        update();
+    }
+    return true;
+}
+
+void DS::ConnectRequest::read(SocketHandle sock)
+{
+    DS::SockSetRecvTimeout(sock, HANDSHAKE_TIMEOUT);
+    while (m_size < m_needed) {
+        m_size += DS::RecvSome(sock, m_buffer + m_size, m_needed - m_size);
+        update();
+    }
+    DS::SockSetRecvTimeout(sock, NET_TIMEOUT);
+}
+
+bool DS::ConnectRequest::clientKey(uint8_t* key) const
+{
+    DS_ASSERT(m_keyExchange && complete());
+
+    // An empty connect message means no seed
+    size_t keySize = m_size - m_headerSize - 2;
+    if (keySize == 0)
+        return false;
+
+    memset(key, 0, 64);
+    memcpy(key, m_buffer + m_headerSize + 2, keySize);
+    BYTE_SWAP_BUFFER(key, 64);
+    return true;
+}
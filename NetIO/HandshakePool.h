@@ -0,0 +1,87 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _DS_HANDSHAKEPOOL_H
+#define _DS_HANDSHAKEPOOL_H
+
+#include "SockIO.h"
+#include <functional>
+
+/* A client that starts a connection request but then stalls is dropped
+ * after this long */
+#define HANDSHAKE_TIMEOUT (10)
+
+/* The expensive part of connection setup (the Diffie-Hellman exponentiation)
+ * is handled by a small pool of worker threads, one per core by default.
+ * This keeps a flood of reconnecting clients from starving the event loops
+ * or spawning thousands of threads that all compete for the CPU at once.
+ *
+ * The client's request is read in full (see ConnectRequest) before its
+ * handshake is queued, so the pool's threads never wait on a slow client.
+ */
+
+namespace DS
+{
+    void StartHandshakePool();
+    void StopHandshakePool();
+
+    typedef std::function<void ()> HandshakeJob;
+
+    // Queues the handshake for sock to run in the background.  Returns
+    // false without queueing anything if the backlog is full.
+    bool HandshakeSubmit(SocketHandle sock, HandshakeJob job);
+
+    // Runs the handshake for sock on the pool and waits for it to finish,
+    // rethrowing any exception it raises.  If called from one of the pool's
+    // own threads, the job is run immediately.
+    void HandshakeRun(SocketHandle sock, const HandshakeJob& job);
+
+    /* A client's connection header (size first), followed by its key
+     * exchange request for the services that encrypt their traffic */
+    class ConnectRequest
+    {
+    public:
+        // headerSize is the size the header must declare for itself
+        ConnectRequest(uint32_t headerSize, bool keyExchange = true);
+
+        // Reads whatever has arrived without blocking, and returns true once
+        // the request is complete.  Nothing past the request is consumed.
+        bool readSome(SocketHandle sock);
+
+        // Reads the rest of the request, blocking for up to HANDSHAKE_TIMEOUT
+        void read(SocketHandle sock);
+
+        bool complete() const { return m_size == m_needed; }
+
+        // The header, after its size field
+        const uint8_t* header() const { return m_buffer + sizeof(uint32_t); }
+
+        // Fills in the client's 64-byte public key (in OpenSSL byte order),
+        // or returns false if the client wants an unencrypted connection
+        bool clientKey(uint8_t* key) const;
+
+    private:
+        uint8_t m_buffer[128];
+        uint32_t m_headerSize;
+        bool m_keyExchange;
+        size_t m_size, m_needed;
+
+        void update();
+    };
+}
+
+#endif
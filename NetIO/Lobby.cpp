@@ -24,8 +24,21 @@
 #include "SockIO.h"
 #include "errors.h"
 #include "settings.h"
+#include <sys/epoll.h>
+#include <unistd.h>
 #include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <list>
+#include <ctime>
 #include <cstdio>
+#include <cstring>
+
+/* Clients that haven't sent their full connection header within this many
+ * seconds are dropped.  A legitimate client sends it immediately.
+ */
+#define LOBBY_HEADER_TIMEOUT (10)
 
 enum ConnType
 {
@@ -44,86 +57,210 @@ struct ConnectionHeader
     DS::Uuid m_productId;
 };
 
-static std::thread s_lobbyThread;
-static DS::SocketHandle s_listenSock;
+// Size of the ConnectionHeader on the wire
+#define CONN_HEADER_SIZE (sizeof(uint8_t) + sizeof(uint16_t) \
+                          + 3 * sizeof(uint32_t) + sizeof(DS::Uuid::m_bytes))
 
-void dm_lobby()
+struct Lobby_PendingClient
 {
-    ST::printf("[Lobby] Running on {}\n", DS::SockIpAddress(s_listenSock));
-    {
-        for ( ;; ) {
-            DS::SocketHandle client;
-            try {
-                client = DS::AcceptSock(s_listenSock);
-            } catch (const DS::SockHup&) {
-                break;
-            }
+    DS::SocketHandle m_sock;
+    uint8_t m_header[CONN_HEADER_SIZE];
+    size_t m_received;
+    time_t m_deadline;
+};
+
+struct Lobby_Acceptor
+{
+    DS::SocketHandle m_listenSock;
+    int m_epoll;
+    std::thread m_thread;
+
+    Lobby_Acceptor() : m_listenSock(nullptr), m_epoll(-1) { }
+};
+
+static std::vector<std::unique_ptr<Lobby_Acceptor>> s_acceptors;
+static std::atomic<bool> s_lobbyRunning;
+
+static void lobby_dispatch(DS::SocketHandle client, const uint8_t* buffer)
+{
+    DS::BufferStream stream(buffer, CONN_HEADER_SIZE);
+    ConnectionHeader header;
+    header.m_connType = stream.read<uint8_t>();
+    header.m_sockHeaderSize = stream.read<uint16_t>();
+    header.m_buildId = stream.read<uint32_t>();
+    header.m_buildType = stream.read<uint32_t>();
+    header.m_branchId = stream.read<uint32_t>();
+    stream.readBytes(header.m_productId.m_bytes, sizeof(header.m_productId.m_bytes));
+
+    // The services expect to do blocking reads from here on out
+    DS::SockSetBlocking(client, true);
+
+    switch (header.m_connType) {
+    case e_ConnCliToGateKeeper:
+        DS::GateKeeper_Add(client);
+        break;
+    case e_ConnCliToFile:
+        DS::FileServer_Add(client);
+        break;
+    case e_ConnCliToAuth:
+        DS::AuthServer_Add(client);
+        break;
+    case e_ConnCliToGame:
+        DS::GameServer_Add(client);
+        break;
+    case e_ConnCliToCsr:
+        ST::printf("[Lobby] {} - CSR client?  Get that mutha outta here!\n",
+                   DS::SockIpAddress(client));
+        DS::FreeSock(client);
+        break;
+    default:
+        ST::printf("[Lobby] {} - Unknown connection type!  Abandon ship!\n",
+               DS::SockIpAddress(client));
+        DS::FreeSock(client);
+        break;
+    }
+}
+
+static void lobby_accept(Lobby_Acceptor* acceptor, std::list<Lobby_PendingClient>& pending)
+{
+    for ( ;; ) {
+        DS::SocketHandle client = DS::AcceptSock(acceptor->m_listenSock, true);
+        if (!client)
+            return;
+
+        pending.emplace_back();
+        Lobby_PendingClient& conn = pending.back();
+        conn.m_sock = client;
+        conn.m_received = 0;
+        conn.m_deadline = time(nullptr) + LOBBY_HEADER_TIMEOUT;
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &conn;
+        if (epoll_ctl(acceptor->m_epoll, EPOLL_CTL_ADD, DS::SockFd(client), &ev) < 0) {
+            ST::printf(stderr, "[Lobby] {} - Failed to watch incoming client: {}\n",
+                       DS::SockIpAddress(client), strerror(errno));
+            DS::FreeSock(client);
+            pending.pop_back();
+        }
+    }
+}
 
-            if (!client)
+// Returns true once the client has left the lobby
+static bool lobby_read(Lobby_Acceptor* acceptor, Lobby_PendingClient& conn)
+{
+    try {
+        // Only read exactly as much as the header needs -- anything past it
+        // belongs to the service the client is connecting to
+        size_t bytes = DS::RecvNonBlocking(conn.m_sock, conn.m_header + conn.m_received,
+                                           CONN_HEADER_SIZE - conn.m_received);
+        conn.m_received += bytes;
+        if (conn.m_received < CONN_HEADER_SIZE)
+            return false;
+
+        epoll_ctl(acceptor->m_epoll, EPOLL_CTL_DEL, DS::SockFd(conn.m_sock), nullptr);
+        lobby_dispatch(conn.m_sock, conn.m_header);
+    } catch (const DS::SockHup& hup) {
+        DS::FreeSock(conn.m_sock);
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Lobby] {} - Exception while processing incoming client: {}\n",
+                   DS::SockIpAddress(conn.m_sock), ex.what());
+        DS::FreeSock(conn.m_sock);
+    }
+    return true;
+}
+
+void dm_lobby(Lobby_Acceptor* acceptor)
+{
+    ST::printf("[Lobby] Running on {}\n", DS::SockIpAddress(acceptor->m_listenSock));
+
+    std::list<Lobby_PendingClient> pending;
+    epoll_event events[64];
+    while (s_lobbyRunning) {
+        int count = epoll_wait(acceptor->m_epoll, events, 64, 1000);
+        if (count < 0) {
+            if (errno == EINTR)
                 continue;
+            ST::printf(stderr, "[Lobby] Failure in epoll_wait: {}\n", strerror(errno));
+            break;
+        }
 
-            try {
-                ConnectionHeader header;
-                header.m_connType = DS::RecvValue<uint8_t>(client);
-                header.m_sockHeaderSize = DS::RecvValue<uint16_t>(client);
-                header.m_buildId = DS::RecvValue<uint32_t>(client);
-                header.m_buildType = DS::RecvValue<uint32_t>(client);
-                header.m_branchId = DS::RecvValue<uint32_t>(client);
-                DS::RecvBuffer(client, header.m_productId.m_bytes,
-                               sizeof(header.m_productId.m_bytes));
-
-                switch (header.m_connType) {
-                case e_ConnCliToGateKeeper:
-                    DS::GateKeeper_Add(client);
-                    break;
-                case e_ConnCliToFile:
-                    DS::FileServer_Add(client);
-                    break;
-                case e_ConnCliToAuth:
-                    DS::AuthServer_Add(client);
-                    break;
-                case e_ConnCliToGame:
-                    DS::GameServer_Add(client);
-                    break;
-                case e_ConnCliToCsr:
-                    ST::printf("[Lobby] {} - CSR client?  Get that mutha outta here!\n",
-                               DS::SockIpAddress(client));
-                    DS::FreeSock(client);
-                    break;
-                default:
-                    ST::printf("[Lobby] {} - Unknown connection type!  Abandon ship!\n",
-                           DS::SockIpAddress(client));
-                    DS::FreeSock(client);
-                    break;
+        for (int i = 0; i < count; ++i) {
+            if (!events[i].data.ptr) {
+                try {
+                    lobby_accept(acceptor, pending);
+                } catch (const DS::SockHup&) {
+                    s_lobbyRunning = false;
                 }
-            } catch (const DS::SockHup& hup) {
-                DS::FreeSock(client);
-            } catch (const std::exception& ex) {
-                ST::printf(stderr, "[Lobby] {} - Exception while processing incoming client: {}\n",
-                           DS::SockIpAddress(client), ex.what());
-                DS::FreeSock(client);
+                continue;
             }
+
+            Lobby_PendingClient* conn = reinterpret_cast<Lobby_PendingClient*>(events[i].data.ptr);
+            if (lobby_read(acceptor, *conn))
+                conn->m_sock = nullptr;
+        }
+
+        time_t now = time(nullptr);
+        auto conn_iter = pending.begin();
+        while (conn_iter != pending.end()) {
+            if (conn_iter->m_sock && now >= conn_iter->m_deadline) {
+                ST::printf("[Lobby] {} - Timed out waiting for connection header\n",
+                           DS::SockIpAddress(conn_iter->m_sock));
+                epoll_ctl(acceptor->m_epoll, EPOLL_CTL_DEL, DS::SockFd(conn_iter->m_sock), nullptr);
+                DS::FreeSock(conn_iter->m_sock);
+                conn_iter->m_sock = nullptr;
+            }
+            if (!conn_iter->m_sock)
+                conn_iter = pending.erase(conn_iter);
+            else
+                ++conn_iter;
         }
     }
 
-    DS::FreeSock(s_listenSock);
+    for (Lobby_PendingClient& conn : pending)
+        DS::FreeSock(conn.m_sock);
+    DS::FreeSock(acceptor->m_listenSock);
 }
 
 void DS::StartLobby()
 {
-    try {
-        s_listenSock = DS::BindSocket(DS::Settings::LobbyAddress(),
-                                      DS::Settings::LobbyPort());
-        DS::ListenSock(s_listenSock);
-    } catch (const SystemError &err) {
-        fputs(err.what(), stderr);
-        exit(1);
+    uint32_t numAcceptors = std::max(1u, DS::Settings::LobbyAcceptors());
+    s_lobbyRunning = true;
+
+    for (uint32_t i = 0; i < numAcceptors; ++i) {
+        std::unique_ptr<Lobby_Acceptor> acceptor(new Lobby_Acceptor);
+        try {
+            acceptor->m_listenSock = DS::BindSocket(DS::Settings::LobbyAddress(),
+                                                    DS::Settings::LobbyPort(),
+                                                    numAcceptors > 1);
+            DS::ListenSock(acceptor->m_listenSock);
+            DS::SockSetBlocking(acceptor->m_listenSock, false);
+
+            acceptor->m_epoll = epoll_create1(EPOLL_CLOEXEC);
+            if (acceptor->m_epoll < 0)
+                throw DS::SystemError("Failed to create epoll instance", strerror(errno));
+
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = nullptr;
+            if (epoll_ctl(acceptor->m_epoll, EPOLL_CTL_ADD,
+                          DS::SockFd(acceptor->m_listenSock), &ev) < 0)
+                throw DS::SystemError("Failed to add listen socket to epoll", strerror(errno));
+        } catch (const SystemError &err) {
+            fputs(err.what(), stderr);
+            exit(1);
+        }
+        acceptor->m_thread = std::thread(&dm_lobby, acceptor.get());
+        s_acceptors.emplace_back(std::move(acceptor));
     }
-    s_lobbyThread = std::thread(&dm_lobby);
 }
 
 void DS::StopLobby()
 {
-    DS::CloseSock(s_listenSock);
-    s_lobbyThread.join();
+    s_lobbyRunning = false;
+    for (auto& acceptor : s_acceptors) {
+        acceptor->m_thread.join();
+        close(acceptor->m_epoll);
+    }
+    s_acceptors.clear();
 }
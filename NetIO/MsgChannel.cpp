@@ -18,17 +18,38 @@
 #include "MsgChannel.h"
 
 #include <sys/eventfd.h>
+#include <poll.h>
 #include <unistd.h>
 #include <errno.h>
 #include <cstring>
+#include <thread>
 #include "errors.h"
 
+/* The queue itself is an intrusive linked MPSC queue (as described by
+ * Dmitry Vyukov).  Producers swap themselves in at the head; the single
+ * consumer follows the next pointers from the tail.  A push that has
+ * swapped the head but not yet linked its predecessor is briefly
+ * invisible to the consumer, which m_depth lets us detect.
+ */
+
+DS::MsgChannel::MsgChannel()
+    : m_semaphore(-1), m_head(&m_stub), m_tail(&m_stub), m_depth(0), m_peakDepth(0),
+      m_putting(0)
+{
+    m_stub.m_next.store(nullptr, std::memory_order_relaxed);
+}
+
 DS::MsgChannel::~MsgChannel()
 {
-    if (m_semaphore < 0)
+    FifoMessage msg;
+    while (pop(msg))
+        ;
+
+    int semaphore = m_semaphore.load();
+    if (semaphore < 0)
         return;
 
-    int result = close(m_semaphore);
+    int result = close(semaphore);
     if (result < 0 && errno != EBADF) {
         ST::printf(stderr, "WARNING: Failed to close event semaphore: {}\n",
                    strerror(errno));
@@ -37,47 +58,168 @@ DS::MsgChannel::~MsgChannel()
 
 int DS::MsgChannel::fd()
 {
-    std::lock_guard<std::mutex> guard(m_mutex);
-
-    if (m_semaphore >= 0)
-        return m_semaphore;
+    int semaphore = m_semaphore.load(std::memory_order_acquire);
+    if (semaphore >= 0)
+        return semaphore;
 
-    m_semaphore = eventfd(0, EFD_SEMAPHORE);
-    if (m_semaphore < 0)
+    int created = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (created < 0)
         throw SystemError("Failed to create event semaphore", strerror(errno));
-    return m_semaphore;
+    if (!m_semaphore.compare_exchange_strong(semaphore, created, std::memory_order_acq_rel)) {
+        // Somebody else beat us to it
+        close(created);
+        return semaphore;
+    }
+    return created;
 }
 
 void DS::MsgChannel::putMessage(int type, void* payload)
 {
-    FifoMessage msg;
-    msg.m_messageType = type;
-    msg.m_payload = payload;
+    // Counted before the message becomes visible, so that idle() can't
+    // see an empty queue while we're still signaling the consumer
+    struct PutGuard
     {
-        std::lock_guard<std::mutex> guard(m_mutex);
-        m_queue.push(msg);
+        std::atomic<int>& m_putting;
+        explicit PutGuard(std::atomic<int>& putting) : m_putting(putting) { ++m_putting; }
+        ~PutGuard() { --m_putting; }
+    } putGuard(m_putting);
+
+    Node* node = new Node;
+    node->m_next.store(nullptr, std::memory_order_relaxed);
+    node->m_message.m_messageType = type;
+    node->m_message.m_payload = payload;
+
+    Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+    prev->m_next.store(node, std::memory_order_release);
+
+    long depth = m_depth.fetch_add(1, std::memory_order_acq_rel) + 1;
+    size_t peak = m_peakDepth.load(std::memory_order_relaxed);
+    while (depth > 0 && static_cast<size_t>(depth) > peak
+           && !m_peakDepth.compare_exchange_weak(peak, depth, std::memory_order_relaxed))
+        ;
+
+    // Only the transition from empty needs to wake up the consumer
+    if (depth == 1 && m_wakeup) {
+        m_wakeup();
+    } else if (depth == 1) {
+        int result = eventfd_write(fd(), 1);
+        if (result < 0)
+            throw SystemError("Failed to write to event semaphore", strerror(errno));
+    }
+}
+
+bool DS::MsgChannel::pop(FifoMessage& msg)
+{
+    Node* tail = m_tail;
+    Node* next = tail->m_next.load(std::memory_order_acquire);
+    if (tail == &m_stub) {
+        if (!next)
+            return false;
+        m_tail = next;
+        tail = next;
+        next = next->m_next.load(std::memory_order_acquire);
     }
 
-    int result = eventfd_write(fd(), 1);
-    if (result < 0)
-        throw SystemError("Failed to write to event semaphore", strerror(errno));
+    if (next) {
+        msg = tail->m_message;
+        m_tail = next;
+        delete tail;
+        return true;
+    }
+
+    // tail is the last node we can see -- we can only take it if nobody is
+    // in the middle of pushing behind it
+    if (tail != m_head.load(std::memory_order_acquire))
+        return false;
+
+    m_stub.m_next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = m_head.exchange(&m_stub, std::memory_order_acq_rel);
+    prev->m_next.store(&m_stub, std::memory_order_release);
+
+    next = tail->m_next.load(std::memory_order_acquire);
+    if (next) {
+        msg = tail->m_message;
+        m_tail = next;
+        delete tail;
+        return true;
+    }
+    return false;
 }
 
-DS::FifoMessage DS::MsgChannel::getMessage()
+void DS::MsgChannel::clearSignal()
 {
     eventfd_t value;
-    int result = eventfd_read(fd(), &value);
-    if (result < 0)
+    if (eventfd_read(fd(), &value) < 0 && errno != EAGAIN)
         throw SystemError("Failed to read from event semaphore", strerror(errno));
+}
+
+void DS::MsgChannel::waitSignal()
+{
+    pollfd pfd;
+    pfd.fd = fd();
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR)
+            throw SystemError("Failed to wait on event semaphore", strerror(errno));
+    }
+}
+
+size_t DS::MsgChannel::getMessages(FifoMessage* messages, size_t count, bool block)
+{
+    size_t received = 0;
+    bool cleared = false;
+    while (received < count) {
+        if (pop(messages[received])) {
+            m_depth.fetch_sub(1, std::memory_order_acq_rel);
+            ++received;
+            continue;
+        }
+        if (received > 0)
+            break;
 
-    std::lock_guard<std::mutex> guard(m_mutex);
-    FifoMessage msg = m_queue.front();
-    m_queue.pop();
+        if (m_depth.load(std::memory_order_acquire) > 0) {
+            // A push is in progress, and will be visible momentarily
+            std::this_thread::yield();
+            continue;
+        }
+
+        if (!cleared) {
+            // Consume any stale wakeup and look again, in case a message
+            // arrived just before the signal was cleared
+            if (!m_wakeup)
+                clearSignal();
+            cleared = true;
+            continue;
+        }
+
+        if (!block)
+            break;
+        DS_ASSERT(!m_wakeup);
+        waitSignal();
+        cleared = false;
+    }
+
+    // Producers only signal when the queue goes from empty to non-empty, so
+    // if we consumed the signal for a message we're leaving behind (e.g. one
+    // that arrived after the queue looked empty, and didn't fit in this
+    // batch), nobody else will set it again
+    if (cleared && !m_wakeup && m_depth.load(std::memory_order_acquire) > 0) {
+        int result = eventfd_write(fd(), 1);
+        if (result < 0)
+            throw SystemError("Failed to write to event semaphore", strerror(errno));
+    }
+    return received;
+}
+
+DS::FifoMessage DS::MsgChannel::getMessage()
+{
+    FifoMessage msg;
+    getMessages(&msg, 1, true);
     return msg;
 }
 
-bool DS::MsgChannel::hasMessage()
+size_t DS::MsgChannel::depth() const
 {
-    std::lock_guard<std::mutex> guard(m_mutex);
-    return !m_queue.empty();
+    long depth = m_depth.load(std::memory_order_relaxed);
+    return depth > 0 ? static_cast<size_t>(depth) : 0;
 }
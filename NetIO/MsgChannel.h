@@ -18,8 +18,9 @@
 #ifndef _DS_MSGCHANNEL_H
 #define _DS_MSGCHANNEL_H
 
-#include <queue>
-#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <functional>
 
 namespace DS
 {
@@ -29,21 +30,80 @@ namespace DS
         void* m_payload;
     };
 
+    /* Multiple-producer, single-consumer message queue.  Producers never
+     * block or take a lock, and the consumer is only signaled (through
+     * the fd()) when the queue goes from empty to non-empty, so a burst of
+     * messages costs a single wakeup.
+     *
+     * NOTE: fd() may occasionally be readable with no messages waiting, so
+     * consumers that poll() it must use the non-blocking getMessages().
+     *
+     * A consumer that isn't a thread of its own (e.g. an executor task) can
+     * set a wakeup callback instead, which is called by the producer in
+     * place of signaling the fd().  Such channels can only be read with the
+     * non-blocking getMessages().
+     */
     class MsgChannel
     {
     public:
-        MsgChannel() : m_semaphore(-1) { }
+        MsgChannel();
         ~MsgChannel();
 
         int fd();
         void putMessage(int type, void* payload = nullptr);
+
+        // Must be set before any messages are sent
+        void setWakeup(std::function<void ()> wakeup) { m_wakeup = std::move(wakeup); }
         FifoMessage getMessage();
-        bool hasMessage();
+        bool hasMessage() const { return m_depth.load(std::memory_order_acquire) > 0; }
+
+        // True if the queue is empty and no putMessage() call is still
+        // running (e.g. in its wakeup callback).  Once the consumer knows
+        // that nobody will send anything else, an idle channel is safe to
+        // destroy.
+        bool idle() const
+        {
+            return m_putting.load(std::memory_order_acquire) == 0 && !hasMessage();
+        }
+
+        // Retrieve up to count messages at once.  If block is set, waits
+        // for at least one message to arrive; otherwise returns 0 if the
+        // queue is empty.
+        size_t getMessages(FifoMessage* messages, size_t count, bool block = true);
+
+        template <size_t count>
+        size_t getMessages(FifoMessage (&messages)[count], bool block = true)
+        {
+            return getMessages(messages, count, block);
+        }
+
+        // Queue depth statistics
+        size_t depth() const;
+        size_t peakDepth() const { return m_peakDepth.load(std::memory_order_relaxed); }
 
     private:
-        int m_semaphore;
-        std::mutex m_mutex;
-        std::queue<FifoMessage> m_queue;
+        struct Node
+        {
+            std::atomic<Node*> m_next;
+            FifoMessage m_message;
+        };
+
+        std::function<void ()> m_wakeup;
+        std::atomic<int> m_semaphore;
+        std::atomic<Node*> m_head;
+        Node* m_tail;
+        Node m_stub;
+
+        std::atomic<long> m_depth;
+        std::atomic<size_t> m_peakDepth;
+        std::atomic<int> m_putting;
+
+        bool pop(FifoMessage& msg);
+        void clearSignal();
+        void waitSignal();
+
+        MsgChannel(const MsgChannel&) = delete;
+        MsgChannel& operator=(const MsgChannel&) = delete;
     };
 }
 
@@ -0,0 +1,646 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "Reactor.h"
+#include "HandshakePool.h"
+#include "settings.h"
+#include "errors.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <list>
+#include <memory>
+
+#define REACTOR_MAX_EVENTS (64)
+
+/* A client with more than this waiting to be sent isn't read from, or sent
+ * any broadcasts, until it catches up */
+#define REACTOR_SEND_BACKLOG (64 * 1024)
+
+struct DS::ReactorLoop
+{
+    int m_epoll, m_wakeup;
+    std::thread m_thread;
+    std::atomic<bool> m_running, m_finished;
+
+    std::mutex m_clientMutex;
+    std::list<ReactorClient*> m_clients;
+
+    std::vector<ReactorClient*> m_pending, m_closing;
+
+    // Clients handed back by the handshake pool, and whether they connected
+    std::mutex m_handoffMutex;
+    std::vector<std::pair<ReactorClient*, bool>> m_handoff;
+
+    ReactorLoop()
+        : m_epoll(-1), m_wakeup(-1), m_running(false), m_finished(false) { }
+    ~ReactorLoop();
+
+    void add(ReactorClient* client);
+    void handshake(ReactorClient* client);
+    void finishHandshakes(time_t now);
+    void dispatch(ReactorClient::EventSource* source, uint32_t events, time_t now);
+    void dispatchPending(ReactorClient* client, time_t now);
+    void readMessage(ReactorClient* client);
+    void update(ReactorClient* client);
+    void watchReply(ReactorClient* client);
+    void reply(ReactorClient* client, time_t now);
+    void close(ReactorClient* client);
+    void reapLater(ReactorClient* client);
+    void reap();
+    void run();
+};
+
+static std::vector<std::unique_ptr<DS::ReactorLoop>> s_loops;
+static std::atomic<size_t> s_nextLoop;
+
+DS::ReactorLoop::~ReactorLoop()
+{
+    if (m_wakeup >= 0)
+        ::close(m_wakeup);
+    if (m_epoll >= 0)
+        ::close(m_epoll);
+}
+
+void DS::ReactorLoop::add(ReactorClient* client)
+{
+    client->m_evLoop = this;
+    client->m_evSock.m_client = client;
+    client->m_evSock.m_type = ReactorClient::e_SourceSock;
+    client->m_evEvent.m_client = client;
+    client->m_evEvent.m_type = ReactorClient::e_SourceEvent;
+    client->m_evReply.m_client = client;
+    client->m_evReply.m_type = ReactorClient::e_SourceReply;
+    client->m_evLastActive = time(nullptr);
+
+    {
+        std::lock_guard<std::mutex> clientGuard(m_clientMutex);
+        m_clients.push_back(client);
+    }
+
+    // The event fd must be registered first:  As soon as the socket is
+    // added, this client may be handled (and freed) by the loop thread.
+    int eventFd = -1;
+    try {
+        eventFd = client->eventFd();
+        if (eventFd >= 0) {
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = &client->m_evEvent;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, eventFd, &ev) < 0)
+                throw DS::SystemError("Failed to add event fd to epoll", strerror(errno));
+            client->m_evEvents = true;
+        }
+
+        client->m_evReading = true;
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &client->m_evSock;
+        if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, DS::SockFd(client->sock()), &ev) < 0)
+            throw DS::SystemError("Failed to add socket to epoll", strerror(errno));
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Reactor] Could not add client {}: {}\n",
+                   DS::SockIpAddress(client->sock()), ex.what());
+        if (eventFd >= 0)
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, eventFd, nullptr);
+        {
+            std::lock_guard<std::mutex> clientGuard(m_clientMutex);
+            m_clients.remove(client);
+        }
+        // Not on the loop, so any reply onDisconnect needs is waited for here
+        client->m_evLoop = nullptr;
+        client->onDisconnect();
+        delete client;
+    }
+}
+
+void DS::ReactorLoop::dispatch(ReactorClient::EventSource* source, uint32_t events,
+                               time_t now)
+{
+    ReactorClient* client = source->m_client;
+    if (source->m_type == ReactorClient::e_SourceReply) {
+        reply(client, now);
+        return;
+    }
+    if (client->m_evClosed)
+        return;
+
+    client->m_evLastActive = now;
+    try {
+        CryptState crypt = client->cryptState();
+        if (source->m_type == ReactorClient::e_SourceEvent) {
+            client->onEvent();
+        } else if (!client->m_evConnected) {
+            // Read here, so the handshake pool never waits on a slow client
+            if (!client->onConnectRead())
+                return;
+            client->m_evConnected = true;
+            handshake(client);
+            return;
+        } else {
+            if (events & EPOLLOUT) {
+                DS::CryptSendFlush(client->sock(), crypt);
+                client->onSockWrite();
+            }
+            if ((events & ~EPOLLOUT) && !client->m_evReading) {
+                // Reads are paused, but the connection is gone
+                if (events & (EPOLLERR | EPOLLHUP))
+                    throw DS::SockHup();
+            } else if ((events & ~EPOLLOUT) && crypt) {
+                DS::CryptRecvFill(client->sock(), crypt);
+                readMessage(client);
+            } else if (events & ~EPOLLOUT) {
+                client->onSockRead();
+            }
+        }
+        update(client);
+    } catch (const DS::SockHup&) {
+        // Socket closed...
+        close(client);
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[{}] Error processing client message from {}: {}\n",
+                   client->serviceName(), DS::SockIpAddress(client->sock()),
+                   ex.what());
+        close(client);
+    }
+}
+
+void DS::ReactorLoop::dispatchPending(ReactorClient* client, time_t now)
+{
+    client->m_evPending = false;
+    if (client->m_evClosed)
+        return;
+
+    client->m_evLastActive = now;
+    try {
+        if (client->cryptState())
+            readMessage(client);
+        else
+            client->onSockRead();
+        update(client);
+    } catch (const DS::SockHup&) {
+        // Socket closed...
+        close(client);
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[{}] Error processing client message from {}: {}\n",
+                   client->serviceName(), DS::SockIpAddress(client->sock()),
+                   ex.what());
+        close(client);
+    }
+}
+
+/* Handles the next message buffered for a client that uses CryptIO, if all
+ * of it has arrived */
+void DS::ReactorLoop::readMessage(ReactorClient* client)
+{
+    CryptState crypt = client->cryptState();
+    if (!client->m_evReading || !DS::CryptRecvPending(crypt))
+        return;
+
+    try {
+        client->onSockRead();
+    } catch (const DS::RecvIncomplete&) {
+        DS::CryptRecvRewind(crypt);
+        return;
+    }
+    DS::CryptRecvCommit(crypt);
+}
+
+/* Brings the client's epoll registration in line with what it's waiting
+ * for, and queues it up again if it has more buffered messages to handle */
+void DS::ReactorLoop::update(ReactorClient* client)
+{
+    if (client->m_evClosed || client->m_evHandshake)
+        return;
+
+    // While waiting for a reply, broadcasts are held back too, so the
+    // client's handlers still never overlap
+    size_t queued = DS::CryptSendQueued(client->cryptState());
+    bool reading = !client->m_evReplyHandler && queued <= REACTOR_SEND_BACKLOG;
+    bool writing = queued > 0 || client->sendPending();
+    if (reading != client->m_evReading || writing != client->m_evWriting) {
+        epoll_event ev;
+        ev.events = 0;
+        if (reading)
+            ev.events |= EPOLLIN;
+        if (writing)
+            ev.events |= EPOLLOUT;
+        ev.data.ptr = &client->m_evSock;
+        if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, DS::SockFd(client->sock()), &ev) < 0)
+            throw DS::SystemError("Failed to update socket in epoll", strerror(errno));
+        client->m_evReading = reading;
+        client->m_evWriting = writing;
+    }
+
+    int eventFd = client->eventFd();
+    if (eventFd >= 0 && client->m_evEvents != reading) {
+        epoll_event ev;
+        ev.events = reading ? uint32_t(EPOLLIN) : 0;
+        ev.data.ptr = &client->m_evEvent;
+        if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, eventFd, &ev) < 0)
+            throw DS::SystemError("Failed to update event fd in epoll", strerror(errno));
+        client->m_evEvents = reading;
+    }
+
+    if (reading && !client->m_evPending && client->recvPending()) {
+        client->m_evPending = true;
+        m_pending.push_back(client);
+    }
+}
+
+void DS::ReactorClient::awaitReply(MsgChannel& channel, ReplyHandler done)
+{
+    if (!m_evLoop) {
+        done(channel.getMessage());
+        return;
+    }
+
+    DS_ASSERT(!m_evReplyHandler);
+    m_evReplyChannel = &channel;
+    m_evReplyHandler = std::move(done);
+    m_evLoop->watchReply(this);
+}
+
+void DS::ReactorLoop::watchReply(ReactorClient* client)
+{
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &client->m_evReply;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, client->m_evReplyChannel->fd(), &ev) < 0) {
+        // The reply handler owns what the daemon is writing to, so it can't
+        // just be dropped
+        ST::printf(stderr, "[Reactor] Could not wait for a reply for {}: {}\n",
+                   DS::SockIpAddress(client->sock()), strerror(errno));
+        ReactorClient::ReplyHandler done = std::move(client->m_evReplyHandler);
+        client->m_evReplyHandler = nullptr;
+        done(client->m_evReplyChannel->getMessage());
+    }
+}
+
+void DS::ReactorLoop::reply(ReactorClient* client, time_t now)
+{
+    FifoMessage msg;
+    if (!client->m_evReplyHandler || client->m_evReplyChannel->getMessages(&msg, 1, false) == 0)
+        return;
+
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, client->m_evReplyChannel->fd(), nullptr);
+    ReactorClient::ReplyHandler done = std::move(client->m_evReplyHandler);
+    client->m_evReplyHandler = nullptr;
+    client->m_evLastActive = now;
+
+    // A closed client still gets its reply handled, so whatever it was
+    // waiting on is cleaned up properly
+    try {
+        done(msg);
+        update(client);
+    } catch (const DS::SockHup&) {
+        // Socket closed...
+        close(client);
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[{}] Error processing client message from {}: {}\n",
+                   client->serviceName(), DS::SockIpAddress(client->sock()),
+                   ex.what());
+        close(client);
+    }
+    if (client->m_evClosed && !client->m_evReplyHandler)
+        reapLater(client);
+}
+
+void DS::ReactorLoop::handshake(ReactorClient* client)
+{
+    // The client is left out of the loop until the handshake pool is done
+    // with it, so nothing else is dispatched for it in the meantime
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, DS::SockFd(client->sock()), nullptr);
+    int eventFd = client->eventFd();
+    if (eventFd >= 0)
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, eventFd, nullptr);
+    client->m_evHandshake = true;
+    client->m_evReading = false;
+    client->m_evWriting = false;
+    client->m_evEvents = false;
+
+    bool queued = DS::HandshakeSubmit(client->sock(), [this, client] {
+        bool connected = false;
+        try {
+            client->onConnect();
+            connected = true;
+        } catch (const DS::SockHup&) {
+            // Socket closed...
+        } catch (const std::exception& ex) {
+            ST::printf(stderr, "[{}] Error connecting {}: {}\n", client->serviceName(),
+                       DS::SockIpAddress(client->sock()), ex.what());
+        }
+
+        {
+            std::lock_guard<std::mutex> handoffGuard(m_handoffMutex);
+            m_handoff.emplace_back(client, connected);
+        }
+        eventfd_write(m_wakeup, 1);
+    });
+
+    if (!queued) {
+        ST::printf(stderr, "[{}] Handshake backlog is full; dropping {}\n",
+                   client->serviceName(), DS::SockIpAddress(client->sock()));
+        client->m_evHandshake = false;
+        close(client);
+    }
+}
+
+void DS::ReactorLoop::finishHandshakes(time_t now)
+{
+    std::vector<std::pair<ReactorClient*, bool>> handoff;
+    {
+        std::lock_guard<std::mutex> handoffGuard(m_handoffMutex);
+        handoff.swap(m_handoff);
+    }
+
+    for (const auto& result : handoff) {
+        ReactorClient* client = result.first;
+        client->m_evHandshake = false;
+        client->m_evLastActive = now;
+        if (!result.second) {
+            close(client);
+            continue;
+        }
+
+        try {
+            // From here on, the client's traffic is handled without blocking
+            CryptState crypt = client->cryptState();
+            if (crypt)
+                DS::CryptSetNonBlocking(crypt);
+
+            int eventFd = client->eventFd();
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = &client->m_evEvent;
+            if (eventFd >= 0 && epoll_ctl(m_epoll, EPOLL_CTL_ADD, eventFd, &ev) < 0)
+                throw DS::SystemError("Failed to add event fd to epoll", strerror(errno));
+            client->m_evEvents = (eventFd >= 0);
+
+            ev.data.ptr = &client->m_evSock;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, DS::SockFd(client->sock()), &ev) < 0)
+                throw DS::SystemError("Failed to add socket to epoll", strerror(errno));
+            client->m_evReading = true;
+
+            update(client);
+        } catch (const std::exception& ex) {
+            ST::printf(stderr, "[Reactor] Could not add client {}: {}\n",
+                       DS::SockIpAddress(client->sock()), ex.what());
+            close(client);
+        }
+    }
+}
+
+void DS::ReactorLoop::close(ReactorClient* client)
+{
+    if (client->m_evClosed)
+        return;
+
+    client->m_evClosed = true;
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, DS::SockFd(client->sock()), nullptr);
+    try {
+        int eventFd = client->eventFd();
+        if (eventFd >= 0)
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, eventFd, nullptr);
+    } catch (const std::exception&) {
+        // The event fd was never created, so it isn't registered either
+    }
+    reapLater(client);
+}
+
+void DS::ReactorLoop::reapLater(ReactorClient* client)
+{
+    if (!client->m_evReaping) {
+        client->m_evReaping = true;
+        m_closing.push_back(client);
+    }
+}
+
+void DS::ReactorLoop::reap()
+{
+    // Closed clients are only freed once the whole event batch has been
+    // processed, since later events in the batch may still refer to them
+    std::vector<ReactorClient*> closing;
+    closing.swap(m_closing);
+    for (ReactorClient* client : closing) {
+        client->m_evReaping = false;
+
+        // Whoever is going to reply still refers to the client, so it's
+        // reaped again once the reply has been handled
+        if (client->m_evReplyHandler)
+            continue;
+
+        if (!client->m_evDisconnected) {
+            client->m_evDisconnected = true;
+            {
+                std::lock_guard<std::mutex> clientGuard(m_clientMutex);
+                m_clients.remove(client);
+            }
+            try {
+                client->onDisconnect();
+            } catch (const std::exception& ex) {
+                ST::printf(stderr, "[{}] WARNING: {}\n", client->serviceName(), ex.what());
+            }
+            if (client->m_evReplyHandler)
+                continue;
+        }
+
+        // The daemon's putMessage() may still be running after its reply
+        // has been handled, and the channel goes away with the client
+        if (client->m_evReplyChannel && !client->m_evReplyChannel->idle()) {
+            reapLater(client);
+            continue;
+        }
+        delete client;
+    }
+}
+
+void DS::ReactorLoop::run()
+{
+    epoll_event events[REACTOR_MAX_EVENTS];
+    std::vector<ReactorClient*> ready;
+    time_t lastSweep = time(nullptr);
+
+    while (m_running) {
+        int timeout = !m_pending.empty() ? 0 : !m_closing.empty() ? 1 : 1000;
+        int count = epoll_wait(m_epoll, events, REACTOR_MAX_EVENTS, timeout);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            ST::printf(stderr, "[Reactor] Failure in epoll_wait: {}\n", strerror(errno));
+            break;
+        }
+        time_t now = time(nullptr);
+
+        // Clients with buffered data get one message handled per pass, so
+        // a single busy client can't starve the rest of the loop
+        ready.swap(m_pending);
+        for (ReactorClient* client : ready)
+            dispatchPending(client, now);
+        ready.clear();
+
+        for (int i = 0; i < count; ++i) {
+            if (!events[i].data.ptr) {
+                // Wakeup request from StopReactor or the handshake pool
+                eventfd_t value;
+                eventfd_read(m_wakeup, &value);
+                finishHandshakes(now);
+                continue;
+            }
+            dispatch(reinterpret_cast<ReactorClient::EventSource*>(events[i].data.ptr),
+                     events[i].events, now);
+        }
+
+        if (now - lastSweep >= 1) {
+            std::lock_guard<std::mutex> clientGuard(m_clientMutex);
+            for (ReactorClient* client : m_clients) {
+                // Clients in the handshake pool are only waiting for a thread,
+                // and the others are waiting on us
+                if (client->m_evHandshake || client->m_evReplyHandler)
+                    continue;
+                time_t timeout = client->m_evConnected ? NET_TIMEOUT : HANDSHAKE_TIMEOUT;
+                if (now - client->m_evLastActive > timeout)
+                    close(client);
+            }
+            lastSweep = now;
+        }
+
+        // Anything closed may still be sitting in the pending list
+        if (!m_closing.empty()) {
+            auto pend_iter = m_pending.begin();
+            while (pend_iter != m_pending.end()) {
+                if ((*pend_iter)->m_evClosed)
+                    pend_iter = m_pending.erase(pend_iter);
+                else
+                    ++pend_iter;
+            }
+        }
+        reap();
+    }
+    m_finished = true;
+}
+
+static void pin_thread(std::thread& thread, size_t index)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return;
+
+    int count = CPU_COUNT(&allowed);
+    if (count <= 0)
+        return;
+    int target = static_cast<int>(index % count);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        if (target-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            int result = pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+            if (result != 0) {
+                ST::printf(stderr, "[Reactor] Warning: Could not pin event loop to CPU {}: {}\n",
+                           cpu, strerror(result));
+            }
+            return;
+        }
+    }
+}
+
+void DS::StartReactor()
+{
+    if (DS::Settings::ThreadPerClient())
+        return;
+
+    size_t numLoops = DS::Settings::EventLoops();
+    if (numLoops == 0)
+        numLoops = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < numLoops; ++i) {
+        std::unique_ptr<ReactorLoop> loop(new ReactorLoop);
+        try {
+            loop->m_epoll = epoll_create1(EPOLL_CLOEXEC);
+            if (loop->m_epoll < 0)
+                throw DS::SystemError("Failed to create epoll instance", strerror(errno));
+            loop->m_wakeup = eventfd(0, EFD_CLOEXEC);
+            if (loop->m_wakeup < 0)
+                throw DS::SystemError("Failed to create wakeup event", strerror(errno));
+
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = nullptr;
+            if (epoll_ctl(loop->m_epoll, EPOLL_CTL_ADD, loop->m_wakeup, &ev) < 0)
+                throw DS::SystemError("Failed to add wakeup event to epoll", strerror(errno));
+        } catch (const DS::SystemError& err) {
+            fputs(err.what(), stderr);
+            exit(1);
+        }
+
+        loop->m_running = true;
+        loop->m_thread = std::thread(&ReactorLoop::run, loop.get());
+        pin_thread(loop->m_thread, i);
+        s_loops.emplace_back(std::move(loop));
+    }
+    ST::printf("[Reactor] Started {} event loops\n", s_loops.size());
+}
+
+void DS::StopReactor()
+{
+    for (auto& loop : s_loops) {
+        loop->m_running = false;
+        eventfd_write(loop->m_wakeup, 1);
+    }
+
+    bool complete = false;
+    for (int i=0; i<50 && !complete; ++i) {
+        complete = true;
+        for (const auto& loop : s_loops)
+            complete = complete && loop->m_finished;
+        if (!complete)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    for (auto& loop : s_loops) {
+        if (loop->m_finished) {
+            loop->m_thread.join();
+        } else {
+            // Still stuck in a handler; leave it be rather than pulling
+            // the loop out from under it
+            loop->m_thread.detach();
+            loop.release();
+        }
+    }
+    if (!complete)
+        fputs("[Reactor] Event loops didn't die after 5 seconds!\n", stderr);
+    s_loops.clear();
+}
+
+void DS::ReactorAdd(ReactorClient* client)
+{
+    DS_ASSERT(!s_loops.empty());
+    size_t index = s_nextLoop++ % s_loops.size();
+    s_loops[index]->add(client);
+}
@@ -0,0 +1,134 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _DS_REACTOR_H
+#define _DS_REACTOR_H
+
+#include "SockIO.h"
+#include "CryptIO.h"
+#include "MsgChannel.h"
+#include <functional>
+#include <ctime>
+
+/* The reactor multiplexes client connections for all of the services onto
+ * a small, fixed number of epoll loops (one per core by default), rather
+ * than running a dedicated thread for each connection.  Each connection is
+ * owned by exactly one loop, so its handlers are never run concurrently.
+ *
+ * Nothing run by a loop may wait, since that would hold up every other
+ * connection on it:
+ *
+ *  - Clients using CryptIO hand over their cryptState().  The loop then
+ *    buffers their incoming data, and only calls onSockRead() to parse a
+ *    message from that buffer (see CryptRecvFill).  Their sends are queued
+ *    and written out as the socket becomes writable.  Other clients read
+ *    and write their socket without blocking themselves; they can ask to
+ *    be told when it is writable by returning true from sendPending().
+ *
+ *  - A handler that needs a reply from a daemon or game host passes the
+ *    rest of its work to awaitReply().  The loop stops reading from the
+ *    client, and handling its broadcasts, until the reply arrives on its
+ *    channel, so messages are still handled one at a time and in order.
+ *
+ *  - A client that isn't reading what we send it isn't read from either,
+ *    and its broadcasts stay in its BroadcastQueue (within that queue's
+ *    budget) until it catches up.
+ */
+
+namespace DS
+{
+    struct ReactorLoop;
+
+    class ReactorClient
+    {
+    public:
+        typedef std::function<void (const FifoMessage&)> ReplyHandler;
+
+        ReactorClient()
+            : m_evLoop(nullptr), m_evReplyChannel(nullptr), m_evLastActive(0),
+              m_evConnected(false), m_evHandshake(false), m_evPending(false),
+              m_evReading(false), m_evWriting(false), m_evEvents(false),
+              m_evClosed(false), m_evReaping(false), m_evDisconnected(false) { }
+        virtual ~ReactorClient() { }
+
+        virtual SocketHandle sock() const = 0;
+
+        // The client's encryption state, for clients which use CryptIO
+        virtual CryptState cryptState() const { return nullptr; }
+
+        // The client's broadcast channel, or -1 if it doesn't have one
+        virtual int eventFd() { return -1; }
+
+        // True if data has already been read off the socket but not handled
+        virtual bool recvPending() { return false; }
+
+        // True if queued output is waiting for the socket to become writable
+        virtual bool sendPending() { return false; }
+
+        // Reads the client's connection request without blocking, and
+        // returns true once it is complete
+        virtual bool onConnectRead() = 0;
+
+        // Connection handshake.  Called on the handshake pool once the
+        // connection request has been read
+        virtual void onConnect() = 0;
+        virtual void onSockRead() = 0;
+        virtual void onSockWrite() { }
+        virtual void onEvent() { }
+
+        // Called after the connection has been removed from its loop.  The
+        // client is deleted once this returns, or once the reply it is
+        // waiting for has been handled.
+        virtual void onDisconnect() = 0;
+
+        virtual const char* serviceName() const = 0;
+
+        // Calls done with the next message on channel.  On a loop, this
+        // returns right away, and done is called by the loop once the
+        // message arrives.  Anything the daemon writes to must therefore be
+        // owned by done.  Without a loop (Net.ThreadPerClient), this simply
+        // waits for the message.
+        void awaitReply(MsgChannel& channel, ReplyHandler done);
+
+    private:
+        enum SourceType { e_SourceSock, e_SourceEvent, e_SourceReply };
+
+        struct EventSource
+        {
+            ReactorClient* m_client;
+            SourceType m_type;
+        };
+
+        ReactorLoop* m_evLoop;
+        EventSource m_evSock, m_evEvent, m_evReply;
+        MsgChannel* m_evReplyChannel;   // The last channel awaited
+        ReplyHandler m_evReplyHandler;
+        time_t m_evLastActive;
+        bool m_evConnected, m_evHandshake, m_evPending;
+        bool m_evReading, m_evWriting, m_evEvents;
+        bool m_evClosed, m_evReaping, m_evDisconnected;
+
+        friend struct ReactorLoop;
+    };
+
+    void StartReactor();
+    void StopReactor();
+
+    void ReactorAdd(ReactorClient* client);
+}
+
+#endif
@@ -29,6 +29,7 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <cstdio>
 #include <cstring>
 #include <mutex>
@@ -65,7 +66,8 @@ static uint16_t get_in_port(SocketHandle_Private* sock)
     return ntohs(sock->m_in6addr.sin6_port);
 }
 
-DS::SocketHandle DS::BindSocket(const char* address, const char* port)
+DS::SocketHandle DS::BindSocket(const char* address, const char* port,
+                                bool reusePort)
 {
     int result;
     int sockfd;
@@ -96,6 +98,10 @@ DS::SocketHandle DS::BindSocket(const char* address, const char* port)
         // the server.
         if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &SOCK_YES, sizeof(SOCK_YES)) < 0)
             ST::printf(stderr, "[Bind] Warning: Failed to set socket address reuse: {}\n", strerror(errno));
+        // Allow several listeners to share the port, with the kernel
+        // balancing incoming connections between them
+        if (reusePort && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &SOCK_YES, sizeof(SOCK_YES)) < 0)
+            ST::printf(stderr, "[Bind] Warning: Failed to set socket port reuse: {}\n", strerror(errno));
         if (bind(sockfd, addr_iter->ai_addr, addr_iter->ai_addrlen) == 0)
             break;
         ST::printf(stderr, "[Bind] {}\n", strerror(errno));
@@ -132,18 +138,19 @@ void DS::ListenSock(const DS::SocketHandle sock, int backlog)
     }
 }
 
-DS::SocketHandle DS::AcceptSock(const DS::SocketHandle sock)
+DS::SocketHandle DS::AcceptSock(const DS::SocketHandle sock, bool nonBlocking)
 {
     DS_ASSERT(sock);
     SocketHandle_Private* sockp = reinterpret_cast<SocketHandle_Private*>(sock);
 
     SocketHandle_Private* client = new SocketHandle_Private(-1);
-    client->m_sockfd = accept(sockp->m_sockfd, &client->m_addr, &client->m_addrLen);
+    client->m_sockfd = accept4(sockp->m_sockfd, &client->m_addr, &client->m_addrLen,
+                               nonBlocking ? SOCK_NONBLOCK : 0);
     if (client->m_sockfd < 0) {
         delete client;
         if (errno == EINVAL) {
             throw DS::SockHup();
-        } else if (errno == ECONNABORTED) {
+        } else if (errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK) {
             return nullptr;
         } else {
             ST::printf(stderr, "Failed to accept incoming connection: {}\n",
@@ -162,6 +169,27 @@ DS::SocketHandle DS::AcceptSock(const DS::SocketHandle sock)
     return reinterpret_cast<SocketHandle>(client);
 }
 
+void DS::SockSetBlocking(const DS::SocketHandle sock, bool blocking)
+{
+    int fd = reinterpret_cast<SocketHandle_Private*>(sock)->m_sockfd;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0)
+        throw DS::SystemError("Failed to get socket flags", strerror(errno));
+    flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    if (fcntl(fd, F_SETFL, flags) < 0)
+        throw DS::SystemError("Failed to set socket flags", strerror(errno));
+}
+
+void DS::SockSetRecvTimeout(const DS::SocketHandle sock, unsigned int seconds)
+{
+    timeval tv;
+    tv.tv_sec = seconds;
+    tv.tv_usec = 0;
+    if (setsockopt(reinterpret_cast<SocketHandle_Private*>(sock)->m_sockfd,
+                   SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+        ST::printf(stderr, "Warning: Failed to set recv timeout: {}\n", strerror(errno));
+}
+
 void DS::CloseSock(DS::SocketHandle sock)
 {
     if (!sock) {
@@ -172,6 +200,15 @@ void DS::CloseSock(DS::SocketHandle sock)
     close(reinterpret_cast<SocketHandle_Private*>(sock)->m_sockfd);
 }
 
+void DS::ShutdownSock(DS::SocketHandle sock)
+{
+    if (!sock) {
+        fputs("WARNING: Tried to shut down invalid socket\n", stderr);
+        return;
+    }
+    shutdown(reinterpret_cast<SocketHandle_Private*>(sock)->m_sockfd, SHUT_RDWR);
+}
+
 void DS::FreeSock(DS::SocketHandle sock)
 {
     CloseSock(sock);
@@ -246,6 +283,48 @@ void DS::SendBuffer(const DS::SocketHandle sock, const void* buffer, size_t size
     } while (size > 0);
 }
 
+size_t DS::SendSome(const DS::SocketHandle sock, const iovec* parts, size_t count)
+{
+    for ( ;; ) {
+        ssize_t bytes = writev(reinterpret_cast<SocketHandle_Private*>(sock)->m_sockfd,
+                               parts, count);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EPIPE && errno != ECONNRESET) {
+                const char *error_text = strerror(errno);
+                ST::printf(stderr, "Failed to send to {}: {}\n",
+                           DS::SockIpAddress(sock), error_text);
+            }
+            throw DS::SockHup();
+        } else if (bytes == 0) {
+            // Connection closed without error
+            throw DS::SockHup();
+        }
+        return bytes;
+    }
+}
+
+void DS::SendVector(const DS::SocketHandle sock, iovec* parts, size_t count)
+{
+    while (count > 0 && parts[0].iov_len == 0) {
+        ++parts;
+        --count;
+    }
+    while (count > 0) {
+        size_t bytes = SendSome(sock, parts, count);
+        while (count > 0 && bytes >= parts[0].iov_len) {
+            bytes -= parts[0].iov_len;
+            ++parts;
+            --count;
+        }
+        if (count > 0) {
+            parts[0].iov_base = reinterpret_cast<uint8_t*>(parts[0].iov_base) + bytes;
+            parts[0].iov_len -= bytes;
+        }
+    }
+}
+
 void DS::SendFile(const DS::SocketHandle sock, const void* buffer, size_t bufsz,
                   int fd, off_t* offset, size_t fdsz)
 {
@@ -293,9 +372,64 @@ void DS::SendFile(const DS::SocketHandle sock, const void* buffer, size_t bufsz,
         ST::printf(stderr, "Warning: Failed to set cork option: {}", strerror(errno));
 }
 
-void DS::RecvBuffer(const DS::SocketHandle sock, void* buffer, size_t size)
+size_t DS::SendNonBlocking(const DS::SocketHandle sock, const iovec* parts,
+                           size_t count, bool more)
 {
-    while (size > 0) {
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = const_cast<iovec*>(parts);
+    msg.msg_iovlen = count;
+
+    int flags = MSG_DONTWAIT | (more ? MSG_MORE : 0);
+    for ( ;; ) {
+        ssize_t bytes = sendmsg(reinterpret_cast<SocketHandle_Private*>(sock)->m_sockfd,
+                                &msg, flags);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            } else if (errno != EPIPE && errno != ECONNRESET) {
+                const char *error_text = strerror(errno);
+                ST::printf(stderr, "Failed to send to {}: {}\n",
+                           DS::SockIpAddress(sock), error_text);
+            }
+            throw DS::SockHup();
+        }
+        return static_cast<size_t>(bytes);
+    }
+}
+
+size_t DS::SendFileNonBlocking(const DS::SocketHandle sock, int fd, off_t* offset,
+                               size_t size)
+{
+    // sendfile() has no MSG_DONTWAIT equivalent, so the socket itself must
+    // already be in non-blocking mode for this to return early
+    for ( ;; ) {
+        ssize_t bytes = sendfile(reinterpret_cast<SocketHandle_Private*>(sock)->m_sockfd,
+                                 fd, offset, size);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            } else if (errno != EPIPE && errno != ECONNRESET) {
+                const char *error_text = strerror(errno);
+                ST::printf(stderr, "Failed to send to {}: {}\n",
+                           DS::SockIpAddress(sock), error_text);
+            }
+            throw DS::SockHup();
+        } else if (bytes == 0) {
+            // The file was truncated underneath us
+            throw DS::SockHup();
+        }
+        return static_cast<size_t>(bytes);
+    }
+}
+
+size_t DS::RecvSome(const DS::SocketHandle sock, void* buffer, size_t size)
+{
+    for ( ;; ) {
         ssize_t bytes = recv(reinterpret_cast<SocketHandle_Private*>(sock)->m_sockfd,
                              buffer, size, 0);
         if (bytes < 0) {
@@ -311,7 +445,37 @@ void DS::RecvBuffer(const DS::SocketHandle sock, void* buffer, size_t size)
         } else if (bytes == 0) {
             throw DS::SockHup();
         }
+        return static_cast<size_t>(bytes);
+    }
+}
 
+size_t DS::RecvNonBlocking(const DS::SocketHandle sock, void* buffer, size_t size)
+{
+    for ( ;; ) {
+        ssize_t bytes = recv(reinterpret_cast<SocketHandle_Private*>(sock)->m_sockfd,
+                             buffer, size, MSG_DONTWAIT);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            } else if (errno != ECONNRESET && errno != EPIPE) {
+                const char *error_text = strerror(errno);
+                ST::printf(stderr, "Failed to recv from {}: {}\n",
+                           DS::SockIpAddress(sock), error_text);
+            }
+            throw DS::SockHup();
+        } else if (bytes == 0) {
+            throw DS::SockHup();
+        }
+        return static_cast<size_t>(bytes);
+    }
+}
+
+void DS::RecvBuffer(const DS::SocketHandle sock, void* buffer, size_t size)
+{
+    while (size > 0) {
+        size_t bytes = RecvSome(sock, buffer, size);
         size -= bytes;
         buffer = reinterpret_cast<void*>(reinterpret_cast<uint8_t*>(buffer) + bytes);
     }
@@ -20,6 +20,7 @@
 
 #include "streams.h"
 #include <stdexcept>
+#include <sys/uio.h>
 
 // Don't allow the client to send payloads > 128KB in size
 #define MAX_PAYLOAD_SIZE (128 * 1024)
@@ -28,10 +29,16 @@ namespace DS
 {
     typedef void* SocketHandle;
 
-    SocketHandle BindSocket(const char* address, const char* port);
+    SocketHandle BindSocket(const char* address, const char* port,
+                            bool reusePort = false);
     void ListenSock(const SocketHandle sock, int backlog = 10);
-    SocketHandle AcceptSock(const SocketHandle sock);
+    SocketHandle AcceptSock(const SocketHandle sock, bool nonBlocking = false);
+    void SockSetBlocking(const SocketHandle sock, bool blocking);
+
+    // Blocking reads fail with SockHup after this long (NET_TIMEOUT by default)
+    void SockSetRecvTimeout(const SocketHandle sock, unsigned int seconds);
     void CloseSock(SocketHandle sock);
+    void ShutdownSock(SocketHandle sock);
     void FreeSock(SocketHandle sock);
 
     ST::string SockIpAddress(const SocketHandle sock);
@@ -39,9 +46,23 @@ namespace DS
     int SockFd(const SocketHandle sock);
 
     void SendBuffer(const SocketHandle sock, const void* buffer, size_t size);
+    size_t SendSome(const SocketHandle sock, const iovec* parts, size_t count);
+
+    // Sends all parts in order.  The parts array is consumed in the process.
+    void SendVector(const SocketHandle sock, iovec* parts, size_t count);
     void SendFile(const SocketHandle sock, const void* buffer, size_t bufsz,
                   int fd, off_t* offset, size_t fdsz);
+
+    // Return 0 if the socket can't accept any more data right now.  Set
+    // more if further data for the same message will follow immediately.
+    size_t SendNonBlocking(const SocketHandle sock, const iovec* parts, size_t count,
+                           bool more = false);
+    size_t SendFileNonBlocking(const SocketHandle sock, int fd, off_t* offset, size_t size);
     void RecvBuffer(const SocketHandle sock, void* buffer, size_t size);
+    size_t RecvSome(const SocketHandle sock, void* buffer, size_t size);
+
+    // Returns 0 if no data is available yet
+    size_t RecvNonBlocking(const SocketHandle sock, void* buffer, size_t size);
     size_t PeekSize(const SocketHandle sock);
 
     template <typename tp>
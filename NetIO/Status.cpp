@@ -19,6 +19,8 @@
 #include "SockIO.h"
 #include "errors.h"
 #include "settings.h"
+#include "AuthServ/AuthServer.h"
+#include "GameServ/GameServer.h"
 #include <cstdio>
 #include <list>
 #include <thread>
@@ -30,6 +32,45 @@ static DS::SocketHandle s_listenSock;
 #define SEND_RAW(sock, str) \
     DS::SendBuffer((sock), static_cast<const void*>(str), strlen(str))
 
+static ST::string queue_stats_json(const DS::BroadcastQueueStats& stats)
+{
+    return ST::format("{{\"clients\":{},\"messages\":{},\"bytes\":{},"
+                      "\"max_messages\":{},\"max_bytes\":{},\"dropped\":{},"
+                      "\"coalesced\":{}}",
+                      stats.m_queues, stats.m_messages, stats.m_bytes,
+                      stats.m_maxMessages, stats.m_maxBytes, stats.m_dropped,
+                      stats.m_coalesced);
+}
+
+static ST::string age_stats_json(const std::vector<DS::GameAgeStats>& stats)
+{
+    ST::string_stream json;
+    json << "[";
+    for (auto it = stats.begin(); it != stats.end(); ++it) {
+        if (it != stats.begin())
+            json << ",";
+        json << ST::format("{{\"age\":\"{}\",\"instance\":\"{}\",\"players\":{},"
+                           "\"sdl\":{{\"broadcasts\":{},\"bytes\":{},\"saved\":{}}},"
+                           "\"irrelevant\":{{\"messages\":{},\"bytes\":{}}}}",
+                           it->m_ageFilename, it->m_instanceId.toString(true),
+                           it->m_clients, it->m_sdlBroadcasts, it->m_sdlBytes,
+                           it->m_sdlBytesSaved, it->m_irrelevantMessages,
+                           it->m_irrelevantBytes);
+    }
+    json << "]";
+    return json.to_string();
+}
+
+static ST::string host_pool_json(const DS::GameHostPoolStats& stats)
+{
+    return ST::format("{{\"cold_starts\":{},\"warm_starts\":{},\"lingering\":{},"
+                      "\"db_queued\":{},\"threads\":{},\"runnable\":{},"
+                      "\"runs\":{},\"steals\":{}}",
+                      stats.m_coldStarts, stats.m_warmStarts, stats.m_lingering,
+                      stats.m_dbQueued, stats.m_workers, stats.m_runnable,
+                      stats.m_runs, stats.m_steals);
+}
+
 void dm_htserv()
 {
     ST::printf("[Status] Running on {}\n", DS::SockIpAddress(s_listenSock));
@@ -120,6 +161,12 @@ void dm_htserv()
                 ST::string welcome = DS::Settings::WelcomeMsg();
                 welcome = welcome.replace("\"", "\\\"");
                 json += ST::format(",\"welcome\":\"{}\"", welcome);
+                json += ST::format(",\"queues\":{{\"auth\":{},\"game\":{},\"evictions\":{}}",
+                                   queue_stats_json(DS::AuthServer_QueueStats()),
+                                   queue_stats_json(DS::GameServer_QueueStats()),
+                                   DS::BroadcastQueue_Evictions());
+                json += ST::format(",\"ages\":{}", age_stats_json(DS::GameServer_AgeStats()));
+                json += ST::format(",\"hosts\":{}", host_pool_json(DS::GameServer_HostPoolStats()));
                 json += "}\r\n";
                 // TODO: Add more status fields (players/ages, etc)
 
@@ -19,6 +19,7 @@
 #define _MOUL_KEY_H
 
 #include "streams.h"
+#include "arena.h"
 
 namespace MOUL
 {
@@ -172,6 +173,9 @@ namespace MOUL
         {
             Uoid m_uoid;
             std::atomic_int m_refs;
+
+            static void* operator new(size_t size) { return Arena::Allocate(size); }
+            static void operator delete(void* ptr) { Arena::Free(ptr); }
         }* m_data;
     };
 
@@ -0,0 +1,107 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "NetMessageView.h"
+#include "NetMsgObject.h"
+#include "Key.h"
+
+namespace
+{
+    // Only used to read the common NetMessage fields
+    class NetMessageHeader : public MOUL::NetMessage
+    {
+    public:
+        NetMessageHeader() : NetMessage(0) { }
+        ~NetMessageHeader() override { }
+    };
+}
+
+bool MOUL::NetMessageView::read(const DS::Blob& message)
+{
+    DS::BlobStream stream(message);
+    m_type = stream.read<uint16_t>();
+    m_receivers.clear();
+    if (m_type != ID_NetMsgGameMessage && m_type != ID_NetMsgGameMessageDirected
+            && m_type != ID_NetMsgVoice)
+        return false;
+
+    NetMessageHeader header;
+    header.read(&stream);
+    m_contentFlags = header.m_contentFlags;
+    m_playerId = header.m_playerId;
+
+    if (m_type == ID_NetMsgVoice) {
+        stream.seek(2 * sizeof(uint8_t), SEEK_CUR);     // Flags, frames
+        uint16_t length = stream.read<uint16_t>();
+        stream.seek(length, SEEK_CUR);
+    } else {
+        stream.read<uint32_t>();                        // Uncompressed size
+        if (stream.read<NetMsgStream::Compression, uint8_t>() == NetMsgStream::e_CompressZlib)
+            return false;
+        uint32_t size = stream.read<uint32_t>();
+        uint32_t end = stream.tell() + size;
+        if (end > stream.size())
+            throw DS::EofException();
+
+        // Just the plMessage header of the wrapped message
+        m_gameMsgType = stream.read<uint16_t>();
+        MOUL::Key key;
+        key.read(&stream);                              // Sender
+        uint32_t receivers = stream.read<uint32_t>();
+        for (uint32_t i = 0; i < receivers; ++i)
+            key.read(&stream);
+        stream.read<double>();                          // Timestamp
+        m_bcastFlagsOffset = stream.tell();
+        m_bcastFlags = stream.read<uint32_t>();
+        if (stream.tell() > end)
+            throw DS::EofException();
+        stream.seek(end, SEEK_SET);
+
+        if (stream.read<bool>()) {
+            DS::UnifiedTime deliveryTime;
+            deliveryTime.read(&stream);
+        }
+    }
+
+    if (m_type != ID_NetMsgGameMessage) {
+        m_receivers.resize(stream.read<uint8_t>());
+        for (size_t i = 0; i < m_receivers.size(); ++i)
+            m_receivers[i] = stream.read<uint32_t>();
+    }
+    return stream.atEof();
+}
+
+bool MOUL::NetMessageView::gameMsgSafeForNet() const
+{
+    // Keep in sync with the Message subclasses that override makeSafeForNet()
+    switch (m_gameMsgType) {
+    case ID_AvatarInputStateMsg:
+    case ID_AvBrainGenericMsg:
+    case ID_AvTaskSeekDoneMsg:
+    case ID_ClothingMsg:
+    case ID_EnableMsg:
+    case ID_InputIfaceMgrMsg:
+    case ID_LinkEffectsTriggerMsg:
+    case ID_NotifyMsg:
+    case ID_ParticleTransferMsg:
+    case ID_ServerReplyMsg:
+    case ID_SubWorldMsg:
+        return true;
+    default:
+        return false;
+    }
+}
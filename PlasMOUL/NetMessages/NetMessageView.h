@@ -0,0 +1,64 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _MOUL_NETMESSAGEVIEW_H
+#define _MOUL_NETMESSAGEVIEW_H
+
+#include "NetMessage.h"
+#include <vector>
+
+namespace MOUL
+{
+    /* Decodes only the parts of a serialized net message that the game
+     * server needs for routing and validation, so that pass-through traffic
+     * can be forwarded as the original bytes.  Messages the server has to
+     * inspect or rewrite still need the full decode from the Factory.
+     */
+    class NetMessageView
+    {
+    public:
+        uint16_t m_type;
+        uint32_t m_contentFlags;
+        uint32_t m_playerId;
+
+        // NetMsgGameMessage(Directed): the wrapped message's type and
+        // broadcast flags, and where the flags are in the serialized data
+        uint16_t m_gameMsgType;
+        uint32_t m_bcastFlags;
+        size_t m_bcastFlagsOffset;
+
+        // NetMsgGameMessageDirected and NetMsgVoice
+        std::vector<uint32_t> m_receivers;
+
+        NetMessageView()
+            : m_type(), m_contentFlags(), m_playerId(), m_gameMsgType(),
+              m_bcastFlags(), m_bcastFlagsOffset() { }
+
+        /* Parses a message as written by Factory::WriteCreatable.  Returns
+         * false if the message can't be handled without a full decode
+         * (other message types, compressed game messages, or unexpected
+         * trailing data).  Throws on malformed data.
+         */
+        bool read(const DS::Blob& message);
+
+        // True if the wrapped game message's makeSafeForNet() can neither
+        // reject nor change it, so it needn't be decoded to be validated
+        bool gameMsgSafeForNet() const;
+    };
+}
+
+#endif
@@ -0,0 +1,174 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "arena.h"
+
+#include <atomic>
+#include <new>
+
+struct MOUL::Arena::_chunk
+{
+    _chunk* m_next;
+    size_t m_used;
+
+    /* Live allocations, plus one while the owning arena holds the chunk */
+    std::atomic<size_t> m_refs;
+
+    alignas(std::max_align_t) unsigned char m_data[1];
+};
+
+namespace
+{
+    /* Prefixed to every allocation so Free() knows where it came from.
+     * A null chunk means the allocation came straight from the heap. */
+    union alloc_header
+    {
+        MOUL::Arena::_chunk* m_chunk;
+        std::max_align_t m_align;
+    };
+
+    using chunk_t = MOUL::Arena::_chunk;
+
+    constexpr size_t CHUNK_DATA_SIZE = MOUL::Arena::e_ChunkSize - offsetof(chunk_t, m_data);
+
+    // Anything bigger than this isn't worth wasting the rest of a chunk on
+    constexpr size_t MAX_ARENA_ALLOC = CHUNK_DATA_SIZE / 4;
+
+    // Spare chunks kept per thread, so steady-state traffic doesn't malloc
+    constexpr size_t MAX_CACHED_CHUNKS = 16;
+
+    struct chunk_cache
+    {
+        chunk_t* m_free = nullptr;
+        size_t m_count = 0;
+
+        ~chunk_cache()
+        {
+            while (m_free) {
+                chunk_t* next = m_free->m_next;
+                ::operator delete(m_free);
+                m_free = next;
+            }
+        }
+    };
+
+    thread_local chunk_cache s_chunkCache;
+    thread_local MOUL::Arena* s_currentArena = nullptr;
+
+    size_t align_size(size_t size)
+    {
+        constexpr size_t align = alignof(std::max_align_t);
+        return (size + align - 1) & ~(align - 1);
+    }
+
+    chunk_t* chunk_get()
+    {
+        chunk_t* chunk = s_chunkCache.m_free;
+        if (chunk) {
+            s_chunkCache.m_free = chunk->m_next;
+            --s_chunkCache.m_count;
+        } else {
+            chunk = static_cast<chunk_t*>(::operator new(MOUL::Arena::e_ChunkSize));
+            new (&chunk->m_refs) std::atomic<size_t>();
+        }
+        chunk->m_next = nullptr;
+        chunk->m_used = 0;
+        chunk->m_refs = 1;
+        return chunk;
+    }
+
+    void chunk_unref(chunk_t* chunk)
+    {
+        if (--chunk->m_refs != 0)
+            return;
+
+        // May be the last escaped object dying on some other thread; it
+        // just ends up in that thread's cache instead
+        if (s_chunkCache.m_count < MAX_CACHED_CHUNKS) {
+            chunk->m_next = s_chunkCache.m_free;
+            s_chunkCache.m_free = chunk;
+            ++s_chunkCache.m_count;
+        } else {
+            ::operator delete(chunk);
+        }
+    }
+}
+
+void MOUL::Arena::release()
+{
+    while (m_chunk) {
+        _chunk* next = m_chunk->m_next;
+        chunk_unref(m_chunk);
+        m_chunk = next;
+    }
+}
+
+void* MOUL::Arena::allocate(size_t size)
+{
+    size_t total = sizeof(alloc_header) + align_size(size);
+    if (!m_chunk || m_chunk->m_used + total > CHUNK_DATA_SIZE) {
+        _chunk* chunk = chunk_get();
+        chunk->m_next = m_chunk;
+        m_chunk = chunk;
+    }
+
+    alloc_header* header = reinterpret_cast<alloc_header*>(m_chunk->m_data + m_chunk->m_used);
+    header->m_chunk = m_chunk;
+    m_chunk->m_used += total;
+    ++m_chunk->m_refs;
+    return header + 1;
+}
+
+void* MOUL::Arena::Allocate(size_t size)
+{
+    if (s_currentArena && size <= MAX_ARENA_ALLOC)
+        return s_currentArena->allocate(size);
+
+    alloc_header* header = static_cast<alloc_header*>(
+                ::operator new(sizeof(alloc_header) + size));
+    header->m_chunk = nullptr;
+    return header + 1;
+}
+
+void MOUL::Arena::Free(void* ptr)
+{
+    if (!ptr)
+        return;
+
+    alloc_header* header = static_cast<alloc_header*>(ptr) - 1;
+    if (header->m_chunk)
+        chunk_unref(header->m_chunk);
+    else
+        ::operator delete(header);
+}
+
+MOUL::Arena* MOUL::Arena::Current()
+{
+    return s_currentArena;
+}
+
+MOUL::ArenaScope::ArenaScope()
+    : m_previous(s_currentArena)
+{
+    s_currentArena = &m_arena;
+}
+
+MOUL::ArenaScope::~ArenaScope()
+{
+    s_currentArena = m_previous;
+    m_arena.release();
+}
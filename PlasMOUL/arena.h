@@ -0,0 +1,82 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _MOUL_ARENA_H
+#define _MOUL_ARENA_H
+
+#include <cstddef>
+
+namespace MOUL
+{
+    /* Bump allocator for the short-lived objects created while decoding and
+     * dispatching one message.  Creatables and key data allocate from the
+     * arena installed on the current thread (see ArenaScope), and everything
+     * is handed back in one go when the arena is released.
+     *
+     * Memory is carved out of fixed-size chunks.  Each chunk counts its live
+     * allocations, so an object that escapes the message (e.g. a stored
+     * clone message or key) keeps only its own chunk alive until its last
+     * unref, and deleting arena objects early is always safe. */
+    class Arena
+    {
+    public:
+        enum { e_ChunkSize = 4096 };
+
+        Arena() : m_chunk() { }
+        ~Arena() { release(); }
+
+        /* Drop the arena's hold on all of its chunks.  Chunks without any
+         * escaped objects are recycled immediately. */
+        void release();
+
+        /* Allocate from the current thread's arena, or from the heap if no
+         * arena is installed or the request is too large for a chunk. */
+        static void* Allocate(size_t size);
+        static void Free(void* ptr);
+
+        static Arena* Current();
+
+        /* Opaque; only public so the allocator internals can name it */
+        struct _chunk;
+
+    private:
+        _chunk* m_chunk;
+
+        void* allocate(size_t size);
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+    };
+
+    /* Installs an arena as the current thread's allocation target for the
+     * lifetime of the scope, releasing it on exit */
+    class ArenaScope
+    {
+    public:
+        ArenaScope();
+        ~ArenaScope();
+
+    private:
+        Arena m_arena;
+        Arena* m_previous;
+
+        ArenaScope(const ArenaScope&) = delete;
+        ArenaScope& operator=(const ArenaScope&) = delete;
+    };
+}
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "config.h"
 #include "streams.h"
+#include "arena.h"
 
 #define FACTORY_CREATABLE(type) \
     protected: friend class Factory; \
@@ -66,6 +67,11 @@ namespace MOUL
                 pCre->unref();
         }
 
+        /* Creatables come from the current thread's message arena when one
+           is installed; see MOUL::ArenaScope */
+        static void* operator new(size_t size) { return Arena::Allocate(size); }
+        static void operator delete(void* ptr) { Arena::Free(ptr); }
+
         virtual void read(DS::Stream* stream) { }
         virtual void write(DS::Stream* stream) const { }
 
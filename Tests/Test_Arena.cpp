@@ -0,0 +1,98 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+
+#include "PlasMOUL/arena.h"
+
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    struct ArenaObject
+    {
+        char m_data[40];
+
+        static void* operator new(size_t size) { return MOUL::Arena::Allocate(size); }
+        static void operator delete(void* ptr) { MOUL::Arena::Free(ptr); }
+    };
+}
+
+TEST_CASE("Test MOUL::Arena", "[arena]")
+{
+    SECTION("No arena installed") {
+        CHECK(MOUL::Arena::Current() == nullptr);
+        ArenaObject* obj = new ArenaObject;
+        memset(obj->m_data, 0xAA, sizeof(obj->m_data));
+        delete obj;
+    }
+
+    SECTION("Scoped allocation") {
+        MOUL::ArenaScope scope;
+        REQUIRE(MOUL::Arena::Current() != nullptr);
+
+        ArenaObject* first = new ArenaObject;
+        ArenaObject* second = new ArenaObject;
+        auto distance = reinterpret_cast<uintptr_t>(second) - reinterpret_cast<uintptr_t>(first);
+        CHECK(distance < 128);
+        delete first;
+        delete second;
+    }
+    CHECK(MOUL::Arena::Current() == nullptr);
+
+    SECTION("Nested scopes") {
+        MOUL::ArenaScope outer;
+        MOUL::Arena* outerArena = MOUL::Arena::Current();
+        {
+            MOUL::ArenaScope inner;
+            CHECK(MOUL::Arena::Current() != outerArena);
+        }
+        CHECK(MOUL::Arena::Current() == outerArena);
+    }
+
+    SECTION("Objects outlive their arena") {
+        ArenaObject* escaped;
+        {
+            MOUL::ArenaScope scope;
+            for (size_t i = 0; i < 1000; ++i)
+                delete new ArenaObject;
+            escaped = new ArenaObject;
+            memset(escaped->m_data, 0x55, sizeof(escaped->m_data));
+        }
+
+        // Recycled chunks must not hand out the escaped object's memory
+        MOUL::ArenaScope scope;
+        std::vector<ArenaObject*> objects;
+        for (size_t i = 0; i < 1000; ++i) {
+            objects.push_back(new ArenaObject);
+            memset(objects.back()->m_data, 0, sizeof(objects.back()->m_data));
+        }
+        for (char ch : escaped->m_data)
+            CHECK(ch == 0x55);
+        delete escaped;
+        for (ArenaObject* obj : objects)
+            delete obj;
+    }
+
+    SECTION("Large allocations") {
+        MOUL::ArenaScope scope;
+        void* big = MOUL::Arena::Allocate(MOUL::Arena::e_ChunkSize * 2);
+        memset(big, 0, MOUL::Arena::e_ChunkSize * 2);
+        MOUL::Arena::Free(big);
+    }
+}
@@ -0,0 +1,92 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+#include <catch2/catch.hpp>
+
+#include "AuthServ/AuthFileCache.h"
+#include "settings.h"
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+static void write_file(const char* path, const void* data, size_t size)
+{
+    FILE* file = fopen(path, "wb");
+    REQUIRE(file != nullptr);
+    fwrite(data, 1, size, file);
+    fclose(file);
+}
+
+TEST_CASE("Test DS::AuthFileCache_Get", "[authfilecache]")
+{
+    char path[] = "/tmp/dstest_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    ST::string filename = path;
+
+    const char contents[] = "# Python and SDL packs are encrypted on the fly";
+    constexpr size_t contentsSize = sizeof(contents) - 1;
+
+    SECTION("Plain files are encrypted with the droid key") {
+        write_file(path, contents, contentsSize);
+
+        DS::AuthFileRef cached = DS::AuthFileCache_Get(filename);
+        REQUIRE(cached->m_data.size() > 12);
+        CHECK(memcmp(cached->m_data.buffer(), "notthedroids", 12) == 0);
+
+        DS::BufferStream base(cached->m_data.buffer(), cached->m_data.size());
+        DS::EncryptedStream stream(&base, DS::EncryptedStream::Mode::e_read,
+                                   std::nullopt, DS::Settings::DroidKey());
+        REQUIRE(stream.size() == contentsSize);
+        char test[contentsSize];
+        stream.readBytes(test, contentsSize);
+        CHECK(memcmp(test, contents, contentsSize) == 0);
+    }
+
+    SECTION("Encrypted files are sent as-is") {
+        uint8_t encrypted[] = {
+            0x77, 0x68, 0x61, 0x74, 0x64, 0x6F, 0x79, 0x6F, 0x75, 0x73, 0x65, 0x65,
+            0x0D, 0x00, 0x00, 0x00, 0xAC, 0xC1, 0xA6, 0xB6, 0xDC, 0x33, 0x95, 0x0E,
+            0x99, 0x18, 0xAE, 0xFC, 0x9C, 0xD3, 0x00, 0xB9
+        };
+        write_file(path, encrypted, sizeof(encrypted));
+
+        DS::AuthFileRef cached = DS::AuthFileCache_Get(filename);
+        REQUIRE(cached->m_data.size() == sizeof(encrypted));
+        CHECK(memcmp(cached->m_data.buffer(), encrypted, sizeof(encrypted)) == 0);
+    }
+
+    SECTION("Images are shared until the file changes") {
+        write_file(path, contents, contentsSize);
+
+        DS::AuthFileRef first = DS::AuthFileCache_Get(filename);
+        DS::AuthFileRef second = DS::AuthFileCache_Get(filename);
+        CHECK(first.get() == second.get());
+
+        write_file(path, contents, contentsSize - 1);
+        DS::AuthFileRef third = DS::AuthFileCache_Get(filename);
+        CHECK(first.get() != third.get());
+    }
+
+    SECTION("Missing files throw") {
+        unlink(path);
+        CHECK_THROWS_AS(DS::AuthFileCache_Get(filename), DS::FileIOException);
+    }
+
+    unlink(path);
+    DS::AuthFileCache_Clear();
+}
@@ -0,0 +1,69 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+
+#include "Types/BitVector.h"
+
+TEST_CASE("Test DS::BitVector", "[bitvector]")
+{
+    SECTION("Set and get") {
+        DS::BitVector bits;
+        CHECK(bits.empty());
+        CHECK_FALSE(bits.get(0));
+        CHECK_FALSE(bits.get(100));
+
+        bits.set(3, true);
+        bits.set(40, true);
+        CHECK(bits.get(3));
+        CHECK(bits.get(40));
+        CHECK_FALSE(bits.get(4));
+        CHECK_FALSE(bits.get(64));
+        CHECK_FALSE(bits.empty());
+
+        bits.set(3, false);
+        bits.set(40, false);
+        CHECK(bits.empty());
+    }
+
+    SECTION("Copies keep every word") {
+        DS::BitVector bits;
+        bits.set(1, true);
+        bits.set(95, true);
+        DS::BitVector copy(bits);
+        CHECK(copy.get(1));
+        CHECK(copy.get(95));
+
+        DS::BitVector assigned;
+        assigned = bits;
+        CHECK(assigned.get(1));
+        CHECK(assigned.get(95));
+    }
+
+    SECTION("Overlap") {
+        DS::BitVector a, b;
+        CHECK_FALSE(a.overlaps(b));
+        a.set(2, true);
+        a.set(70, true);
+        b.set(3, true);
+        CHECK_FALSE(a.overlaps(b));
+        CHECK_FALSE(b.overlaps(a));
+        b.set(70, true);
+        CHECK(a.overlaps(b));
+        CHECK(b.overlaps(a));
+    }
+}
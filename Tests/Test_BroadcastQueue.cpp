@@ -0,0 +1,141 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+
+#include "NetIO/BroadcastQueue.h"
+#include "NetIO/SockIO.h"
+#include <algorithm>
+#include <vector>
+
+static DS::BufferStream* make_buffer(uint32_t value, size_t size = 100)
+{
+    DS::BufferStream* buffer = new DS::BufferStream();
+    buffer->write<uint32_t>(value);
+    while (buffer->size() < size)
+        buffer->write<uint8_t>(0);
+    return buffer;
+}
+
+static uint32_t buffer_value(const DS::FifoMessage& msg)
+{
+    const DS::BufferStream* buffer = reinterpret_cast<const DS::BufferStream*>(msg.m_payload);
+    return *reinterpret_cast<const uint32_t*>(buffer->buffer());
+}
+
+// Pulls everything currently waiting, releasing the payloads
+static std::vector<uint32_t> drain(DS::BroadcastQueue& queue)
+{
+    std::vector<uint32_t> values;
+    DS::FifoMessage batch[16];
+    for ( ;; ) {
+        size_t count = queue.getMessages(batch);
+        if (count == 0)
+            break;
+        for (size_t i = 0; i < count; ++i) {
+            values.push_back(buffer_value(batch[i]));
+            reinterpret_cast<DS::BufferStream*>(batch[i].m_payload)->unref();
+        }
+    }
+    return values;
+}
+
+TEST_CASE("Test DS::BroadcastQueue", "[broadcastqueue]")
+{
+    SECTION("Within budget") {
+        DS::BroadcastQueue queue(DS::e_QueueDisconnect, 1000, 10);
+        for (uint32_t i = 0; i < 5; ++i) {
+            DS::BufferStream* buffer = make_buffer(i);
+            CHECK(queue.push(0, buffer, false) == DS::BroadcastQueue::e_Queued);
+            buffer->unref();
+        }
+        CHECK(queue.depth() == 5);
+        CHECK(queue.bytes() == 500);
+        CHECK(drain(queue) == std::vector<uint32_t>{0, 1, 2, 3, 4});
+        CHECK(queue.bytes() == 0);
+        CHECK(queue.peakBytes() == 500);
+        CHECK_FALSE(queue.coalescing());
+    }
+
+    SECTION("Drop unreliable messages") {
+        DS::BroadcastQueue queue(DS::e_QueueDropUnreliable, 1000, 4);
+        for (uint32_t i = 0; i < 6; ++i) {
+            DS::BufferStream* buffer = make_buffer(i);
+            queue.push(0, buffer, i == 5);
+            buffer->unref();
+        }
+        CHECK(queue.dropped() == 1);
+        CHECK(drain(queue) == std::vector<uint32_t>{0, 1, 2, 3, 5});
+        CHECK_FALSE(queue.evicted());
+    }
+
+    SECTION("Reliable messages evict past twice the budget") {
+        DS::BroadcastQueue queue(DS::e_QueueDropUnreliable, 1000, 2);
+        DS::BroadcastQueue::PushResult result = DS::BroadcastQueue::e_Queued;
+        for (uint32_t i = 0; i < 5; ++i) {
+            DS::BufferStream* buffer = make_buffer(i);
+            result = queue.push(0, buffer, true);
+            buffer->unref();
+        }
+        CHECK(result == DS::BroadcastQueue::e_Evict);
+        CHECK(queue.evicted());
+        DS::FifoMessage batch[4];
+        CHECK_THROWS_AS(queue.getMessages(batch), DS::SockHup);
+        queue.clear();
+    }
+
+    SECTION("Disconnect as soon as the budget is exceeded") {
+        DS::BroadcastQueue queue(DS::e_QueueDisconnect, 250, 100);
+        DS::BufferStream* buffer = make_buffer(0);
+        CHECK(queue.push(0, buffer, true) == DS::BroadcastQueue::e_Queued);
+        CHECK(queue.push(0, buffer, true) == DS::BroadcastQueue::e_Queued);
+        CHECK(queue.push(0, buffer, true) == DS::BroadcastQueue::e_Evict);
+        CHECK(queue.push(0, buffer, true) == DS::BroadcastQueue::e_Dropped);
+        buffer->unref();
+        queue.clear();
+    }
+
+    SECTION("Coalesce keyed messages") {
+        DS::BroadcastQueue queue(DS::e_QueueCoalesce, 1000, 2);
+        const std::string keyA = "A", keyB = "B";
+        uint32_t pushes[][2] = {
+            {  1, 0 }, {  2, 0 },   // Fills the budget
+            { 10, 1 }, { 11, 2 }, { 12, 1 }, { 13, 2 }, { 14, 1 },
+            {  3, 0 },              // Unkeyed and unreliable
+        };
+        for (const auto& push : pushes) {
+            DS::BufferStream* buffer = make_buffer(push[0]);
+            const std::string& key = (push[1] == 1) ? keyA
+                                   : (push[1] == 2) ? keyB : std::string();
+            queue.push(0, buffer, push[1] != 0, key);
+            buffer->unref();
+        }
+        CHECK(queue.coalesced() == 3);
+        CHECK(queue.dropped() == 1);
+        CHECK(queue.coalescing());
+
+        std::vector<uint32_t> values = drain(queue);
+        REQUIRE(values.size() == 4);
+        CHECK(values[0] == 1);
+        CHECK(values[1] == 2);
+        // The newest message for each key, after everything queued before
+        CHECK(std::find(values.begin() + 2, values.end(), 14) != values.end());
+        CHECK(std::find(values.begin() + 2, values.end(), 13) != values.end());
+        CHECK(queue.bytes() == 0);
+        CHECK_FALSE(queue.coalescing());
+    }
+}
@@ -0,0 +1,149 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+
+#include "NetIO/HandshakePool.h"
+#include "NetIO/CryptIO.h"
+#include "errors.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    // A connected pair of sockets:  the raw client end, and the server end
+    struct SocketPair
+    {
+        DS::SocketHandle m_listen, m_server;
+        int m_client;
+
+        SocketPair()
+        {
+            m_listen = DS::BindSocket("127.0.0.1", "0");
+            DS::ListenSock(m_listen);
+
+            sockaddr_in addr;
+            socklen_t addrLen = sizeof(addr);
+            getsockname(DS::SockFd(m_listen), reinterpret_cast<sockaddr*>(&addr), &addrLen);
+            m_client = socket(AF_INET, SOCK_STREAM, 0);
+            REQUIRE(connect(m_client, reinterpret_cast<sockaddr*>(&addr), addrLen) == 0);
+            m_server = DS::AcceptSock(m_listen);
+            REQUIRE(m_server);
+        }
+
+        ~SocketPair()
+        {
+            close(m_client);
+            DS::FreeSock(m_server);
+            DS::FreeSock(m_listen);
+        }
+
+        void send(const std::vector<uint8_t>& data, size_t offset, size_t size)
+        {
+            REQUIRE(::send(m_client, data.data() + offset, size, 0) == ssize_t(size));
+        }
+    };
+
+    std::vector<uint8_t> make_request(uint32_t headerSize, uint8_t keySize)
+    {
+        std::vector<uint8_t> request(sizeof(headerSize));
+        memcpy(request.data(), &headerSize, sizeof(headerSize));
+        for (uint32_t i = sizeof(headerSize); i < headerSize; ++i)
+            request.push_back(0xAA);
+        request.push_back(DS::e_CliToServConnect);
+        request.push_back(keySize + 2);
+        for (uint8_t i = 0; i < keySize; ++i)
+            request.push_back(i + 1);
+        return request;
+    }
+}
+
+TEST_CASE("Test DS::ConnectRequest", "[handshake]")
+{
+    SocketPair sockets;
+
+    SECTION("Partial requests are completed without blocking") {
+        std::vector<uint8_t> request = make_request(20, 64);
+        DS::ConnectRequest connect(20);
+        CHECK_FALSE(connect.readSome(sockets.m_server));
+
+        sockets.send(request, 0, 10);
+        CHECK_FALSE(connect.readSome(sockets.m_server));
+        CHECK_FALSE(connect.complete());
+
+        // The next message must be left on the socket
+        request.push_back(0x42);
+        sockets.send(request, 10, request.size() - 10);
+        CHECK(connect.readSome(sockets.m_server));
+        CHECK(connect.complete());
+        CHECK(DS::RecvValue<uint8_t>(sockets.m_server) == 0x42);
+
+        CHECK(connect.header()[0] == 0xAA);
+        uint8_t key[64];
+        REQUIRE(connect.clientKey(key));
+        for (size_t i = 0; i < 64; ++i)
+            CHECK(key[i] == 64 - i);
+    }
+
+    SECTION("Short keys are padded") {
+        std::vector<uint8_t> request = make_request(36, 62);
+        sockets.send(request, 0, request.size());
+        DS::ConnectRequest connect(36);
+        connect.read(sockets.m_server);
+
+        uint8_t key[64];
+        REQUIRE(connect.clientKey(key));
+        CHECK(key[0] == 0);
+        CHECK(key[1] == 0);
+        CHECK(key[2] == 62);
+        CHECK(key[63] == 1);
+    }
+
+    SECTION("Unencrypted connections have no key") {
+        std::vector<uint8_t> request = make_request(20, 0);
+        sockets.send(request, 0, request.size());
+        DS::ConnectRequest connect(20);
+        connect.read(sockets.m_server);
+
+        uint8_t key[64];
+        CHECK_FALSE(connect.clientKey(key));
+    }
+
+    SECTION("Requests without a key exchange end after the header") {
+        std::vector<uint8_t> request = make_request(12, 0);
+        sockets.send(request, 0, request.size());
+        DS::ConnectRequest connect(12, false);
+        CHECK(connect.readSome(sockets.m_server));
+        CHECK(DS::RecvValue<uint8_t>(sockets.m_server) == DS::e_CliToServConnect);
+    }
+
+    SECTION("Malformed requests are rejected early") {
+        std::vector<uint8_t> request = make_request(24, 64);
+        sockets.send(request, 0, sizeof(uint32_t));
+        DS::ConnectRequest connect(20);
+        CHECK_THROWS_AS(connect.readSome(sockets.m_server), DS::InvalidConnectionHeader);
+
+        request = make_request(20, 65);
+        DS::ConnectRequest tooLong(20);
+        sockets.send(request, 0, 22);
+        CHECK_THROWS_AS(tooLong.readSome(sockets.m_server), DS::InvalidConnectionHeader);
+    }
+}
@@ -0,0 +1,315 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+#include <openssl/bn.h>
+#include <openssl/rand.h>
+#include <openssl/rc4.h>
+#include <string_theory/stdio>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "NetIO/CryptIO.h"
+
+struct TestKeys
+{
+    uint8_t m_N[64], m_K[64], m_X[64];
+
+    TestKeys()
+    {
+        DS::GenPrimeKeys(m_N, m_K);
+        DS::CryptCalcX(m_X, m_N, m_K, CRYPT_BASE_AUTH);
+    }
+};
+
+// Generating primes is slow, so every test shares the same key
+static const TestKeys& test_keys()
+{
+    static TestKeys s_keys;
+    return s_keys;
+}
+
+// Client side of the key exchange:  Y = g^y % N, and the shared secret is
+// X^y % N (with X = g^K % N from the server)
+static void client_exchange(uint8_t* Y, uint8_t* secret, const TestKeys& keys)
+{
+    BN_CTX* ctx = BN_CTX_new();
+    BIGNUM* bn_N = BN_bin2bn(keys.m_N, 64, nullptr);
+    BIGNUM* bn_X = BN_bin2bn(keys.m_X, 64, nullptr);
+    BIGNUM* bn_G = BN_new();
+    BIGNUM* bn_y = BN_new();
+    BIGNUM* bn_result = BN_new();
+
+    BN_set_word(bn_G, CRYPT_BASE_AUTH);
+    BN_rand_range(bn_y, bn_N);
+    BN_mod_exp(bn_result, bn_G, bn_y, bn_N, ctx);
+    BN_bn2binpad(bn_result, Y, 64);
+    BN_mod_exp(bn_result, bn_X, bn_y, bn_N, ctx);
+    BN_bn2binpad(bn_result, secret, 64);
+
+    BN_free(bn_result);
+    BN_free(bn_y);
+    BN_free(bn_G);
+    BN_free(bn_X);
+    BN_free(bn_N);
+    BN_CTX_free(ctx);
+}
+
+TEST_CASE("Test DS::CryptEstablish", "[crypt]")
+{
+    const TestKeys& keys = test_keys();
+    DS::CryptKey serverKey = DS::CryptKeyInit(keys.m_N, keys.m_K);
+
+    for (int i = 0; i < 8; ++i) {
+        uint8_t Y[64], secret[64];
+        client_exchange(Y, secret, keys);
+
+        uint8_t seed[7], key[7];
+        DS::CryptEstablish(seed, key, serverKey, Y);
+
+        // The server sends its seed to the client, which combines it with
+        // the little-endian shared secret
+        BYTE_SWAP_BUFFER(secret, 64);
+        for (size_t b = 0; b < 7; ++b)
+            CHECK(key[b] == (secret[b] ^ seed[b]));
+    }
+
+    DS::CryptKeyFree(serverKey);
+}
+
+/* Reports how many handshakes (the server side of the key exchange) can be
+ * completed per second on each core.  Hidden by default; run it with:
+ *     test_dirtsand "[.benchmark]"
+ */
+TEST_CASE("Benchmark DS::CryptEstablish", "[.benchmark]")
+{
+    const TestKeys& keys = test_keys();
+    const size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    const auto duration = std::chrono::seconds(2);
+
+    uint8_t Y[64], secret[64];
+    client_exchange(Y, secret, keys);
+
+    auto run = [&](bool cached) {
+        DS::CryptKey sharedKey = DS::CryptKeyInit(keys.m_N, keys.m_K);
+        std::atomic<uint64_t> total(0);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < numThreads; ++i) {
+            threads.emplace_back([&] {
+                uint64_t count = 0;
+                auto stop = std::chrono::steady_clock::now() + duration;
+                while (std::chrono::steady_clock::now() < stop) {
+                    uint8_t seed[7], key[7];
+                    if (cached) {
+                        DS::CryptEstablish(seed, key, sharedKey, Y);
+                    } else {
+                        // Parse the key for every handshake, as before caching
+                        DS::CryptKey serverKey = DS::CryptKeyInit(keys.m_N, keys.m_K);
+                        DS::CryptEstablish(seed, key, serverKey, Y);
+                        DS::CryptKeyFree(serverKey);
+                    }
+                    ++count;
+                }
+                total += count;
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+        DS::CryptKeyFree(sharedKey);
+        return static_cast<double>(total) / duration.count();
+    };
+
+    double uncached = run(false);
+    double cached = run(true);
+    ST::printf("Handshakes on {} threads:\n", numThreads);
+    ST::printf("    Per-handshake key setup: {.0f}/sec ({.0f}/sec per core)\n",
+               uncached, uncached / numThreads);
+    ST::printf("    Cached key:              {.0f}/sec ({.0f}/sec per core)\n",
+               cached, cached / numThreads);
+    CHECK(cached > 0);
+}
+
+namespace
+{
+    // A loopback connection, with the client side left as a plain socket
+    // that encrypts with its own copy of the key
+    struct CryptSockets
+    {
+        DS::SocketHandle m_listen, m_server;
+        int m_client;
+        RC4_KEY m_clientWrite, m_clientRead;
+
+        CryptSockets(const uint8_t* key, size_t size)
+        {
+            m_listen = DS::BindSocket("127.0.0.1", "0");
+            DS::ListenSock(m_listen);
+
+            sockaddr_in addr;
+            socklen_t addrLen = sizeof(addr);
+            getsockname(DS::SockFd(m_listen), reinterpret_cast<sockaddr*>(&addr), &addrLen);
+            m_client = socket(AF_INET, SOCK_STREAM, 0);
+            REQUIRE(connect(m_client, reinterpret_cast<sockaddr*>(&addr), addrLen) == 0);
+            m_server = DS::AcceptSock(m_listen);
+            REQUIRE(m_server);
+
+            RC4_set_key(&m_clientWrite, size, key);
+            RC4_set_key(&m_clientRead, size, key);
+        }
+
+        ~CryptSockets()
+        {
+            close(m_client);
+            DS::FreeSock(m_server);
+            DS::FreeSock(m_listen);
+        }
+
+        void send(const std::vector<uint8_t>& data, size_t offset, size_t size)
+        {
+            std::vector<uint8_t> encrypted(size);
+            RC4(&m_clientWrite, size, data.data() + offset, encrypted.data());
+            REQUIRE(::send(m_client, encrypted.data(), size, 0) == ssize_t(size));
+        }
+
+        // Reads whatever the server has sent so far
+        void receive(std::vector<uint8_t>& data)
+        {
+            uint8_t buffer[4096];
+            ssize_t bytes;
+            while ((bytes = recv(m_client, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+                size_t start = data.size();
+                data.resize(start + bytes);
+                RC4(&m_clientRead, bytes, buffer, data.data() + start);
+            }
+        }
+    };
+
+    // A value, followed by a sized payload
+    std::vector<uint8_t> make_message(uint32_t value, uint32_t size)
+    {
+        std::vector<uint8_t> message(2 * sizeof(uint32_t));
+        memcpy(message.data(), &value, sizeof(value));
+        memcpy(message.data() + sizeof(value), &size, sizeof(size));
+        for (uint32_t i = 0; i < size; ++i)
+            message.push_back(static_cast<uint8_t>(i));
+        return message;
+    }
+
+    bool parse_message(DS::SocketHandle sock, DS::CryptState crypt, uint32_t& value,
+                       std::vector<uint8_t>& payload)
+    {
+        try {
+            value = DS::CryptRecvValue<uint32_t>(sock, crypt);
+            payload.resize(DS::CryptRecvSize(sock, crypt, 1024 * 1024));
+            DS::CryptRecvBuffer(sock, crypt, payload.data(), payload.size());
+        } catch (const DS::RecvIncomplete&) {
+            DS::CryptRecvRewind(crypt);
+            return false;
+        }
+        DS::CryptRecvCommit(crypt);
+        return true;
+    }
+}
+
+TEST_CASE("Test non-blocking DS::CryptState", "[crypt]")
+{
+    const uint8_t key[7] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77 };
+    CryptSockets sockets(key, sizeof(key));
+    DS::CryptState crypt = DS::CryptStateInit(key, sizeof(key));
+    DS::CryptSetNonBlocking(crypt);
+
+    uint32_t value = 0;
+    std::vector<uint8_t> payload;
+
+    SECTION("Partial messages are parsed again once complete") {
+        std::vector<uint8_t> message = make_message(0x12345678, 5);
+        CHECK_FALSE(DS::CryptRecvFill(sockets.m_server, crypt));
+
+        sockets.send(message, 0, 6);
+        CHECK(DS::CryptRecvFill(sockets.m_server, crypt));
+        REQUIRE(DS::CryptRecvPending(crypt));
+        CHECK_FALSE(parse_message(sockets.m_server, crypt, value, payload));
+
+        // Nothing more to parse until more data arrives
+        CHECK_FALSE(DS::CryptRecvPending(crypt));
+
+        // The next message's first byte must be left in the buffer
+        std::vector<uint8_t> next = make_message(0x9ABCDEF0, 0);
+        message.insert(message.end(), next.begin(), next.end());
+        sockets.send(message, 6, message.size() - 6 - next.size() + 1);
+        CHECK(DS::CryptRecvFill(sockets.m_server, crypt));
+        REQUIRE(DS::CryptRecvPending(crypt));
+        REQUIRE(parse_message(sockets.m_server, crypt, value, payload));
+        CHECK(value == 0x12345678);
+        CHECK(payload == std::vector<uint8_t>({ 0, 1, 2, 3, 4 }));
+
+        REQUIRE(DS::CryptRecvPending(crypt));
+        CHECK_FALSE(parse_message(sockets.m_server, crypt, value, payload));
+        sockets.send(message, message.size() - next.size() + 1, next.size() - 1);
+        CHECK(DS::CryptRecvFill(sockets.m_server, crypt));
+        REQUIRE(parse_message(sockets.m_server, crypt, value, payload));
+        CHECK(value == 0x9ABCDEF0);
+        CHECK(payload.empty());
+        CHECK_FALSE(DS::CryptRecvPending(crypt));
+    }
+
+    SECTION("Messages larger than the buffer still arrive") {
+        std::vector<uint8_t> message = make_message(42, 100 * 1024);
+        sockets.send(message, 0, message.size());
+
+        bool parsed = false;
+        for (int i = 0; i < 1000 && !parsed; ++i) {
+            DS::CryptRecvFill(sockets.m_server, crypt);
+            if (DS::CryptRecvPending(crypt))
+                parsed = parse_message(sockets.m_server, crypt, value, payload);
+        }
+        REQUIRE(parsed);
+        CHECK(value == 42);
+        CHECK(payload == std::vector<uint8_t>(message.begin() + 8, message.end()));
+    }
+
+    SECTION("Sends are queued instead of blocking") {
+        std::vector<uint8_t> chunk(64 * 1024);
+        for (size_t i = 0; i < chunk.size(); ++i)
+            chunk[i] = static_cast<uint8_t>(i * 7);
+
+        // Keep sending until the socket's buffers are full
+        size_t sent = 0;
+        while (DS::CryptSendQueued(crypt) == 0 && sent < 256 * 1024 * 1024) {
+            DS::CryptSendBuffer(sockets.m_server, crypt, chunk.data(), chunk.size());
+            sent += chunk.size();
+        }
+        REQUIRE(DS::CryptSendQueued(crypt) > 0);
+
+        std::vector<uint8_t> received;
+        for (int i = 0; i < 100000 && received.size() < sent; ++i) {
+            sockets.receive(received);
+            DS::CryptSendFlush(sockets.m_server, crypt);
+        }
+        CHECK(DS::CryptSendQueued(crypt) == 0);
+        REQUIRE(received.size() == sent);
+        for (size_t offset = 0; offset < sent; offset += chunk.size())
+            REQUIRE(memcmp(received.data() + offset, chunk.data(), chunk.size()) == 0);
+    }
+
+    DS::CryptStateFree(crypt);
+}
@@ -0,0 +1,168 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+
+#include "NetIO/Executor.h"
+#include "NetIO/MsgChannel.h"
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct CountingTask : public DS::ExecutorTask
+    {
+        DS::MsgChannel m_channel;
+        std::atomic<int> m_running, m_runs;
+        std::atomic<bool> m_overlapped;
+        std::atomic<size_t> m_received;
+
+        CountingTask() : m_running(0), m_runs(0), m_overlapped(false), m_received(0)
+        {
+            m_channel.setWakeup([this] { DS::ExecutorSchedule(this); });
+        }
+
+        bool onRun() override
+        {
+            if (m_running++ != 0)
+                m_overlapped = true;
+            DS::FifoMessage batch[16];
+            m_received += m_channel.getMessages(batch, false);
+            ++m_runs;
+            --m_running;
+            return true;
+        }
+
+        bool runPending() override { return m_channel.hasMessage(); }
+    };
+
+    // Always has more to do, so the queues never run empty
+    struct BusyTask : public DS::ExecutorTask
+    {
+        std::atomic<bool> m_stop;
+
+        BusyTask() : m_stop(false) { }
+
+        bool onRun() override { return true; }
+        bool runPending() override { return !m_stop; }
+    };
+
+    // Waits (as a game host waits on the auth daemon) for another task
+    struct WaitingTask : public DS::ExecutorTask
+    {
+        CountingTask* m_other;
+        std::atomic<bool> m_done;
+
+        WaitingTask(CountingTask* other) : m_other(other), m_done(false) { }
+
+        bool onRun() override
+        {
+            DS::ExecutorBlockingScope blocking;
+            m_other->m_channel.putMessage(0);
+            while (m_other->m_received == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            m_done = true;
+            return true;
+        }
+
+        bool runPending() override { return false; }
+    };
+
+    template <typename Condition>
+    bool wait_for(Condition&& condition)
+    {
+        for (int i = 0; i < 5000 && !condition(); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return condition();
+    }
+}
+
+TEST_CASE("Test DS::Executor", "[executor]")
+{
+    // Tasks are only destroyed after the executor is stopped, since a worker
+    // may still be finishing up with them
+    SECTION("Tasks run serially and see every message") {
+        DS::StartExecutor(4);
+
+        constexpr size_t numTasks = 8;
+        constexpr size_t numProducers = 4;
+        constexpr size_t numMessages = 5000;
+
+        std::vector<std::unique_ptr<CountingTask>> tasks;
+        for (size_t i = 0; i < numTasks; ++i)
+            tasks.emplace_back(new CountingTask);
+
+        std::vector<std::thread> producers;
+        for (size_t p = 0; p < numProducers; ++p) {
+            producers.emplace_back([&tasks] {
+                for (size_t i = 0; i < numMessages; ++i)
+                    tasks[i % tasks.size()]->m_channel.putMessage(0);
+            });
+        }
+        for (auto& thread : producers)
+            thread.join();
+
+        for (const auto& task : tasks) {
+            CHECK(wait_for([&task] {
+                return task->m_received == numProducers * numMessages / numTasks;
+            }));
+            CHECK_FALSE(task->m_overlapped);
+        }
+        CHECK(wait_for([] { return DS::ExecutorGetStats().m_queued == 0; }));
+        DS::StopExecutor();
+    }
+
+    SECTION("Timers") {
+        CountingTask task;
+        DS::StartExecutor(2);
+        DS::ExecutorSetTimer(&task, std::chrono::steady_clock::now()
+                                    + std::chrono::milliseconds(10));
+        CHECK(wait_for([&task] { return task.m_runs == 1; }));
+
+        // A cancelled timer never fires
+        DS::ExecutorSetTimer(&task, std::chrono::steady_clock::now()
+                                    + std::chrono::milliseconds(10));
+        DS::ExecutorCancelTimer(&task);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CHECK(task.m_runs == 1);
+        DS::StopExecutor();
+    }
+
+    SECTION("Timers fire while the queues are busy") {
+        CountingTask task;
+        BusyTask busy;
+        DS::StartExecutor(1);
+        DS::ExecutorSchedule(&busy);
+        DS::ExecutorSetTimer(&task, std::chrono::steady_clock::now()
+                                    + std::chrono::milliseconds(10));
+        CHECK(wait_for([&task] { return task.m_runs == 1; }));
+        busy.m_stop = true;
+        DS::StopExecutor();
+    }
+
+    SECTION("Blocked workers get a spare") {
+        CountingTask other;
+        WaitingTask waiter(&other);
+        DS::StartExecutor(1);
+        DS::ExecutorSchedule(&waiter);
+        CHECK(wait_for([&waiter] { return waiter.m_done.load(); }));
+        DS::StopExecutor();
+    }
+
+    CHECK(DS::ExecutorGetStats().m_workers == 0);
+}
@@ -0,0 +1,92 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+#include <catch2/catch.hpp>
+
+#include "FileServ/FileManifest.h"
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+static void write_manifest(const char* path, int entries)
+{
+    FILE* mfs = fopen(path, "w");
+    REQUIRE(mfs != nullptr);
+    for (int i = 0; i < entries; ++i) {
+        fprintf(mfs, "dat\\File%d.prp,dat\\File%d.prp.gz,"
+                     "0123456789abcdef0123456789abcdef,"
+                     "fedcba9876543210fedcba9876543210,%d,%d,0\n",
+                i, i, 1000 + i, 500 + i);
+    }
+    fclose(mfs);
+}
+
+TEST_CASE("Test DS::FileManifest_Get", "[manifest]")
+{
+    char path[] = "/tmp/dstest_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    ST::string filename = path;
+
+    SECTION("Cached manifest matches a fresh encode") {
+        write_manifest(path, 3);
+
+        DS::ManifestRef cached;
+        REQUIRE(DS::FileManifest_Get(filename, cached) == DS::e_NetSuccess);
+
+        DS::FileManifest manifest;
+        REQUIRE(manifest.loadManifest(path) == DS::e_NetSuccess);
+        DS::BufferStream encoded;
+        uint32_t dataSize = manifest.encodeToStream(&encoded);
+
+        CHECK(cached->m_fileCount == 3);
+        CHECK(cached->m_dataSize == dataSize);
+        REQUIRE(cached->m_encoded.size() == encoded.size());
+        CHECK(memcmp(cached->m_encoded.buffer(), encoded.buffer(), encoded.size()) == 0);
+    }
+
+    SECTION("Unchanged manifest is shared") {
+        write_manifest(path, 2);
+
+        DS::ManifestRef first, second;
+        REQUIRE(DS::FileManifest_Get(filename, first) == DS::e_NetSuccess);
+        REQUIRE(DS::FileManifest_Get(filename, second) == DS::e_NetSuccess);
+        CHECK(first.get() == second.get());
+    }
+
+    SECTION("Changed manifest is reloaded") {
+        write_manifest(path, 2);
+
+        DS::ManifestRef first, second;
+        REQUIRE(DS::FileManifest_Get(filename, first) == DS::e_NetSuccess);
+        write_manifest(path, 5);
+        REQUIRE(DS::FileManifest_Get(filename, second) == DS::e_NetSuccess);
+        CHECK(first.get() != second.get());
+        CHECK(first->m_fileCount == 2);
+        CHECK(second->m_fileCount == 5);
+    }
+
+    SECTION("Missing manifest") {
+        unlink(path);
+        DS::ManifestRef cached;
+        CHECK(DS::FileManifest_Get(filename, cached) == DS::e_NetFileNotFound);
+        CHECK_FALSE(cached);
+    }
+
+    unlink(path);
+    DS::FileManifest_ClearCache();
+}
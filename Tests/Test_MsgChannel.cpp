@@ -0,0 +1,164 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+
+#include "NetIO/MsgChannel.h"
+#include <poll.h>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Test DS::MsgChannel", "[msgchannel]")
+{
+    SECTION("Single thread FIFO order") {
+        DS::MsgChannel channel;
+        CHECK_FALSE(channel.hasMessage());
+
+        for (int i = 0; i < 100; ++i)
+            channel.putMessage(i);
+        CHECK(channel.hasMessage());
+        CHECK(channel.depth() == 100);
+        CHECK(channel.peakDepth() == 100);
+
+        DS::FifoMessage batch[32];
+        int expected = 0;
+        while (expected < 100) {
+            size_t count = channel.getMessages(batch, false);
+            REQUIRE(count > 0);
+            for (size_t i = 0; i < count; ++i)
+                CHECK(batch[i].m_messageType == expected++);
+        }
+        CHECK_FALSE(channel.hasMessage());
+        CHECK(channel.depth() == 0);
+        CHECK(channel.getMessages(batch, false) == 0);
+    }
+
+    SECTION("Stale wakeups are not reported as messages") {
+        DS::MsgChannel channel;
+        channel.putMessage(1);
+        CHECK(channel.getMessage().m_messageType == 1);
+
+        // The event fd may still be signaled here, but a non-blocking
+        // read must not block or return anything
+        DS::FifoMessage batch[4];
+        CHECK(channel.getMessages(batch, false) == 0);
+
+        pollfd pfd;
+        pfd.fd = channel.fd();
+        pfd.events = POLLIN;
+        CHECK(poll(&pfd, 1, 0) == 0);
+    }
+
+    SECTION("Wakeup callback") {
+        DS::MsgChannel channel;
+        int wakeups = 0;
+        channel.setWakeup([&wakeups] { ++wakeups; });
+
+        // Only a message arriving in an empty queue wakes the consumer
+        channel.putMessage(1);
+        channel.putMessage(2);
+        CHECK(wakeups == 1);
+
+        DS::FifoMessage batch[4];
+        CHECK(channel.getMessages(batch, false) == 2);
+        CHECK(channel.getMessages(batch, false) == 0);
+        channel.putMessage(3);
+        CHECK(wakeups == 2);
+        CHECK(channel.getMessages(batch, false) == 1);
+        CHECK(batch[0].m_messageType == 3);
+    }
+
+    SECTION("Idle while a producer is still signaling") {
+        // The consumer may already have the message, but the channel is
+        // only safe to destroy once the wakeup callback has returned
+        DS::MsgChannel channel;
+        bool idleInWakeup = true;
+        channel.setWakeup([&channel, &idleInWakeup] {
+            DS::FifoMessage msg;
+            CHECK(channel.getMessages(&msg, 1, false) == 1);
+            idleInWakeup = channel.idle();
+        });
+        CHECK(channel.idle());
+        channel.putMessage(1);
+        CHECK_FALSE(idleInWakeup);
+        CHECK(channel.idle());
+    }
+
+    SECTION("Bounded drains keep the consumer signaled") {
+        // Like the event loop: wait on the fd, then take one small batch.
+        // Messages left behind must keep the fd readable, even when a
+        // drain consumed the signal for a message that arrived mid-drain.
+        constexpr int numMessages = 200000;
+
+        DS::MsgChannel channel;
+        std::thread producer([&channel] {
+            // Bursts, so the consumer keeps catching up with the producer
+            for (int i = 0; i < numMessages; ++i) {
+                channel.putMessage(i);
+                if ((i % 4) == 3)
+                    std::this_thread::yield();
+            }
+        });
+
+        pollfd pfd;
+        pfd.fd = channel.fd();
+        pfd.events = POLLIN;
+        int received = 0;
+        while (received < numMessages) {
+            REQUIRE(poll(&pfd, 1, 5000) == 1);
+            DS::FifoMessage batch[2];
+            size_t count = channel.getMessages(batch, false);
+            for (size_t i = 0; i < count; ++i)
+                REQUIRE(batch[i].m_messageType == received++);
+        }
+        producer.join();
+        CHECK_FALSE(channel.hasMessage());
+    }
+
+    SECTION("Multiple producers") {
+        constexpr int numProducers = 4;
+        constexpr int numMessages = 20000;
+
+        DS::MsgChannel channel;
+        std::vector<std::thread> producers;
+        for (int p = 0; p < numProducers; ++p) {
+            producers.emplace_back([&channel, p] {
+                for (int i = 0; i < numMessages; ++i)
+                    channel.putMessage(p, reinterpret_cast<void*>(static_cast<intptr_t>(i)));
+            });
+        }
+
+        // Messages from each producer must arrive in the order they were sent
+        std::vector<intptr_t> next(numProducers, 0);
+        size_t received = 0;
+        while (received < numProducers * numMessages) {
+            DS::FifoMessage batch[64];
+            size_t count = channel.getMessages(batch);
+            for (size_t i = 0; i < count; ++i) {
+                int producer = batch[i].m_messageType;
+                REQUIRE(reinterpret_cast<intptr_t>(batch[i].m_payload) == next[producer]);
+                ++next[producer];
+            }
+            received += count;
+        }
+        for (auto& thread : producers)
+            thread.join();
+
+        CHECK_FALSE(channel.hasMessage());
+        CHECK(channel.peakDepth() <= numProducers * numMessages);
+    }
+}
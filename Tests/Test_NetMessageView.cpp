@@ -0,0 +1,120 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+
+#include "PlasMOUL/NetMessages/NetMessageView.h"
+#include "PlasMOUL/NetMessages/NetMsgGameMessage.h"
+#include "PlasMOUL/NetMessages/NetMsgVoice.h"
+#include "PlasMOUL/Messages/NotifyMsg.h"
+#include "PlasMOUL/Messages/WarpMsg.h"
+#include "PlasMOUL/factory.h"
+
+static DS::Blob serialize(const MOUL::Creatable* msg)
+{
+    DS::BufferStream stream;
+    MOUL::Factory::WriteCreatable(&stream, msg);
+    return DS::Blob(stream.buffer(), stream.size());
+}
+
+TEST_CASE("Test MOUL::NetMessageView", "[netmessageview]")
+{
+    SECTION("Directed game message") {
+        MOUL::NotifyMsg* notify = MOUL::NotifyMsg::Create();
+        notify->m_receivers.resize(2);
+        notify->m_bcastFlags = MOUL::Message::e_NetPropagate;
+        notify->m_id = 42;
+
+        MOUL::NetMsgGameMessageDirected* netmsg = MOUL::NetMsgGameMessageDirected::Create();
+        netmsg->m_contentFlags = MOUL::NetMessage::e_HasTimeSent
+                               | MOUL::NetMessage::e_HasPlayerID;
+        netmsg->m_playerId = 1234;
+        netmsg->m_message = notify;
+        netmsg->m_receivers = { 5, 6, 7 };
+        DS::Blob blob = serialize(netmsg);
+        netmsg->unref();
+
+        MOUL::NetMessageView view;
+        REQUIRE(view.read(blob));
+        CHECK(view.m_type == MOUL::ID_NetMsgGameMessageDirected);
+        CHECK(view.m_contentFlags == (MOUL::NetMessage::e_HasTimeSent
+                                      | MOUL::NetMessage::e_HasPlayerID));
+        CHECK(view.m_playerId == 1234);
+        CHECK(view.m_gameMsgType == MOUL::ID_NotifyMsg);
+        CHECK(view.gameMsgSafeForNet());
+        CHECK(view.m_bcastFlags == MOUL::Message::e_NetPropagate);
+        CHECK(view.m_receivers == std::vector<uint32_t>{ 5, 6, 7 });
+
+        // Patching the flags in place must give the same message back
+        DS::BufferStream patched(blob.buffer(), blob.size());
+        patched.seek(view.m_bcastFlagsOffset, SEEK_SET);
+        patched.write<uint32_t>(view.m_bcastFlags | MOUL::Message::e_NetNonLocal);
+        patched.seek(0, SEEK_SET);
+        auto reread = MOUL::Factory::Read<MOUL::NetMsgGameMessageDirected>(&patched);
+        REQUIRE(reread);
+        CHECK(patched.atEof());
+        CHECK(reread->m_message->m_bcastFlags == (MOUL::Message::e_NetPropagate
+                                                  | MOUL::Message::e_NetNonLocal));
+        CHECK(reread->m_message->Cast<MOUL::NotifyMsg>()->m_id == 42);
+        reread->unref();
+    }
+
+    SECTION("Messages that need validating") {
+        MOUL::NetMsgGameMessage* netmsg = MOUL::NetMsgGameMessage::Create();
+        netmsg->m_message = MOUL::WarpMsg::Create();
+        DS::Blob blob = serialize(netmsg);
+        netmsg->unref();
+
+        MOUL::NetMessageView view;
+        REQUIRE(view.read(blob));
+        CHECK(view.m_gameMsgType == MOUL::ID_WarpMsg);
+        CHECK_FALSE(view.gameMsgSafeForNet());
+        CHECK(view.m_receivers.empty());
+    }
+
+    SECTION("Voice") {
+        MOUL::NetMsgVoice* voice = MOUL::NetMsgVoice::Create();
+        const uint8_t data[] = { 1, 2, 3, 4, 5 };
+        voice->m_data = DS::Blob(data, sizeof(data));
+        voice->m_receivers = { 99 };
+        DS::Blob blob = serialize(voice);
+        voice->unref();
+
+        MOUL::NetMessageView view;
+        REQUIRE(view.read(blob));
+        CHECK(view.m_type == MOUL::ID_NetMsgVoice);
+        CHECK(view.m_receivers == std::vector<uint32_t>{ 99 });
+    }
+
+    SECTION("Other messages need the full decode") {
+        MOUL::NetMsgGameMessage* netmsg = MOUL::NetMsgGameMessage::Create();
+        netmsg->m_message = MOUL::NotifyMsg::Create();
+        netmsg->m_compression = MOUL::NetMsgStream::e_CompressZlib;
+        DS::Blob blob = serialize(netmsg);
+        netmsg->unref();
+
+        MOUL::NetMessageView view;
+        CHECK_FALSE(view.read(blob));
+
+        netmsg = MOUL::NetMsgGameMessage::Create();
+        netmsg->m_message = MOUL::NotifyMsg::Create();
+        DS::Blob plain = serialize(netmsg);
+        netmsg->unref();
+        DS::Blob cut(plain.buffer(), plain.size() - 1);
+        CHECK_THROWS(view.read(cut));
+    }
+}
@@ -0,0 +1,163 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+
+#include "db/pqaccess.h"
+#include <cstring>
+#include <iterator>
+
+TEST_CASE("Test DS::PostgresParams", "[pqaccess]")
+{
+    DS::PostgresParams<5> params;
+
+    SECTION("Integers go as binary when the server expects an integer") {
+        params.set(0, DS::e_PGTypeInt4, 0x12345678);
+        params.set(1, DS::e_PGTypeInt2, -2);
+        params.set(2, DS::e_PGTypeInt8, 0xdeadbeefU);
+        CHECK(params.m_formats[0] == 1);
+        CHECK(params.m_lengths[0] == 4);
+        CHECK(memcmp(params.m_values[0], "\x12\x34\x56\x78", 4) == 0);
+        CHECK(params.m_formats[1] == 1);
+        CHECK(params.m_lengths[1] == 2);
+        CHECK(memcmp(params.m_values[1], "\xff\xfe", 2) == 0);
+        CHECK(params.m_formats[2] == 1);
+        CHECK(params.m_lengths[2] == 8);
+        CHECK(memcmp(params.m_values[2], "\0\0\0\0\xde\xad\xbe\xef", 8) == 0);
+    }
+
+    SECTION("Everything else goes as text") {
+        params.set(0, DS::e_PGTypeInt4, 0x80000000U);
+        params.set(1, DS::e_PGTypeInt2, 40000);
+        params.set(2, InvalidOid, 42);
+        params.set(3, DS::e_PGTypeInt4, ST_LITERAL("17"));
+        params.set(4, 25 /* text */, 42U);
+        CHECK(params.m_formats[0] == 0);
+        CHECK(strcmp(params.m_values[0], "2147483648") == 0);
+        CHECK(params.m_formats[1] == 0);
+        CHECK(strcmp(params.m_values[1], "40000") == 0);
+        CHECK(params.m_formats[2] == 0);
+        CHECK(strcmp(params.m_values[2], "42") == 0);
+        CHECK(params.m_formats[3] == 0);
+        CHECK(strcmp(params.m_values[3], "17") == 0);
+        CHECK(params.m_formats[4] == 0);
+        CHECK(strcmp(params.m_values[4], "42") == 0);
+    }
+
+    SECTION("Statements which were never prepared send text") {
+        DS::PGStatement stmt("SELECT $1, $2");
+        CHECK(stmt.paramType(0) == InvalidOid);
+        params.set_all(stmt, 1, ST_LITERAL("two"));
+        CHECK(params.m_formats[0] == 0);
+        CHECK(strcmp(params.m_values[0], "1") == 0);
+        CHECK(strcmp(params.m_values[1], "two") == 0);
+    }
+}
+
+TEST_CASE("Test DS::PGStatement names", "[pqaccess]")
+{
+    DS::PGStatement first("SELECT 1");
+    DS::PGStatement second("SELECT 1", DS::PGStatement::e_BinaryResults);
+    CHECK(strcmp(first.name(), second.name()) != 0);
+    CHECK(first.resultFormat() == 0);
+    CHECK(second.resultFormat() == 1);
+}
+
+TEST_CASE("Test DS::PQgetInt and DS::PQgetBool", "[pqaccess]")
+{
+    DS::PGresultRef result = PQmakeEmptyPGresult(nullptr, PGRES_TUPLES_OK);
+    PGresAttDesc columns[5];
+    memset(columns, 0, sizeof(columns));
+    const char* names[] = { "text", "int2", "int4", "int8", "bool" };
+    const Oid types[] = { DS::e_PGTypeInt4, DS::e_PGTypeInt2, DS::e_PGTypeInt4,
+                          DS::e_PGTypeInt8, DS::e_PGTypeBool };
+    for (size_t i = 0; i < std::size(columns); ++i) {
+        columns[i].name = const_cast<char*>(names[i]);
+        columns[i].typid = types[i];
+        columns[i].format = (i == 0) ? 0 : 1;
+    }
+    REQUIRE(PQsetResultAttrs(result, 5, columns));
+
+    char text[] = "4000000000";
+    char int2[] = "\xff\xfe";
+    char int4[] = "\x80\0\0\0";
+    char int8[] = "\0\0\0\x01\0\0\0\x02";
+    char boolean[] = "\x01";
+    REQUIRE(PQsetvalue(result, 0, 0, text, strlen(text)));
+    REQUIRE(PQsetvalue(result, 0, 1, int2, 2));
+    REQUIRE(PQsetvalue(result, 0, 2, int4, 4));
+    REQUIRE(PQsetvalue(result, 0, 3, int8, 8));
+    REQUIRE(PQsetvalue(result, 0, 4, boolean, 1));
+
+    CHECK(DS::PQgetInt(result, 0, 0) == 4000000000LL);
+    CHECK(DS::PQgetInt(result, 0, 1) == -2);
+    CHECK(DS::PQgetInt(result, 0, 2) == INT32_MIN);
+    CHECK(DS::PQgetInt(result, 0, 3) == 0x100000002LL);
+    CHECK(DS::PQgetBool(result, 0, 4));
+}
+
+TEST_CASE("Test DS::PQgetUuid and DS::PQgetBlob", "[pqaccess]")
+{
+    DS::PGresultRef result = PQmakeEmptyPGresult(nullptr, PGRES_TUPLES_OK);
+    PGresAttDesc columns[4];
+    memset(columns, 0, sizeof(columns));
+    const char* names[] = { "uuid", "uuid_bin", "blob", "blob_bin" };
+    const Oid types[] = { 2950 /* uuid */, 2950 /* uuid */, DS::e_PGTypeBytea,
+                          DS::e_PGTypeBytea };
+    for (size_t i = 0; i < std::size(columns); ++i) {
+        columns[i].name = const_cast<char*>(names[i]);
+        columns[i].typid = types[i];
+        columns[i].format = (i % 2 == 0) ? 0 : 1;
+    }
+    REQUIRE(PQsetResultAttrs(result, 4, columns));
+
+    char uuid[] = "01234567-89ab-cdef-0123-456789abcdef";
+    char uuidBin[] = "\x01\x23\x45\x67\x89\xab\xcd\xef\x01\x23\x45\x67\x89\xab\xcd\xef";
+    char blob[] = "\\x00ff10";
+    char blobBin[] = "\x00\xff\x10";
+    REQUIRE(PQsetvalue(result, 0, 0, uuid, strlen(uuid)));
+    REQUIRE(PQsetvalue(result, 0, 1, uuidBin, 16));
+    REQUIRE(PQsetvalue(result, 0, 2, blob, strlen(blob)));
+    REQUIRE(PQsetvalue(result, 0, 3, blobBin, 3));
+
+    DS::Uuid expected(uuid);
+    CHECK(DS::PQgetUuid(result, 0, 0) == expected);
+    CHECK(DS::PQgetUuid(result, 0, 1) == expected);
+
+    for (int col = 2; col < 4; ++col) {
+        DS::Blob value = DS::PQgetBlob(result, 0, col);
+        REQUIRE(value.size() == 3);
+        CHECK(memcmp(value.buffer(), "\x00\xff\x10", 3) == 0);
+    }
+}
+
+TEST_CASE("Test blob parameters", "[pqaccess]")
+{
+    DS::Blob blob(reinterpret_cast<const uint8_t*>("\x00\x01\x02"), 3);
+
+    DS::PostgresParams<1> params;
+    params.set(0, DS::e_PGTypeBytea, blob);
+    CHECK(params.m_formats[0] == 1);
+    CHECK(params.m_lengths[0] == 3);
+    CHECK(params.m_values[0] == reinterpret_cast<const char*>(blob.buffer()));
+
+    DS::PostgresStrings<2> strings;
+    strings.set_all(ST_LITERAL("text"), blob);
+    CHECK(strings.m_formats[0] == 0);
+    CHECK(strings.m_formats[1] == 1);
+    CHECK(strings.m_lengths[1] == 3);
+}
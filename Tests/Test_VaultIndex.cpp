@@ -0,0 +1,196 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+#include <catch2/catch.hpp>
+
+#include "AuthServ/VaultIndex.h"
+#include <map>
+#include <set>
+
+// A tiny stand-in for vault."NodeRefs" and vault.fetch_tree()
+struct FakeVault
+{
+    std::multimap<uint32_t, uint32_t> m_refs;
+    int m_fetches = 0;
+
+    void ref(uint32_t parent, uint32_t child) { m_refs.emplace(parent, child); }
+
+    void unref(uint32_t parent, uint32_t child)
+    {
+        auto range = m_refs.equal_range(parent);
+        for (auto it = range.first; it != range.second; ) {
+            if (it->second == child)
+                it = m_refs.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    bool has_node(uint32_t parent, uint32_t child) const
+    {
+        std::set<uint32_t> seen;
+        std::vector<uint32_t> stack { parent };
+        while (!stack.empty()) {
+            uint32_t node = stack.back();
+            stack.pop_back();
+            if (node == child)
+                return true;
+            if (!seen.insert(node).second)
+                continue;
+            auto range = m_refs.equal_range(node);
+            for (auto it = range.first; it != range.second; ++it)
+                stack.push_back(it->second);
+        }
+        return false;
+    }
+
+    bool fetch_tree(uint32_t node, std::vector<DS::Vault::NodeRef>& refs)
+    {
+        ++m_fetches;
+        std::set<uint32_t> seen;
+        std::vector<uint32_t> stack { node };
+        while (!stack.empty()) {
+            uint32_t parent = stack.back();
+            stack.pop_back();
+            if (!seen.insert(parent).second)
+                continue;
+            auto range = m_refs.equal_range(parent);
+            for (auto it = range.first; it != range.second; ++it) {
+                refs.push_back({ parent, it->second, 0 });
+                stack.push_back(it->second);
+            }
+        }
+        return true;
+    }
+};
+
+static void check_consistent(const FakeVault& vault, const DS::VaultIndex& index,
+                             std::initializer_list<uint32_t> roots)
+{
+    for (uint32_t root : roots) {
+        for (uint32_t node = 1; node <= 20; ++node) {
+            CAPTURE(root, node);
+            CHECK(index.reaches(root, node) == vault.has_node(root, node));
+        }
+    }
+}
+
+TEST_CASE("Test DS::VaultIndex", "[vault]")
+{
+    FakeVault vault;
+    DS::VaultIndex index([&vault](uint32_t node, std::vector<DS::Vault::NodeRef>& refs) {
+        return vault.fetch_tree(node, refs);
+    });
+
+    // Two players sharing a system node, plus a tree nobody is watching
+    vault.ref(1, 3);
+    vault.ref(3, 4);
+    vault.ref(2, 5);
+    vault.ref(1, 10);
+    vault.ref(2, 10);
+    vault.ref(10, 11);
+    vault.ref(15, 16);
+
+    REQUIRE(index.subscribe(1));
+    REQUIRE(index.subscribe(2));
+    check_consistent(vault, index, { 1, 2 });
+    CHECK(index.roots(11)->size() == 2);
+    CHECK(index.roots(16) == nullptr);
+
+    SECTION("Adding refs") {
+        // Attaching an unwatched subtree loads it once
+        int fetches = vault.m_fetches;
+        vault.ref(4, 15);
+        index.addRef(4, 15);
+        CHECK(vault.m_fetches == fetches + 1);
+        check_consistent(vault, index, { 1, 2 });
+        CHECK(index.reaches(1, 16));
+        CHECK_FALSE(index.reaches(2, 16));
+
+        // Refs below unwatched nodes are ignored
+        vault.ref(17, 18);
+        index.addRef(17, 18);
+        CHECK(index.roots(18) == nullptr);
+
+        // Cycles don't confuse the index
+        vault.ref(16, 1);
+        index.addRef(16, 1);
+        check_consistent(vault, index, { 1, 2 });
+    }
+
+    SECTION("Adding refs with a prefetched subtree") {
+        vault.ref(4, 15);
+        CHECK(index.needsTree(4, 15));
+        CHECK_FALSE(index.needsTree(17, 15));
+        CHECK_FALSE(index.needsTree(1, 10));
+
+        uint64_t generation = index.generation();
+        DS::VaultIndex::Tree tree;
+        REQUIRE(vault.fetch_tree(15, tree));
+
+        // Any ref change, even an unwatched one, invalidates the prefetch
+        index.addRef(17, 18);
+        CHECK(index.generation() != generation);
+
+        int fetches = vault.m_fetches;
+        index.addRef(4, 15, &tree);
+        CHECK(vault.m_fetches == fetches);
+        check_consistent(vault, index, { 1, 2 });
+        CHECK(index.reaches(1, 16));
+        CHECK_FALSE(index.needsTree(4, 15));
+    }
+
+    SECTION("Removing refs") {
+        vault.unref(1, 10);
+        index.removeRef(1, 10);
+        check_consistent(vault, index, { 1, 2 });
+        CHECK(index.roots(11)->size() == 1);
+
+        vault.unref(2, 10);
+        index.removeRef(2, 10);
+        check_consistent(vault, index, { 1, 2 });
+        CHECK(index.roots(10) == nullptr);
+        CHECK(index.roots(11) == nullptr);
+
+        // Forgotten subtrees are loaded again if they are reattached
+        vault.ref(11, 12);
+        vault.ref(5, 10);
+        index.addRef(5, 10);
+        check_consistent(vault, index, { 1, 2 });
+        CHECK(index.reaches(2, 12));
+    }
+
+    SECTION("Removing all parents of a node") {
+        vault.unref(1, 10);
+        vault.unref(2, 10);
+        index.removeParents(10);
+        check_consistent(vault, index, { 1, 2 });
+    }
+
+    SECTION("Subscriptions are reference counted") {
+        REQUIRE(index.subscribe(1));
+        index.unsubscribe(1);
+        CHECK(index.reaches(1, 4));
+        index.unsubscribe(1);
+        CHECK_FALSE(index.reaches(1, 4));
+        CHECK(index.roots(3) == nullptr);
+        CHECK(index.reaches(2, 11));
+
+        index.unsubscribe(2);
+        CHECK(index.rootCount() == 0);
+        CHECK(index.nodeCount() == 0);
+    }
+}
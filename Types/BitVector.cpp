@@ -16,6 +16,7 @@
  ******************************************************************************/
 
 #include "BitVector.h"
+#include <algorithm>
 
 void DS::BitVector::set(size_t idx, bool bit)
 {
@@ -35,6 +36,25 @@ void DS::BitVector::set(size_t idx, bool bit)
         m_bits[idx / 32] &= ~(1 << (idx % 32));
 }
 
+bool DS::BitVector::empty() const
+{
+    for (size_t i = 0; i < m_words; ++i) {
+        if (m_bits[i])
+            return false;
+    }
+    return true;
+}
+
+bool DS::BitVector::overlaps(const BitVector& other) const
+{
+    size_t words = std::min(m_words, other.m_words);
+    for (size_t i = 0; i < words; ++i) {
+        if (m_bits[i] & other.m_bits[i])
+            return true;
+    }
+    return false;
+}
+
 void DS::BitVector::read(DS::Stream* stream)
 {
     delete[] m_bits;
@@ -30,31 +30,38 @@ namespace DS
         BitVector(const BitVector& copy) : m_words(copy.m_words)
         {
             m_bits = new uint32_t[m_words];
-            memcpy(m_bits, copy.m_bits, m_words);
+            memcpy(m_bits, copy.m_bits, m_words * sizeof(uint32_t));
         }
 
         BitVector(BitVector&& move)
             : m_bits(move.m_bits), m_words(move.m_words)
         {
             move.m_bits = nullptr;
+            move.m_words = 0;
         }
 
         ~BitVector() { delete[] m_bits; }
 
         bool get(size_t idx) const
         {
-            return (m_words < (idx / 32)) ? false
+            return (m_words <= (idx / 32)) ? false
                  : (m_bits[idx / 32] & (1 << (idx % 32))) != 0;
         }
 
         void set(size_t idx, bool bit);
 
+        // True if no bits are set
+        bool empty() const;
+
+        // True if any bit is set in both vectors
+        bool overlaps(const BitVector& other) const;
+
         BitVector& operator=(const BitVector& copy)
         {
             delete[] m_bits;
             m_words = copy.m_words;
             m_bits = new uint32_t[m_words];
-            memcpy(m_bits, copy.m_bits, m_words);
+            memcpy(m_bits, copy.m_bits, m_words * sizeof(uint32_t));
             return *this;
         }
 
@@ -64,6 +71,7 @@ namespace DS
             m_bits = move.m_bits;
             m_words = move.m_words;
             move.m_bits = nullptr;
+            move.m_words = 0;
             return *this;
         }
 
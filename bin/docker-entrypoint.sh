@@ -189,6 +189,7 @@ done
 echo -e "\e[36m(Re-)Initializing database..\e[0m"
 psql -d "host=${POSTGRES_HOST:-db} port=${POSTGRES_PORT:-5432} dbname=${POSTGRES_DB} user=${POSTGRES_USER} password=${POSTGRES_PASSWORD}" -c "CREATE EXTENSION IF NOT EXISTS \"uuid-ossp\";"
 psql -d "host=${POSTGRES_HOST:-db} port=${POSTGRES_PORT:-5432} dbname=${POSTGRES_DB} user=${POSTGRES_USER} password=${POSTGRES_PASSWORD}" -f /opt/dirtsand/db/dbinit.sql
+psql -d "host=${POSTGRES_HOST:-db} port=${POSTGRES_PORT:-5432} dbname=${POSTGRES_DB} user=${POSTGRES_USER} password=${POSTGRES_PASSWORD}" -f /opt/dirtsand/db/migrate_bytea.sql
 psql -d "host=${POSTGRES_HOST:-db} port=${POSTGRES_PORT:-5432} dbname=${POSTGRES_DB} user=${POSTGRES_USER} password=${POSTGRES_PASSWORD}" -f /opt/dirtsand/db/functions.sql
 
 echo -e "\e[36mStarting DIRTSAND...\e[0m"
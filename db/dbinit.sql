@@ -144,8 +144,8 @@ CREATE TABLE IF NOT EXISTS "Nodes" (
     "IString64_2" character varying(64),
     "Text_1" character varying(1024),
     "Text_2" character varying(1024),
-    "Blob_1" text,
-    "Blob_2" text
+    "Blob_1" bytea,
+    "Blob_2" bytea
 );
 CREATE INDEX IF NOT EXISTS "PublicAgeList" ON vault."Nodes" ("NodeType", "Int32_2", "String64_2");
 CREATE SEQUENCE IF NOT EXISTS "Nodes_idx_seq"
@@ -185,8 +185,8 @@ CREATE TABLE IF NOT EXISTS "AgeStates" (
     idx integer NOT NULL,
     "ServerIdx" integer NOT NULL,
     "Descriptor" character varying(64) NOT NULL,
-    "ObjectKey" text NOT NULL,
-    "SdlBlob" text NOT NULL
+    "ObjectKey" bytea NOT NULL,
+    "SdlBlob" bytea NOT NULL
 );
 CREATE SEQUENCE IF NOT EXISTS "AgeStates_idx_seq"
     START WITH 1
@@ -231,3 +231,5 @@ ALTER TABLE ONLY "Servers"
     ADD CONSTRAINT "Servers_pkey" PRIMARY KEY (idx);
 ALTER TABLE ONLY "AgeStates"
     ADD CONSTRAINT "AgeStates_pkey" PRIMARY KEY (idx);
+CREATE UNIQUE INDEX IF NOT EXISTS "AgeStates_Object_key"
+    ON "AgeStates" ("ServerIdx", "Descriptor", "ObjectKey");
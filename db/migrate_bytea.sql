@@ -0,0 +1,50 @@
+-- This file is part of dirtsand.
+--
+-- dirtsand is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU Affero General Public License as
+-- published by the Free Software Foundation, either version 3 of the
+-- License, or (at your option) any later version.
+--
+-- dirtsand is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Affero General Public License for more details.
+--
+-- You should have received a copy of the GNU Affero General Public License
+-- along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.
+-------------------------------------------------------------------------------
+-- Converts vault node blobs and age states from base64 text to bytea, and
+-- adds the unique key used to save age states.
+-- Databases created before the switch need this run once; it does nothing
+-- if the columns were already converted.
+
+DO $$
+BEGIN
+    IF (SELECT data_type FROM information_schema.columns
+            WHERE table_schema = 'vault' AND table_name = 'Nodes'
+              AND column_name = 'Blob_1') = 'text' THEN
+        RAISE NOTICE 'Converting vault."Nodes" blobs to bytea...';
+        ALTER TABLE vault."Nodes"
+            ALTER COLUMN "Blob_1" TYPE bytea USING decode("Blob_1", 'base64'),
+            ALTER COLUMN "Blob_2" TYPE bytea USING decode("Blob_2", 'base64');
+    END IF;
+
+    IF (SELECT data_type FROM information_schema.columns
+            WHERE table_schema = 'game' AND table_name = 'AgeStates'
+              AND column_name = 'SdlBlob') = 'text' THEN
+        RAISE NOTICE 'Converting game."AgeStates" to bytea...';
+        ALTER TABLE game."AgeStates"
+            ALTER COLUMN "ObjectKey" TYPE bytea USING decode("ObjectKey", 'base64'),
+            ALTER COLUMN "SdlBlob" TYPE bytea USING decode("SdlBlob", 'base64');
+    END IF;
+END
+$$;
+
+-- Age states are now written back with INSERT ... ON CONFLICT, which needs
+-- each object's state to be unique per server.  Older servers could leave
+-- duplicate rows behind; keep only the newest of each.
+DELETE FROM game."AgeStates" a USING game."AgeStates" b
+    WHERE a."ServerIdx" = b."ServerIdx" AND a."Descriptor" = b."Descriptor"
+      AND a."ObjectKey" = b."ObjectKey" AND a.idx < b.idx;
+CREATE UNIQUE INDEX IF NOT EXISTS "AgeStates_Object_key"
+    ON game."AgeStates" ("ServerIdx", "Descriptor", "ObjectKey");
@@ -0,0 +1,144 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "pqaccess.h"
+#include <string_theory/format>
+#include <unordered_map>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+
+/* Which statements have been prepared on each connection, indexed by
+ * statement ID.  Connections can move between threads (game hosts are set
+ * up by the thread that starts them), so this is shared. */
+static std::mutex s_statementMutex;
+static std::unordered_map<PGconn*, std::vector<bool>> s_prepared;
+static size_t s_statementCount = 0;
+
+DS::PGStatement::PGStatement(const char* command, ResultFormat format)
+    : m_command(command), m_resultFormat(format), m_described(false)
+{
+    std::lock_guard<std::mutex> guard(s_statementMutex);
+    m_id = s_statementCount++;
+    snprintf(m_name, sizeof(m_name), "ds_stmt_%zu", m_id);
+}
+
+DS::PGresultRef DS::PGStatement::prepare(PGconn* conn) const
+{
+    {
+        std::lock_guard<std::mutex> guard(s_statementMutex);
+        const std::vector<bool>& prepared = s_prepared[conn];
+        if (m_id < prepared.size() && prepared[m_id])
+            return nullptr;
+    }
+
+    // Let the server pick the parameter types, and ask it what it chose
+    PGresultRef result = PQprepare(conn, m_name, m_command, 0, nullptr);
+    if (PQresultStatus(result) != PGRES_COMMAND_OK)
+        return result;
+    result = PQdescribePrepared(conn, m_name);
+    if (PQresultStatus(result) != PGRES_COMMAND_OK)
+        return result;
+
+    std::lock_guard<std::mutex> guard(s_statementMutex);
+    if (!m_described) {
+        m_paramTypes.resize(PQnparams(result));
+        for (size_t i = 0; i < m_paramTypes.size(); ++i)
+            m_paramTypes[i] = PQparamtype(result, i);
+        m_described = true;
+    }
+    std::vector<bool>& prepared = s_prepared[conn];
+    if (prepared.size() <= m_id)
+        prepared.resize(m_id + 1);
+    prepared[m_id] = true;
+    return nullptr;
+}
+
+void DS::PQforgetStatements(PGconn* conn)
+{
+    std::lock_guard<std::mutex> guard(s_statementMutex);
+    s_prepared.erase(conn);
+}
+
+bool DS::PQstatementMissing(const PGresult* result)
+{
+    // invalid_sql_statement_name
+    const char* state = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+    return state && strcmp(state, "26000") == 0;
+}
+
+int64_t DS::PQgetInt(const PGresult* result, int row, int col)
+{
+    const char* value = PQgetvalue(result, row, col);
+    if (PQfformat(result, col) == 0)
+        return strtoll(value, nullptr, 10);
+
+    int size = PQgetlength(result, row, col);
+    uint64_t bits = 0;
+    for (int i = 0; i < size && i < 8; ++i)
+        bits = (bits << 8) | static_cast<uint8_t>(value[i]);
+    switch (PQftype(result, col)) {
+    case e_PGTypeInt2:
+        return static_cast<int16_t>(bits);
+    case e_PGTypeInt4:
+        return static_cast<int32_t>(bits);
+    case e_PGTypeOid:
+        return static_cast<uint32_t>(bits);
+    default:
+        return static_cast<int64_t>(bits);
+    }
+}
+
+bool DS::PQgetBool(const PGresult* result, int row, int col)
+{
+    const char* value = PQgetvalue(result, row, col);
+    if (PQfformat(result, col) == 0)
+        return *value == 't';
+    return PQgetlength(result, row, col) > 0 && *value != 0;
+}
+
+DS::Uuid DS::PQgetUuid(const PGresult* result, int row, int col)
+{
+    const char* value = PQgetvalue(result, row, col);
+    if (PQfformat(result, col) == 0)
+        return Uuid(value);
+    if (PQgetlength(result, row, col) != 16)
+        return Uuid();
+
+    // The wire format is the plain RFC 4122 byte order
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(value);
+    uint32_t data1 = (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16)
+                   | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+    uint16_t data2 = uint16_t((bytes[4] << 8) | bytes[5]);
+    uint16_t data3 = uint16_t((bytes[6] << 8) | bytes[7]);
+    return Uuid(data1, data2, data3, bytes + 8);
+}
+
+DS::Blob DS::PQgetBlob(const PGresult* result, int row, int col)
+{
+    const uint8_t* value = reinterpret_cast<const uint8_t*>(PQgetvalue(result, row, col));
+    if (PQfformat(result, col) != 0)
+        return Blob(value, PQgetlength(result, row, col));
+
+    size_t size;
+    uint8_t* buffer = PQunescapeBytea(value, &size);
+    if (!buffer)
+        return Blob();
+    Blob blob(buffer, size);
+    PQfreemem(buffer);
+    return blob;
+}
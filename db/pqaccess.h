@@ -15,8 +15,14 @@
  * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
  ******************************************************************************/
 
+#ifndef _DS_PQACCESS_H
+#define _DS_PQACCESS_H
+
 #include "Types/Uuid.h"
+#include <string_theory/stdio>
 #include <libpq-fe.h>
+#include <cstdint>
+#include <vector>
 
 namespace DS
 {
@@ -25,6 +31,8 @@ namespace DS
     {
     public:
         const char* m_values[count];
+        int m_lengths[count];
+        int m_formats[count];
         ST::string m_strings[count];
 
         void set(size_t idx, const ST::string& str)
@@ -45,6 +53,14 @@ namespace DS
             _cache(idx);
         }
 
+        // Sent as binary bytea.  The blob must outlive the query.
+        void set(size_t idx, const Blob& blob)
+        {
+            m_values[idx] = reinterpret_cast<const char*>(blob.buffer());
+            m_lengths[idx] = static_cast<int>(blob.size());
+            m_formats[idx] = 1;
+        }
+
         template <typename... ArgsT>
         void set_all(ArgsT&&... args)
         {
@@ -64,6 +80,8 @@ namespace DS
         void _cache(size_t idx)
         {
             m_values[idx] = m_strings[idx].c_str();
+            m_lengths[idx] = 0;
+            m_formats[idx] = 0;
         }
     };
 
@@ -108,20 +126,218 @@ namespace DS
         PGresult* m_result;
     };
 
+    /* A query which is prepared on each connection the first time it runs
+     * there, so the server only parses and plans it once per session.
+     * Usually declared right at the call site with DS_STATEMENT.
+     *
+     * Integer parameters are sent in binary whenever the server expects an
+     * integer type for them, and blobs are always sent as binary bytea.
+     * Results come back as text unless the statement asks for
+     * e_BinaryResults; the PQget*() helpers below read either. */
+    class PGStatement
+    {
+    public:
+        enum ResultFormat { e_TextResults = 0, e_BinaryResults = 1 };
+
+        explicit PGStatement(const char* command, ResultFormat format = e_TextResults);
+
+        const char* command() const { return m_command; }
+        const char* name() const { return m_name; }
+        int resultFormat() const { return m_resultFormat; }
+
+        // Prepares the statement on conn, unless that was already done since
+        // the session was last reset.  Returns the failed result if the
+        // server rejected it, or a null result on success.
+        PGresultRef prepare(PGconn* conn) const;
+
+        // The type the server chose for a parameter.  Only valid once the
+        // statement has been prepared somewhere.
+        Oid paramType(size_t idx) const
+        {
+            return idx < m_paramTypes.size() ? m_paramTypes[idx] : InvalidOid;
+        }
+
+    private:
+        const char* m_command;
+        char m_name[24];
+        size_t m_id;
+        ResultFormat m_resultFormat;
+
+        // Filled in by the first prepare(), under the registry lock
+        mutable std::vector<Oid> m_paramTypes;
+        mutable bool m_described;
+    };
+
+    enum PGTypeOids : Oid
+    {
+        e_PGTypeBool = 16, e_PGTypeBytea = 17, e_PGTypeInt8 = 20,
+        e_PGTypeInt2 = 21, e_PGTypeInt4 = 23, e_PGTypeOid = 26,
+    };
+
+    template <size_t count>
+    class PostgresParams
+    {
+    public:
+        const char* m_values[count];
+        int m_lengths[count];
+        int m_formats[count];
+
+        void set(size_t idx, Oid type, const ST::string& str)
+        {
+            m_strings[idx] = str;
+            _cacheText(idx);
+        }
+
+        void set(size_t idx, Oid type, uint32_t value)
+        {
+            if (!_setBinary(idx, type, value)) {
+                m_strings[idx] = ST::string::from_uint(value);
+                _cacheText(idx);
+            }
+        }
+
+        void set(size_t idx, Oid type, int value)
+        {
+            if (!_setBinary(idx, type, value)) {
+                m_strings[idx] = ST::string::from_int(value);
+                _cacheText(idx);
+            }
+        }
+
+        void set(size_t idx, Oid type, const Blob& blob)
+        {
+            m_values[idx] = reinterpret_cast<const char*>(blob.buffer());
+            m_lengths[idx] = static_cast<int>(blob.size());
+            m_formats[idx] = 1;
+        }
+
+        template <typename... ArgsT>
+        void set_all(const PGStatement& stmt, ArgsT&&... args)
+        {
+            _set_many(stmt, 0, std::forward<ArgsT>(args)...);
+        }
+
+    private:
+        ST::string m_strings[count];
+        uint8_t m_binary[count][8];
+
+        void _set_many(const PGStatement& stmt, size_t idx) { }
+
+        template <typename ArgN, typename... ArgsT>
+        void _set_many(const PGStatement& stmt, size_t idx, ArgN&& arg, ArgsT&&... args)
+        {
+            set(idx, stmt.paramType(idx), std::forward<ArgN>(arg));
+            _set_many(stmt, idx + 1, std::forward<ArgsT>(args)...);
+        }
+
+        void _cacheText(size_t idx)
+        {
+            m_values[idx] = m_strings[idx].c_str();
+            m_lengths[idx] = 0;
+            m_formats[idx] = 0;
+        }
+
+        // Values that don't fit the server's type go as text, so the server
+        // reports them the same way it always has
+        bool _setBinary(size_t idx, Oid type, int64_t value)
+        {
+            int size;
+            switch (type) {
+            case e_PGTypeInt2:
+                if (value < INT16_MIN || value > INT16_MAX)
+                    return false;
+                size = 2;
+                break;
+            case e_PGTypeInt4:
+                if (value < INT32_MIN || value > INT32_MAX)
+                    return false;
+                size = 4;
+                break;
+            case e_PGTypeInt8:
+                size = 8;
+                break;
+            default:
+                return false;
+            }
+            uint64_t bits = static_cast<uint64_t>(value);
+            for (int i = size - 1; i >= 0; --i) {
+                m_binary[idx][i] = static_cast<uint8_t>(bits);
+                bits >>= 8;
+            }
+            m_values[idx] = reinterpret_cast<const char*>(m_binary[idx]);
+            m_lengths[idx] = size;
+            m_formats[idx] = 1;
+            return true;
+        }
+    };
+
+    // Forgets which statements were prepared on conn.  Needed whenever its
+    // server session goes away.
+    void PQforgetStatements(PGconn* conn);
+
+    inline void PQclose(PGconn* conn)
+    {
+        PQforgetStatements(conn);
+        PQfinish(conn);
+    }
+
+    // True if the server lost a prepared statement we thought it had
+    bool PQstatementMissing(const PGresult* result);
+
+    // Read a column in either result format
+    int64_t PQgetInt(const PGresult* result, int row, int col);
+    bool PQgetBool(const PGresult* result, int row, int col);
+    Uuid PQgetUuid(const PGresult* result, int row, int col);
+    Blob PQgetBlob(const PGresult* result, int row, int col);
+
     template <typename... ArgsT>
     PGresultRef PQexecVA(PGconn* conn, const char* command, ArgsT&&... args)
     {
         PostgresStrings<sizeof...(args)> params;
         params.set_all(std::forward<ArgsT>(args)...);
         return PQexecParams(conn, command, sizeof...(args), nullptr,
-                            params.m_values, nullptr, nullptr, 0);
+                            params.m_values, params.m_lengths, params.m_formats, 0);
+    }
+
+    template <typename... ArgsT>
+    PGresultRef PQexecVA(PGconn* conn, const PGStatement& stmt, ArgsT&&... args)
+    {
+        PGresultRef result = stmt.prepare(conn);
+        if (result)
+            return result;
+
+        PostgresParams<sizeof...(args)> params;
+        params.set_all(stmt, std::forward<ArgsT>(args)...);
+        result = PQexecPrepared(conn, stmt.name(), sizeof...(args), params.m_values,
+                                params.m_lengths, params.m_formats, stmt.resultFormat());
+        if (PQstatementMissing(result)) {
+            // Someone else reset the session; prepare it again and retry
+            PQforgetStatements(conn);
+            result = stmt.prepare(conn);
+            if (result)
+                return result;
+            result = PQexecPrepared(conn, stmt.name(), sizeof...(args), params.m_values,
+                                    params.m_lengths, params.m_formats, stmt.resultFormat());
+        }
+        return result;
     }
 }
 
+/* Declares a statement for a single call site, e.g.
+ *     DS::PQexecVA(conn, DS_STATEMENT("SELECT ... WHERE idx=$1"), idx);
+ */
+#define DS_STATEMENT(command, ...)                                      \
+    ([]() -> const DS::PGStatement& {                                   \
+        static const DS::PGStatement s_statement(command, ##__VA_ARGS__); \
+        return s_statement;                                             \
+    }())
+
 static inline void check_postgres(PGconn* postgres)
 {
     auto status = PQstatus(postgres);
     if (status == CONNECTION_BAD) {
+        // The new session doesn't have any of our prepared statements
+        DS::PQforgetStatements(postgres);
         PQreset(postgres);
         status = PQstatus(postgres);
     }
@@ -135,3 +351,5 @@ static inline void check_postgres(PGconn* postgres)
 #define PQ_PRINT_ERROR(pq, action)                                      \
     ST::printf(stderr, "{}:{}:\n    Postgres " #action " error: {}\n",  \
                __FILE__, __LINE__, PQerrorMessage(pq))
+
+#endif
@@ -17,6 +17,8 @@
 
 #include "NetIO/Lobby.h"
 #include "NetIO/Status.h"
+#include "NetIO/Reactor.h"
+#include "NetIO/HandshakePool.h"
 #include "NetIO/CryptIO.h"
 #include "GateKeeper/GateServ.h"
 #include "FileServ/FileServer.h"
@@ -245,6 +247,8 @@ int main(int argc, char* argv[])
     DS::AuthServer_Init(restrictLogins);
     DS::GameServer_Init();
     DS::GateKeeper_Init();
+    DS::StartHandshakePool();
+    DS::StartReactor();
     DS::StartLobby();
     if (DS::Settings::StatusEnabled())
         DS::StartStatusHTTP();
@@ -423,9 +427,11 @@ int main(int argc, char* argv[])
     if (DS::Settings::StatusEnabled())
         DS::StopStatusHTTP();
     DS::StopLobby();
+    DS::StopHandshakePool();
     DS::GateKeeper_Shutdown();
     DS::GameServer_Shutdown();
     DS::AuthServer_Shutdown();
     DS::FileServer_Shutdown();
+    DS::StopReactor();
     return 0;
 }
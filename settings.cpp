@@ -75,8 +75,16 @@ static struct
 
     /* Host configuration */
     ST::string m_lobbyAddr, m_lobbyPort;
+    uint32_t m_lobbyAcceptors;
     ST::string m_statusAddr, m_statusPort;
 
+    /* Client I/O */
+    bool m_threadPerClient;
+    uint32_t m_eventLoops;
+    uint32_t m_queueBytes, m_queueMessages;
+    DS::QueuePolicy m_queuePolicy;
+    uint32_t m_handshakeThreads, m_handshakeBacklog;
+
     /* Data locations */
     ST::string m_fileRoot, m_authRoot;
     ST::string m_sdlPath, m_agePath;
@@ -84,6 +92,12 @@ static struct
 
     /* Database */
     ST::string m_dbHostname, m_dbPort, m_dbUsername, m_dbPassword, m_dbDbase;
+    bool m_vaultCheckIndex;
+    uint32_t m_authWorkers;
+    uint32_t m_stateFlushInterval;
+    uint32_t m_gameMaxInFlight;
+    uint32_t m_gameHostThreads;
+    uint32_t m_gameDbConnections;
 
     /* Misc */
     bool m_statusEnabled;
@@ -172,6 +186,32 @@ bool DS::Settings::LoadFrom(const ST::string& filename)
                 s_settings.m_lobbyAddr = params[1];
             } else if (params[0] == "Lobby.Port") {
                 s_settings.m_lobbyPort = params[1];
+            } else if (params[0] == "Lobby.Acceptors") {
+                s_settings.m_lobbyAcceptors = params[1].to_uint();
+            } else if (params[0] == "Net.ThreadPerClient") {
+                s_settings.m_threadPerClient = params[1].to_bool();
+            } else if (params[0] == "Net.EventLoops") {
+                s_settings.m_eventLoops = params[1].to_uint();
+            } else if (params[0] == "Net.HandshakeThreads") {
+                s_settings.m_handshakeThreads = params[1].to_uint();
+            } else if (params[0] == "Net.HandshakeBacklog") {
+                s_settings.m_handshakeBacklog = params[1].to_uint();
+            } else if (params[0] == "Net.QueueBytes") {
+                s_settings.m_queueBytes = params[1].to_uint();
+            } else if (params[0] == "Net.QueueMessages") {
+                s_settings.m_queueMessages = params[1].to_uint();
+            } else if (params[0] == "Net.QueuePolicy") {
+                if (params[1] == "drop") {
+                    s_settings.m_queuePolicy = e_QueueDropUnreliable;
+                } else if (params[1] == "coalesce") {
+                    s_settings.m_queuePolicy = e_QueueCoalesce;
+                } else if (params[1] == "disconnect") {
+                    s_settings.m_queuePolicy = e_QueueDisconnect;
+                } else {
+                    ST::printf(stderr, "Invalid queue policy '{}': Expected "
+                                       "drop, coalesce or disconnect\n", params[1]);
+                    return false;
+                }
             } else if (params[0] == "Status.Addr") {
                 s_settings.m_statusAddr = params[1];
             } else if (params[0] == "Status.Port") {
@@ -200,6 +240,18 @@ bool DS::Settings::LoadFrom(const ST::string& filename)
                 s_settings.m_dbPassword = params[1];
             } else if (params[0] == "Db.Database") {
                 s_settings.m_dbDbase = params[1];
+            } else if (params[0] == "Vault.CheckIndex") {
+                s_settings.m_vaultCheckIndex = params[1].to_bool();
+            } else if (params[0] == "Auth.Workers") {
+                s_settings.m_authWorkers = params[1].to_uint();
+            } else if (params[0] == "Game.StateFlushInterval") {
+                s_settings.m_stateFlushInterval = params[1].to_uint();
+            } else if (params[0] == "Game.MaxInFlight") {
+                s_settings.m_gameMaxInFlight = params[1].to_uint();
+            } else if (params[0] == "Game.HostThreads") {
+                s_settings.m_gameHostThreads = params[1].to_uint();
+            } else if (params[0] == "Game.DbConnections") {
+                s_settings.m_gameDbConnections = params[1].to_uint();
             } else if (params[0] == "Welcome.Msg") {
                 s_settings.m_welcome = params[1];
             } else {
@@ -219,8 +271,16 @@ void DS::Settings::UseDefaults()
     s_settings.m_fileServ = ST_LITERAL("localhost").to_utf16();
     s_settings.m_gameServ = ST_LITERAL("localhost");
     s_settings.m_lobbyPort = ST_LITERAL("14617");
+    s_settings.m_lobbyAcceptors = 1;
     s_settings.m_statusPort = ST_LITERAL("8080");
     s_settings.m_statusEnabled = true;
+    s_settings.m_threadPerClient = false;
+    s_settings.m_eventLoops = 0;
+    s_settings.m_handshakeThreads = 0;
+    s_settings.m_handshakeBacklog = 1024;
+    s_settings.m_queueBytes = 1024 * 1024;
+    s_settings.m_queueMessages = 4096;
+    s_settings.m_queuePolicy = e_QueueCoalesce;
 
     s_settings.m_fileRoot = ST_LITERAL("./data");
     s_settings.m_authRoot = ST_LITERAL("./authdata");
@@ -231,6 +291,12 @@ void DS::Settings::UseDefaults()
     s_settings.m_dbPort = ST_LITERAL("5432");
     s_settings.m_dbUsername = ST_LITERAL("dirtsand");
     s_settings.m_dbPassword = ST::string();
+    s_settings.m_vaultCheckIndex = false;
+    s_settings.m_authWorkers = 4;
+    s_settings.m_stateFlushInterval = 2000;
+    s_settings.m_gameMaxInFlight = 64;
+    s_settings.m_gameHostThreads = 0;
+    s_settings.m_gameDbConnections = 4;
     s_settings.m_dbDbase = ST_LITERAL("dirtsand");
 }
 
@@ -272,6 +338,46 @@ const char* DS::Settings::LobbyPort()
     return s_settings.m_lobbyPort.c_str();
 }
 
+uint32_t DS::Settings::LobbyAcceptors()
+{
+    return s_settings.m_lobbyAcceptors;
+}
+
+bool DS::Settings::ThreadPerClient()
+{
+    return s_settings.m_threadPerClient;
+}
+
+uint32_t DS::Settings::EventLoops()
+{
+    return s_settings.m_eventLoops;
+}
+
+uint32_t DS::Settings::QueueBytes()
+{
+    return s_settings.m_queueBytes;
+}
+
+uint32_t DS::Settings::QueueMessages()
+{
+    return s_settings.m_queueMessages;
+}
+
+DS::QueuePolicy DS::Settings::QueueOverflowPolicy()
+{
+    return s_settings.m_queuePolicy;
+}
+
+uint32_t DS::Settings::HandshakeThreads()
+{
+    return s_settings.m_handshakeThreads;
+}
+
+uint32_t DS::Settings::HandshakeBacklog()
+{
+    return s_settings.m_handshakeBacklog;
+}
+
 bool DS::Settings::StatusEnabled()
 {
     return s_settings.m_statusEnabled;
@@ -339,6 +445,36 @@ const char* DS::Settings::DbDbaseName()
     return s_settings.m_dbDbase.c_str();
 }
 
+bool DS::Settings::VaultCheckIndex()
+{
+    return s_settings.m_vaultCheckIndex;
+}
+
+uint32_t DS::Settings::AuthWorkers()
+{
+    return s_settings.m_authWorkers;
+}
+
+uint32_t DS::Settings::StateFlushInterval()
+{
+    return s_settings.m_stateFlushInterval;
+}
+
+uint32_t DS::Settings::GameMaxInFlight()
+{
+    return s_settings.m_gameMaxInFlight;
+}
+
+uint32_t DS::Settings::GameHostThreads()
+{
+    return s_settings.m_gameHostThreads;
+}
+
+uint32_t DS::Settings::GameDbConnections()
+{
+    return s_settings.m_gameDbConnections;
+}
+
 ST::string DS::Settings::WelcomeMsg()
 {
     return s_settings.m_welcome;
@@ -36,6 +36,11 @@ namespace DS
         e_KeyGame_K, e_KeyMaxTypes
     };
 
+    enum QueuePolicy
+    {
+        e_QueueDropUnreliable, e_QueueCoalesce, e_QueueDisconnect
+    };
+
     namespace Settings
     {
         // Product ID values
@@ -60,6 +65,18 @@ namespace DS
 
         const char* LobbyAddress();
         const char* LobbyPort();
+        uint32_t LobbyAcceptors();
+
+        bool ThreadPerClient();
+        uint32_t EventLoops();
+
+        // Per-client outbound queue budget
+        uint32_t QueueBytes();
+        uint32_t QueueMessages();
+        QueuePolicy QueueOverflowPolicy();
+
+        uint32_t HandshakeThreads();
+        uint32_t HandshakeBacklog();
 
         bool StatusEnabled();
         const char* StatusAddress();
@@ -77,6 +94,24 @@ namespace DS
         const char* DbPassword();
         const char* DbDbaseName();
 
+        // Cross-check vault notifications against vault.has_node()
+        bool VaultCheckIndex();
+
+        // Auth daemon threads, each with its own database connection
+        uint32_t AuthWorkers();
+
+        // Milliseconds a game host may hold persistent SDL changes
+        uint32_t StateFlushInterval();
+
+        // Game messages a client may have waiting for its age host
+        uint32_t GameMaxInFlight();
+
+        // Threads running game hosts; 0 means one per core
+        uint32_t GameHostThreads();
+
+        // Database connections shared by all game hosts
+        uint32_t GameDbConnections();
+
         ST::string WelcomeMsg();
         void SetWelcomeMsg(const ST::string& welcome);
 